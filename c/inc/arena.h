@@ -0,0 +1,72 @@
+/*
+
+Copyright (c) 2016 Sean Leffler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+// A bump allocator for memory that is all released at once, such as scratch
+// space for one frame. Memory comes in chunks from the allocator the arena is
+// created with, which has the same contract as Lua's `lua_Alloc`. Resetting
+// the arena keeps the chunks around, so once it has grown to fit a frame's
+// worth of allocations it stops asking for more.
+
+#ifndef LASER_ARENA_H
+#define LASER_ARENA_H
+
+#include <stddef.h>
+
+// Allocations are aligned to this many bytes.
+#define AR_ALIGN 16
+
+// The smallest chunk an arena asks for.
+#define AR_MIN_CHUNK (64 * 1024)
+
+typedef void *(*ar_alloc_fn)(void *ud, void *ptr, size_t osize, size_t nsize);
+
+typedef struct ar_chunk {
+    struct ar_chunk *next;
+    // Bytes of room after the header, and how many of them are in use.
+    size_t size;
+    size_t used;
+} ar_chunk;
+
+typedef struct Arena {
+    ar_alloc_fn alloc;
+    void *ud;
+    // Chunks in the order they were allocated. Allocations come out of `cur`,
+    // moving on to the next chunk when it's full.
+    ar_chunk *head;
+    ar_chunk *cur;
+    // Total bytes of chunks, headers included.
+    size_t reserved;
+} Arena;
+
+void ar_init(Arena *a, ar_alloc_fn alloc, void *ud);
+void ar_free(Arena *a);
+
+// Returns NULL if out of memory.
+void *ar_alloc(Arena *a, size_t size);
+
+// Makes all of the arena's memory available again. Everything allocated from it
+// so far must not be used afterwards.
+void ar_reset(Arena *a);
+
+#endif
@@ -0,0 +1,123 @@
+/*
+
+Copyright (c) 2016 Sean Leffler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+// Two-dimensional grids of bits, for tile-map masks. Each row is stored like a
+// bitset, cell `x` in bit `x % BITWIDTH` of block `x / BITWIDTH`, and padded
+// out to a whole number of blocks so that every row starts on a block
+// boundary. Padding bits are always clear.
+//
+// Everything here works a block of cells at a time: shifting a row moves whole
+// blocks and carries bits across, neighbours are found by shifting the rows
+// above and below, and neighbour counts are kept bit-sliced, one block per
+// bit of the count.
+//
+// A grid's blocks are followed by `BG_SCRATCH_ROWS` rows of scratch space, so
+// that operations reading neighbouring rows can work in place. Functions
+// taking a `dst` and a `src` allow them to be the same grid, and use `dst`'s
+// scratch rows; otherwise the two must be the same size.
+
+#ifndef LASER_BITGRID_H
+#define LASER_BITGRID_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bitset.h"
+
+#define BG_SCRATCH_ROWS 2
+
+typedef struct BitGrid {
+    size_t width;
+    size_t height;
+    // Blocks per row.
+    size_t stride;
+    block_t bits[];
+} BitGrid;
+
+typedef enum bg_op { BG_COPY, BG_AND, BG_OR, BG_ANDNOT, BG_XOR } bg_op;
+
+// The number of bytes a `width` by `height` grid takes, scratch space and all,
+// or 0 if that doesn't fit in a `size_t`.
+size_t bg_size(size_t width, size_t height);
+
+// Sets up a grid in `bg_size(width, height)` bytes, with every cell clear.
+void bg_init(BitGrid *g, size_t width, size_t height);
+
+static inline block_t *bg_row(const BitGrid *g, size_t y) {
+    return (block_t*)g->bits + y * g->stride;
+}
+
+// The cell must be in the grid.
+static inline bool bg_get(const BitGrid *g, size_t x, size_t y) {
+    return (bg_row(g, y)[x / BITWIDTH] >> (x % BITWIDTH)) & 1;
+}
+
+static inline void bg_put(BitGrid *g, size_t x, size_t y, bool value) {
+    block_t *const blk = &bg_row(g, y)[x / BITWIDTH];
+    const block_t bit = (block_t)1 << (x % BITWIDTH);
+
+    *blk = value ? (*blk | bit) : (*blk & ~bit);
+}
+
+size_t bg_count(const BitGrid *g);
+bool bg_equals(const BitGrid *a, const BitGrid *b);
+
+// Sets or clears the cells of a rectangle, clipped to the grid.
+void bg_fill(BitGrid *g, ptrdiff_t x, ptrdiff_t y, ptrdiff_t w, ptrdiff_t h,
+    bool value);
+
+// Moves every cell by `(dx, dy)`. Cells moved off the grid are lost, and cells
+// moved away from are cleared.
+void bg_shift(BitGrid *dst, const BitGrid *src, ptrdiff_t dx, ptrdiff_t dy);
+
+// Combines the `w` by `h` rectangle of `src` at `(sx, sy)` into `dst` at
+// `(dx, dy)`, clipping it to both grids. Unlike the rest, the grids may be
+// different sizes. They may also be the same grid, with the rectangles
+// overlapping.
+void bg_blit(bg_op op, BitGrid *dst, ptrdiff_t dx, ptrdiff_t dy,
+    const BitGrid *src, ptrdiff_t sx, ptrdiff_t sy, ptrdiff_t w, ptrdiff_t h);
+
+// Grows (dilates) or shrinks (erodes) the set cells by one, over the eight
+// neighbours of each cell, or just the four orthogonal ones. Cells off the
+// grid count as clear when growing and set when shrinking, so the edges of the
+// grid have no effect.
+void bg_dilate(BitGrid *dst, const BitGrid *src, bool diagonal);
+void bg_erode(BitGrid *dst, const BitGrid *src, bool diagonal);
+
+// One step of a Life-like cellular automaton. Bit `n` of `born` is set if a
+// clear cell with `n` set neighbours becomes set, and bit `n` of `survive` if a
+// set cell with `n` set neighbours stays set. Cells off the grid count as
+// `edge`.
+void bg_step(BitGrid *dst, const BitGrid *src, unsigned born,
+    unsigned survive, bool edge);
+
+// Copies the cells to or from a bitset with one row after another, cell
+// `(x, y)` at index `y * width + x`. `bits` has to be at least
+// `bg_flat_blocks(g)` blocks long.
+size_t bg_flat_blocks(const BitGrid *g);
+void bg_to_flat(const BitGrid *g, block_t *bits);
+void bg_from_flat(BitGrid *g, const block_t *bits, size_t len);
+
+#endif
@@ -0,0 +1,172 @@
+/*
+
+Copyright (c) 2016 Sean Leffler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+// Shared definitions for the bitset module and anything else that wants to
+// work on raw bitset blocks.
+
+#ifndef LASER_BITSET_H
+#define LASER_BITSET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The name of the bitset module and of its userdata metatables in the registry,
+// for other modules which work with bitsets; see bitset_lua.h.
+#define LUA_BITSET_LIBNAME "bitset"
+#define LUA_BITSET_TYPENAME "_bitset_ty"
+#define LUA_BITSET_INLINE_TYPENAME "_bitset_inline_ty"
+#define LUA_BITSET_ARENA_TYPENAME "_bitset_arena_ty"
+#define LUA_BITSET_MAP_TYPENAME "_bitset_map_ty"
+#define LUA_BITSET_SIGTABLE_TYPENAME "_bitset_sigtable_ty"
+#define LUA_BITSET_FIXED64_TYPENAME "_bitset_fixed64_ty"
+#define LUA_BITSET_FIXED128_TYPENAME "_bitset_fixed128_ty"
+#define LUA_BITSET_FIXED256_TYPENAME "_bitset_fixed256_ty"
+
+#define BITWIDTH (8 * sizeof(block_t))
+#define ALL_ONES (~(block_t)0)
+#define JUST_ONE ((block_t)0x1)
+
+typedef uint32_t block_t;
+
+// Index of the lowest/highest set bit in a block. Undefined if the block is
+// zero.
+#define BLOCK_CTZ(x) ((size_t)__builtin_ctzll((unsigned long long)(x)))
+#define BLOCK_HIGHEST(x) \
+    ((size_t)(63 - __builtin_clzll((unsigned long long)(x))))
+
+#define BLOCK_POPCOUNT(x) ((size_t)__builtin_popcountll((unsigned long long)(x)))
+
+// NOTE: lib/bitset_ffi.lua declares this struct to the LuaJIT FFI, and has to be
+// kept in sync with it. Only the fields up to `count` are declared there.
+//
+// `len` is the number of blocks in use, and `cap` the number allocated. The
+// blocks from `len` up to `cap` are garbage until the bitset grows into them.
+//
+// Small bitsets keep their blocks in the userdata itself, in `inline_bits`,
+// and only move them to the heap if they outgrow it. Bitsets can also have
+// their blocks in an arena, or in a file mapped into memory. Either way, `bits`
+// points at the blocks. Only bitsets with blocks on the heap or in a file need
+// `__gc`, which decides the userdata's metatable.
+typedef struct Bitset {
+    block_t *bits;
+    size_t len;
+    size_t cap;
+    // How many times `bits` has been reallocated, for testing and tuning.
+    size_t reallocs;
+    // The rank index: `ranks[s]` is the number of set bits in the blocks before
+    // block `s * BS_RANK_BLOCKS`. It's built when it's first needed, and only
+    // good while `ranked` is set, which anything that changes the bits clears.
+    // Comes from the arena, if the bitset is in one, or else the heap.
+    bool ranked;
+    // The number of set bits, or `BS_COUNT_UNKNOWN` if it has to be counted
+    // again. Setting and clearing single bits keep it up to date; other changes
+    // throw it out.
+    size_t count;
+    size_t nranks;
+    size_t *ranks;
+    // The arena `bits` came from, if any, which owns the blocks.
+    struct Arena *arena;
+    // The file mapping `bits` points into, if any. It lives in the userdata,
+    // where the inline blocks would be.
+    struct Mapping *mapping;
+    block_t inline_bits[];
+} Bitset;
+
+#define BS_COUNT_UNKNOWN SIZE_MAX
+
+// Bitsets created with up to this many blocks are stored inline.
+#define BS_INLINE_BLOCKS 16
+
+// Blocks covered by each entry of the rank index. Bitsets no longer than
+// `BS_INLINE_BLOCKS` don't get an index, since counting their bits directly is
+// about as quick.
+#define BS_RANK_BLOCKS 8
+
+
+// Forgets everything worked out from the bitset's bits: the cached count and
+// the rank index. Anything that writes to `bits` other than through the
+// bitset module's own functions has to call this afterwards.
+static inline void bs_invalidate(Bitset *bitset) {
+    bitset->ranked = false;
+    bitset->count = BS_COUNT_UNKNOWN;
+}
+
+
+// Block kernels. Every kernel works on `n` blocks; `dst` may alias `a`, `b` or
+// both, which is how the in-place and destination-passing operations use them,
+// but must not partly overlap either of them. Implementations are free to chew
+// through the blocks in wider words than `block_t`, so long as the result is
+// the same as doing it one block at a time.
+typedef struct bs_kernels {
+    const char *name;
+
+    // dst = a & b, dst = a | b, dst = a & ~b, dst = a ^ b
+    void (*and_blocks)(block_t *dst, const block_t *a, const block_t *b, size_t n);
+    void (*or_blocks)(block_t *dst, const block_t *a, const block_t *b, size_t n);
+    void (*andnot_blocks)(block_t *dst, const block_t *a, const block_t *b, size_t n);
+    void (*xor_blocks)(block_t *dst, const block_t *a, const block_t *b, size_t n);
+
+    // a == b, a is a subset of b, a is all zero
+    bool (*eq_blocks)(const block_t *a, const block_t *b, size_t n);
+    bool (*subset_blocks)(const block_t *a, const block_t *b, size_t n);
+    bool (*zero_blocks)(const block_t *a, size_t n);
+
+    size_t (*popcount_blocks)(const block_t *a, size_t n);
+
+    // popcount(a & b), popcount(a | b), popcount(a & ~b), popcount(a ^ b),
+    // without storing the result anywhere
+    size_t (*and_popcount_blocks)(const block_t *a, const block_t *b, size_t n);
+    size_t (*or_popcount_blocks)(const block_t *a, const block_t *b, size_t n);
+    size_t (*andnot_popcount_blocks)(const block_t *a, const block_t *b, size_t n);
+    size_t (*xor_popcount_blocks)(const block_t *a, const block_t *b, size_t n);
+
+    // a & b is not all zero; stops at the first block in common
+    bool (*intersects_blocks)(const block_t *a, const block_t *b, size_t n);
+
+    // Scans `n` rows of `words` 64-bit words, stored a column per word with
+    // `stride` words between columns, and writes a bit per row into `out`: set
+    // if the row has every bit of `all`, none of `none`, and at least one of
+    // `any`, unless `any` is all zero. Writes whole blocks, so `out` needs `n`
+    // bits rounded up to a block, and the bits past `n` come out clear.
+    void (*match_rows)(block_t *out, const uint64_t *cols, size_t stride,
+        size_t words, size_t n, const uint64_t *all, const uint64_t *none,
+        const uint64_t *any);
+} bs_kernels;
+
+
+// The kernels currently in use. Set up by `bs_kernels_init`, which picks the
+// fastest implementation the running CPU supports.
+extern const bs_kernels *bs_kern;
+
+void bs_kernels_init(void);
+
+// Look up a kernel implementation by name ("scalar", "sse2", "avx2"). Returns
+// NULL if it doesn't exist or the CPU can't run it.
+const bs_kernels *bs_kernels_find(const char *name);
+
+// The names of all kernel implementations compiled in, NULL-terminated.
+extern const char *const bs_kernel_names[];
+
+#endif
@@ -0,0 +1,77 @@
+/*
+
+Copyright (c) 2016 Sean Leffler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+// Helpers for Lua modules which take bitsets as arguments.
+//
+// Bitsets come with one of two metatables: `LUA_BITSET_TYPENAME` for ones
+// whose blocks are on the heap, and `LUA_BITSET_INLINE_TYPENAME` for ones whose
+// blocks are stored inline or in an arena, which has no `__gc` for the
+// collector to call. So
+// `luaL_checkudata` isn't enough to tell whether something is a bitset; use
+// these instead.
+
+#ifndef LASER_BITSET_LUA_H
+#define LASER_BITSET_LUA_H
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#include "bitset.h"
+
+// Returns the bitset at `idx`, or NULL if it isn't one.
+static inline Bitset *bs_test(lua_State *L, int idx) {
+    Bitset *const bitset = (Bitset*)lua_touserdata(L, idx);
+
+    if (bitset == NULL || !lua_getmetatable(L, idx)) {
+        return NULL;
+    }
+
+    luaL_getmetatable(L, LUA_BITSET_INLINE_TYPENAME);
+    bool eq = lua_rawequal(L, -1, -2);
+    lua_pop(L, 1);
+
+    if (!eq) {
+        luaL_getmetatable(L, LUA_BITSET_TYPENAME);
+        eq = lua_rawequal(L, -1, -2);
+        lua_pop(L, 1);
+    }
+
+    lua_pop(L, 1);
+
+    return eq ? bitset : NULL;
+}
+
+
+// Returns the bitset at `idx`, raising an error if it isn't one.
+static inline Bitset *bs_check(lua_State *L, int idx) {
+    Bitset *const bitset = bs_test(L, idx);
+
+    if (bitset == NULL) {
+        luaL_typerror(L, idx, LUA_BITSET_TYPENAME);
+    }
+
+    return bitset;
+}
+
+#endif
@@ -0,0 +1,100 @@
+/*
+
+Copyright (c) 2016 Sean Leffler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+// Blocked Bloom filters. The filter is cut into blocks the size of a cache line,
+// and each key sets or tests all of its bits within the one block its hash
+// picks, so an insert or a lookup touches a single line of memory instead of
+// `k` scattered ones. The price is a slightly higher false positive rate than
+// a plain Bloom filter of the same size, which `bl_params` makes up for.
+//
+// The blocks are ordinary `block_t`s, and a filter's storage lives wherever
+// its owner puts it; `bl_size` says how big it has to be.
+
+#ifndef LASER_BLOOM_H
+#define LASER_BLOOM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bitset.h"
+
+#define BL_BLOCK_BYTES 64
+#define BL_BLOCK_BITS (8 * BL_BLOCK_BYTES)
+#define BL_BLOCK_WORDS (BL_BLOCK_BYTES / sizeof(block_t))
+
+// The most bits any one key sets.
+#define BL_MAX_K 16
+
+typedef struct Bloom {
+    // Number of blocks, and bits set per key.
+    size_t nblocks;
+    unsigned k;
+    // Points into `storage`, at the first cache-line boundary.
+    block_t *bits;
+    unsigned char storage[];
+} Bloom;
+
+// Picks the number of blocks and of bits per key for a filter expected to hold
+// `n` keys with a false positive rate of `p`. Returns false if that would take
+// more than `SIZE_MAX` bytes.
+bool bl_params(double n, double p, size_t *nblocks, unsigned *k);
+
+// The size of a `Bloom` with `nblocks` blocks, including its storage, or 0 if
+// that's more than `SIZE_MAX`.
+size_t bl_size(size_t nblocks);
+
+// Sets up an empty filter in `bl_size(nblocks)` bytes at `bl`.
+void bl_init(Bloom *bl, size_t nblocks, unsigned k);
+
+void bl_clear(Bloom *bl);
+
+// Makes `dst`, of the same size as `src`, a copy of it.
+void bl_copy(Bloom *dst, const Bloom *src);
+
+// 64-bit hashes of the keys a filter holds. Strings and numbers hash
+// differently, so `"1"` and `1` are different keys.
+uint64_t bl_hash_bytes(const void *p, size_t n);
+uint64_t bl_hash_number(double x);
+
+void bl_add(Bloom *bl, uint64_t h);
+bool bl_contains(const Bloom *bl, uint64_t h);
+
+// The same for `n` hashes at once. The blocks are all fetched before any of
+// them is looked at, so the cache misses overlap.
+void bl_add_many(Bloom *bl, const uint64_t *h, size_t n);
+void bl_contains_many(const Bloom *bl, const uint64_t *h, size_t n, bool *out);
+
+// Whether two filters have the same shape, so their bits can be combined.
+bool bl_compatible(const Bloom *a, const Bloom *b);
+
+// ORs `src` into `dst`. The two must be compatible.
+void bl_union(Bloom *dst, const Bloom *src);
+
+// Estimates how many distinct keys have been added.
+double bl_estimate(const Bloom *bl);
+
+size_t bl_bits(const Bloom *bl);
+
+#endif
@@ -0,0 +1,105 @@
+/*
+
+Copyright (c) 2016 Sean Leffler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+// Hash tables keyed by the contents of bitsets. Keys are copied in, so the
+// bitsets they came from can change afterwards, and trailing zero blocks don't
+// count, so two keys are the same exactly when the bitsets are equal. Each key
+// maps to an `int`, which the Lua side uses as a reference to the value.
+//
+// The table uses linear probing, and deletes by shifting later entries back
+// rather than leaving tombstones, so it never has to be cleaned up. Memory
+// comes from an allocator with the same contract as Lua's `lua_Alloc`.
+
+#ifndef LASER_BSMAP_H
+#define LASER_BSMAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bitset.h"
+
+// Keys of up to this many blocks are stored in the table itself, which covers
+// every fixed-width bitset.
+#define BM_INLINE_BLOCKS 8
+
+// The table doubles when it gets fuller than this many eighths.
+#define BM_MAX_LOAD 6
+
+typedef void *(*bm_alloc_fn)(void *ud, void *ptr, size_t osize, size_t nsize);
+
+typedef struct bm_entry {
+    uint64_t hash;
+    // Blocks in the key. Only meaningful if `used` is set.
+    size_t len;
+    int ref;
+    bool used;
+    union {
+        block_t *heap;
+        block_t inline_bits[BM_INLINE_BLOCKS];
+    } key;
+} bm_entry;
+
+typedef struct BsMap {
+    bm_alloc_fn alloc;
+    void *ud;
+    // A power of two, or 0 before anything has been added.
+    size_t cap;
+    size_t count;
+    bm_entry *slots;
+} BsMap;
+
+void bm_init(BsMap *m, bm_alloc_fn alloc, void *ud);
+void bm_free(BsMap *m);
+
+// Removes every entry, keeping the slots.
+void bm_clear(BsMap *m);
+
+// The number of blocks of `bits` up to and including the last non-zero one.
+size_t bm_trim(const block_t *bits, size_t len);
+
+// A 64-bit hash of `len` blocks, which must already be trimmed.
+uint64_t bm_hash(const block_t *bits, size_t len);
+
+// The entry for a trimmed key with the given hash, or NULL.
+bm_entry *bm_find(const BsMap *m, const block_t *bits, size_t len,
+    uint64_t hash);
+
+// Adds a trimmed key, mapping to `ref`, if it isn't already there. Returns its
+// entry either way, with `added` saying which, or NULL if out of memory.
+bm_entry *bm_insert(BsMap *m, const block_t *bits, size_t len, uint64_t hash,
+    int ref, bool *added);
+
+// Removes the entry for a trimmed key, storing what it mapped to in `ref`.
+// Returns false if there was none. Entries after it in the table may move.
+bool bm_remove(BsMap *m, const block_t *bits, size_t len, uint64_t hash,
+    int *ref);
+
+const block_t *bm_key(const bm_entry *e);
+
+// The first entry at or after slot `*i`, advancing `*i` past it, or NULL if
+// there are no more.
+bm_entry *bm_next(const BsMap *m, size_t *i);
+
+#endif
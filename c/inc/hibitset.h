@@ -0,0 +1,113 @@
+/*
+
+Copyright (c) 2016 Sean Leffler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+// Hierarchical bitsets. The bits themselves are stored densely, in 64-bit
+// words, as in a plain bitset; on top of them sit two summary layers, where
+// bit `i` of a layer is set if word `i` of the layer below isn't zero. One
+// summary word covers 64 words of bits, and one word of the top layer covers
+// 4096, so scans skip over empty stretches that many words at a time. Sparse
+// sets over a big index space (entities with some component, say) can then be
+// combined and iterated over in time proportional to how many words are in
+// use, rather than the highest index.
+//
+// Memory comes from an allocator with the same contract as Lua's `lua_Alloc`.
+// Functions that allocate return false when they run out of memory, leaving
+// the bitset unchanged.
+
+#ifndef LASER_HIBITSET_H
+#define LASER_HIBITSET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bitset.h"
+
+#define HB_LAYERS 3
+#define HB_WORD_BITS 64
+
+// Returned by `hb_next` when there's no such bit.
+#define HB_NONE SIZE_MAX
+
+typedef void *(*hb_alloc_fn)(void *ud, void *ptr, size_t osize, size_t nsize);
+
+typedef struct HiBitset {
+    hb_alloc_fn alloc;
+    void *ud;
+    // `layers[0]` holds the bits, and each layer after it summarizes the one
+    // before. `len[n]` is the number of words in layer `n`, all of which are
+    // in use; words past the end of a layer are zero.
+    uint64_t *layers[HB_LAYERS];
+    size_t len[HB_LAYERS];
+} HiBitset;
+
+typedef enum hb_op { HB_AND, HB_OR, HB_ANDNOT, HB_XOR } hb_op;
+
+void hb_init(HiBitset *h, hb_alloc_fn alloc, void *ud);
+void hb_free(HiBitset *h);
+bool hb_copy(HiBitset *dst, const HiBitset *src);
+
+// Makes room for the bits `[0, nbits)`.
+bool hb_reserve(HiBitset *h, size_t nbits);
+
+bool hb_set(HiBitset *h, size_t idx);
+void hb_clear(HiBitset *h, size_t idx);
+bool hb_get(const HiBitset *h, size_t idx);
+
+// Set or clear `[lo, hi)`.
+bool hb_set_range(HiBitset *h, size_t lo, size_t hi);
+void hb_clear_range(HiBitset *h, size_t lo, size_t hi);
+
+size_t hb_count(const HiBitset *h);
+
+// The first set bit at or after `from`, or `HB_NONE`.
+size_t hb_next(const HiBitset *h, size_t from);
+
+// The last set bit at or before `from`, or `HB_NONE`.
+size_t hb_prev(const HiBitset *h, size_t from);
+
+// The first clear bit at or after `from`. Full words aren't summarized, so this
+// takes time in proportion to the run of set bits it skips.
+size_t hb_next_clear(const HiBitset *h, size_t from);
+
+// `out` is initialized by `hb_binop`, and left empty on failure.
+bool hb_binop(hb_op op, HiBitset *out, const HiBitset *a, const HiBitset *b);
+
+// `a = a op b`, in place. On failure, `a` is left as it was.
+bool hb_binop_mut(hb_op op, HiBitset *a, const HiBitset *b);
+
+size_t hb_intersection_count(const HiBitset *a, const HiBitset *b);
+bool hb_intersects(const HiBitset *a, const HiBitset *b);
+bool hb_equals(const HiBitset *a, const HiBitset *b);
+bool hb_subset(const HiBitset *a, const HiBitset *b);
+
+size_t hb_memory(const HiBitset *h);
+
+// Conversions from and to the blocks of a dense bitset. `hb_from_blocks`
+// initializes `h`, and `hb_to_blocks` ignores bits that don't fit in `len`.
+bool hb_from_blocks(HiBitset *h, hb_alloc_fn alloc, void *ud,
+    const block_t *bits, size_t len);
+void hb_to_blocks(const HiBitset *h, block_t *bits, size_t len);
+
+#endif
@@ -0,0 +1,62 @@
+/*
+
+Copyright (c) 2016 Sean Leffler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+// Files mapped into memory, for bitsets too big to read in or to keep on the
+// heap. A mapping is either shared, so that writes go through to the file, or
+// private, so that writes are copy-on-write and the file is never changed.
+//
+// Functions that can fail return false and leave the reason in `errno`. Only
+// POSIX systems are supported; elsewhere, `mp_open` fails with `ENOSYS`.
+
+#ifndef LASER_MAPPING_H
+#define LASER_MAPPING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct Mapping {
+    // Kept open for shared mappings, so that they can be resized; -1 for
+    // private ones.
+    int fd;
+    bool shared;
+    void *addr;
+    size_t size;
+} Mapping;
+
+// Maps the file at `path`. A shared mapping creates the file if it has to and
+// extends it with zeroes to at least `size` bytes, and to a whole number of
+// `unit`-byte units. A private one maps the whole of an existing file, and
+// ignores `size` and `unit`. Mapping an empty file privately succeeds with
+// `addr` NULL and `size` zero.
+bool mp_open(Mapping *m, const char *path, size_t size, size_t unit,
+    bool shared);
+void mp_close(Mapping *m);
+
+// Changes the size of a shared mapping, and of its file. The mapping may move.
+bool mp_resize(Mapping *m, size_t size);
+
+// Writes a shared mapping's changes back to its file.
+bool mp_sync(const Mapping *m);
+
+#endif
@@ -0,0 +1,86 @@
+/*
+
+Copyright (c) 2016 Sean Leffler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+// Morton (Z-order) codes: the bits of two or three coordinates interleaved into
+// one integer, so that points close together in space tend to be close together
+// in code order. The x coordinate always lands in the lowest bit.
+//
+//  - 2D, 16-bit coordinates -> 32-bit codes
+//  - 2D, 32-bit coordinates -> 64-bit codes
+//  - 3D, 10-bit coordinates -> 30-bit codes
+//  - 3D, 21-bit coordinates -> 63-bit codes
+//
+// Everything works on arrays, so that the choice of implementation is made once
+// per batch rather than once per point. Coordinate bits beyond the width of the
+// code are ignored.
+
+#ifndef LASER_MORTON_H
+#define LASER_MORTON_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MORTON2_16_MAX 0xFFFFu
+#define MORTON2_32_MAX 0xFFFFFFFFu
+#define MORTON3_10_MAX 0x3FFu
+#define MORTON3_21_MAX 0x1FFFFFu
+
+typedef struct morton_kernels {
+    const char *name;
+
+    void (*encode2_16)(const uint32_t *x, const uint32_t *y,
+        uint32_t *codes, size_t n);
+    void (*decode2_16)(const uint32_t *codes,
+        uint32_t *x, uint32_t *y, size_t n);
+
+    void (*encode2_32)(const uint32_t *x, const uint32_t *y,
+        uint64_t *codes, size_t n);
+    void (*decode2_32)(const uint64_t *codes,
+        uint32_t *x, uint32_t *y, size_t n);
+
+    void (*encode3_10)(const uint32_t *x, const uint32_t *y, const uint32_t *z,
+        uint32_t *codes, size_t n);
+    void (*decode3_10)(const uint32_t *codes,
+        uint32_t *x, uint32_t *y, uint32_t *z, size_t n);
+
+    void (*encode3_21)(const uint32_t *x, const uint32_t *y, const uint32_t *z,
+        uint64_t *codes, size_t n);
+    void (*decode3_21)(const uint64_t *codes,
+        uint32_t *x, uint32_t *y, uint32_t *z, size_t n);
+} morton_kernels;
+
+// The implementation in use. Starts out as the portable "magic bits" version;
+// call `morton_kernels_init` to pick the best one for this CPU.
+extern const morton_kernels *morton_kern;
+
+// NULL-terminated names of every implementation compiled in, available or not.
+extern const char *const morton_kernel_names[];
+
+// Looks up an implementation by name. NULL if it doesn't exist or the CPU
+// can't run it.
+const morton_kernels *morton_kernels_find(const char *name);
+
+void morton_kernels_init(void);
+
+#endif
@@ -0,0 +1,77 @@
+/*
+
+Copyright (c) 2016 Sean Leffler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+// A small pool of worker threads for bulk operations on very large bitsets.
+// `bs_pool_run` cuts a range of blocks into chunks which the calling thread and
+// the workers take turns claiming, and returns once every chunk is done, so
+// callers never see any of the threads.
+//
+// Small ranges, and callers that find the pool busy with another one, just
+// run on the calling thread. The pool is shared by every Lua state in the
+// process, and the workers are started the first time they're needed. Only
+// POSIX threads are supported; elsewhere, everything runs on the calling
+// thread.
+
+#ifndef LASER_POOL_H
+#define LASER_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "bitset.h"
+
+// The most threads an operation is ever split across, the calling thread
+// included.
+#define BS_POOL_MAX_THREADS 16
+
+// Ranges shorter than this many blocks (4 MiB) aren't split by default, since
+// waking the workers up costs more than they would save.
+#define BS_POOL_MIN_BLOCKS ((size_t)1 << 20)
+
+// Works on the blocks `[lo, hi)`.
+typedef void (*bs_task_fn)(void *ctx, size_t lo, size_t hi);
+
+// Runs `fn` over `[0, n)`, split across the pool if `n` is big enough. The
+// pieces may run in any order, and at the same time.
+void bs_pool_run(size_t n, bs_task_fn fn, void *ctx);
+
+// The number of threads operations are split across, and the number of blocks
+// an operation has to cover before it's split at all.
+size_t bs_pool_threads(void);
+size_t bs_pool_min_blocks(void);
+
+// Changes the settings above, waiting for any operation in progress to finish.
+// One thread turns splitting off. Returns false and sets `errno` if more than
+// one thread was asked for where threads aren't supported.
+bool bs_pool_configure(size_t threads, size_t min_blocks);
+
+// The kernels of `bs_kern`, split across the pool when there are enough blocks.
+// Each piece calls whatever `bs_kern` is at the time, so switching kernels
+// switches these too.
+extern const bs_kernels bs_par;
+
+// Copies `n` blocks from `src`, which needn't be aligned, split the same way.
+void bs_par_copy(block_t *dst, const void *src, size_t n);
+
+#endif
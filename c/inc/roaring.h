@@ -0,0 +1,118 @@
+/*
+
+Copyright (c) 2016 Sean Leffler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+// Roaring-style compressed bitmaps over 32-bit indices. The index space is cut
+// into 64K-bit chunks keyed by the high 16 bits of the index, and each non-empty
+// chunk is stored in whichever container suits it:
+//
+//  - an array of sorted 16-bit values, for up to `RR_ARRAY_MAX` set bits;
+//  - a plain bitmap of `block_t`s, for anything denser;
+//  - a list of runs, for long stretches of set bits (see `rr_optimize`).
+//
+// Functions that allocate return false (or -1) when they run out of memory.
+
+#ifndef LASER_ROARING_H
+#define LASER_ROARING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bitset.h"
+
+#define RR_CHUNK_BITS 65536
+#define RR_BITMAP_BLOCKS (RR_CHUNK_BITS / BITWIDTH)
+#define RR_ARRAY_MAX 4096
+
+#define RR_MAX_INDEX UINT32_MAX
+
+enum { RR_ARRAY, RR_BITMAP, RR_RUN };
+
+// An inclusive run of set bits, `[start, last]`.
+typedef struct rr_run {
+    uint16_t start;
+    uint16_t last;
+} rr_run;
+
+typedef struct rr_container {
+    uint16_t key;
+    uint8_t type;
+    // Set if `data` belongs to someone else; see `rr_view_blocks`.
+    uint8_t borrowed;
+    uint32_t card;
+    // Number of values (array) or runs (run) in use, and room for how many.
+    uint32_t n;
+    uint32_t cap;
+    void *data;
+} rr_container;
+
+typedef struct Roaring {
+    // Non-empty containers, sorted by key.
+    rr_container *cs;
+    size_t len;
+    size_t cap;
+} Roaring;
+
+typedef enum rr_op { RR_AND, RR_OR, RR_ANDNOT, RR_XOR } rr_op;
+
+void rr_init(Roaring *r);
+void rr_free(Roaring *r);
+bool rr_copy(Roaring *dst, const Roaring *src);
+
+// 1 if the bit was flipped, 0 if it was already that way, -1 if out of memory.
+int rr_add(Roaring *r, uint32_t idx);
+int rr_remove(Roaring *r, uint32_t idx);
+
+bool rr_contains(const Roaring *r, uint32_t idx);
+uint64_t rr_cardinality(const Roaring *r);
+
+// Set or clear `[lo, hi)`, with `hi` at most `RR_MAX_INDEX + 1`.
+bool rr_add_range(Roaring *r, uint64_t lo, uint64_t hi);
+bool rr_remove_range(Roaring *r, uint64_t lo, uint64_t hi);
+
+// `out` is initialized by these, and left empty on failure.
+bool rr_binop(rr_op op, Roaring *out, const Roaring *a, const Roaring *b);
+
+bool rr_equals(const Roaring *a, const Roaring *b);
+bool rr_subset(const Roaring *a, const Roaring *b);
+
+// Finds the first set bit at or after `from`. Returns false if there is none.
+bool rr_next(const Roaring *r, uint64_t from, uint32_t *out);
+
+// Converts each container to the smallest of the three representations.
+bool rr_optimize(Roaring *r);
+
+size_t rr_memory(const Roaring *r);
+
+// Treats dense blocks as a roaring bitmap without copying them, so they can be
+// used as an operand. Only blocks covering indices up to `RR_MAX_INDEX` are
+// looked at, so callers have to check that none past them have bits set. The
+// view must be freed with `rr_free`, and must not outlive or be used across
+// modifications of `bits`.
+bool rr_view_blocks(Roaring *view, const block_t *bits, size_t len);
+
+// ORs the set bits into dense blocks, ignoring any that don't fit in `len`.
+void rr_to_blocks(const Roaring *r, block_t *bits, size_t len);
+
+#endif
@@ -0,0 +1,75 @@
+/*
+
+Copyright (c) 2016 Sean Leffler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+
+// Tables of fixed-width signatures, for matching many of them against a query
+// at once. Rows are 1, 2 or 4 64-bit words wide, and stored a column per word:
+// word `w` of row `r` is at `cols[w * cap + r]`. That way a scan reads each
+// column straight through, and vector kernels can test several rows with one
+// load. Memory comes from an allocator with the same contract as Lua's
+// `lua_Alloc`.
+
+#ifndef LASER_SIGTABLE_H
+#define LASER_SIGTABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bitset.h"
+
+typedef void *(*st_alloc_fn)(void *ud, void *ptr, size_t osize, size_t nsize);
+
+typedef struct SigTable {
+    st_alloc_fn alloc;
+    void *ud;
+    // Words in each row.
+    size_t words;
+    size_t len;
+    size_t cap;
+    uint64_t *cols;
+} SigTable;
+
+void st_init(SigTable *t, st_alloc_fn alloc, void *ud, size_t words);
+void st_free(SigTable *t);
+
+// Makes room for at least `cap` rows. Returns false if out of memory.
+bool st_reserve(SigTable *t, size_t cap);
+
+// Appends a row of `t->words` words. Returns false if out of memory.
+bool st_push(SigTable *t, const uint64_t *row);
+
+void st_set(SigTable *t, size_t r, const uint64_t *row);
+void st_get(const SigTable *t, size_t r, uint64_t *row);
+
+// Moves the last row into row `r`, and drops the last row.
+void st_swap_remove(SigTable *t, size_t r);
+
+// Sets bit `r` of `out`, which must have room for `t->len` bits rounded up to
+// whole blocks, if row `r` has every bit of `all`, none of `none`, and at least
+// one of `any`, unless `any` is all zero. Each mask is `t->words` words.
+void st_match(const SigTable *t, const uint64_t *all, const uint64_t *none,
+    const uint64_t *any, block_t *out);
+
+#endif
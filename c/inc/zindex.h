@@ -0,0 +1,105 @@
+/*
+
+Copyright (c) 2016 Sean Leffler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+// A linear quadtree (or octree) over axis-aligned boxes, for broad-phase
+// queries. Space is cut into a grid of `2^ZI_LEVELS2`-square cells (2D) or
+// `2^ZI_LEVELS3`-cube cells (3D), and every box is filed under the smallest
+// tree node whose cells cover it. A node is named by the Morton code of its
+// first cell, so the whole tree is just one array of entries sorted by
+// (code, largest node first), with no pointers between nodes.
+//
+// Boxes outside the grid are clamped onto its edge cells, so they are still
+// found, just less efficiently.
+
+#ifndef LASER_ZINDEX_H
+#define LASER_ZINDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ZI_LEVELS2 16
+#define ZI_LEVELS3 10
+
+// Entries are sorted by packing their position in with their sort key, which
+// leaves room for this many.
+#define ZI_MAX_ENTRIES ((size_t)1 << 27)
+
+#define ZI_NONE UINT32_MAX
+
+typedef struct zi_entry {
+    // Morton code of the node's first cell, and the node's level: a node at
+    // level L is 2^L cells across.
+    uint32_t key;
+    uint32_t level;
+    uint32_t id;
+    double min[3];
+    double max[3];
+} zi_entry;
+
+typedef struct ZIndex {
+    int dims;
+    uint32_t levels;
+    double cell;
+    double origin[3];
+
+    zi_entry *entries;
+    size_t len;
+    size_t cap;
+
+    // Position of each ID in `entries`, or `ZI_NONE`.
+    uint32_t *slots;
+    size_t nslots;
+
+    // Results of the last query, and scratch space for `zi_nearest`.
+    uint32_t *found;
+    size_t nfound;
+    size_t found_cap;
+
+    void *hits;
+    size_t hits_cap;
+    void *nodes;
+    size_t nodes_cap;
+} ZIndex;
+
+void zi_init(ZIndex *z, int dims, double cell, const double origin[3]);
+void zi_free(ZIndex *z);
+
+// Replaces the contents with `n` boxes, `boxes` holding the `dims` minimum
+// coordinates of each followed by its `dims` maximums. Later duplicate IDs
+// win. Returns false if out of memory or `n` is more than `ZI_MAX_ENTRIES`,
+// leaving the index empty.
+bool zi_rebuild(ZIndex *z, const uint32_t *ids, const double *boxes, size_t n);
+
+// Inserts or moves one box. Cheap when it hasn't moved far in Morton order.
+bool zi_update(ZIndex *z, uint32_t id, const double min[3], const double max[3]);
+bool zi_remove(ZIndex *z, uint32_t id);
+
+// These leave the IDs found in `found`/`nfound`. Boxes touching the query box
+// count as overlapping it. `zi_nearest` finds the `k` boxes closest to a point
+// (zero if the point is inside), sorted nearest first.
+bool zi_query(ZIndex *z, const double min[3], const double max[3]);
+bool zi_nearest(ZIndex *z, const double point[3], size_t k);
+
+#endif
@@ -0,0 +1,689 @@
+/*
+
+Copyright (c) 2016 Sean Leffler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+/// Two-dimensional grids of bits, for walkability, visibility and collision
+/// masks on tile maps. Cells are addressed by `(x, y)`, both from 0, and each
+/// row is stored like a bitset, padded out to a whole number of blocks.
+///
+/// Besides getting and setting cells, grids can be shifted, grown and shrunk
+/// (dilated and eroded), stepped as Life-like cellular automata, and have
+/// rectangles of other grids copied or combined into them. All of these work a
+/// block of cells at a time rather than cell by cell. Operations that change
+/// the whole grid come in pairs, like the set operations on bitsets: one
+/// returning a new grid, and one with a `_mut` suffix working in place.
+// @module bitgrid
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#include "bitset.h"
+#include "bitset_lua.h"
+#include "bitgrid.h"
+
+#define LUA_BITGRID_LIBNAME "bitgrid"
+#define LUA_BITGRID_TYPENAME "_bitgrid_ty"
+
+#define AUTHOR_STRING "Sean Leffler <sean@errno.com>"
+#define VERSION_STRING "1.0"
+
+/*** A grid of bits.
+@type BitGrid
+*/
+
+
+static BitGrid *bg_check(lua_State *L, int idx) {
+    return luaL_checkudata(L, idx, LUA_BITGRID_TYPENAME);
+}
+
+
+// Pushes a new, clear grid. The blocks are part of the userdata, so nothing
+// needs freeing.
+static BitGrid *bg_push(lua_State *L, size_t width, size_t height) {
+    const size_t size = bg_size(width, height);
+
+    if (size == 0 || (width != 0 && height > SIZE_MAX / width)) {
+        // Lua 5.1 can't format a `size_t`, but a number holds any that fit in
+        // 53 bits exactly.
+        luaL_error(L, "grid too big: %f by %f", (lua_Number)width,
+            (lua_Number)height);
+    }
+
+    BitGrid *const g = (BitGrid*)lua_newuserdata(L, size);
+    bg_init(g, width, height);
+
+    luaL_getmetatable(L, LUA_BITGRID_TYPENAME);
+    lua_setmetatable(L, -2);
+
+    return g;
+}
+
+
+static BitGrid *bg_push_like(lua_State *L, const BitGrid *g) {
+    return bg_push(L, g->width, g->height);
+}
+
+
+static size_t check_size(lua_State *L, int arg) {
+    const lua_Integer n = luaL_checkinteger(L, arg);
+
+    if (n < 0) {
+        luaL_argerror(L, arg, "expected positive size");
+    }
+
+    return (size_t)n;
+}
+
+
+// Checks that `(x, y)` at `arg` and `arg + 1` is a cell of the grid.
+static void check_cell(lua_State *L, const BitGrid *g, int arg, size_t *x,
+        size_t *y) {
+    const lua_Integer int_x = luaL_checkinteger(L, arg);
+    const lua_Integer int_y = luaL_checkinteger(L, arg + 1);
+
+    if (int_x < 0 || (size_t)int_x >= g->width) {
+        luaL_argerror(L, arg, "cell out of range");
+    }
+
+    if (int_y < 0 || (size_t)int_y >= g->height) {
+        luaL_argerror(L, arg + 1, "cell out of range");
+    }
+
+    *x = (size_t)int_x;
+    *y = (size_t)int_y;
+}
+
+
+/*** Allocate a new grid, with every cell clear.
+If called with a grid instead, it is copied.
+
+@function new
+@tparam num|BitGrid width the width of the grid in cells, or a grid to copy.
+@tparam[opt] num height the height of the grid in cells.
+@treturn BitGrid a newly allocated grid.
+*/
+static int bg_new(lua_State *L) {
+    if (lua_isuserdata(L, 1)) {
+        const BitGrid *const src = bg_check(L, 1);
+        BitGrid *const dst = bg_push_like(L, src);
+
+        memcpy(dst->bits, src->bits,
+            src->stride * src->height * sizeof(block_t));
+        return 1;
+    }
+
+    const size_t width = check_size(L, 1);
+    const size_t height = check_size(L, 2);
+
+    bg_push(L, width, height);
+    return 1;
+}
+
+
+/*** Make a grid from a flat bitset, laid out one row after another.
+That is, cell `(x, y)` comes from bit `y * width + x`. Bits past the end of
+the bitset count as clear.
+
+@function from_bitset
+@tparam Bitset bs the bitset to copy cells from.
+@tparam num width the width of the grid in cells.
+@tparam num height the height of the grid in cells.
+@treturn BitGrid a newly allocated grid.
+@see BitGrid:to_bitset
+*/
+static int bg_from_bitset(lua_State *L) {
+    const Bitset *const bs = bs_check(L, 1);
+    const size_t width = check_size(L, 2);
+    const size_t height = check_size(L, 3);
+
+    BitGrid *const g = bg_push(L, width, height);
+    bg_from_flat(g, bs->bits, bs->len);
+
+    return 1;
+}
+
+
+/*** The width of the grid, in cells.
+@function BitGrid:width
+@treturn num the width.
+*/
+static int bg_width(lua_State *L) {
+    lua_pushinteger(L, (lua_Integer)bg_check(L, 1)->width);
+    return 1;
+}
+
+
+/*** The height of the grid, in cells.
+@function BitGrid:height
+@treturn num the height.
+*/
+static int bg_height(lua_State *L) {
+    lua_pushinteger(L, (lua_Integer)bg_check(L, 1)->height);
+    return 1;
+}
+
+
+/*** Gets a single cell. Cells off the grid are clear.
+@function BitGrid:get
+@tparam num x the column of the cell.
+@tparam num y the row of the cell.
+@treturn bool whether the cell is set.
+*/
+static int bg_get_l(lua_State *L) {
+    const BitGrid *const g = bg_check(L, 1);
+    const lua_Integer x = luaL_checkinteger(L, 2);
+    const lua_Integer y = luaL_checkinteger(L, 3);
+
+    lua_pushboolean(L, x >= 0 && y >= 0 &&
+        (size_t)x < g->width && (size_t)y < g->height &&
+        bg_get(g, (size_t)x, (size_t)y));
+    return 1;
+}
+
+
+/*** Sets a single cell.
+The grid is modified in place, but for convenience, it is also returned.
+
+@function BitGrid:set
+@tparam num x the column of the cell.
+@tparam num y the row of the cell.
+@treturn BitGrid the modified grid.
+*/
+static int bg_set(lua_State *L) {
+    BitGrid *const g = bg_check(L, 1);
+
+    size_t x, y;
+    check_cell(L, g, 2, &x, &y);
+
+    bg_put(g, x, y, true);
+
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+/*** Clears a single cell.
+@function BitGrid:clear
+@tparam num x the column of the cell.
+@tparam num y the row of the cell.
+@treturn BitGrid the modified grid.
+*/
+static int bg_clear(lua_State *L) {
+    BitGrid *const g = bg_check(L, 1);
+
+    size_t x, y;
+    check_cell(L, g, 2, &x, &y);
+
+    bg_put(g, x, y, false);
+
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+static int fill_rect(lua_State *L, bool value) {
+    BitGrid *const g = bg_check(L, 1);
+    const lua_Integer x = luaL_checkinteger(L, 2);
+    const lua_Integer y = luaL_checkinteger(L, 3);
+    const lua_Integer w = luaL_checkinteger(L, 4);
+    const lua_Integer h = luaL_checkinteger(L, 5);
+
+    bg_fill(g, (ptrdiff_t)x, (ptrdiff_t)y, (ptrdiff_t)w, (ptrdiff_t)h, value);
+
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+/*** Sets every cell of a rectangle.
+The rectangle is clipped to the grid, so it may hang off the edges.
+
+@function BitGrid:set_rect
+@tparam num x the column of the rectangle's top-left corner.
+@tparam num y the row of the rectangle's top-left corner.
+@tparam num w the width of the rectangle.
+@tparam num h the height of the rectangle.
+@treturn BitGrid the modified grid.
+*/
+static int bg_set_rect(lua_State *L) {
+    return fill_rect(L, true);
+}
+
+
+/*** Clears every cell of a rectangle.
+The rectangle is clipped to the grid, so it may hang off the edges.
+
+@function BitGrid:clear_rect
+@tparam num x the column of the rectangle's top-left corner.
+@tparam num y the row of the rectangle's top-left corner.
+@tparam num w the width of the rectangle.
+@tparam num h the height of the rectangle.
+@treturn BitGrid the modified grid.
+*/
+static int bg_clear_rect(lua_State *L) {
+    return fill_rect(L, false);
+}
+
+
+/*** Counts how many cells are set. Also available as `#`.
+@function BitGrid:count
+@treturn num the number of set cells.
+*/
+static int bg_count_l(lua_State *L) {
+    lua_pushinteger(L, (lua_Integer)bg_count(bg_check(L, 1)));
+    return 1;
+}
+
+
+/*** Tests whether two grids are the same size, with the same cells set.
+Also available as the `==` operator.
+
+@function BitGrid:eq
+@tparam BitGrid lhs the left-hand grid.
+@tparam BitGrid rhs the right-hand grid.
+@treturn bool whether the grids are equal.
+*/
+static int bg_eq(lua_State *L) {
+    lua_pushboolean(L, bg_equals(bg_check(L, 1), bg_check(L, 2)));
+    return 1;
+}
+
+
+static int shift(lua_State *L, bool in_place) {
+    BitGrid *const src = bg_check(L, 1);
+    const lua_Integer dx = luaL_checkinteger(L, 2);
+    const lua_Integer dy = luaL_checkinteger(L, 3);
+
+    BitGrid *const dst = in_place ? src : bg_push_like(L, src);
+    bg_shift(dst, src, (ptrdiff_t)dx, (ptrdiff_t)dy);
+
+    if (in_place) {
+        lua_pushvalue(L, 1);
+    }
+
+    return 1;
+}
+
+
+/*** Moves every cell by `(dx, dy)`.
+Cells moved off the grid are lost, and the cells they leave behind are clear.
+
+@function BitGrid:shift
+@tparam num dx how far to move the cells to the right; negative moves them left.
+@tparam num dy how far to move the cells down; negative moves them up.
+@treturn BitGrid a newly allocated grid with the cells moved.
+@see BitGrid:shift_mut
+*/
+static int bg_shift_l(lua_State *L) {
+    return shift(L, false);
+}
+
+
+/*** Moves every cell by `(dx, dy)`, in place.
+@function BitGrid:shift_mut
+@tparam num dx how far to move the cells to the right; negative moves them left.
+@tparam num dy how far to move the cells down; negative moves them up.
+@treturn BitGrid the grid is modified in place, but returned for convenience.
+@see BitGrid:shift
+*/
+static int bg_shift_mut(lua_State *L) {
+    return shift(L, true);
+}
+
+
+static int morph(lua_State *L, bool erode, bool in_place) {
+    BitGrid *const src = bg_check(L, 1);
+    const bool diagonal = lua_isnoneornil(L, 2) || lua_toboolean(L, 2);
+
+    BitGrid *const dst = in_place ? src : bg_push_like(L, src);
+
+    if (erode) {
+        bg_erode(dst, src, diagonal);
+    } else {
+        bg_dilate(dst, src, diagonal);
+    }
+
+    if (in_place) {
+        lua_pushvalue(L, 1);
+    }
+
+    return 1;
+}
+
+
+/*** Grows the set cells by one in every direction.
+A cell is set in the result if it or any of its neighbours is set. Cells off
+the grid count as clear, so nothing grows in from the edges.
+
+@function BitGrid:dilate
+@tparam[opt=true] bool diagonal whether to count all eight neighbours, or just the four orthogonal ones.
+@treturn BitGrid a newly allocated, dilated grid.
+@see BitGrid:dilate_mut
+*/
+static int bg_dilate_l(lua_State *L) {
+    return morph(L, false, false);
+}
+
+
+/*** Grows the set cells by one in every direction, in place.
+@function BitGrid:dilate_mut
+@tparam[opt=true] bool diagonal whether to count all eight neighbours, or just the four orthogonal ones.
+@treturn BitGrid the grid is modified in place, but returned for convenience.
+@see BitGrid:dilate
+*/
+static int bg_dilate_mut(lua_State *L) {
+    return morph(L, false, true);
+}
+
+
+/*** Shrinks the set cells by one in every direction.
+A cell is set in the result if it and all of its neighbours are set. Cells off
+the grid count as set, so nothing is eaten away at the edges.
+
+@function BitGrid:erode
+@tparam[opt=true] bool diagonal whether to count all eight neighbours, or just the four orthogonal ones.
+@treturn BitGrid a newly allocated, eroded grid.
+@see BitGrid:erode_mut
+*/
+static int bg_erode_l(lua_State *L) {
+    return morph(L, true, false);
+}
+
+
+/*** Shrinks the set cells by one in every direction, in place.
+@function BitGrid:erode_mut
+@tparam[opt=true] bool diagonal whether to count all eight neighbours, or just the four orthogonal ones.
+@treturn BitGrid the grid is modified in place, but returned for convenience.
+@see BitGrid:erode
+*/
+static int bg_erode_mut(lua_State *L) {
+    return morph(L, true, true);
+}
+
+
+// Parses a rule like "B3/S23" into masks of neighbour counts.
+static void check_rule(lua_State *L, int arg, unsigned *born,
+        unsigned *survive) {
+    const char *p = luaL_checkstring(L, arg);
+    unsigned *target = NULL;
+
+    *born = *survive = 0;
+
+    for (; *p != '\0'; p++) {
+        if (*p == 'B' || *p == 'b') {
+            target = born;
+        } else if (*p == 'S' || *p == 's') {
+            target = survive;
+        } else if (*p >= '0' && *p <= '8' && target != NULL) {
+            *target |= 1u << (*p - '0');
+        } else if (*p != '/') {
+            luaL_argerror(L, arg, "expected a rule like \"B3/S23\"");
+        }
+    }
+}
+
+
+static int step(lua_State *L, bool in_place) {
+    BitGrid *const src = bg_check(L, 1);
+
+    unsigned born, survive;
+    check_rule(L, 2, &born, &survive);
+
+    const bool edge = lua_toboolean(L, 3);
+
+    BitGrid *const dst = in_place ? src : bg_push_like(L, src);
+    bg_step(dst, src, born, survive, edge);
+
+    if (in_place) {
+        lua_pushvalue(L, 1);
+    }
+
+    return 1;
+}
+
+
+/*** Runs one step of a Life-like cellular automaton.
+The rule says how many of its eight neighbours a clear cell needs to become
+set, and a set cell to stay set, in the usual notation: `"B3/S23"` is Conway's
+Life, and `"B678/S345678"` smooths random noise into caves.
+
+@function BitGrid:step
+@tparam string rule the rule, as `"B"` and the birth counts, then `"/S"` and the survival counts.
+@tparam[opt=false] bool edge whether cells off the grid count as set, which closes caves off at the edges.
+@treturn BitGrid a newly allocated grid, one step on.
+@see BitGrid:step_mut
+*/
+static int bg_step_l(lua_State *L) {
+    return step(L, false);
+}
+
+
+/*** Runs one step of a Life-like cellular automaton, in place.
+@function BitGrid:step_mut
+@tparam string rule the rule, as `"B"` and the birth counts, then `"/S"` and the survival counts.
+@tparam[opt=false] bool edge whether cells off the grid count as set.
+@treturn BitGrid the grid is modified in place, but returned for convenience.
+@see BitGrid:step
+*/
+static int bg_step_mut(lua_State *L) {
+    return step(L, true);
+}
+
+
+static int blit(lua_State *L, bg_op op) {
+    BitGrid *const dst = bg_check(L, 1);
+    const BitGrid *const src = bg_check(L, 2);
+
+    const lua_Integer x = luaL_optinteger(L, 3, 0);
+    const lua_Integer y = luaL_optinteger(L, 4, 0);
+    const lua_Integer sx = luaL_optinteger(L, 5, 0);
+    const lua_Integer sy = luaL_optinteger(L, 6, 0);
+    const lua_Integer w = luaL_optinteger(L, 7, (lua_Integer)src->width);
+    const lua_Integer h = luaL_optinteger(L, 8, (lua_Integer)src->height);
+
+    bg_blit(op, dst, (ptrdiff_t)x, (ptrdiff_t)y, src, (ptrdiff_t)sx,
+        (ptrdiff_t)sy, (ptrdiff_t)w, (ptrdiff_t)h);
+
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+/*** Copies a rectangle of another grid into this one.
+By default the whole of `src` is copied to the top-left corner. The rectangle
+is clipped to both grids, and `src` may be this grid, even if the rectangles
+overlap.
+
+@function BitGrid:blit
+@tparam BitGrid src the grid to copy from.
+@tparam[opt=0] num x the column to copy to.
+@tparam[opt=0] num y the row to copy to.
+@tparam[opt=0] num sx the column of the rectangle in `src`.
+@tparam[opt=0] num sy the row of the rectangle in `src`.
+@tparam[opt] num w the width of the rectangle, by default that of `src`.
+@tparam[opt] num h the height of the rectangle, by default that of `src`.
+@treturn BitGrid the modified grid.
+*/
+static int bg_blit_copy(lua_State *L) {
+    return blit(L, BG_COPY);
+}
+
+
+/*** Intersects a rectangle of this grid with one of another.
+Takes the same arguments as @{BitGrid:blit}; cells outside the rectangle are
+left alone.
+
+@function BitGrid:blit_and
+@tparam BitGrid src the grid to intersect with.
+@treturn BitGrid the modified grid.
+@see BitGrid:blit
+*/
+static int bg_blit_and(lua_State *L) {
+    return blit(L, BG_AND);
+}
+
+
+/*** Unions a rectangle of another grid into this one.
+Takes the same arguments as @{BitGrid:blit}.
+
+@function BitGrid:blit_or
+@tparam BitGrid src the grid to union with.
+@treturn BitGrid the modified grid.
+@see BitGrid:blit
+*/
+static int bg_blit_or(lua_State *L) {
+    return blit(L, BG_OR);
+}
+
+
+/*** Clears the cells of a rectangle of this grid which are set in another.
+Takes the same arguments as @{BitGrid:blit}.
+
+@function BitGrid:blit_andnot
+@tparam BitGrid src the grid to subtract.
+@treturn BitGrid the modified grid.
+@see BitGrid:blit
+*/
+static int bg_blit_andnot(lua_State *L) {
+    return blit(L, BG_ANDNOT);
+}
+
+
+/*** Flips the cells of a rectangle of this grid which are set in another.
+Takes the same arguments as @{BitGrid:blit}.
+
+@function BitGrid:blit_xor
+@tparam BitGrid src the grid to compare with.
+@treturn BitGrid the modified grid.
+@see BitGrid:blit
+*/
+static int bg_blit_xor(lua_State *L) {
+    return blit(L, BG_XOR);
+}
+
+
+/*** Converts the grid to a flat bitset, laid out one row after another.
+That is, cell `(x, y)` goes to bit `y * width + x`. Requires the `bitset`
+module.
+
+@function BitGrid:to_bitset
+@treturn Bitset a newly allocated bitset of `width * height` bits.
+@see from_bitset
+*/
+static int bg_to_bitset(lua_State *L) {
+    const BitGrid *const g = bg_check(L, 1);
+
+    // Let the bitset module allocate the bitset the way it likes.
+    lua_getglobal(L, "require");
+    lua_pushliteral(L, LUA_BITSET_LIBNAME);
+    lua_call(L, 1, 1);
+    lua_getfield(L, -1, "new");
+
+    lua_pushinteger(L, (lua_Integer)(g->width * g->height));
+    lua_call(L, 1, 1);
+
+    Bitset *const bitset = bs_check(L, -1);
+    bg_to_flat(g, bitset->bits);
+    bs_invalidate(bitset);
+
+    return 1;
+}
+
+
+static const luaL_reg bg_funcs[] = {
+    {"new", bg_new},
+    {"from_bitset", bg_from_bitset},
+    {NULL, NULL},
+};
+
+
+static const luaL_reg bg_methods[] = {
+    {"width", bg_width},
+    {"height", bg_height},
+    {"get", bg_get_l},
+    {"set", bg_set},
+    {"clear", bg_clear},
+    {"set_rect", bg_set_rect},
+    {"clear_rect", bg_clear_rect},
+    {"count", bg_count_l},
+    {"eq", bg_eq},
+    {"shift", bg_shift_l},
+    {"shift_mut", bg_shift_mut},
+    {"dilate", bg_dilate_l},
+    {"dilate_mut", bg_dilate_mut},
+    {"erode", bg_erode_l},
+    {"erode_mut", bg_erode_mut},
+    {"step", bg_step_l},
+    {"step_mut", bg_step_mut},
+    {"blit", bg_blit_copy},
+    {"blit_and", bg_blit_and},
+    {"blit_or", bg_blit_or},
+    {"blit_andnot", bg_blit_andnot},
+    {"blit_xor", bg_blit_xor},
+    {"to_bitset", bg_to_bitset},
+    {NULL, NULL},
+};
+
+
+LUALIB_API int luaopen_bitgrid(lua_State *L) {
+    bs_kernels_init();
+
+    luaL_register(L, LUA_BITGRID_LIBNAME, bg_funcs);
+
+    if (luaL_newmetatable(L, LUA_BITGRID_TYPENAME) == 0) {
+        lua_pushstring(L, "Uh-oh! The string used in the bitgrid library to \
+            identify the bitgrid metatable is taken in the registry! Sean \
+            didn't think this would happen, so you better tell him either \
+            through github or email at <sean@errno.com>.");
+        lua_error(L);
+    }
+
+    static const struct luaL_reg bg_mt[] = {
+        {"__len", bg_count_l},
+        {"__eq", bg_eq},
+        {NULL, NULL},
+    };
+
+    lua_newtable(L);
+    luaL_register(L, NULL, bg_methods);
+    lua_setfield(L, -2, "__index");
+
+    luaL_register(L, NULL, bg_mt);
+
+    lua_pushstring(L, AUTHOR_STRING);
+    lua_setfield(L, -2, "_AUTHOR");
+
+    lua_pushstring(L, VERSION_STRING);
+    lua_setfield(L, -2, "_VERSION");
+
+    // Pop the metatable, leaving the library table to be returned.
+    lua_pop(L, 1);
+
+    return 1;
+}
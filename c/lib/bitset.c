@@ -23,39 +23,37 @@ SOFTWARE.
 */
 
 /// A simple bitset implementation, accelerated with C. Uses 32-bit integers for
-/// hypothetical portability. Tested and compatible with LuaJIT and Lua 5.1.
+/// hypothetical portability; set operations are done 64 bits at a time, or with
+/// SSE2/AVX2 where the CPU supports it. Tested and compatible with LuaJIT and
+/// Lua 5.1.
 // @module bitset
 
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stddef.h>
+#include <errno.h>
 #include <stdint.h>
 #include <string.h>
 
 #include "lua.h"
 #include "lauxlib.h"
 
+#include "arena.h"
+#include "bitset.h"
+#include "bsmap.h"
+#include "mapping.h"
+#include "pool.h"
+#include "sigtable.h"
+
 #define ERRORMSG_OUT_OF_MEMORY "Error: out of memory! Could not allocate bitset."
 
-#define LUA_BITSET_LIBNAME "bitset"
-#define LUA_BITSET_TYPENAME "_bitset_ty"
 
 #define AUTHOR_STRING "Sean Leffler <sean@errno.com>"
 #define VERSION_STRING "1.0"
 
-#define BITWIDTH (8 * sizeof(block_t))
-#define ALL_ONES (~(block_t)0)
-#define JUST_ONE ((block_t)0x1)
-
-typedef uint32_t block_t;
-
 /*** A bitset type.
 @type Bitset
 */
-typedef struct Bitset {
-    block_t *bits;
-    size_t len;
-} Bitset;
 
 
 static void error_out_of_memory(lua_State *L) {
@@ -64,71 +62,535 @@ static void error_out_of_memory(lua_State *L) {
 }
 
 
-static Bitset* bs_alloc(lua_State *L, size_t sz) {
-    Bitset *bitset =
-        (Bitset*)lua_newuserdata(L, sizeof(Bitset));
+// Every function in the module gets the two bitset metatables, the three
+// fixed-width bitset metatables and the map metatable as upvalues, so that
+// checking an argument's type doesn't have to look them up by name.
+#define HEAP_MT lua_upvalueindex(1)
+#define INLINE_MT lua_upvalueindex(2)
+#define FIXED_MT(slot) lua_upvalueindex(2 + (slot))
+#define MAP_MT lua_upvalueindex(6)
 
-    bitset->bits = (block_t*)calloc(sz, sizeof(block_t));
+#define NUM_UPVALUES 6
 
-    if (bitset->bits == NULL) {
-        error_out_of_memory(L);
+
+// Pushes `fn` as a closure over the calling function's upvalues, plus the
+// `extra` values on top of the stack.
+static void push_closure(lua_State *L, lua_CFunction fn, int extra) {
+    int i;
+    for (i = 1; i <= NUM_UPVALUES; i++) {
+        lua_pushvalue(L, lua_upvalueindex(i));
+        lua_insert(L, -1 - extra);
     }
 
-    bitset->len = sz;
+    lua_pushcclosure(L, fn, NUM_UPVALUES + extra);
+}
+
+// Returns the bitset at `idx`, or NULL if it isn't one.
+static Bitset* test_bitset(lua_State *L, int idx) {
+    Bitset *const bitset = (Bitset*)lua_touserdata(L, idx);
+
+    if (bitset != NULL && lua_getmetatable(L, idx)) {
+        const bool ok =
+            lua_rawequal(L, -1, INLINE_MT) || lua_rawequal(L, -1, HEAP_MT);
+        lua_pop(L, 1);
+
+        if (ok) {
+            return bitset;
+        }
+    }
+
+    return NULL;
+}
+
+
+static Bitset* check_bitset(lua_State *L, int idx) {
+    Bitset *const bitset = test_bitset(L, idx);
+
+    if (bitset == NULL) {
+        luaL_typerror(L, idx, LUA_BITSET_TYPENAME);
+    }
+
+    return bitset;
+}
+
+
+// Like `check_bitset`, for a bitset that's about to be changed. Anything worked
+// out from its bits, like the rank index, is thrown out.
+static Bitset* check_bitset_mut(lua_State *L, int idx) {
+    Bitset *const bitset = check_bitset(L, idx);
+    bs_invalidate(bitset);
+    return bitset;
+}
+
+
+// Records `n` clear bits being set, or set bits being cleared if `set` is
+// false. The cached count stays exact, so long as it was known.
+static void bs_flipped(Bitset *bitset, size_t n, bool set) {
+    bitset->ranked = false;
+
+    if (bitset->count != BS_COUNT_UNKNOWN) {
+        bitset->count = set ? bitset->count + n : bitset->count - n;
+    }
+}
 
-    luaL_getmetatable(L, LUA_BITSET_TYPENAME);
+
+// Allocates, reallocates and frees through the Lua state's allocator, like
+// `lua_Alloc`. The Lua GC can't see these bytes, so for every kilobyte we take
+// it gets to do a kilobyte's worth of collecting, the same as if we'd made a
+// Lua object that big. Otherwise big bitsets pile up long before the collector
+// thinks it's time to look at them.
+static void *bs_realloc(lua_State *L, void *ptr, size_t osize, size_t nsize) {
+    if (nsize > osize && (nsize - osize) >= 1024) {
+        lua_gc(L, LUA_GCSTEP, (int)((nsize - osize) >> 10));
+    }
+
+    void *ud;
+    lua_Alloc alloc = lua_getallocf(L, &ud);
+
+    return alloc(ud, ptr, osize, nsize);
+}
+
+
+static void bs_free(lua_State *L, Bitset *bitset) {
+    void *ud;
+    lua_Alloc alloc = lua_getallocf(L, &ud);
+
+    alloc(ud, bitset->bits, bitset->cap * sizeof(block_t), 0);
+}
+
+
+// Only for rank indexes on the heap; the arena owns the ones in arenas.
+static void bs_free_ranks(lua_State *L, Bitset *bitset) {
+    if (bitset->ranks != NULL) {
+        void *ud;
+        lua_Alloc alloc = lua_getallocf(L, &ud);
+
+        alloc(ud, bitset->ranks, bitset->nranks * sizeof(size_t), 0);
+    }
+
+    bitset->ranked = false;
+    bitset->nranks = 0;
+    bitset->ranks = NULL;
+}
+
+
+// Allocates from an arena, putting the same pressure on the GC as
+// `bs_realloc` when the arena has to grow.
+static void *bs_arena_alloc(lua_State *L, Arena *arena, size_t size) {
+    const size_t before = arena->reserved;
+    void *const p = ar_alloc(arena, size);
+
+    if (arena->reserved - before >= 1024) {
+        lua_gc(L, LUA_GCSTEP, (int)((arena->reserved - before) >> 10));
+    }
+
+    return p;
+}
+
+
+static Bitset* bs_alloc(lua_State *L, size_t sz, Arena *arena) {
+    // Small bitsets get their blocks in the same allocation as the userdata,
+    // which saves an allocation, a free and a pointer chase for each of them,
+    // and they get a metatable without `__gc` so the collector can just drop
+    // them. Empty ones get a block anyway, since they're likely to have bits
+    // set.
+    const size_t inline_len =
+        (sz > BS_INLINE_BLOCKS) ? 0 : (sz > 0) ? sz : 1;
+
+    Bitset *bitset = (Bitset*)lua_newuserdata(L,
+        sizeof(Bitset) + inline_len * sizeof(block_t));
+
+    // Even a heap bitset starts out pointing inline, so that `bs_gc` has
+    // nothing to free if allocating the blocks fails.
+    bitset->bits = bitset->inline_bits;
+    bitset->len = sz;
+    bitset->cap = inline_len;
+    bitset->reallocs = 0;
+    bitset->arena = NULL;
+    bitset->mapping = NULL;
+    bitset->ranked = false;
+    // Left for whoever fills in the blocks to say.
+    bitset->count = BS_COUNT_UNKNOWN;
+    bitset->nranks = 0;
+    bitset->ranks = NULL;
+
+    const bool heap = (inline_len == 0 && arena == NULL);
+
+    lua_pushvalue(L, heap ? HEAP_MT : INLINE_MT);
     lua_setmetatable(L, -2);
 
+    if (inline_len == 0) {
+        block_t *const bits = (arena != NULL) ?
+            (block_t*)bs_arena_alloc(L, arena, sz * sizeof(block_t)) :
+            (block_t*)bs_realloc(L, NULL, 0, sz * sizeof(block_t));
+
+        if (bits == NULL) {
+            error_out_of_memory(L);
+        }
+
+        bitset->bits = bits;
+        bitset->cap = sz;
+        bitset->arena = arena;
+    }
+
+    // All of the blocks, including the spare inline one of an empty bitset,
+    // which `dump_raw` can still look at.
+    memset(bitset->bits, 0, bitset->cap * sizeof(block_t));
+
     return bitset;
 }
 
 
+static bool bs_is_inline(const Bitset *bitset) {
+    return bitset->bits == bitset->inline_bits;
+}
+
+
+// Makes room for at least `cap` blocks, without changing the length. Inline
+// blocks are moved out to the heap, in which case the bitset, at `idx` on the
+// stack, gets the metatable with `__gc`. Bitsets in an arena stay there.
+static void bs_reserve(lua_State *L, int idx, Bitset *bitset, size_t cap) {
+    if (cap <= bitset->cap) {
+        return;
+    }
+
+    const size_t size = cap * sizeof(block_t);
+    block_t *bits;
+
+    Mapping *const mapping = bitset->mapping;
+
+    if (mapping != NULL && mapping->shared) {
+        // The file grows along with the bitset.
+        if (!mp_resize(mapping, size)) {
+            luaL_error(L, "could not grow memory-mapped bitset: %s",
+                strerror(errno));
+        }
+
+        bits = (block_t*)mapping->addr;
+    } else if (bitset->arena != NULL || bs_is_inline(bitset) ||
+            mapping != NULL) {
+        bits = (bitset->arena != NULL) ?
+            (block_t*)bs_arena_alloc(L, bitset->arena, size) :
+            (block_t*)bs_realloc(L, NULL, 0, size);
+
+        if (bits == NULL) {
+            error_out_of_memory(L);
+        }
+
+        memcpy(bits, bitset->bits, bitset->len * sizeof(block_t));
+
+        // A private mapping can't grow past the end of its file, so the blocks
+        // move to the heap like inline ones do.
+        if (mapping != NULL) {
+            mp_close(mapping);
+            bitset->mapping = NULL;
+        }
+
+        if (bitset->arena == NULL) {
+            lua_pushvalue(L, HEAP_MT);
+            lua_setmetatable(L, idx);
+        }
+    } else {
+        bits = (block_t*)bs_realloc(L, bitset->bits,
+            bitset->cap * sizeof(block_t), size);
+
+        if (bits == NULL) {
+            error_out_of_memory(L);
+        }
+    }
+
+    bitset->bits = bits;
+    bitset->cap = cap;
+    bitset->reallocs++;
+}
+
+
+// Sets the length of the bitset to `len` blocks, without clearing any new ones.
+// The capacity at least doubles whenever it has to grow, so that setting bits
+// in increasing order only reallocates a logarithmic number of times.
+static void bs_resize(lua_State *L, int idx, Bitset *bitset, size_t len) {
+    if (len > bitset->cap) {
+        const size_t cap = 2 * bitset->cap;
+        bs_reserve(L, idx, bitset, (cap > len) ? cap : len);
+    }
+
+    bitset->len = len;
+}
+
+
+// Grows the bitset to `len` blocks, clearing the new ones.
+static void bs_grow(lua_State *L, int idx, Bitset *bitset, size_t len) {
+    if (len <= bitset->len) {
+        return;
+    }
+
+    const size_t old_len = bitset->len;
+    bs_resize(L, idx, bitset, len);
+
+    memset(bitset->bits + old_len, 0, (len - old_len) * sizeof(block_t));
+}
+
+
 static int bs_gc(lua_State *L) {
-    Bitset *bitset = luaL_checkudata(L, 1, LUA_BITSET_TYPENAME);
-    free(bitset->bits);
+    Bitset *bitset = check_bitset(L, 1);
+
+    if (bitset->mapping != NULL) {
+        mp_close(bitset->mapping);
+    } else if (!bs_is_inline(bitset) && bitset->arena == NULL) {
+        bs_free(L, bitset);
+    }
+
+    if (bitset->arena == NULL) {
+        bs_free_ranks(L, bitset);
+    }
+
     return 0;
 }
 
 
-/*** Allocate a new bitset.
-Capable of allocating a new bitset, with an optional bit capacity. If specified,
-the bits of the newly allocated bitset can be set to all one. If called with a
-bitset as the first argument instead of a number, the bitset will be cloned.
+// Fixed-width bitsets are just their words, in a userdata with one of the
+// `FIXED_MT` metatables: slot 1 for one word, 2 for two and 3 for four.
+#define FIXED_WORD_BITS 64
+#define FIXED_MAX_BITS 256
+#define FIXED_SLOTS 3
 
-@function new
-@tparam num|Bitset size the size of a bitset to allocate. Or, if a bitset, the bitset to copy.
-@tparam bool init if true, set all newly allocated bits.
-@treturn Bitset a newly allocated bitset.
-*/
-static int bs_new(lua_State *L) {
-    if (lua_isnumber(L, 1)) {
-        lua_Integer int_sz = lua_tointeger(L, 1);
+// The number of words in the fixed-width bitset at `idx`, or 0 if it isn't
+// one.
+static size_t fixed_words(lua_State *L, int idx) {
+    if (lua_touserdata(L, idx) == NULL || !lua_getmetatable(L, idx)) {
+        return 0;
+    }
+
+    size_t words = 0;
+
+    int slot;
+    for (slot = 1; slot <= FIXED_SLOTS && words == 0; slot++) {
+        if (lua_rawequal(L, -1, FIXED_MT(slot))) {
+            words = (size_t)1 << (slot - 1);
+        }
+    }
+
+    lua_pop(L, 1);
+    return words;
+}
+
+
+// Copies `n` words of a fixed-width bitset into as many blocks as they take.
+static void fixed_to_blocks(const uint64_t *words, size_t n, block_t *bits) {
+    const size_t per_word = FIXED_WORD_BITS / BITWIDTH;
+
+    size_t j;
+    for (j = 0; j < n * per_word; j++) {
+        bits[j] = (block_t)(words[j / per_word] >> (j % per_word * BITWIDTH));
+    }
+}
+
+
+// The blocks of the widest fixed-width bitset.
+#define FIXED_BLOCKS (FIXED_MAX_BITS / BITWIDTH)
+
+// Returns the bitset at `idx` as the read-only operand of an operation on
+// bitsets. A fixed-width bitset is accepted too: its words are converted into
+// `tmp`, and `view` is filled in as a bitset over them.
+static Bitset* check_operand(lua_State *L, int idx, Bitset *view,
+        block_t *tmp) {
+    Bitset *const bitset = test_bitset(L, idx);
+
+    if (bitset != NULL) {
+        return bitset;
+    }
+
+    const size_t words = fixed_words(L, idx);
+
+    if (words == 0) {
+        luaL_typerror(L, idx, "bitset or fixed bitset");
+    }
+
+    fixed_to_blocks((const uint64_t*)lua_touserdata(L, idx), words, tmp);
+
+    memset(view, 0, sizeof(Bitset));
+    view->bits = tmp;
+    view->len = view->cap = words * (FIXED_WORD_BITS / BITWIDTH);
+    view->count = BS_COUNT_UNKNOWN;
+
+    return view;
+}
+
+
+// Does the work of `bitset.new` and `Arena:new`, whose arguments start at `arg`.
+static int new_bitset(lua_State *L, int arg, Arena *arena) {
+    if (lua_isnumber(L, arg)) {
+        lua_Integer int_sz = lua_tointeger(L, arg);
 
         if (int_sz < 0) {
-            luaL_argerror(L, 1, "expected positive size");
+            luaL_argerror(L, arg, "expected positive size");
         }
 
-        int init = lua_toboolean(L, 2);
+        int init = lua_toboolean(L, arg + 1);
 
         // We are assuming Lua 5.1's API/ABI, so we don't have a lua_Unsigned type
         // to work with, unfortunately. `size_t` should do the trick in the
         // meantime.
         Bitset *const bitset =
-            bs_alloc(L, (size_t)int_sz / BITWIDTH + 1);
+            bs_alloc(L, (size_t)int_sz / BITWIDTH + 1, arena);
 
-        if (lua_isboolean(L, 2) && init) {
+        if (lua_isboolean(L, arg + 1) && init) {
             memset(bitset->bits, -1, (bitset->len - 1) * sizeof(block_t));
             bitset->bits[bitset->len - 1] |=
                ~(ALL_ONES << ((size_t)int_sz % BITWIDTH));
+            bitset->count = (size_t)int_sz;
+        } else {
+            bitset->count = 0;
         }
-    } else if (lua_isuserdata(L, 1)) {
-        const Bitset *const src = luaL_checkudata(L, 1, LUA_BITSET_TYPENAME);
-        Bitset *const dst = bs_alloc(L, src->len);
-        memcpy(src->bits, dst->bits, src->len * sizeof(block_t));
+    } else if (fixed_words(L, arg) != 0) {
+        const size_t n = fixed_words(L, arg);
+        Bitset *const dst =
+            bs_alloc(L, n * (FIXED_WORD_BITS / BITWIDTH), arena);
+        fixed_to_blocks((const uint64_t*)lua_touserdata(L, arg), n, dst->bits);
+    } else if (lua_isuserdata(L, arg)) {
+        const Bitset *const src = check_bitset(L, arg);
+        Bitset *const dst = bs_alloc(L, src->len, arena);
+        bs_par_copy(dst->bits, src->bits, src->len);
+        dst->count = src->count;
     } else {
-        bs_alloc(L, 0);
+        bs_alloc(L, 0, arena)->count = 0;
+    }
+
+    return 1;
+}
+
+
+/*** Allocate a new bitset.
+Capable of allocating a new bitset, with an optional bit capacity. If specified,
+the bits of the newly allocated bitset can be set to all one. If called with a
+bitset as the first argument instead of a number, the bitset will be cloned.
+
+@function new
+@tparam num|Bitset|FixedBitset size the size of a bitset to allocate. Or, if a
+bitset or a fixed-width bitset, the bitset to copy.
+@tparam bool init if true, set all newly allocated bits.
+@treturn Bitset a newly allocated bitset.
+*/
+static int bs_new(lua_State *L) {
+    return new_bitset(L, 1, NULL);
+}
+
+
+/*** Makes room for a number of bits without growing again.
+Bitsets grow by at least doubling their capacity, so setting bits one after
+another only reallocates every so often; if you know how big a bitset is going
+to get, reserving room up front saves even that. The bitset's contents are
+unchanged.
+
+@function Bitset:reserve
+@tparam num nbits how many bits to make room for.
+@treturn Bitset the bitset, for convenience.
+@see Bitset:capacity
+*/
+static int bs_reserve_l(lua_State *L) {
+    Bitset *const bitset = check_bitset(L, 1);
+
+    lua_Integer int_nbits = luaL_checkinteger(L, 2);
+
+    if (int_nbits < 0) {
+        luaL_argerror(L, 2, "expected positive size");
+    }
+
+    const size_t nbits = (size_t)int_nbits;
+    bs_reserve(L, 1, bitset, nbits / BITWIDTH + (nbits % BITWIDTH != 0));
+
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+/*** Gives back any memory the bitset isn't using.
+Clear blocks at the end of the bitset are dropped as well, so after this it
+takes up no more memory than its highest set bit needs.
+
+@function Bitset:shrink_to_fit
+@treturn Bitset the bitset, for convenience.
+*/
+static int bs_shrink_to_fit(lua_State *L) {
+    Bitset *const bitset = check_bitset(L, 1);
+
+    while (bitset->len > 0 && bitset->bits[bitset->len - 1] == 0) {
+        bitset->len--;
+    }
+
+    // The inline blocks can't be given back, but a bitset that has spilled
+    // onto the heap can move back into them if it fits.
+    const size_t inline_cap =
+        (lua_objlen(L, 1) - sizeof(Bitset)) / sizeof(block_t);
+
+    // Arena blocks can only be given back by resetting the arena, and mapped
+    // files stay the size they are.
+    if (bs_is_inline(bitset) || bitset->arena != NULL ||
+            bitset->mapping != NULL) {
+        lua_pushvalue(L, 1);
+        return 1;
+    }
+
+    if (bitset->len <= inline_cap) {
+        memcpy(bitset->inline_bits, bitset->bits,
+            bitset->len * sizeof(block_t));
+        bs_free(L, bitset);
+
+        // Inline bitsets don't get `__gc`, so they can't have a rank index on
+        // the heap; they're too short to need one anyway.
+        bs_free_ranks(L, bitset);
+
+        bitset->bits = bitset->inline_bits;
+        bitset->cap = inline_cap;
+        bitset->reallocs++;
+
+        lua_pushvalue(L, INLINE_MT);
+        lua_setmetatable(L, 1);
+    } else if (bitset->len < bitset->cap) {
+        // Keep at least one block around, since reallocating to zero bytes
+        // would free the buffer.
+        const size_t cap = (bitset->len > 0) ? bitset->len : 1;
+
+        block_t *const bits = (block_t*)bs_realloc(L, bitset->bits,
+            bitset->cap * sizeof(block_t), cap * sizeof(block_t));
+
+        // Failing to shrink is harmless; keep the bigger buffer.
+        if (bits != NULL) {
+            bitset->bits = bits;
+            bitset->cap = cap;
+            bitset->reallocs++;
+        }
     }
 
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+/*** How many bits the bitset has room for without reallocating.
+@function Bitset:capacity
+@treturn num the capacity, in bits.
+@see Bitset:reserve
+*/
+static int bs_capacity(lua_State *L) {
+    const Bitset *const bitset = check_bitset(L, 1);
+
+    lua_pushinteger(L, (lua_Integer)(bitset->cap * BITWIDTH));
+    return 1;
+}
+
+
+/*** How many times the bitset's memory has been reallocated.
+Growing, @{Bitset:reserve} and @{Bitset:shrink_to_fit} all count. Mostly useful
+for checking that a bitset isn't growing more often than it should.
+
+@function Bitset:reallocations
+@treturn num the number of reallocations since the bitset was created.
+*/
+static int bs_reallocations(lua_State *L) {
+    const Bitset *const bitset = check_bitset(L, 1);
+
+    lua_pushinteger(L, (lua_Integer)bitset->reallocs);
     return 1;
 }
 
@@ -141,7 +603,7 @@ The bitset is modified in place, but for convenience, it is also returned.
 @treturn Bitset the modified bitset.
 */
 static int bs_set(lua_State *L) {
-    Bitset *bitset = luaL_checkudata(L, 1, LUA_BITSET_TYPENAME);
+    Bitset *bitset = check_bitset(L, 1);
 
     lua_Integer int_idx = luaL_checkinteger(L, 2);
 
@@ -155,29 +617,57 @@ static int bs_set(lua_State *L) {
     // If we're trying to set/clear a bit that's far out of range, we have
     // to reallocate.
     if (idx >= bitset->len * BITWIDTH) {
-        size_t len_old = bitset->len;
-        bitset->len = idx / BITWIDTH + 1;
-        bitset->bits = (block_t*)realloc(bitset->bits,
-            sizeof(block_t) * bitset->len);
-
-        if (bitset->bits == NULL) {
-            error_out_of_memory(L);
-        }
-
-        memset(bitset->bits + len_old, 0,
-            (bitset->len - len_old) * sizeof(block_t));
+        bs_grow(L, 1, bitset, idx / BITWIDTH + 1);
     }
 
     size_t bit = idx % BITWIDTH;
     idx = idx / BITWIDTH;
 
-    bitset->bits[idx] |= (JUST_ONE << bit);
+    const block_t mask = JUST_ONE << bit;
+
+    if (!(bitset->bits[idx] & mask)) {
+        bitset->bits[idx] |= mask;
+        bs_flipped(bitset, 1, true);
+    }
 
     lua_pushvalue(L, 1);
     return 1;
 }
 
 
+// Sets the bits `[lo, hi)`, which have to be within the bitset. `hi` may be one
+// past the last bit.
+static void fill_range(Bitset *bitset, size_t lo, size_t hi) {
+    block_t mask;
+
+    const size_t lo_bit = lo % BITWIDTH;
+    const size_t lo_blk = lo / BITWIDTH;
+
+    const size_t hi_bit = hi % BITWIDTH;
+    const size_t hi_blk = hi / BITWIDTH;
+
+    if (hi_blk > lo_blk) {
+        mask = ALL_ONES << lo_bit;
+
+        bitset->bits[lo_blk] |= mask;
+
+        size_t blk;
+        for (blk = lo_blk + 1; blk < hi_blk; blk++) {
+            bitset->bits[blk] = ALL_ONES;
+        }
+
+        // `hi` may sit exactly on the end of the last block.
+        if (hi_bit != 0) {
+            bitset->bits[hi_blk] |= ~(ALL_ONES << hi_bit);
+        }
+    } else {
+        mask = (ALL_ONES << lo_bit) & ~(ALL_ONES << hi_bit);
+
+        bitset->bits[lo_blk] |= mask;
+    }
+}
+
+
 /*** Sets a range of bits in the bitset, `[lo, hi)`.
 The bitset is modified in place, but for convenience, it is also returned.
 The parameters are named `lo` and `hi`, but if `lo` is greater than `hi`,
@@ -190,7 +680,7 @@ bound is exclusive.
 @treturn Bitset the modified bitset.
 */
 static int bs_set_range(lua_State *L) {
-    Bitset *bitset = luaL_checkudata(L, 1, LUA_BITSET_TYPENAME);
+    Bitset *bitset = check_bitset_mut(L, 1);
 
     lua_Integer int_lo = luaL_checkinteger(L, 2);
     lua_Integer int_hi = luaL_checkinteger(L, 3);
@@ -215,62 +705,27 @@ static int bs_set_range(lua_State *L) {
     // If we're trying to set/clear any bits that are far out of range, we have
     // to reallocate.
     if (hi >= bitset->len * BITWIDTH) {
-        size_t len_old = bitset->len;
-        bitset->len = hi / BITWIDTH + 1;
-        bitset->bits = (block_t*)realloc(bitset->bits,
-            sizeof(block_t) * bitset->len);
-
-        if (bitset->bits == NULL) {
-            error_out_of_memory(L);
-        }
-
-        memset(bitset->bits + len_old, 0,
-            (bitset->len - len_old) * sizeof(block_t));
+        bs_grow(L, 1, bitset, hi / BITWIDTH + 1);
     }
 
-    block_t mask;
+    fill_range(bitset, lo, hi);
 
-    const size_t lo_bit = lo % BITWIDTH;
-    const size_t lo_blk = lo / BITWIDTH;
+    lua_pushvalue(L, 1);
+    return 1;
+}
 
-    const size_t hi_bit = hi % BITWIDTH;
-    const size_t hi_blk = hi / BITWIDTH;
 
-    if (hi_blk > lo_blk) {
-        mask = ALL_ONES << lo_bit;
+/*** Clears a single bit in the bitset, at a given index.
+The bitset is modified in place, but for convenience, it is also returned.
 
-        bitset->bits[lo_blk] |= mask;
+@function Bitset:clear
+@tparam num idx the index of the bit to clear.
+@treturn Bitset the modified bitset.
+*/
+static int bs_clear(lua_State *L) {
+    Bitset *bitset = check_bitset(L, 1);
 
-        mask = ~(ALL_ONES << hi_bit);
-
-        bitset->bits[hi_blk] |= mask;
-
-        size_t blk;
-        for (blk = lo_blk + 1; blk < hi_blk; blk++) {
-            bitset->bits[blk] = ALL_ONES;
-        }
-    } else {
-        mask = (ALL_ONES << lo_bit) & ~(ALL_ONES << hi_bit);
-
-        bitset->bits[lo_blk] |= mask;
-    }
-
-    lua_pushvalue(L, 1);
-    return 1;
-}
-
-
-/*** Clears a single bit in the bitset, at a given index.
-The bitset is modified in place, but for convenience, it is also returned.
-
-@function Bitset:clear
-@tparam num idx the index of the bit to clear.
-@treturn Bitset the modified bitset.
-*/
-static int bs_clear(lua_State *L) {
-    Bitset *bitset = luaL_checkudata(L, 1, LUA_BITSET_TYPENAME);
-
-    lua_Integer int_idx = luaL_checkinteger(L, 2);
+    lua_Integer int_idx = luaL_checkinteger(L, 2);
 
     // A negative index is completely invalid.
     if (int_idx < 0) {
@@ -285,7 +740,12 @@ static int bs_clear(lua_State *L) {
         size_t bit = idx % BITWIDTH;
         idx = idx / BITWIDTH;
 
-        bitset->bits[idx] &= ~(JUST_ONE << bit);
+        const block_t mask = JUST_ONE << bit;
+
+        if (bitset->bits[idx] & mask) {
+            bitset->bits[idx] &= ~mask;
+            bs_flipped(bitset, 1, false);
+        }
     }
 
     lua_pushvalue(L, 1);
@@ -305,7 +765,7 @@ high bound is exclusive.
 @treturn Bitset the modified bitset.
 */
 static int bs_clear_range(lua_State *L) {
-    Bitset *bitset = luaL_checkudata(L, 1, LUA_BITSET_TYPENAME);
+    Bitset *bitset = check_bitset_mut(L, 1);
 
     lua_Integer int_lo = luaL_checkinteger(L, 2);
     lua_Integer int_hi = luaL_checkinteger(L, 3);
@@ -373,7 +833,7 @@ static int bs_clear_range(lua_State *L) {
 @treturn bool whether the bit is set.
 */
 static int bs_get(lua_State *L) {
-    Bitset *bitset = luaL_checkudata(L, 1, LUA_BITSET_TYPENAME);
+    Bitset *bitset = check_bitset(L, 1);
 
     lua_Integer int_idx = luaL_checkinteger(L, 2);
 
@@ -405,7 +865,7 @@ static int bs_get(lua_State *L) {
 @treturn {bool,...} the range set. Indexing starts at 1, and ends at `hi - lo + 1`.
 */
 static int bs_get_range(lua_State *L) {
-    Bitset *const bitset = luaL_checkudata(L, 1, LUA_BITSET_TYPENAME);
+    Bitset *const bitset = check_bitset(L, 1);
 
     const lua_Integer int_lo = luaL_checkinteger(L, 2);
     const lua_Integer int_hi = luaL_checkinteger(L, 3);
@@ -453,452 +913,3289 @@ static int bs_get_range(lua_State *L) {
 }
 
 
-/*** Counts how many bits are set in the bitset.
-@function Bitset:count
-@treturn num the number of set bits.
+// Reads entry `i` of the array at `arg` as a bit index, raising an error if it
+// isn't one.
+static size_t index_at(lua_State *L, int arg, size_t i) {
+    lua_rawgeti(L, arg, (int)i);
+
+    if (!lua_isnumber(L, -1)) {
+        luaL_argerror(L, arg, lua_pushfstring(L,
+            "expected index at position %d, got %s", (int)i,
+            luaL_typename(L, -1)));
+    }
+
+    const lua_Integer int_idx = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+
+    if (int_idx < 0) {
+        luaL_argerror(L, arg, lua_pushfstring(L,
+            "expected positive index at position %d", (int)i));
+    }
+
+    return (size_t)int_idx;
+}
+
+
+// Checks that the first `n` entries of the array at `arg` are all bit indices,
+// and returns one past the highest of them, or 0 if there are none.
+static size_t check_indices(lua_State *L, int arg, size_t n) {
+    size_t top = 0;
+
+    size_t i;
+    for (i = 1; i <= n; i++) {
+        const size_t idx = index_at(L, arg, i);
+
+        if (idx >= top) {
+            top = idx + 1;
+        }
+    }
+
+    return top;
+}
+
+
+// Sets the bits at the first `n` entries of the array at `arg`, which have all
+// been checked and fit in the bitset. Returns how many were clear before.
+static size_t set_indices(lua_State *L, int arg, size_t n, Bitset *bitset) {
+    block_t *const bits = bitset->bits;
+    size_t flips = 0;
+
+    size_t i;
+    for (i = 1; i <= n; i++) {
+        lua_rawgeti(L, arg, (int)i);
+        const size_t idx = (size_t)lua_tointeger(L, -1);
+        lua_pop(L, 1);
+
+        const block_t mask = JUST_ONE << (idx % BITWIDTH);
+
+        flips += !(bits[idx / BITWIDTH] & mask);
+        bits[idx / BITWIDTH] |= mask;
+    }
+
+    return flips;
+}
+
+
+// The array argument of the batch functions at `arg`, and how many of its
+// entries to use, which is all of them unless the argument after it says.
+static size_t check_index_array(lua_State *L, int arg) {
+    luaL_checktype(L, arg, LUA_TTABLE);
+
+    const lua_Integer n =
+        luaL_optinteger(L, arg + 1, (lua_Integer)lua_objlen(L, arg));
+
+    if (n < 0) {
+        luaL_argerror(L, arg + 1, "expected positive count");
+    }
+
+    return (size_t)n;
+}
+
+
+/*** Sets the bits at each of an array of indices.
+Does the same as calling @{Bitset:set} on each index in turn, in a single call.
+All of the indices are checked before any bits are set, and the bitset grows at
+most once, to fit the highest of them.
+
+When `bitset_ffi` is loaded, `indices` may also be an FFI buffer of `int32_t`s,
+in which case `n` has to be given.
+
+@function Bitset:set_many
+@tparam {num,...} indices the indices of the bits to set.
+@tparam[opt=#indices] num n how many of the indices to use.
+@treturn Bitset the modified bitset.
 */
-static int bs_count(lua_State *L) {
-    Bitset *bitset = luaL_checkudata(L, 1, LUA_BITSET_TYPENAME);
+static int bs_set_many(lua_State *L) {
+    Bitset *const bitset = check_bitset(L, 1);
+
+    const size_t n = check_index_array(L, 2);
+    const size_t top = check_indices(L, 2, n);
 
-    size_t sum = 0, i;
-    for (i = 0; i < bitset->len; i++) {
-        sum += __builtin_popcount(bitset->bits[i]);
+    if (top > bitset->len * BITWIDTH) {
+        bs_grow(L, 1, bitset, (top - 1) / BITWIDTH + 1);
     }
 
-    lua_pushinteger(L, (lua_Integer)sum);
+    const size_t flips = set_indices(L, 2, n, bitset);
+
+    if (flips > 0) {
+        bs_flipped(bitset, flips, true);
+    }
+
+    lua_pushvalue(L, 1);
     return 1;
 }
 
 
-/*** The intersection of two bitsets. Also available as the `*` operator.
-NOTE: `Bitset:intersection` is a _constructive_ operation. That is, it allocates
-a new bitset to hold the results. For an in-place intersection, see
-@{Bitset:intersection_mut}.
+/*** Clears the bits at each of an array of indices.
+Does the same as calling @{Bitset:clear} on each index in turn, in a single
+call. Indices past the end of the bitset are ignored, but all of them have to
+be valid indices.
 
-@function Bitset:intersection
-@tparam Bitset lhs the left-hand bitset to intersect.
-@tparam Bitset rhs the right-hand bitset to intersect.
-@treturn Bitset a newly allocated bitset containing the intersection.
-@see Bitset:intersection_mut
+When `bitset_ffi` is loaded, `indices` may also be an FFI buffer of `int32_t`s,
+in which case `n` has to be given.
+
+@function Bitset:clear_many
+@tparam {num,...} indices the indices of the bits to clear.
+@tparam[opt=#indices] num n how many of the indices to use.
+@treturn Bitset the modified bitset.
 */
-static int bs_intersection(lua_State *L) {
-    Bitset* large = luaL_checkudata(L, 1, LUA_BITSET_TYPENAME);
-    Bitset* small = luaL_checkudata(L, 2, LUA_BITSET_TYPENAME);
+static int bs_clear_many(lua_State *L) {
+    Bitset *const bitset = check_bitset(L, 1);
 
-    if (small->len > large->len) {
-        Bitset *const tmp = large;
-        large = small;
-        small = tmp;
+    const size_t n = check_index_array(L, 2);
+    check_indices(L, 2, n);
+
+    block_t *const bits = bitset->bits;
+    const size_t maxbits = bitset->len * BITWIDTH;
+    size_t flips = 0;
+
+    size_t i;
+    for (i = 1; i <= n; i++) {
+        lua_rawgeti(L, 2, (int)i);
+        const size_t idx = (size_t)lua_tointeger(L, -1);
+        lua_pop(L, 1);
+
+        if (idx < maxbits) {
+            const block_t mask = JUST_ONE << (idx % BITWIDTH);
+
+            flips += !!(bits[idx / BITWIDTH] & mask);
+            bits[idx / BITWIDTH] &= ~mask;
+        }
     }
 
-    Bitset *const out = bs_alloc(L, small->len);
-    memcpy(small->bits, out->bits, small->len * sizeof(block_t));
+    if (flips > 0) {
+        bs_flipped(bitset, flips, false);
+    }
 
-    size_t blk;
-    for (blk = 0; blk < small->len; blk++) {
-        out->bits[blk] &= large->bits[blk];
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+/*** Gets the bits at each of an array of indices.
+@function Bitset:get_many
+@tparam {num,...} indices the indices of the bits to get.
+@tparam[opt=#indices] num n how many of the indices to use.
+@treturn {bool,...} whether each bit is set, in the same order as `indices`.
+*/
+static int bs_get_many(lua_State *L) {
+    const Bitset *const bitset = check_bitset(L, 1);
+
+    const size_t n = check_index_array(L, 2);
+    const size_t maxbits = bitset->len * BITWIDTH;
+
+    lua_createtable(L, (int)n, 0);
+
+    size_t i;
+    for (i = 1; i <= n; i++) {
+        const size_t idx = index_at(L, 2, i);
+
+        lua_pushboolean(L, idx < maxbits &&
+            (bitset->bits[idx / BITWIDTH] & (JUST_ONE << (idx % BITWIDTH))));
+        lua_rawseti(L, -2, (int)i);
     }
 
     return 1;
 }
 
 
-/*** The in-place intersection of two bitsets.
-NOTE: `Bitset:intersection_mut` is a _destructive_ operation. That is, it
-mutates the left-hand operand passed to it instead of allocating a new bitset.
-For a constructive intersection operation, see @{Bitset:intersection}.
+/*** Makes a bitset with the bits at each of an array of indices set.
+The bitset is allocated just big enough for the highest index.
 
-@function Bitset:intersection_mut
-@tparam Bitset lhs the left-hand bitset to intersect. Is mutated to contain the intersection.
-@tparam Bitset rhs the right-hand bitset to intersect.
-@treturn Bitset the left-hand bitset is modified in-place, but returned for convenience.
-@see Bitset:intersection
+@function from_indices
+@tparam {num,...} indices the indices of the bits to set.
+@tparam[opt=#indices] num n how many of the indices to use.
+@treturn Bitset a newly allocated bitset.
+@see Bitset:to_indices
 */
-static int bs_intersection_mut(lua_State *L) {
-    Bitset* lhs = luaL_checkudata(L, 1, LUA_BITSET_TYPENAME);
-    Bitset* rhs = luaL_checkudata(L, 2, LUA_BITSET_TYPENAME);
+static int bs_from_indices(lua_State *L) {
+    const size_t n = check_index_array(L, 1);
+    const size_t top = check_indices(L, 1, n);
 
-    if (lhs->len > rhs->len) {
-        lhs->bits = (block_t*)realloc(lhs->bits, rhs->len * sizeof(block_t));
-        lhs->len = rhs->len;
+    Bitset *const bitset =
+        bs_alloc(L, (top + BITWIDTH - 1) / BITWIDTH, NULL);
 
-        if (lhs->bits == NULL) {
-            lua_pushliteral(L, ERRORMSG_OUT_OF_MEMORY);
-            lua_error(L);
+    bitset->count = set_indices(L, 1, n, bitset);
+
+    return 1;
+}
+
+
+// Returned by the `find_*` helpers when there's no such bit.
+#define NO_BIT SIZE_MAX
+
+
+// The index of the first set bit at or after `idx`, or `NO_BIT`.
+static size_t find_next_set(const Bitset *bitset, size_t idx) {
+    size_t blk = idx / BITWIDTH;
+
+    if (blk >= bitset->len) {
+        return NO_BIT;
+    }
+
+    block_t word = bitset->bits[blk] & (ALL_ONES << (idx % BITWIDTH));
+
+    while (word == 0) {
+        if (++blk >= bitset->len) {
+            return NO_BIT;
         }
+
+        word = bitset->bits[blk];
+    }
+
+    return blk * BITWIDTH + BLOCK_CTZ(word);
+}
+
+
+// The index of the last set bit at or before `idx`, or `NO_BIT`.
+static size_t find_prev_set(const Bitset *bitset, size_t idx) {
+    if (bitset->len == 0) {
+        return NO_BIT;
     }
 
     size_t blk;
-    for (blk = 0; blk < rhs->len; blk++) {
-        lhs->bits[blk] &= rhs->bits[blk];
+    block_t word;
+
+    if (idx >= bitset->len * BITWIDTH) {
+        blk = bitset->len - 1;
+        word = bitset->bits[blk];
+    } else {
+        blk = idx / BITWIDTH;
+        word = bitset->bits[blk] &
+            (ALL_ONES >> (BITWIDTH - 1 - idx % BITWIDTH));
     }
 
-    lua_pushvalue(L, 1);
+    while (word == 0) {
+        if (blk == 0) {
+            return NO_BIT;
+        }
+
+        word = bitset->bits[--blk];
+    }
+
+    return blk * BITWIDTH + BLOCK_HIGHEST(word);
+}
+
+
+// The index of the first clear bit at or after `idx`. There always is one,
+// since everything past the end of the bitset is clear.
+static size_t find_next_clear(const Bitset *bitset, size_t idx) {
+    size_t blk = idx / BITWIDTH;
+
+    if (blk >= bitset->len) {
+        return idx;
+    }
+
+    block_t word = (block_t)~bitset->bits[blk] & (ALL_ONES << (idx % BITWIDTH));
+
+    while (word == 0) {
+        if (++blk >= bitset->len) {
+            return blk * BITWIDTH;
+        }
+
+        word = (block_t)~bitset->bits[blk];
+    }
+
+    return blk * BITWIDTH + BLOCK_CTZ(word);
+}
+
+
+// Positions in `free` where a run of `n` set bits starts, for `n` between 1
+// and `BITWIDTH`. Runs have to fit in the block; ones running off the top are
+// left to the caller. Takes about log2(n) shifts, by doubling the run length
+// checked so far.
+static block_t run_starts(block_t free, size_t n) {
+    size_t have = 1;
+
+    while (have < n) {
+        const size_t step = have < n - have ? have : n - have;
+        free &= free >> step;
+        have += step;
+    }
+
+    return free;
+}
+
+
+// The index of the first run of `n` clear bits starting at or after `from`, for
+// `n` at least 1. Like `find_next_clear`, there always is one, and runs may go
+// past the end of the bitset.
+//
+// Scans a block at a time, carrying the clear bits at the top of each block
+// over into the next one, so a long run costs one step per block it covers.
+static size_t find_clear_run(const Bitset *bitset, size_t n, size_t from) {
+    size_t blk = from / BITWIDTH;
+
+    // Start of the clear run carried in from the blocks before, and its length.
+    size_t start = from;
+    size_t run = 0;
+
+    // Bits before `from` count as set.
+    block_t before = ~(ALL_ONES << (from % BITWIDTH));
+
+    for (; blk < bitset->len; blk++) {
+        const block_t word = bitset->bits[blk] | before;
+        before = 0;
+
+        if (word == 0) {
+            run += BITWIDTH;
+
+            if (run >= n) {
+                return start;
+            }
+
+            continue;
+        }
+
+        // Full blocks are common in occupancy maps, and end any run.
+        if (word == ALL_ONES) {
+            while (blk + 1 < bitset->len && bitset->bits[blk + 1] == ALL_ONES) {
+                blk++;
+            }
+
+            start = (blk + 1) * BITWIDTH;
+            run = 0;
+            continue;
+        }
+
+        if (run + BLOCK_CTZ(word) >= n) {
+            return start;
+        }
+
+        // Runs between two set bits in this block.
+        if (n < BITWIDTH) {
+            const block_t starts = run_starts((block_t)~word, n);
+
+            if (starts != 0) {
+                return blk * BITWIDTH + BLOCK_CTZ(starts);
+            }
+        }
+
+        const size_t top = BLOCK_HIGHEST(word);
+        start = blk * BITWIDTH + top + 1;
+        run = BITWIDTH - 1 - top;
+    }
+
+    // Everything from here on is clear.
+    return start;
+}
+
+
+static void push_bit_index(lua_State *L, size_t idx) {
+    if (idx == NO_BIT) {
+        lua_pushnil(L);
+    } else {
+        lua_pushinteger(L, (lua_Integer)idx);
+    }
+}
+
+
+/*** Finds the first set bit at or after a given index.
+Whole blocks of zeroes are skipped at once, so this is cheap even on large,
+sparse bitsets.
+
+@function Bitset:next_set
+@tparam num idx the index to start searching at.
+@treturn ?num the index of the next set bit, or `nil` if there are none.
+*/
+static int bs_next_set(lua_State *L) {
+    const Bitset *bitset = check_bitset(L, 1);
+
+    lua_Integer int_idx = luaL_checkinteger(L, 2);
+
+    // A negative index is completely invalid.
+    if (int_idx < 0) {
+        luaL_argerror(L, 2, "expected positive index");
+    }
+
+    push_bit_index(L, find_next_set(bitset, (size_t)int_idx));
     return 1;
 }
 
 
-/*** The union of two bitsets. Also available as the `+` operator.
-NOTE: `Bitset:union` is a _constructive_ operation. That is, it allocates a new
-bitset to hold the results. For an in-place union, see @{Bitset:union_mut}.
+/*** Finds the last set bit at or before a given index.
+@function Bitset:prev_set
+@tparam num idx the index to start searching backwards from.
+@treturn ?num the index of the previous set bit, or `nil` if there are none.
+*/
+static int bs_prev_set(lua_State *L) {
+    const Bitset *bitset = check_bitset(L, 1);
 
-@function Bitset:union
-@tparam Bitset lhs the left-hand bitset to union.
-@tparam Bitset rhs the right-hand bitset to union.
-@treturn Bitset a newly allocated bitset containing the union.
-@see Bitset:union_mut
+    lua_Integer int_idx = luaL_checkinteger(L, 2);
+
+    // A negative index is completely invalid.
+    if (int_idx < 0) {
+        luaL_argerror(L, 2, "expected positive index");
+    }
+
+    push_bit_index(L, find_prev_set(bitset, (size_t)int_idx));
+    return 1;
+}
+
+
+/*** Finds the first clear bit at or after a given index.
+Since bits past the end of the bitset are clear, this always finds one.
+
+@function Bitset:next_clear
+@tparam num idx the index to start searching at.
+@treturn num the index of the next clear bit.
 */
-static int bs_union(lua_State *L) {
-    Bitset *const lhs = luaL_checkudata(L, 1, LUA_BITSET_TYPENAME);
-    Bitset *const rhs = luaL_checkudata(L, 2, LUA_BITSET_TYPENAME);
+static int bs_next_clear(lua_State *L) {
+    const Bitset *bitset = check_bitset(L, 1);
 
-    Bitset* small;
-    Bitset* large;
+    lua_Integer int_idx = luaL_checkinteger(L, 2);
 
-    if (lhs->len >= rhs->len) {
-        large = lhs;
-        small = rhs;
-    } else {
-        large = rhs;
-        small = lhs;
+    // A negative index is completely invalid.
+    if (int_idx < 0) {
+        luaL_argerror(L, 2, "expected positive index");
+    }
+
+    push_bit_index(L, find_next_clear(bitset, (size_t)int_idx));
+    return 1;
+}
+
+
+/*** Finds the first clear bit in the bitset.
+Equivalent to `bs:next_clear(0)`.
+
+@function Bitset:find_first_clear
+@treturn num the index of the first clear bit.
+*/
+static int bs_find_first_clear(lua_State *L) {
+    const Bitset *bitset = check_bitset(L, 1);
+
+    push_bit_index(L, find_next_clear(bitset, 0));
+    return 1;
+}
+
+
+// Reads the run length and optional start index shared by `find_clear_run` and
+// `acquire_run`.
+static void check_run_args(lua_State *L, size_t *n, size_t *from) {
+    lua_Integer int_n = luaL_checkinteger(L, 2);
+    lua_Integer int_from = luaL_optinteger(L, 3, 0);
+
+    if (int_n <= 0) {
+        luaL_argerror(L, 2, "expected positive run length");
+    }
+
+    if (int_from < 0) {
+        luaL_argerror(L, 3, "expected positive index");
     }
 
-    Bitset *const out = bs_alloc(L, large->len);
-    memcpy(large->bits, out->bits, large->len * sizeof(block_t));
+    *n = (size_t)int_n;
+    *from = (size_t)int_from;
+}
+
+
+/*** Finds the first run of `n` clear bits at or after a given index.
+This is meant for bitsets used as occupancy maps: finding a free slot, or a
+block of free slots. The search goes a block at a time, so it stays cheap on
+large, mostly full bitsets. Bits past the end of the bitset are clear, so there
+is always such a run, though it may hang off the end.
+
+@function Bitset:find_clear_run
+@tparam num n the length of the run.
+@tparam[opt=0] num start the index to start searching at.
+@treturn num the index of the first bit of the run.
+*/
+static int bs_find_clear_run(lua_State *L) {
+    const Bitset *bitset = check_bitset(L, 1);
+
+    size_t n, from;
+    check_run_args(L, &n, &from);
+
+    push_bit_index(L, find_clear_run(bitset, n, from));
+    return 1;
+}
+
+
+/*** Finds the first run of `n` clear bits and sets it.
+Does the same search as @{Bitset:find_clear_run}, then sets the bits of the run,
+growing the bitset if the run goes past its end.
+
+@function Bitset:acquire_run
+@tparam num n the length of the run.
+@tparam[opt=0] num start the index to start searching at.
+@treturn num the index of the first bit of the run.
+*/
+static int bs_acquire_run(lua_State *L) {
+    Bitset *bitset = check_bitset(L, 1);
+
+    size_t n, from;
+    check_run_args(L, &n, &from);
+
+    const size_t lo = find_clear_run(bitset, n, from);
+    const size_t hi = lo + n;
+
+    if (hi > bitset->len * BITWIDTH) {
+        bs_grow(L, 1, bitset, (hi + BITWIDTH - 1) / BITWIDTH);
+    }
+
+    // Every bit of the run was clear.
+    fill_range(bitset, lo, hi);
+    bs_flipped(bitset, n, true);
+
+    push_bit_index(L, lo);
+    return 1;
+}
+
+
+static int bs_iter_next(lua_State *L) {
+    const Bitset *bitset = check_bitset(L, 1);
+
+    const lua_Integer prev = luaL_checkinteger(L, 2);
+
+    push_bit_index(L, find_next_set(bitset, prev < 0 ? 0 : (size_t)prev + 1));
+    return 1;
+}
+
+
+/*** Iterates over the indices of the set bits, in increasing order.
+The iterator is stateless and allocates nothing, and whole blocks of zeroes are
+skipped at once, so iterating costs about as much as there are set bits rather
+than as much as the bitset is long. Setting or clearing bits at indices past the
+current one while iterating is fine.
+
+@usage
+for i in bs:iter() do
+    print(i)
+end
+
+@function Bitset:iter
+@tparam[opt=0] num from the index to start iterating at.
+@return an iterator function, the bitset, and the starting state.
+*/
+static int bs_iter(lua_State *L) {
+    check_bitset(L, 1);
+
+    const lua_Integer from = luaL_optinteger(L, 2, 0);
+
+    if (from < 0) {
+        luaL_argerror(L, 2, "expected positive index");
+    }
+
+    lua_pushvalue(L, HEAP_MT);
+    lua_pushvalue(L, INLINE_MT);
+    lua_pushcclosure(L, bs_iter_next, 2);
+    lua_pushvalue(L, 1);
+    lua_pushinteger(L, from - 1);
+    return 3;
+}
+
+
+// The number of set bits, counting them only if the cached count is unknown.
+static size_t count_bits(Bitset *bitset) {
+    if (bitset->count == BS_COUNT_UNKNOWN) {
+        bitset->count = bs_par.popcount_blocks(bitset->bits, bitset->len);
+    }
+
+    return bitset->count;
+}
+
+
+/*** Counts how many bits are set in the bitset.
+The count is remembered, and kept up to date by @{Bitset:set} and
+@{Bitset:clear}, so this only goes over the blocks after other changes.
+
+@function Bitset:count
+@treturn num the number of set bits.
+*/
+static int bs_count(lua_State *L) {
+    Bitset *bitset = check_bitset(L, 1);
+
+    lua_pushinteger(L, (lua_Integer)count_bits(bitset));
+    return 1;
+}
+
+
+/*** Gets the indices of all of the set bits, as an array.
+The array is allocated at its full size up front, and filled a block at a time,
+so this is much cheaper than building the same table with @{Bitset:iter}.
+
+@function Bitset:to_indices
+@treturn {num,...} the indices of the set bits, in increasing order.
+@see from_indices
+*/
+static int bs_to_indices(lua_State *L) {
+    Bitset *const bitset = check_bitset(L, 1);
+
+    lua_createtable(L, (int)count_bits(bitset), 0);
+
+    int i = 1;
+
+    size_t blk;
+    for (blk = 0; blk < bitset->len; blk++) {
+        block_t block = bitset->bits[blk];
+
+        while (block != 0) {
+            lua_pushinteger(L,
+                (lua_Integer)(blk * BITWIDTH + BLOCK_CTZ(block)));
+            lua_rawseti(L, -2, i++);
+
+            block &= block - 1;
+        }
+    }
+
+    return 1;
+}
+
+
+// Builds the rank index if it's out of date, and returns it, or NULL for
+// bitsets short enough to do without one.
+static const size_t *bs_ranks(lua_State *L, Bitset *bitset) {
+    if (bitset->len <= BS_INLINE_BLOCKS) {
+        return NULL;
+    }
+
+    if (bitset->ranked) {
+        return bitset->ranks;
+    }
+
+    const size_t n = bitset->len / BS_RANK_BLOCKS + 1;
+
+    if (bitset->nranks < n) {
+        size_t *const ranks = (bitset->arena != NULL) ?
+            (size_t*)bs_arena_alloc(L, bitset->arena, n * sizeof(size_t)) :
+            (size_t*)bs_realloc(L, bitset->ranks,
+                bitset->nranks * sizeof(size_t), n * sizeof(size_t));
+
+        if (ranks == NULL) {
+            error_out_of_memory(L);
+        }
+
+        bitset->ranks = ranks;
+        bitset->nranks = n;
+    }
+
+    size_t *const ranks = bitset->ranks;
+    size_t sum = 0;
+    size_t s;
+
+    ranks[0] = 0;
+
+    for (s = 1; s < n; s++) {
+        sum += bs_kern->popcount_blocks(
+            bitset->bits + (s - 1) * BS_RANK_BLOCKS, BS_RANK_BLOCKS);
+        ranks[s] = sum;
+    }
+
+    bitset->ranked = true;
+    return ranks;
+}
+
+
+/*** Counts the set bits below a given index.
+Along with @{Bitset:select}, this makes a bitset into a compact map from sparse
+indices to dense ones: each set bit `i` maps to `bs:rank(i)`, which runs from
+zero up to one less than the number of set bits.
+
+The first call builds an index of the number of bits set before every 256 bits,
+which is kept until the bitset is changed. With it, `rank` takes constant time.
+
+@function Bitset:rank
+@tparam num idx the index to count up to, exclusive.
+@treturn num the number of set bits before `idx`.
+@see Bitset:select
+*/
+static int bs_rank(lua_State *L) {
+    Bitset *const bitset = check_bitset(L, 1);
+
+    lua_Integer int_idx = luaL_checkinteger(L, 2);
+
+    // A negative index is completely invalid.
+    if (int_idx < 0) {
+        luaL_argerror(L, 2, "expected positive index");
+    }
+
+    size_t blk = (size_t)int_idx / BITWIDTH;
+    size_t bit = (size_t)int_idx % BITWIDTH;
+
+    if (blk >= bitset->len) {
+        blk = bitset->len;
+        bit = 0;
+    }
+
+    const size_t *const ranks = bs_ranks(L, bitset);
+
+    size_t first = 0;
+    size_t rank = 0;
+
+    if (ranks != NULL) {
+        first = blk / BS_RANK_BLOCKS * BS_RANK_BLOCKS;
+        rank = ranks[blk / BS_RANK_BLOCKS];
+    }
+
+    rank += bs_kern->popcount_blocks(bitset->bits + first, blk - first);
+
+    if (bit != 0) {
+        rank += BLOCK_POPCOUNT(bitset->bits[blk] & ~(ALL_ONES << bit));
+    }
+
+    lua_pushinteger(L, (lua_Integer)rank);
+    return 1;
+}
+
+
+/*** Finds the set bit with a given rank.
+The inverse of @{Bitset:rank}: `bs:rank(bs:select(k)) == k` for every `k` less
+than the number of set bits. Uses the same index as `rank`, binary searching it
+for the right 256 bits before counting the rest.
+
+@function Bitset:select
+@tparam num k the rank of the bit to find, counting from zero.
+@treturn ?num the index of the bit, or `nil` if fewer than `k + 1` bits are
+set.
+@see Bitset:rank
+*/
+static int bs_select(lua_State *L) {
+    Bitset *const bitset = check_bitset(L, 1);
+
+    lua_Integer int_k = luaL_checkinteger(L, 2);
+
+    if (int_k < 0) {
+        luaL_argerror(L, 2, "expected positive rank");
+    }
+
+    size_t k = (size_t)int_k;
+    size_t blk = 0;
+
+    const size_t *const ranks = bs_ranks(L, bitset);
+
+    if (ranks != NULL) {
+        // The last entry with at most `k` bits set before it.
+        size_t lo = 0;
+        size_t hi = bitset->len / BS_RANK_BLOCKS;
+
+        while (lo < hi) {
+            const size_t mid = lo + (hi - lo + 1) / 2;
+
+            if (ranks[mid] <= k) {
+                lo = mid;
+            } else {
+                hi = mid - 1;
+            }
+        }
+
+        blk = lo * BS_RANK_BLOCKS;
+        k -= ranks[lo];
+    }
+
+    for (; blk < bitset->len; blk++) {
+        block_t word = bitset->bits[blk];
+        const size_t n = BLOCK_POPCOUNT(word);
+
+        if (k < n) {
+            // Drop the lowest `k` set bits of the block.
+            while (k-- > 0) {
+                word &= word - 1;
+            }
+
+            push_bit_index(L, blk * BITWIDTH + BLOCK_CTZ(word));
+            return 1;
+        }
+
+        k -= n;
+    }
+
+    push_bit_index(L, NO_BIT);
+    return 1;
+}
+
+
+// Orders two bitsets by length, so that a kernel can run over the blocks they
+// have in common and the tail of the longer one can be handled on its own.
+static void by_len(const Bitset *lhs, const Bitset *rhs,
+        const Bitset **small, const Bitset **large) {
+    if (lhs->len > rhs->len) {
+        *large = lhs;
+        *small = rhs;
+    } else {
+        *large = rhs;
+        *small = lhs;
+    }
+}
+
+
+/*** The intersection of two bitsets. Also available as the `*` operator.
+NOTE: `Bitset:intersection` is a _constructive_ operation. That is, it allocates
+a new bitset to hold the results. For an in-place intersection, see
+@{Bitset:intersection_mut}.
+
+@function Bitset:intersection
+@tparam Bitset lhs the left-hand bitset to intersect.
+@tparam Bitset rhs the right-hand bitset to intersect.
+@treturn Bitset a newly allocated bitset containing the intersection.
+@see Bitset:intersection_mut
+*/
+static int bs_intersection(lua_State *L) {
+    Bitset small_view;
+    block_t small_blocks[FIXED_BLOCKS];
+    Bitset* large = check_bitset(L, 1);
+    Bitset* small = check_operand(L, 2, &small_view, small_blocks);
+
+    if (small->len > large->len) {
+        Bitset *const tmp = large;
+        large = small;
+        small = tmp;
+    }
+
+    Bitset *const out = bs_alloc(L, small->len, NULL);
+    bs_par.and_blocks(out->bits, small->bits, large->bits, small->len);
+
+    return 1;
+}
+
+
+/*** The in-place intersection of two bitsets.
+NOTE: `Bitset:intersection_mut` is a _destructive_ operation. That is, it
+mutates the left-hand operand passed to it instead of allocating a new bitset.
+For a constructive intersection operation, see @{Bitset:intersection}.
+
+@function Bitset:intersection_mut
+@tparam Bitset lhs the left-hand bitset to intersect. Is mutated to contain the intersection.
+@tparam Bitset rhs the right-hand bitset to intersect.
+@treturn Bitset the left-hand bitset is modified in-place, but returned for convenience.
+@see Bitset:intersection
+*/
+static int bs_intersection_mut(lua_State *L) {
+    Bitset rhs_view;
+    block_t rhs_blocks[FIXED_BLOCKS];
+    Bitset* lhs = check_bitset_mut(L, 1);
+    Bitset *const rhs = check_operand(L, 2, &rhs_view, rhs_blocks);
+
+    // Anything past the end of `rhs` is cleared by the intersection, so we
+    // just throw it away.
+    if (lhs->len > rhs->len) {
+        lhs->len = rhs->len;
+    }
+
+    bs_par.and_blocks(lhs->bits, lhs->bits, rhs->bits, lhs->len);
+
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+/*** The union of two bitsets. Also available as the `+` operator.
+NOTE: `Bitset:union` is a _constructive_ operation. That is, it allocates a new
+bitset to hold the results. For an in-place union, see @{Bitset:union_mut}.
+
+@function Bitset:union
+@tparam Bitset lhs the left-hand bitset to union.
+@tparam Bitset rhs the right-hand bitset to union.
+@treturn Bitset a newly allocated bitset containing the union.
+@see Bitset:union_mut
+*/
+static int bs_union(lua_State *L) {
+    Bitset rhs_view;
+    block_t rhs_blocks[FIXED_BLOCKS];
+    Bitset *const lhs = check_bitset(L, 1);
+    Bitset *const rhs = check_operand(L, 2, &rhs_view, rhs_blocks);
+
+    Bitset* small;
+    Bitset* large;
+
+    if (lhs->len >= rhs->len) {
+        large = lhs;
+        small = rhs;
+    } else {
+        large = rhs;
+        small = lhs;
+    }
+
+    Bitset *const out = bs_alloc(L, large->len, NULL);
+    bs_par.or_blocks(out->bits, large->bits, small->bits, small->len);
+    bs_par_copy(out->bits + small->len, large->bits + small->len,
+        large->len - small->len);
+
+    return 1;
+}
+
+
+/*** The in-place union of two bitsets.
+NOTE: `Bitset:union_mut` is a _destructive_ operation. That is, it mutates the
+left-hand operand passed to it instead of allocating a new bitset. For a
+constructive union operation, see @{Bitset:union}.
+
+@function Bitset:union_mut
+@tparam Bitset lhs the left-hand bitset to union. Is mutated to contain the union.
+@tparam Bitset rhs the right-hand bitset to union.
+@treturn Bitset the left-hand bitset is modified in-place, but returned for convenience.
+@see Bitset:union
+*/
+static int bs_union_mut(lua_State *L) {
+    Bitset rhs_view;
+    block_t rhs_blocks[FIXED_BLOCKS];
+    Bitset* lhs = check_bitset_mut(L, 1);
+    Bitset *const rhs = check_operand(L, 2, &rhs_view, rhs_blocks);
+
+    // Once `lhs` is at least as long as `rhs`, the blocks past the end of `rhs`
+    // are left as they are.
+    bs_grow(L, 1, lhs, rhs->len);
+    bs_par.or_blocks(lhs->bits, lhs->bits, rhs->bits, rhs->len);
+
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+/*** The asymmetric difference of two bitsets. Also available as the `-` operator.
+Returns a newly allocated bitset with bits set iff they are set in the left-hand
+operand but not in the right-hand operand.
+
+NOTE: `Bitset:difference` is a _constructive_ operation. That is, it allocates a
+new bitset to return the results. For an in-place asymmetric difference
+operation, see @{Bitset:difference_mut}.
+
+@function Bitset:difference
+@tparam Bitset lhs the source bitset.
+@tparam Bitset rhs the bitset to "subtract" from the source.
+@treturn Bitset a newly allocated bitset with all bits set that are set in `lhs` but not in `rhs`.
+@see Bitset:difference_mut
+*/
+static int bs_difference(lua_State *L) {
+    Bitset rhs_view;
+    block_t rhs_blocks[FIXED_BLOCKS];
+    const Bitset *const lhs = check_bitset(L, 1);
+    Bitset *const rhs = check_operand(L, 2, &rhs_view, rhs_blocks);
+
+    const size_t len = (lhs->len > rhs->len) ? rhs->len : lhs->len;
+
+    Bitset *const out = bs_alloc(L, lhs->len, NULL);
+    bs_par.andnot_blocks(out->bits, lhs->bits, rhs->bits, len);
+    bs_par_copy(out->bits + len, lhs->bits + len, lhs->len - len);
+
+    return 1;
+}
+
+
+/*** The in-place asymmetric difference of two bitsets.
+Clears any bits in the left-hand operand if they are set in the right-hand.
+
+NOTE: `Bitset:difference_mut` is a _destructive_ operation. That is, it modifies
+the left-hand operand in-place instead of allocating a new bitset to hold the
+result. For a constructive asymmetric difference operation, see
+@{Bitset:difference}.
+
+@function Bitset:difference_mut
+@tparam Bitset lhs the bitset to modify.
+@tparam Bitset rhs the bitset to "subtract" from the left-hand.
+@treturn Bitset the left-hand bitset is modified in place, but returned for convenience.
+@see Bitset:difference
+*/
+static int bs_difference_mut(lua_State *L) {
+    Bitset rhs_view;
+    block_t rhs_blocks[FIXED_BLOCKS];
+    Bitset *const lhs = check_bitset_mut(L, 1);
+    Bitset *const rhs = check_operand(L, 2, &rhs_view, rhs_blocks);
+
+    const size_t len = (lhs->len > rhs->len) ? rhs->len : lhs->len;
+
+    bs_par.andnot_blocks(lhs->bits, lhs->bits, rhs->bits, len);
+
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+/*** The symmetric difference of two bitsets.
+Returns a newly allocated bitset with bits set iff they are set in only the
+left-hand operand or the right-hand operand, but not both.
+
+NOTE: `Bitset:symmetric_diff` is a _constructive_ operation. That is, it
+allocates a new bitset to hold the result rather than modifying the operands
+in-place. For an in-place symmetric difference operation, see
+@{Bitset:symmetric_diff_mut}.
+
+@function Bitset:symmetric_diff
+@tparam Bitset lhs the left-hand bitset for the symmetric difference operation.
+@tparam Bitset rhs the right-hand bitset for the symmetric difference operation.
+@treturn Bitset a newly allocated bitset with all bits set that are set in either `lhs` or `rhs`, but not in both.
+@see Bitset:symmetric_diff_mut
+*/
+static int bs_symmetric_diff(lua_State *L) {
+    Bitset rhs_view;
+    block_t rhs_blocks[FIXED_BLOCKS];
+    const Bitset *const lhs = check_bitset(L, 1);
+    Bitset *const rhs = check_operand(L, 2, &rhs_view, rhs_blocks);
+
+    const Bitset* small;
+    const Bitset* large;
+
+    if (lhs->len > rhs->len) {
+        large = lhs;
+        small = rhs;
+    } else {
+        large = rhs;
+        small = lhs;
+    }
+
+    Bitset *const out = bs_alloc(L, large->len, NULL);
+    bs_par.xor_blocks(out->bits, large->bits, small->bits, small->len);
+    bs_par_copy(out->bits + small->len, large->bits + small->len,
+        large->len - small->len);
+
+    return 1;
+}
+
+
+/*** The in-place symmetric difference of two bitsets.
+Modifies the left-hand operand to contain bits that are set in the right-hand
+but not in the left-hand, and clears any bits that are set in both.
+
+NOTE: `Bitset:symmetric_diff_mut` is a _destructive_ operation. That is, it
+modifies the left-hand operand in-place instead of allocating a new bitset to
+hold the result. For a constructive symmetric difference operation, see
+@{Bitset:symmetric_diff}.
+
+@function Bitset:symmetric_diff_mut
+@tparam Bitset lhs the bitset to modify.
+@tparam Bitset rhs the bitset to compare against.
+@treturn Bitset the left-hand bitset is modified in place, but returned for convenience.
+@see Bitset:symmetric_diff
+*/
+static int bs_symmetric_diff_mut(lua_State *L) {
+    Bitset rhs_view;
+    block_t rhs_blocks[FIXED_BLOCKS];
+    Bitset *const lhs = check_bitset_mut(L, 1);
+    Bitset *const rhs = check_operand(L, 2, &rhs_view, rhs_blocks);
+
+    // Once `lhs` is at least as long as `rhs`, the blocks past the end of `rhs`
+    // are left as they are.
+    bs_grow(L, 1, lhs, rhs->len);
+    bs_par.xor_blocks(lhs->bits, lhs->bits, rhs->bits, rhs->len);
+
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+/*** The intersection of two bitsets, written into a third.
+Gives the same result as @{Bitset:intersection}, but instead of allocating a
+new bitset it overwrites `out`, reusing its memory. `out` may be one of the
+operands. Also available as `bitset.intersection_into`.
+
+@function Bitset:intersection_into
+@tparam Bitset out the bitset to write the intersection into.
+@tparam Bitset lhs the left-hand bitset to intersect.
+@tparam Bitset rhs the right-hand bitset to intersect.
+@treturn Bitset `out`, for convenience.
+@see Bitset:intersection
+*/
+static int bs_intersection_into(lua_State *L) {
+    Bitset lhs_view, rhs_view;
+    block_t lhs_blocks[FIXED_BLOCKS], rhs_blocks[FIXED_BLOCKS];
+    Bitset *const out = check_bitset_mut(L, 1);
+    Bitset *const lhs = check_operand(L, 2, &lhs_view, lhs_blocks);
+    Bitset *const rhs = check_operand(L, 3, &rhs_view, rhs_blocks);
+
+    const size_t len = (lhs->len > rhs->len) ? rhs->len : lhs->len;
+
+    // If `out` is one of the operands, this only ever shrinks it, so the
+    // blocks stay where they are.
+    bs_resize(L, 1, out, len);
+    bs_par.and_blocks(out->bits, lhs->bits, rhs->bits, len);
+
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+// Writes `op(lhs, rhs)` into `out` for the operations where bits past the end
+// of the shorter operand come from the longer one, that is, union and
+// symmetric difference.
+static void widening_into(lua_State *L, void (*op)(block_t*, const block_t*,
+        const block_t*, size_t), Bitset *out, const Bitset *lhs,
+        const Bitset *rhs) {
+    const Bitset *small, *large;
+    by_len(lhs, rhs, &small, &large);
+
+    // `out` may be one of the operands, so their lengths have to be read
+    // before it's resized, and their blocks after, in case it was reallocated.
+    const size_t small_len = small->len, large_len = large->len;
+
+    bs_resize(L, 1, out, large_len);
+    op(out->bits, large->bits, small->bits, small_len);
+
+    if (out != large) {
+        bs_par_copy(out->bits + small_len, large->bits + small_len,
+            large_len - small_len);
+    }
+}
+
+
+/*** The union of two bitsets, written into a third.
+Gives the same result as @{Bitset:union}, but instead of allocating a new
+bitset it overwrites `out`, reusing its memory. `out` may be one of the
+operands. Also available as `bitset.union_into`.
+
+@function Bitset:union_into
+@tparam Bitset out the bitset to write the union into.
+@tparam Bitset lhs the left-hand bitset to union.
+@tparam Bitset rhs the right-hand bitset to union.
+@treturn Bitset `out`, for convenience.
+@see Bitset:union
+*/
+static int bs_union_into(lua_State *L) {
+    Bitset lhs_view, rhs_view;
+    block_t lhs_blocks[FIXED_BLOCKS], rhs_blocks[FIXED_BLOCKS];
+    Bitset *const out = check_bitset_mut(L, 1);
+    Bitset *const lhs = check_operand(L, 2, &lhs_view, lhs_blocks);
+    Bitset *const rhs = check_operand(L, 3, &rhs_view, rhs_blocks);
+
+    widening_into(L, bs_par.or_blocks, out, lhs, rhs);
+
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+/*** The asymmetric difference of two bitsets, written into a third.
+Gives the same result as @{Bitset:difference}, but instead of allocating a new
+bitset it overwrites `out`, reusing its memory. `out` may be one of the
+operands. Also available as `bitset.difference_into`.
+
+@function Bitset:difference_into
+@tparam Bitset out the bitset to write the difference into.
+@tparam Bitset lhs the source bitset.
+@tparam Bitset rhs the bitset to "subtract" from the source.
+@treturn Bitset `out`, for convenience.
+@see Bitset:difference
+*/
+static int bs_difference_into(lua_State *L) {
+    Bitset lhs_view, rhs_view;
+    block_t lhs_blocks[FIXED_BLOCKS], rhs_blocks[FIXED_BLOCKS];
+    Bitset *const out = check_bitset_mut(L, 1);
+    Bitset *const lhs = check_operand(L, 2, &lhs_view, lhs_blocks);
+    Bitset *const rhs = check_operand(L, 3, &rhs_view, rhs_blocks);
+
+    // As in `widening_into`, `out` may be either operand.
+    const size_t lhs_len = lhs->len;
+    const size_t len = (lhs_len > rhs->len) ? rhs->len : lhs_len;
+
+    bs_resize(L, 1, out, lhs_len);
+    bs_par.andnot_blocks(out->bits, lhs->bits, rhs->bits, len);
+
+    if (out != lhs) {
+        bs_par_copy(out->bits + len, lhs->bits + len, lhs_len - len);
+    }
+
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+/*** The symmetric difference of two bitsets, written into a third.
+Gives the same result as @{Bitset:symmetric_diff}, but instead of allocating a
+new bitset it overwrites `out`, reusing its memory. `out` may be one of the
+operands. Also available as `bitset.symmetric_diff_into`.
+
+@function Bitset:symmetric_diff_into
+@tparam Bitset out the bitset to write the symmetric difference into.
+@tparam Bitset lhs the left-hand bitset.
+@tparam Bitset rhs the right-hand bitset.
+@treturn Bitset `out`, for convenience.
+@see Bitset:symmetric_diff
+*/
+static int bs_symmetric_diff_into(lua_State *L) {
+    Bitset lhs_view, rhs_view;
+    block_t lhs_blocks[FIXED_BLOCKS], rhs_blocks[FIXED_BLOCKS];
+    Bitset *const out = check_bitset_mut(L, 1);
+    Bitset *const lhs = check_operand(L, 2, &lhs_view, lhs_blocks);
+    Bitset *const rhs = check_operand(L, 3, &rhs_view, rhs_blocks);
+
+    widening_into(L, bs_par.xor_blocks, out, lhs, rhs);
+
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+static size_t union_count(const Bitset *lhs, const Bitset *rhs) {
+    const Bitset *small, *large;
+    by_len(lhs, rhs, &small, &large);
+
+    return bs_par.or_popcount_blocks(small->bits, large->bits, small->len) +
+        bs_par.popcount_blocks(large->bits + small->len,
+            large->len - small->len);
+}
+
+
+static size_t intersection_count(const Bitset *lhs, const Bitset *rhs) {
+    const size_t len = (lhs->len > rhs->len) ? rhs->len : lhs->len;
+
+    return bs_par.and_popcount_blocks(lhs->bits, rhs->bits, len);
+}
+
+
+/*** Counts the bits set in both of two bitsets.
+Gives the same answer as `(lhs * rhs):count()`, but in a single pass and
+without allocating the intersection.
+
+@function Bitset:intersection_count
+@tparam Bitset lhs the left-hand bitset.
+@tparam Bitset rhs the right-hand bitset.
+@treturn num the number of bits set in both `lhs` and `rhs`.
+@see Bitset:intersection
+*/
+static int bs_intersection_count(lua_State *L) {
+    Bitset rhs_view;
+    block_t rhs_blocks[FIXED_BLOCKS];
+    const Bitset *const lhs = check_bitset(L, 1);
+    Bitset *const rhs = check_operand(L, 2, &rhs_view, rhs_blocks);
+
+    lua_pushinteger(L, (lua_Integer)intersection_count(lhs, rhs));
+    return 1;
+}
+
+
+/*** Counts the bits set in either of two bitsets.
+Gives the same answer as `(lhs + rhs):count()`, but in a single pass and
+without allocating the union.
+
+@function Bitset:union_count
+@tparam Bitset lhs the left-hand bitset.
+@tparam Bitset rhs the right-hand bitset.
+@treturn num the number of bits set in `lhs`, `rhs`, or both.
+@see Bitset:union
+*/
+static int bs_union_count(lua_State *L) {
+    Bitset rhs_view;
+    block_t rhs_blocks[FIXED_BLOCKS];
+    const Bitset *const lhs = check_bitset(L, 1);
+    Bitset *const rhs = check_operand(L, 2, &rhs_view, rhs_blocks);
+
+    lua_pushinteger(L, (lua_Integer)union_count(lhs, rhs));
+    return 1;
+}
+
+
+/*** Counts the bits set in one bitset but not in another.
+Gives the same answer as `(lhs - rhs):count()`, but in a single pass and
+without allocating the difference.
+
+@function Bitset:difference_count
+@tparam Bitset lhs the source bitset.
+@tparam Bitset rhs the bitset to "subtract" from the source.
+@treturn num the number of bits set in `lhs` but not in `rhs`.
+@see Bitset:difference
+*/
+static int bs_difference_count(lua_State *L) {
+    Bitset rhs_view;
+    block_t rhs_blocks[FIXED_BLOCKS];
+    const Bitset *const lhs = check_bitset(L, 1);
+    Bitset *const rhs = check_operand(L, 2, &rhs_view, rhs_blocks);
+
+    const size_t len = (lhs->len > rhs->len) ? rhs->len : lhs->len;
+
+    const size_t sum =
+        bs_par.andnot_popcount_blocks(lhs->bits, rhs->bits, len) +
+        bs_par.popcount_blocks(lhs->bits + len, lhs->len - len);
+
+    lua_pushinteger(L, (lua_Integer)sum);
+    return 1;
+}
+
+
+/*** Counts the bits set in exactly one of two bitsets.
+Gives the same answer as `lhs:symmetric_diff(rhs):count()`, but in a single
+pass and without allocating the symmetric difference.
+
+@function Bitset:symmetric_diff_count
+@tparam Bitset lhs the left-hand bitset.
+@tparam Bitset rhs the right-hand bitset.
+@treturn num the number of bits set in either `lhs` or `rhs`, but not in both.
+@see Bitset:symmetric_diff
+*/
+static int bs_symmetric_diff_count(lua_State *L) {
+    Bitset rhs_view;
+    block_t rhs_blocks[FIXED_BLOCKS];
+    const Bitset *const lhs = check_bitset(L, 1);
+    Bitset *const rhs = check_operand(L, 2, &rhs_view, rhs_blocks);
+
+    const Bitset *small, *large;
+    by_len(lhs, rhs, &small, &large);
+
+    const size_t sum =
+        bs_par.xor_popcount_blocks(small->bits, large->bits, small->len) +
+        bs_par.popcount_blocks(large->bits + small->len,
+            large->len - small->len);
+
+    lua_pushinteger(L, (lua_Integer)sum);
+    return 1;
+}
+
+
+/*** The Jaccard similarity of two bitsets.
+That is, the size of their intersection divided by the size of their union,
+from 0 for disjoint bitsets to 1 for equal ones. Two empty bitsets are equal,
+and so have a similarity of 1.
+
+@function Bitset:jaccard
+@tparam Bitset lhs the left-hand bitset.
+@tparam Bitset rhs the right-hand bitset.
+@treturn num the Jaccard similarity of `lhs` and `rhs`.
+*/
+static int bs_jaccard(lua_State *L) {
+    Bitset rhs_view;
+    block_t rhs_blocks[FIXED_BLOCKS];
+    const Bitset *const lhs = check_bitset(L, 1);
+    Bitset *const rhs = check_operand(L, 2, &rhs_view, rhs_blocks);
+
+    const size_t inter = intersection_count(lhs, rhs);
+    const size_t uni = union_count(lhs, rhs);
+
+    lua_pushnumber(L, uni == 0 ? 1.0 : (lua_Number)inter / (lua_Number)uni);
+    return 1;
+}
+
+
+static bool intersects(const Bitset *lhs, const Bitset *rhs) {
+    const size_t len = (lhs->len > rhs->len) ? rhs->len : lhs->len;
+
+    return bs_par.intersects_blocks(lhs->bits, rhs->bits, len);
+}
+
+
+/*** Checks whether two bitsets have any set bits in common.
+Stops at the first bit in common, so this is much cheaper than counting the
+intersection when it is likely to be non-empty.
+
+@function Bitset:intersects
+@tparam Bitset lhs the left-hand bitset.
+@tparam Bitset rhs the right-hand bitset.
+@treturn bool true if some bit is set in both `lhs` and `rhs`.
+@see Bitset:is_disjoint
+*/
+static int bs_intersects(lua_State *L) {
+    Bitset rhs_view;
+    block_t rhs_blocks[FIXED_BLOCKS];
+    const Bitset *const lhs = check_bitset(L, 1);
+    Bitset *const rhs = check_operand(L, 2, &rhs_view, rhs_blocks);
+
+    lua_pushboolean(L, intersects(lhs, rhs));
+    return 1;
+}
+
+
+/*** Checks whether two bitsets have no set bits in common.
+The opposite of @{Bitset:intersects}.
+
+@function Bitset:is_disjoint
+@tparam Bitset lhs the left-hand bitset.
+@tparam Bitset rhs the right-hand bitset.
+@treturn bool true if no bit is set in both `lhs` and `rhs`.
+@see Bitset:intersects
+*/
+static int bs_is_disjoint(lua_State *L) {
+    Bitset rhs_view;
+    block_t rhs_blocks[FIXED_BLOCKS];
+    const Bitset *const lhs = check_bitset(L, 1);
+    Bitset *const rhs = check_operand(L, 2, &rhs_view, rhs_blocks);
+
+    lua_pushboolean(L, !intersects(lhs, rhs));
+    return 1;
+}
+
+
+static int bs_eq(lua_State *L) {
+    Bitset rhs_view;
+    block_t rhs_blocks[FIXED_BLOCKS];
+    const Bitset *const lhs = check_bitset(L, 1);
+    Bitset *const rhs = check_operand(L, 2, &rhs_view, rhs_blocks);
+
+    const Bitset* small;
+    const Bitset* large;
+
+    if (lhs->len > rhs->len) {
+        large = lhs;
+        small = rhs;
+    } else {
+        large = rhs;
+        small = lhs;
+    }
+
+    // Trailing zero blocks don't count, so the longer one has to be zero past
+    // the end of the shorter one.
+    const bool eq =
+        bs_par.eq_blocks(small->bits, large->bits, small->len) &&
+        bs_par.zero_blocks(large->bits + small->len,
+            large->len - small->len);
+
+    lua_pushboolean(L, eq);
+    return 1;
+}
+
+
+static bool is_subset(const Bitset *lhs, const Bitset *rhs) {
+    if (lhs->len <= rhs->len) {
+        return bs_par.subset_blocks(lhs->bits, rhs->bits, lhs->len);
+    }
+
+    return bs_par.subset_blocks(lhs->bits, rhs->bits, rhs->len) &&
+        bs_par.zero_blocks(lhs->bits + rhs->len, lhs->len - rhs->len);
+}
+
+
+static int bs_subset(lua_State *L) {
+    Bitset rhs_view;
+    block_t rhs_blocks[FIXED_BLOCKS];
+    const Bitset *const lhs = check_bitset(L, 1);
+    Bitset *const rhs = check_operand(L, 2, &rhs_view, rhs_blocks);
+
+    lua_pushboolean(L, is_subset(lhs, rhs));
+    return 1;
+}
+
+
+static int bs_strict_subset(lua_State *L) {
+    Bitset rhs_view;
+    block_t rhs_blocks[FIXED_BLOCKS];
+    Bitset *const lhs = check_bitset(L, 1);
+    Bitset *const rhs = check_operand(L, 2, &rhs_view, rhs_blocks);
+
+    // `lhs` is a strict subset iff it's a subset and `rhs` has at least one
+    // more bit set, which is cheaper to check than equality block by block,
+    // and often free with the counts cached.
+    const bool strict = is_subset(lhs, rhs) &&
+        count_bits(lhs) < count_bits(rhs);
+
+    lua_pushboolean(L, strict);
+    return 1;
+}
+
+
+// The blocks of a bitset or fixed-width bitset at `idx`, as a key for hashing
+// and maps: trimmed of trailing zero blocks, so that equal bitsets give equal
+// keys. Fixed-width bitsets are converted into `tmp`.
+static const block_t *check_key(lua_State *L, int idx, block_t *tmp,
+        size_t *len) {
+    // Keys are looked up often, so fetch the metatable once for both kinds.
+    void *const ud = lua_touserdata(L, idx);
+
+    if (ud != NULL && lua_getmetatable(L, idx)) {
+        if (lua_rawequal(L, -1, HEAP_MT) || lua_rawequal(L, -1, INLINE_MT)) {
+            lua_pop(L, 1);
+
+            const Bitset *const bitset = (const Bitset*)ud;
+            *len = bm_trim(bitset->bits, bitset->len);
+            return bitset->bits;
+        }
+
+        int slot;
+        for (slot = 1; slot <= FIXED_SLOTS; slot++) {
+            if (lua_rawequal(L, -1, FIXED_MT(slot))) {
+                lua_pop(L, 1);
+
+                const size_t words = (size_t)1 << (slot - 1);
+                fixed_to_blocks((const uint64_t*)ud, words, tmp);
+                *len = bm_trim(tmp, words * (FIXED_WORD_BITS / BITWIDTH));
+                return tmp;
+            }
+        }
+
+        lua_pop(L, 1);
+    }
+
+    luaL_typerror(L, idx, "bitset or fixed bitset");
+    return NULL;
+}
+
+
+// Room for the blocks of the widest fixed-width bitset.
+#define KEY_TMP_BLOCKS (FIXED_MAX_BITS / BITWIDTH)
+
+
+/*** Hashes the contents of the bitset.
+Equal bitsets hash the same, however long they are and whether or not they are
+fixed-width, so the hash can stand in for the bitset as a table key, with
+`==` to sort out collisions. Or use @{map}, which does all that in C.
+The hash is 64 bits in C; Lua gets the top 53 of them, as an integer.
+
+@function Bitset:hash
+@treturn num the hash.
+*/
+static int bs_hash(lua_State *L) {
+    block_t tmp[KEY_TMP_BLOCKS];
+    size_t len;
+    const block_t *const bits = check_key(L, 1, tmp, &len);
+
+    lua_pushnumber(L, (lua_Number)(bm_hash(bits, len) >> 11));
+    return 1;
+}
+
+static int dump_raw(lua_State *L) {
+    Bitset *bitset = check_bitset(L, 1);
+
+    lua_Integer int_idx = luaL_checkinteger(L, 2);
+
+    // A negative index is completely invalid.
+    if (int_idx < 0) {
+        luaL_argerror(L, 2, "expected positive index");
+    }
+
+    size_t idx = (size_t)int_idx;
+
+    lua_pushinteger(L, bitset->bits[idx]);
+    return 1;
+}
+
+
+static int dump_len(lua_State *L) {
+    Bitset *bitset = check_bitset(L, 1);
+
+    lua_pushinteger(L, bitset->len);
+    return 1;
+}
+
+
+// Serialized bitsets are laid out byte by byte, bit `i` going in bit `i % 8` of
+// byte `i / 8`, so the format doesn't depend on the width of `block_t` or the
+// byte order. On little-endian machines, that's just the blocks themselves.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define BS_LITTLE_ENDIAN 1
+#else
+#define BS_LITTLE_ENDIAN 0
+#endif
+
+static const char *const bs_encodings[] = { "raw", "rle", NULL };
+
+enum { BS_ENCODING_RAW, BS_ENCODING_RLE };
+
+
+// Writes `val` as an unsigned LEB128 varint: seven bits a byte, low bits first,
+// with the high bit set on every byte but the last. Returns the number of bytes
+// written, at most `VARINT_MAX`.
+#define VARINT_MAX 10
+
+static size_t put_varint(unsigned char *out, size_t val) {
+    size_t n = 0;
+
+    while (val >= 0x80) {
+        out[n++] = (unsigned char)(val | 0x80);
+        val >>= 7;
+    }
+
+    out[n++] = (unsigned char)val;
+    return n;
+}
+
+
+// Reads a varint from `[p, end)`. Returns a pointer past it, or NULL if it's
+// cut off or too big for a `size_t`.
+static const unsigned char *get_varint(const unsigned char *p,
+        const unsigned char *end, size_t *val) {
+    size_t result = 0;
+    unsigned shift = 0;
+
+    while (p < end) {
+        const size_t byte = *p++;
+
+        if (shift >= 8 * sizeof(size_t) ||
+                (byte & 0x7F) > (SIZE_MAX >> shift)) {
+            return NULL;
+        }
+
+        result |= (byte & 0x7F) << shift;
+
+        if (!(byte & 0x80)) {
+            *val = result;
+            return p;
+        }
+
+        shift += 7;
+    }
+
+    return NULL;
+}
+
+
+static void push_raw_bytes(lua_State *L, const Bitset *bitset) {
+    // Trailing zero bytes are left out, so equal bitsets always give the same
+    // string.
+    size_t blk = bitset->len;
+
+    while (blk > 0 && bitset->bits[blk - 1] == 0) {
+        blk--;
+    }
+
+    if (blk == 0) {
+        lua_pushliteral(L, "");
+        return;
+    }
+
+    const size_t nbytes = (blk - 1) * sizeof(block_t) +
+        BLOCK_HIGHEST(bitset->bits[blk - 1]) / 8 + 1;
+
+#if BS_LITTLE_ENDIAN
+    lua_pushlstring(L, (const char*)bitset->bits, nbytes);
+#else
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+
+    size_t i;
+    for (i = 0; i < nbytes; i++) {
+        const block_t word = bitset->bits[i / sizeof(block_t)];
+        luaL_addchar(&b, (char)(word >> (8 * (i % sizeof(block_t)))));
+    }
+
+    luaL_pushresult(&b);
+#endif
+}
+
+
+static void push_rle_bytes(lua_State *L, const Bitset *bitset) {
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+
+    // Each run of set bits is written as two varints: the number of clear bits
+    // since the end of the last run, then its length.
+    size_t prev = 0;
+    size_t lo;
+
+    while ((lo = find_next_set(bitset, prev)) != NO_BIT) {
+        const size_t hi = find_next_clear(bitset, lo);
+
+        unsigned char run[2 * VARINT_MAX];
+        size_t n = put_varint(run, lo - prev);
+        n += put_varint(run + n, hi - lo);
+
+        luaL_addlstring(&b, (const char*)run, n);
+        prev = hi;
+    }
+
+    luaL_pushresult(&b);
+}
+
+
+/*** Serializes the bitset to a string.
+The default `"raw"` encoding stores each bit as a bit, eight to a byte, lowest
+first, leaving out trailing zero bytes; on most machines it is a single copy of
+the blocks. The `"rle"` encoding stores each run of set bits as a pair of
+varints, which is far smaller for sparse bitsets, or ones with long runs. Both
+are the same on every platform.
+
+@function Bitset:to_bytes
+@tparam[opt="raw"] string encoding either `"raw"` or `"rle"`.
+@treturn string the serialized bitset.
+@see from_bytes
+*/
+static int bs_to_bytes(lua_State *L) {
+    const Bitset *bitset = check_bitset(L, 1);
+
+    if (luaL_checkoption(L, 2, "raw", bs_encodings) == BS_ENCODING_RLE) {
+        push_rle_bytes(L, bitset);
+    } else {
+        push_raw_bytes(L, bitset);
+    }
+
+    return 1;
+}
+
+
+static void raw_from_bytes(lua_State *L, const unsigned char *s, size_t n) {
+    Bitset *const bitset =
+        bs_alloc(L, (n + sizeof(block_t) - 1) / sizeof(block_t), NULL);
+
+#if BS_LITTLE_ENDIAN
+    const size_t whole = n / sizeof(block_t);
+
+    bs_par_copy(bitset->bits, s, whole);
+    memcpy(bitset->bits + whole, s + whole * sizeof(block_t),
+        n % sizeof(block_t));
+#else
+    size_t i;
+    for (i = 0; i < n; i++) {
+        bitset->bits[i / sizeof(block_t)] |=
+            (block_t)s[i] << (8 * (i % sizeof(block_t)));
+    }
+#endif
+}
+
+
+static void rle_from_bytes(lua_State *L, const unsigned char *s, size_t n) {
+    const unsigned char *const end = s + n;
+    const unsigned char *p = s;
+
+    // The first pass checks the runs and finds out how big the bitset has to
+    // be, and the second sets them. The bits have to stay few enough that
+    // rounding them up to whole blocks can't overflow.
+    const size_t max_bits = SIZE_MAX - (BITWIDTH - 1);
+    size_t top = 0;
+
+    while (p < end) {
+        size_t gap = 0, run = 0;
+
+        if ((p = get_varint(p, end, &gap)) == NULL ||
+                (p = get_varint(p, end, &run)) == NULL ||
+                gap > max_bits - top || run > max_bits - top - gap) {
+            luaL_argerror(L, 1, "malformed run-length encoding");
+        }
+
+        top += gap + run;
+    }
+
+    Bitset *const bitset = bs_alloc(L, (top + BITWIDTH - 1) / BITWIDTH, NULL);
+
+    size_t pos = 0;
+    p = s;
+
+    while (p < end) {
+        size_t gap = 0, run = 0;
+
+        p = get_varint(p, end, &gap);
+        p = get_varint(p, end, &run);
+
+        pos += gap;
+
+        if (run > 0) {
+            fill_range(bitset, pos, pos + run);
+        }
+
+        pos += run;
+    }
+}
+
+
+/*** Deserializes a bitset from a string.
+Reads strings written by @{Bitset:to_bytes}, in either encoding. Raw strings are
+copied straight into the new bitset's blocks.
+
+@function from_bytes
+@tparam string s the serialized bitset.
+@tparam[opt="raw"] string encoding the encoding `s` was written with, either
+`"raw"` or `"rle"`.
+@treturn Bitset a newly allocated bitset.
+@see Bitset:to_bytes
+*/
+static int bs_from_bytes(lua_State *L) {
+    size_t n;
+    const unsigned char *const s =
+        (const unsigned char*)luaL_checklstring(L, 1, &n);
+
+    if (luaL_checkoption(L, 2, "raw", bs_encodings) == BS_ENCODING_RLE) {
+        rle_from_bytes(L, s, n);
+    } else {
+        raw_from_bytes(L, s, n);
+    }
+
+    return 1;
+}
+
+
+static const char *const bs_map_modes[] = { "r", "rw", NULL };
+
+enum { BS_MAP_READ, BS_MAP_READ_WRITE };
+
+
+/*** Maps a file into memory as a bitset.
+The file holds the bitset's blocks as they are in memory, in the same layout as
+the `"raw"` encoding of @{Bitset:to_bytes}, so nothing is read until it's used
+and opening even a huge bitset is instant. Every other bitset operation works on
+a mapped bitset.
+
+In `"rw"` mode, the default, the file is created if it doesn't exist, and made
+big enough for `nbits` bits. Changes go to the file, and setting bits past the
+end grows it. @{Bitset:sync} waits for the changes to be written.
+
+In `"r"` mode, the file is mapped as it is, and never changed. The bitset can
+still be modified, but the changes are its own; if it has to grow, its blocks
+are copied to the heap.
+
+The mapping is released when the bitset is collected. Only supported on POSIX
+systems with little-endian CPUs.
+
+@function mmap
+@tparam string path the file to map.
+@tparam[opt] num nbits the size of the bitset to make room for, in `"rw"` mode.
+@tparam[opt="rw"] string mode either `"r"` or `"rw"`.
+@treturn Bitset a bitset backed by the file.
+@see Bitset:sync
+*/
+static int bs_mmap(lua_State *L) {
+    const char *const path = luaL_checkstring(L, 1);
+    const lua_Integer int_sz = luaL_optinteger(L, 2, 0);
+    const bool shared =
+        luaL_checkoption(L, 3, "rw", bs_map_modes) == BS_MAP_READ_WRITE;
+
+    if (int_sz < 0) {
+        luaL_argerror(L, 2, "expected positive size");
+    }
+
+#if !BS_LITTLE_ENDIAN
+    luaL_error(L, "memory-mapped bitsets need a little-endian CPU");
+#endif
+
+    // The mapping's bookkeeping goes where the inline blocks would, and the
+    // bitset is made empty first so that `bs_gc` has nothing to do if mapping
+    // the file fails.
+    Bitset *const bitset =
+        (Bitset*)lua_newuserdata(L, sizeof(Bitset) + sizeof(Mapping));
+
+    bitset->bits = bitset->inline_bits;
+    bitset->len = 0;
+    bitset->cap = 0;
+    bitset->reallocs = 0;
+    bitset->arena = NULL;
+    bitset->mapping = NULL;
+    bitset->ranked = false;
+    bitset->count = BS_COUNT_UNKNOWN;
+    bitset->nranks = 0;
+    bitset->ranks = NULL;
+
+    lua_pushvalue(L, HEAP_MT);
+    lua_setmetatable(L, -2);
+
+    Mapping *const mapping = (Mapping*)(void*)bitset->inline_bits;
+
+    // At least one block, so that a new file gets mapped at all.
+    size_t nblocks = ((size_t)int_sz + BITWIDTH - 1) / BITWIDTH;
+
+    if (nblocks == 0) {
+        nblocks = 1;
+    }
+
+    if (!mp_open(mapping, path, nblocks * sizeof(block_t), sizeof(block_t),
+            shared)) {
+        luaL_error(L, "could not map %s: %s", path, strerror(errno));
+    }
+
+    // An empty file mapped read-only is just an empty bitset.
+    if (mapping->addr == NULL) {
+        return 1;
+    }
+
+    // A shared mapping is always whole blocks. A private one may end partway
+    // through one, which is fine, since the last page of the mapping reads as
+    // zeroes past the end of the file, and it's never written back.
+    bitset->bits = (block_t*)mapping->addr;
+    bitset->len = (mapping->size + sizeof(block_t) - 1) / sizeof(block_t);
+    bitset->cap = bitset->len;
+    bitset->mapping = mapping;
+
+    return 1;
+}
+
+
+/*** Writes a memory-mapped bitset's changes to its file.
+Waits until the changes made so far are on disk. They get there eventually even
+without this; it's only needed to be sure they have.
+
+@function Bitset:sync
+@treturn Bitset the bitset, for convenience.
+@see mmap
+*/
+static int bs_sync(lua_State *L) {
+    const Bitset *const bitset = check_bitset(L, 1);
+
+    if (bitset->mapping == NULL || !bitset->mapping->shared) {
+        luaL_argerror(L, 1, "expected a bitset mapped in \"rw\" mode");
+    }
+
+    if (!mp_sync(bitset->mapping)) {
+        luaL_error(L, "could not sync memory-mapped bitset: %s",
+            strerror(errno));
+    }
+
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+/*** Query or change the set-operation kernels in use.
+When the module is loaded, the fastest kernels the CPU supports are selected:
+`"avx2"`, `"sse2"`, or the portable `"scalar"` fallback. All of them give the
+same results; this exists mostly for benchmarking and testing.
+
+@function kernel
+@tparam[opt] string name the kernels to switch to.
+@treturn string the name of the kernels in use, after switching if asked to.
+@treturn {string,...} the names of all the kernels available on this CPU.
+*/
+static int bs_kernel(lua_State *L) {
+    if (!lua_isnoneornil(L, 1)) {
+        const char *const name = luaL_checkstring(L, 1);
+        const bs_kernels *const kern = bs_kernels_find(name);
+
+        if (kern == NULL) {
+            luaL_argerror(L, 1, "kernels not available on this CPU");
+        }
+
+        bs_kern = kern;
+    }
+
+    lua_pushstring(L, bs_kern->name);
+
+    lua_newtable(L);
+
+    int n = 0;
+    size_t i;
+    for (i = 0; bs_kernel_names[i] != NULL; i++) {
+        if (bs_kernels_find(bs_kernel_names[i]) != NULL) {
+            lua_pushstring(L, bs_kernel_names[i]);
+            lua_rawseti(L, -2, ++n);
+        }
+    }
+
+    return 2;
+}
+
+
+/*** Query or change how bulk operations are split across threads.
+Operations over whole bitsets (the set operations and their counts, @{Bitset:count},
+comparisons, copies and @{from_bytes}) on bitsets of at least `min_bits` bits
+are split across a pool of worker threads, shared by every Lua state in the
+process. They still return only once they're done. By default, as many threads
+as there are CPUs are used, up to 16, for bitsets of at least 32 Mbit (4 MiB).
+Only POSIX systems have the pool; elsewhere, only one thread can be asked for.
+
+@function threads
+@tparam[opt] num n how many threads to split operations across, counting the calling one. 1 turns splitting off.
+@tparam[opt] num min_bits how big a bitset has to be, in bits, for its operations to be split.
+@treturn num the number of threads, after changing it if asked to.
+@treturn num the minimum size in bits, likewise.
+*/
+static int bs_threads(lua_State *L) {
+    if (!lua_isnoneornil(L, 1) || !lua_isnoneornil(L, 2)) {
+        const lua_Integer threads =
+            luaL_optinteger(L, 1, (lua_Integer)bs_pool_threads());
+        const lua_Integer min_bits = luaL_optinteger(L, 2,
+            (lua_Integer)(bs_pool_min_blocks() * BITWIDTH));
+
+        if (threads < 1) {
+            luaL_argerror(L, 1, "expected at least one thread");
+        }
+
+        if (min_bits < 0) {
+            luaL_argerror(L, 2, "expected positive size");
+        }
+
+        if (!bs_pool_configure((size_t)threads, (size_t)min_bits / BITWIDTH)) {
+            return luaL_error(L, "could not start threads: %s", strerror(errno));
+        }
+    }
+
+    lua_pushinteger(L, (lua_Integer)bs_pool_threads());
+    lua_pushinteger(L, (lua_Integer)(bs_pool_min_blocks() * BITWIDTH));
+    return 2;
+}
+
+
+/*** A scratch arena for short-lived bitsets.
+Bitsets made by an arena have their blocks bump-allocated out of it, and
+@{Arena:reset} releases them all at once, which is much cheaper than having the
+collector find and free them one by one. Meant for temporaries that only live
+for one frame:
+
+    local scratch = bitset.arena()
+
+    function update()
+        local visible = scratch:new(#entities)
+        -- ...
+        scratch:reset()
+    end
+
+Bitsets small enough to be stored inline don't need the arena, and are made
+the usual way.
+@type Arena
+*/
+
+
+/*** Makes a new arena.
+@function arena
+@treturn Arena an empty arena.
+*/
+static int bs_arena(lua_State *L) {
+    Arena *const arena = (Arena*)lua_newuserdata(L, sizeof(Arena));
+
+    void *ud;
+    lua_Alloc alloc = lua_getallocf(L, &ud);
+    ar_init(arena, alloc, ud);
+
+    luaL_getmetatable(L, LUA_BITSET_ARENA_TYPENAME);
+    lua_setmetatable(L, -2);
+
+    // The arena's environment keeps track of the bitsets made from it, so that
+    // `reset` can find them, and the bitsets' environments point back at it so
+    // that the arena outlives them.
+    lua_createtable(L, 0, 1);
+    lua_pushvalue(L, -2);
+    lua_rawseti(L, -2, 0);
+    lua_setfenv(L, -2);
+
+    return 1;
+}
+
+
+static int arena_gc(lua_State *L) {
+    Arena *const arena = luaL_checkudata(L, 1, LUA_BITSET_ARENA_TYPENAME);
+    ar_free(arena);
+    return 0;
+}
+
+
+/*** Makes a new bitset in the arena.
+Takes the same arguments as @{new}.
+
+@function Arena:new
+@tparam num|Bitset size the size of a bitset to allocate. Or, if a bitset, the bitset to copy.
+@tparam bool init if true, set all newly allocated bits.
+@treturn Bitset a bitset which is emptied when the arena is reset.
+*/
+static int arena_new(lua_State *L) {
+    Arena *const arena = luaL_checkudata(L, 1, LUA_BITSET_ARENA_TYPENAME);
+
+    new_bitset(L, 2, arena);
+
+    const Bitset *const bitset = lua_touserdata(L, -1);
+
+    if (bitset->arena != NULL) {
+        lua_getfenv(L, 1);
+        lua_pushvalue(L, -2);
+        lua_rawseti(L, -2, (int)lua_objlen(L, -2) + 1);
+        lua_setfenv(L, -2);
+    }
+
+    return 1;
+}
+
+
+/*** Releases all of the memory given out by the arena, for reuse.
+Every bitset made from the arena becomes empty, as if it had just been made by
+@{new}. They can go on being used, but they won't be in the arena any more.
+
+@function Arena:reset
+@treturn Arena the arena, for convenience.
+*/
+static int arena_reset(lua_State *L) {
+    Arena *const arena = luaL_checkudata(L, 1, LUA_BITSET_ARENA_TYPENAME);
+
+    lua_getfenv(L, 1);
+
+    const int n = (int)lua_objlen(L, -1);
+    int i;
+    for (i = 1; i <= n; i++) {
+        lua_rawgeti(L, -1, i);
+
+        Bitset *const bitset = lua_touserdata(L, -1);
+        bitset->bits = bitset->inline_bits;
+        bitset->len = 0;
+        bitset->cap = 0;
+        bitset->arena = NULL;
+        bitset->ranked = false;
+        bitset->count = 0;
+        bitset->nranks = 0;
+        bitset->ranks = NULL;
+
+        lua_pushvalue(L, LUA_GLOBALSINDEX);
+        lua_setfenv(L, -2);
+        lua_pop(L, 1);
+    }
+
+    lua_pop(L, 1);
+
+    ar_reset(arena);
+
+    lua_createtable(L, 0, 1);
+    lua_pushvalue(L, 1);
+    lua_rawseti(L, -2, 0);
+    lua_setfenv(L, 1);
+
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+/*** How much memory the arena is holding on to.
+@function Arena:memory
+@treturn num the size of the arena, in bytes.
+*/
+static int arena_memory(lua_State *L) {
+    const Arena *const arena =
+        luaL_checkudata(L, 1, LUA_BITSET_ARENA_TYPENAME);
+
+    lua_pushinteger(L, (lua_Integer)arena->reserved);
+    return 1;
+}
+
+
+/*** A bitset of a fixed width: 64, 128 or 256 bits.
+Made by @{fixed}. Fixed-width bitsets are for small sets that are compared
+against each other a lot, like component signatures, and have no length to
+check or blocks to go looking for: the bits are stored right in the userdata,
+and every operation goes over all of the words without branching.
+
+They have the same methods as bitsets for getting and setting bits, counting,
+iterating, set algebra and comparisons, and the same operators. Indices have
+to be below the width. Binary operations work in the width of the bitset
+they're called on, and also take the other widths and ordinary bitsets as
+their second operand; `union` and `symmetric_diff` raise an error if the
+result wouldn't fit. The arithmetic operators work in the width of the
+left-hand operand, and the comparison operators work between any two bitsets,
+fixed-width or not.
+
+@type FixedBitset
+*/
+
+
+/*** Gets the width of the fixed-width bitset.
+@function FixedBitset:width
+@treturn num 64, 128 or 256.
+*/
+
+
+/*** Copies the fixed-width bitset into an ordinary bitset.
+@function FixedBitset:to_bitset
+@treturn Bitset a newly allocated bitset with the same bits set.
+@see new
+*/
+
+
+static size_t fixed_index(lua_State *L, int arg, size_t width) {
+    const lua_Integer int_idx = luaL_checkinteger(L, arg);
+
+    if (int_idx < 0 || (size_t)int_idx >= width) {
+        luaL_argerror(L, arg, "index out of range");
+    }
+
+    return (size_t)int_idx;
+}
+
+
+// Reads a fixed-width bitset of any width, or a bitset, at `idx` into `n`
+// words at `out`. Returns true if it has any bits set past those.
+static bool fixed_operand(lua_State *L, int idx, uint64_t *out, size_t n) {
+    memset(out, 0, n * sizeof(uint64_t));
+
+    bool over = false;
+    const size_t words = fixed_words(L, idx);
+
+    if (words != 0) {
+        const uint64_t *const src = (const uint64_t*)lua_touserdata(L, idx);
+
+        size_t i;
+        for (i = 0; i < words; i++) {
+            if (i < n) {
+                out[i] = src[i];
+            } else {
+                over |= (src[i] != 0);
+            }
+        }
+
+        return over;
+    }
+
+    const Bitset *const bitset = test_bitset(L, idx);
+
+    if (bitset == NULL) {
+        luaL_typerror(L, idx, "fixed bitset or bitset");
+    }
+
+    const size_t per_word = FIXED_WORD_BITS / BITWIDTH;
+
+    size_t j;
+    for (j = 0; j < bitset->len; j++) {
+        if (j / per_word < n) {
+            out[j / per_word] |=
+                (uint64_t)bitset->bits[j] << (j % per_word * BITWIDTH);
+        } else {
+            over |= (bitset->bits[j] != 0);
+        }
+    }
+
+    return over;
+}
+
+
+// The index of the first set bit at or after `idx` in `n` words, or `NO_BIT`.
+static size_t fixed_next_set(const uint64_t *words, size_t n, size_t idx) {
+    size_t i = idx / FIXED_WORD_BITS;
+
+    if (i >= n) {
+        return NO_BIT;
+    }
+
+    uint64_t word = words[i] & (~UINT64_C(0) << (idx % FIXED_WORD_BITS));
+
+    while (word == 0) {
+        if (++i == n) {
+            return NO_BIT;
+        }
+
+        word = words[i];
+    }
+
+    return i * FIXED_WORD_BITS + (size_t)__builtin_ctzll(word);
+}
+
+
+#define FIXED_BINOP(BITS, W, SLOT, NAME, EXPR, GROWS)                          \
+static int fixed##BITS##_##NAME(lua_State *L) {                                \
+    const uint64_t *const a = fixed##BITS##_check(L, 1);                       \
+    uint64_t tmp[W];                                                           \
+    bool over;                                                                 \
+    const uint64_t *const b = fixed##BITS##_other(L, 2, tmp, &over);           \
+                                                                               \
+    if (GROWS && over) {                                                       \
+        luaL_argerror(L, 2, "has bits past the width of the fixed bitset");    \
+    }                                                                          \
+                                                                               \
+    uint64_t *const out = fixed##BITS##_push(L);                               \
+                                                                               \
+    size_t i;                                                                  \
+    for (i = 0; i < W; i++) {                                                  \
+        out[i] = EXPR;                                                         \
+    }                                                                          \
+                                                                               \
+    return 1;                                                                  \
+}                                                                              \
+                                                                               \
+static int fixed##BITS##_##NAME##_mut(lua_State *L) {                          \
+    uint64_t *const a = fixed##BITS##_check(L, 1);                             \
+    uint64_t tmp[W];                                                           \
+    bool over;                                                                 \
+    const uint64_t *const b = fixed##BITS##_other(L, 2, tmp, &over);           \
+                                                                               \
+    if (GROWS && over) {                                                       \
+        luaL_argerror(L, 2, "has bits past the width of the fixed bitset");    \
+    }                                                                          \
+                                                                               \
+    size_t i;                                                                  \
+    for (i = 0; i < W; i++) {                                                  \
+        a[i] = EXPR;                                                           \
+    }                                                                          \
+                                                                               \
+    lua_settop(L, 1);                                                          \
+    return 1;                                                                  \
+}
+
+
+#define DEFINE_FIXED(BITS, W, SLOT)                                            \
+static uint64_t *fixed##BITS##_push(lua_State *L) {                            \
+    uint64_t *const words =                                                    \
+        (uint64_t*)lua_newuserdata(L, W * sizeof(uint64_t));                   \
+                                                                               \
+    lua_pushvalue(L, FIXED_MT(SLOT));                                          \
+    lua_setmetatable(L, -2);                                                   \
+                                                                               \
+    return words;                                                              \
+}                                                                              \
+                                                                               \
+static uint64_t *fixed##BITS##_check(lua_State *L, int idx) {                  \
+    uint64_t *const words = (uint64_t*)lua_touserdata(L, idx);                 \
+                                                                               \
+    if (words != NULL && lua_getmetatable(L, idx)) {                           \
+        const bool ok = lua_rawequal(L, -1, FIXED_MT(SLOT));                   \
+        lua_pop(L, 1);                                                         \
+                                                                               \
+        if (ok) {                                                              \
+            return words;                                                      \
+        }                                                                      \
+    }                                                                          \
+                                                                               \
+    luaL_typerror(L, idx, "fixed bitset");                                     \
+    return NULL;                                                               \
+}                                                                              \
+                                                                               \
+/* The second operand of a binary operation, straight out of its userdata if   \
+   it's the same width, or else read into `tmp`. `over` is set if it has bits  \
+   past the width. */                                                          \
+static const uint64_t *fixed##BITS##_other(lua_State *L, int idx, uint64_t *tmp, \
+        bool *over) {                                                          \
+    const uint64_t *const words = (const uint64_t*)lua_touserdata(L, idx);     \
+                                                                               \
+    if (words != NULL && lua_getmetatable(L, idx)) {                           \
+        const bool same = lua_rawequal(L, -1, FIXED_MT(SLOT));                 \
+        lua_pop(L, 1);                                                         \
+                                                                               \
+        if (same) {                                                            \
+            *over = false;                                                     \
+            return words;                                                      \
+        }                                                                      \
+    }                                                                          \
+                                                                               \
+    *over = fixed_operand(L, idx, tmp, W);                                     \
+    return tmp;                                                                \
+}                                                                              \
+                                                                               \
+static int fixed##BITS##_set(lua_State *L) {                                   \
+    uint64_t *const a = fixed##BITS##_check(L, 1);                             \
+    const size_t idx = fixed_index(L, 2, W * FIXED_WORD_BITS);                 \
+                                                                               \
+    a[idx / FIXED_WORD_BITS] |= UINT64_C(1) << (idx % FIXED_WORD_BITS);        \
+                                                                               \
+    lua_settop(L, 1);                                                          \
+    return 1;                                                                  \
+}                                                                              \
+                                                                               \
+static int fixed##BITS##_clear(lua_State *L) {                                 \
+    uint64_t *const a = fixed##BITS##_check(L, 1);                             \
+    const size_t idx = fixed_index(L, 2, W * FIXED_WORD_BITS);                 \
+                                                                               \
+    a[idx / FIXED_WORD_BITS] &= ~(UINT64_C(1) << (idx % FIXED_WORD_BITS));     \
+                                                                               \
+    lua_settop(L, 1);                                                          \
+    return 1;                                                                  \
+}                                                                              \
+                                                                               \
+static int fixed##BITS##_get(lua_State *L) {                                   \
+    const uint64_t *const a = fixed##BITS##_check(L, 1);                       \
+    const size_t idx = fixed_index(L, 2, W * FIXED_WORD_BITS);                 \
+                                                                               \
+    lua_pushboolean(L,                                                         \
+        (a[idx / FIXED_WORD_BITS] >> (idx % FIXED_WORD_BITS)) & 1);            \
+    return 1;                                                                  \
+}                                                                              \
+                                                                               \
+static int fixed##BITS##_count(lua_State *L) {                                 \
+    const uint64_t *const a = fixed##BITS##_check(L, 1);                       \
+    size_t n = 0;                                                              \
+                                                                               \
+    size_t i;                                                                  \
+    for (i = 0; i < W; i++) {                                                  \
+        n += BLOCK_POPCOUNT(a[i]);                                             \
+    }                                                                          \
+                                                                               \
+    lua_pushinteger(L, (lua_Integer)n);                                        \
+    return 1;                                                                  \
+}                                                                              \
+                                                                               \
+static int fixed##BITS##_width(lua_State *L) {                                 \
+    fixed##BITS##_check(L, 1);                                                 \
+                                                                               \
+    lua_pushinteger(L, W * FIXED_WORD_BITS);                                   \
+    return 1;                                                                  \
+}                                                                              \
+                                                                               \
+FIXED_BINOP(BITS, W, SLOT, union, a[i] | b[i], true)                           \
+FIXED_BINOP(BITS, W, SLOT, intersection, a[i] & b[i], false)                   \
+FIXED_BINOP(BITS, W, SLOT, difference, a[i] & ~b[i], false)                    \
+FIXED_BINOP(BITS, W, SLOT, symmetric_diff, a[i] ^ b[i], true)                  \
+                                                                               \
+static int fixed##BITS##_eq(lua_State *L) {                                    \
+    const uint64_t *const a = fixed##BITS##_check(L, 1);                       \
+    uint64_t tmp[W];                                                           \
+    bool over;                                                                 \
+    const uint64_t *const b = fixed##BITS##_other(L, 2, tmp, &over);           \
+    uint64_t diff = 0;                                                         \
+                                                                               \
+    size_t i;                                                                  \
+    for (i = 0; i < W; i++) {                                                  \
+        diff |= a[i] ^ b[i];                                                   \
+    }                                                                          \
+                                                                               \
+    lua_pushboolean(L, diff == 0 && !over);                                    \
+    return 1;                                                                  \
+}                                                                              \
+                                                                               \
+static int fixed##BITS##_subset(lua_State *L) {                                \
+    const uint64_t *const a = fixed##BITS##_check(L, 1);                       \
+    uint64_t tmp[W];                                                           \
+    bool over;                                                                 \
+    const uint64_t *const b = fixed##BITS##_other(L, 2, tmp, &over);           \
+    uint64_t extra = 0;                                                        \
+                                                                               \
+    size_t i;                                                                  \
+    for (i = 0; i < W; i++) {                                                  \
+        extra |= a[i] & ~b[i];                                                 \
+    }                                                                          \
+                                                                               \
+    lua_pushboolean(L, extra == 0);                                            \
+    return 1;                                                                  \
+}                                                                              \
+                                                                               \
+static int fixed##BITS##_strict_subset(lua_State *L) {                         \
+    const uint64_t *const a = fixed##BITS##_check(L, 1);                       \
+    uint64_t tmp[W];                                                           \
+    bool over;                                                                 \
+    const uint64_t *const b = fixed##BITS##_other(L, 2, tmp, &over);           \
+    uint64_t extra = 0, missing = 0;                                           \
+                                                                               \
+    size_t i;                                                                  \
+    for (i = 0; i < W; i++) {                                                  \
+        extra |= a[i] & ~b[i];                                                 \
+        missing |= b[i] & ~a[i];                                               \
+    }                                                                          \
+                                                                               \
+    lua_pushboolean(L, extra == 0 && (missing != 0 || over));                  \
+    return 1;                                                                  \
+}                                                                              \
+                                                                               \
+static int fixed##BITS##_intersects(lua_State *L) {                            \
+    const uint64_t *const a = fixed##BITS##_check(L, 1);                       \
+    uint64_t tmp[W];                                                           \
+    bool over;                                                                 \
+    const uint64_t *const b = fixed##BITS##_other(L, 2, tmp, &over);           \
+    uint64_t common = 0;                                                       \
+                                                                               \
+    size_t i;                                                                  \
+    for (i = 0; i < W; i++) {                                                  \
+        common |= a[i] & b[i];                                                 \
+    }                                                                          \
+                                                                               \
+    lua_pushboolean(L, common != 0);                                           \
+    return 1;                                                                  \
+}                                                                              \
+                                                                               \
+static int fixed##BITS##_is_disjoint(lua_State *L) {                           \
+    fixed##BITS##_intersects(L);                                               \
+                                                                               \
+    lua_pushboolean(L, !lua_toboolean(L, -1));                                 \
+    return 1;                                                                  \
+}                                                                              \
+                                                                               \
+static int fixed##BITS##_iter_next(lua_State *L) {                             \
+    const uint64_t *const a = fixed##BITS##_check(L, 1);                       \
+    const lua_Integer prev = luaL_checkinteger(L, 2);                          \
+                                                                               \
+    push_bit_index(L, fixed_next_set(a, W, prev < 0 ? 0 : (size_t)prev + 1));  \
+    return 1;                                                                  \
+}                                                                              \
+                                                                               \
+static int fixed##BITS##_iter(lua_State *L) {                                  \
+    fixed##BITS##_check(L, 1);                                                 \
+                                                                               \
+    push_closure(L, fixed##BITS##_iter_next, 0);                               \
+    lua_pushvalue(L, 1);                                                       \
+    lua_pushinteger(L, -1);                                                    \
+    return 3;                                                                  \
+}                                                                              \
+                                                                               \
+static int fixed##BITS##_to_bitset(lua_State *L) {                             \
+    const uint64_t *const a = fixed##BITS##_check(L, 1);                       \
+                                                                               \
+    Bitset *const bitset =                                                     \
+        bs_alloc(L, W * (FIXED_WORD_BITS / BITWIDTH), NULL);                   \
+    fixed_to_blocks(a, W, bitset->bits);                                       \
+                                                                               \
+    return 1;                                                                  \
+}                                                                              \
+                                                                               \
+static const luaL_reg fixed##BITS##_methods[] = {                              \
+    {"set", fixed##BITS##_set},                                                \
+    {"clear", fixed##BITS##_clear},                                            \
+    {"get", fixed##BITS##_get},                                                \
+    {"count", fixed##BITS##_count},                                            \
+    {"width", fixed##BITS##_width},                                            \
+    {"union", fixed##BITS##_union},                                            \
+    {"union_mut", fixed##BITS##_union_mut},                                    \
+    {"intersection", fixed##BITS##_intersection},                              \
+    {"intersection_mut", fixed##BITS##_intersection_mut},                      \
+    {"difference", fixed##BITS##_difference},                                  \
+    {"difference_mut", fixed##BITS##_difference_mut},                          \
+    {"symmetric_diff", fixed##BITS##_symmetric_diff},                          \
+    {"symmetric_diff_mut", fixed##BITS##_symmetric_diff_mut},                  \
+    {"eq", fixed##BITS##_eq},                                                  \
+    {"subset", fixed##BITS##_subset},                                          \
+    {"intersects", fixed##BITS##_intersects},                                  \
+    {"is_disjoint", fixed##BITS##_is_disjoint},                                \
+    {"iter", fixed##BITS##_iter},                                              \
+    {"to_bitset", fixed##BITS##_to_bitset},                                    \
+    {"hash", bs_hash},                                                         \
+    {NULL, NULL},                                                              \
+};                                                                             \
+                                                                               \
+static const luaL_reg fixed##BITS##_mt[] = {                                   \
+    {"__add", fixed##BITS##_union},                                            \
+    {"__mul", fixed##BITS##_intersection},                                     \
+    {"__sub", fixed##BITS##_difference},                                       \
+    {"__len", fixed##BITS##_count},                                            \
+    {NULL, NULL},                                                              \
+};
+
+
+// One set of functions for each width, taking the number of bits, the number
+// of words and the `FIXED_MT` slot. Each function checks for its own width
+// with a single comparison, and every loop over the words has a constant trip
+// count, so the compiler unrolls all of them.
+DEFINE_FIXED(64, 1, 1)
+DEFINE_FIXED(128, 2, 2)
+DEFINE_FIXED(256, 4, 3)
+
+static const luaL_reg *const fixed_methods[FIXED_SLOTS] = {
+    fixed64_methods, fixed128_methods, fixed256_methods,
+};
+
+static const luaL_reg *const fixed_mts[FIXED_SLOTS] = {
+    fixed64_mt, fixed128_mt, fixed256_mt,
+};
+
+// Lua only calls a comparison metamethod if both operands have the very same
+// one, so every bitset metatable shares these, which hand off to the function
+// for the type of the left-hand operand.
+static const lua_CFunction fixed_eqs[FIXED_SLOTS] = {
+    fixed64_eq, fixed128_eq, fixed256_eq,
+};
+
+static const lua_CFunction fixed_strict_subsets[FIXED_SLOTS] = {
+    fixed64_strict_subset, fixed128_strict_subset, fixed256_strict_subset,
+};
+
+static const lua_CFunction fixed_subsets[FIXED_SLOTS] = {
+    fixed64_subset, fixed128_subset, fixed256_subset,
+};
+
+static int compare(lua_State *L, const lua_CFunction *fixed,
+        lua_CFunction generic) {
+    const size_t words = fixed_words(L, 1);
+
+    if (words == 0) {
+        return generic(L);
+    }
+
+    return fixed[words == 4 ? 2 : words - 1](L);
+}
+
+static int bs_compare_eq(lua_State *L) {
+    return compare(L, fixed_eqs, bs_eq);
+}
+
+static int bs_compare_lt(lua_State *L) {
+    return compare(L, fixed_strict_subsets, bs_strict_subset);
+}
+
+static int bs_compare_le(lua_State *L) {
+    return compare(L, fixed_subsets, bs_subset);
+}
+
+static const char *const fixed_typenames[FIXED_SLOTS] = {
+    LUA_BITSET_FIXED64_TYPENAME,
+    LUA_BITSET_FIXED128_TYPENAME,
+    LUA_BITSET_FIXED256_TYPENAME,
+};
+
+
+/*** Allocate a new fixed-width bitset.
+The width is the smallest of 64, 128 and 256 bits that holds `nbits`. The new
+bitset is empty, or a copy of `src`, which can be a bitset or a fixed-width
+bitset of any width, so long as it has no bits set past the new one's width.
+
+@usage
+local Position, Velocity, Sprite = 0, 1, 2
+
+local query = bitset.fixed(64):set(Position):set(Velocity)
+local archetype = bitset.fixed(64):set(Position):set(Velocity):set(Sprite)
+
+assert(query <= archetype)
+
+@function fixed
+@tparam num nbits how many bits the bitset has to hold, up to 256.
+@tparam[opt] Bitset|FixedBitset src a bitset to copy.
+@treturn FixedBitset a newly allocated fixed-width bitset.
+*/
+static int bs_fixed(lua_State *L) {
+    const lua_Integer nbits = luaL_checkinteger(L, 1);
+
+    if (nbits < 0 || nbits > FIXED_MAX_BITS) {
+        luaL_argerror(L, 1, "expected a width up to 256 bits");
+    }
+
+    // The new bitset goes above `src`, even if there isn't one.
+    lua_settop(L, 2);
+
+    size_t words = 1;
+    int slot = 1;
+
+    while ((lua_Integer)(words * FIXED_WORD_BITS) < nbits) {
+        words *= 2;
+        slot++;
+    }
+
+    uint64_t *const out = (uint64_t*)lua_newuserdata(L,
+        words * sizeof(uint64_t));
+
+    if (lua_isnoneornil(L, 2)) {
+        memset(out, 0, words * sizeof(uint64_t));
+    } else if (fixed_operand(L, 2, out, words)) {
+        luaL_argerror(L, 2, "has bits past the width of the fixed bitset");
+    }
+
+    lua_pushvalue(L, FIXED_MT(slot));
+    lua_setmetatable(L, -2);
+
+    return 1;
+}
+
+
+/*** A map from bitsets to Lua values.
+Lua tables key userdata by identity, so two equal bitsets are two different
+keys. Maps key them by contents instead: any bitset or fixed-width bitset equal
+to a key finds its value, and looking one up hashes and compares its blocks in
+C, without making a string or anything else out of it. Good for looking up
+archetypes by their component signatures:
+
+    local archetypes = bitset.map()
+
+    archetypes:set(signature, archetype)
+    -- ...
+    local archetype = archetypes:get(signature)
+
+Keys are copied into the map, so changing a bitset after using it as a key
+doesn't change the key.
+@type BitsetMap
+*/
+
+
+static BsMap *check_map(lua_State *L, int idx) {
+    BsMap *const m = (BsMap*)lua_touserdata(L, idx);
+
+    if (m != NULL && lua_getmetatable(L, idx)) {
+        const bool ok = lua_rawequal(L, -1, MAP_MT);
+        lua_pop(L, 1);
+
+        if (ok) {
+            return m;
+        }
+    }
+
+    luaL_typerror(L, idx, "bitset map");
+    return NULL;
+}
+
+
+/*** Makes a new, empty map.
+@function map
+@treturn BitsetMap an empty map.
+*/
+static int bs_map(lua_State *L) {
+    BsMap *const m = (BsMap*)lua_newuserdata(L, sizeof(BsMap));
+
+    void *ud;
+    lua_Alloc alloc = lua_getallocf(L, &ud);
+    bm_init(m, alloc, ud);
+
+    lua_pushvalue(L, MAP_MT);
+    lua_setmetatable(L, -2);
+
+    // The values live in the map's environment, under the references its keys
+    // map to.
+    lua_newtable(L);
+    lua_setfenv(L, -2);
+
+    return 1;
+}
+
+
+static int map_gc(lua_State *L) {
+    bm_free(check_map(L, 1));
+    return 0;
+}
+
+
+/*** Looks up the value for a bitset.
+@function BitsetMap:get
+@tparam Bitset|FixedBitset key the bitset to look up.
+@return the value for `key`, or `nil` if there isn't one.
+*/
+static int map_get(lua_State *L) {
+    const BsMap *const m = check_map(L, 1);
+
+    block_t tmp[KEY_TMP_BLOCKS];
+    size_t len;
+    const block_t *const bits = check_key(L, 2, tmp, &len);
+
+    const bm_entry *const e = bm_find(m, bits, len, bm_hash(bits, len));
+
+    if (e == NULL) {
+        lua_pushnil(L);
+    } else {
+        lua_getfenv(L, 1);
+        lua_rawgeti(L, -1, e->ref);
+    }
+
+    return 1;
+}
+
+
+/*** Sets the value for a bitset.
+@function BitsetMap:set
+@tparam Bitset|FixedBitset key the bitset to set the value for.
+@param value the new value, or `nil` to remove `key` from the map.
+@treturn BitsetMap the map, for convenience.
+*/
+static int map_set(lua_State *L) {
+    BsMap *const m = check_map(L, 1);
+
+    block_t tmp[KEY_TMP_BLOCKS];
+    size_t len;
+    const block_t *const bits = check_key(L, 2, tmp, &len);
+    const uint64_t hash = bm_hash(bits, len);
+
+    luaL_checkany(L, 3);
+    lua_settop(L, 3);
+    lua_getfenv(L, 1);
+
+    const int env = 4;
+
+    if (lua_isnil(L, 3)) {
+        int ref;
+
+        if (bm_remove(m, bits, len, hash, &ref)) {
+            luaL_unref(L, env, ref);
+        }
+    } else {
+        const bm_entry *const e = bm_find(m, bits, len, hash);
+
+        if (e != NULL) {
+            lua_pushvalue(L, 3);
+            lua_rawseti(L, env, e->ref);
+        } else {
+            lua_pushvalue(L, 3);
+            const int ref = luaL_ref(L, env);
+
+            bool added;
+
+            if (bm_insert(m, bits, len, hash, ref, &added) == NULL) {
+                luaL_unref(L, env, ref);
+                error_out_of_memory(L);
+            }
+        }
+    }
+
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+/*** Counts the keys in the map.
+@function BitsetMap:count
+@treturn num the number of keys.
+*/
+static int map_count(lua_State *L) {
+    lua_pushinteger(L, (lua_Integer)check_map(L, 1)->count);
+    return 1;
+}
+
+
+/*** Removes every key from the map.
+@function BitsetMap:clear
+@treturn BitsetMap the emptied map.
+*/
+static int map_clear(lua_State *L) {
+    bm_clear(check_map(L, 1));
+
+    lua_newtable(L);
+    lua_setfenv(L, 1);
+
+    lua_settop(L, 1);
+    return 1;
+}
+
+
+#define MAP_ITER_SLOT lua_upvalueindex(NUM_UPVALUES + 1)
+
+static int map_iter_next(lua_State *L) {
+    const BsMap *const m = check_map(L, 1);
+
+    size_t i = (size_t)lua_tointeger(L, MAP_ITER_SLOT);
+    const bm_entry *const e = bm_next(m, &i);
+
+    if (e == NULL) {
+        return 0;
+    }
+
+    lua_pushinteger(L, (lua_Integer)i);
+    lua_replace(L, MAP_ITER_SLOT);
+
+    Bitset *const key = bs_alloc(L, e->len, NULL);
+    memcpy(key->bits, bm_key(e), e->len * sizeof(block_t));
+
+    lua_getfenv(L, 1);
+    lua_rawgeti(L, -1, e->ref);
+    lua_remove(L, -2);
+
+    return 2;
+}
+
+
+/*** Iterates over the keys and values in the map, in no particular order.
+Each key comes out as a new bitset, even if it was set with a fixed-width one.
+Values can be changed while iterating, but keys must not be added or removed.
+
+@usage
+for signature, archetype in archetypes:iter() do
+    print(signature:hash(), archetype)
+end
+
+@function BitsetMap:iter
+@return an iterator function, and the map.
+*/
+static int map_iter(lua_State *L) {
+    check_map(L, 1);
+
+    lua_pushinteger(L, 0);
+    push_closure(L, map_iter_next, 1);
+    lua_pushvalue(L, 1);
+    return 2;
+}
+
+
+/*** A table of fixed-width signatures, matched against queries all at once.
+Testing thousands of archetype or entity signatures against a query one
+`query <= signature` at a time costs a call for each of them. A signature table
+keeps them all together in C, and @{SignatureTable:match} scans every row in one
+call, a few rows per instruction where the CPU allows, writing the matching rows
+into a bitset or an array of row indices:
+
+    local archetypes = bitset.signature_table(64)
+
+    local row = archetypes:add(signature)
+    -- ...
+    for _,row in ipairs(archetypes:match(required, excluded, nil, {})) do
+        -- ...
+    end
+
+Rows are numbered from 0, in the order they were added, like bits.
+@type SignatureTable
+*/
+
+
+static SigTable *check_sigtable(lua_State *L, int idx) {
+    return (SigTable*)luaL_checkudata(L, idx, LUA_BITSET_SIGTABLE_TYPENAME);
+}
+
+
+// Reads the bitset or fixed-width bitset at `idx` into a row of `t`. Nothing,
+// or nil, reads as no bits set.
+static void check_row(lua_State *L, int idx, const SigTable *t,
+        uint64_t *row) {
+    if (lua_isnoneornil(L, idx)) {
+        memset(row, 0, t->words * sizeof(uint64_t));
+    } else if (fixed_operand(L, idx, row, t->words)) {
+        luaL_argerror(L, idx, "has bits past the width of the table");
+    }
+}
+
+
+static size_t check_row_index(lua_State *L, int arg, const SigTable *t) {
+    const lua_Integer r = luaL_checkinteger(L, arg);
+
+    if (r < 0 || (size_t)r >= t->len) {
+        luaL_argerror(L, arg, "row out of range");
+    }
+
+    return (size_t)r;
+}
+
+
+/*** Makes a new, empty signature table.
+@function signature_table
+@tparam num nbits how many bits each signature has to hold, up to 256. Rounded
+up the same way as @{fixed}.
+@treturn SignatureTable an empty signature table.
+*/
+static int bs_signature_table(lua_State *L) {
+    const lua_Integer nbits = luaL_checkinteger(L, 1);
+
+    if (nbits < 0 || nbits > FIXED_MAX_BITS) {
+        luaL_argerror(L, 1, "expected a width up to 256 bits");
+    }
+
+    size_t words = 1;
+
+    while ((lua_Integer)(words * FIXED_WORD_BITS) < nbits) {
+        words *= 2;
+    }
+
+    SigTable *const t = (SigTable*)lua_newuserdata(L, sizeof(SigTable));
+
+    void *ud;
+    lua_Alloc alloc = lua_getallocf(L, &ud);
+    st_init(t, alloc, ud, words);
+
+    luaL_getmetatable(L, LUA_BITSET_SIGTABLE_TYPENAME);
+    lua_setmetatable(L, -2);
+
+    return 1;
+}
+
+
+static int sigtable_gc(lua_State *L) {
+    st_free(check_sigtable(L, 1));
+    return 0;
+}
+
+
+/*** Adds a row to the end of the table.
+@function SignatureTable:add
+@tparam Bitset|FixedBitset signature the row's bits, which must fit in the
+table's width.
+@treturn num the index of the new row.
+*/
+static int sigtable_add(lua_State *L) {
+    SigTable *const t = check_sigtable(L, 1);
+
+    uint64_t row[FIXED_MAX_BITS / FIXED_WORD_BITS];
+    luaL_checkany(L, 2);
+    check_row(L, 2, t, row);
 
-    size_t blk;
-    for (blk = 0; blk < small->len; blk++) {
-        out->bits[blk] |= small->bits[blk];
+    if (!st_push(t, row)) {
+        error_out_of_memory(L);
     }
 
+    lua_pushinteger(L, (lua_Integer)(t->len - 1));
     return 1;
 }
 
 
-/*** The in-place union of two bitsets.
-NOTE: `Bitset:union_mut` is a _destructive_ operation. That is, it mutates the
-left-hand operand passed to it instead of allocating a new bitset. For a
-constructive union operation, see @{Bitset:union}.
-
-@function Bitset:union_mut
-@tparam Bitset lhs the left-hand bitset to union. Is mutated to contain the union.
-@tparam Bitset rhs the right-hand bitset to union.
-@treturn Bitset the left-hand bitset is modified in-place, but returned for convenience.
-@see Bitset:union
+/*** Overwrites a row.
+@function SignatureTable:set
+@tparam num row the index of the row.
+@tparam Bitset|FixedBitset signature the row's new bits.
+@treturn SignatureTable the table, for convenience.
 */
-static int bs_union_mut(lua_State *L) {
-    Bitset* lhs = luaL_checkudata(L, 1, LUA_BITSET_TYPENAME);
-    Bitset* rhs = luaL_checkudata(L, 2, LUA_BITSET_TYPENAME);
+static int sigtable_set(lua_State *L) {
+    SigTable *const t = check_sigtable(L, 1);
+    const size_t r = check_row_index(L, 2, t);
 
-    size_t old_len = lhs->len;
+    uint64_t row[FIXED_MAX_BITS / FIXED_WORD_BITS];
+    luaL_checkany(L, 3);
+    check_row(L, 3, t, row);
 
-    if (lhs->len < rhs->len) {
-        lhs->bits = (block_t*)realloc(lhs->bits, rhs->len * sizeof(block_t));
-        memcpy(rhs->bits + old_len, lhs->bits + old_len,
-            (rhs->len - old_len) * sizeof(block_t));
-        lhs->len = rhs->len;
+    st_set(t, r, row);
 
-        if (lhs->bits == NULL) {
-            lua_pushliteral(L, ERRORMSG_OUT_OF_MEMORY);
-            lua_error(L);
-        }
-    }
+    lua_settop(L, 1);
+    return 1;
+}
 
-    size_t blk;
-    for (blk = 0; blk < old_len; blk++) {
-        lhs->bits[blk] |= rhs->bits[blk];
-    }
 
-    lua_pushvalue(L, 1);
+/*** Gets a row.
+@function SignatureTable:get
+@tparam num row the index of the row.
+@treturn FixedBitset a copy of the row's bits, as wide as the table.
+*/
+static int sigtable_get(lua_State *L) {
+    const SigTable *const t = check_sigtable(L, 1);
+    const size_t r = check_row_index(L, 2, t);
+
+    uint64_t *const out = (uint64_t*)lua_newuserdata(L,
+        t->words * sizeof(uint64_t));
+    st_get(t, r, out);
+
+    lua_pushvalue(L, FIXED_MT(t->words == 4 ? 3 : (int)t->words));
+    lua_setmetatable(L, -2);
+
     return 1;
 }
 
 
-/*** The asymmetric difference of two bitsets. Also available as the `-` operator.
-Returns a newly allocated bitset with bits set iff they are set in the left-hand
-operand but not in the right-hand operand.
-
-NOTE: `Bitset:difference` is a _constructive_ operation. That is, it allocates a
-new bitset to return the results. For an in-place asymmetric difference
-operation, see @{Bitset:difference_mut}.
+/*** Removes a row, moving the last row into its place.
+Keeps the rows packed without shifting all of them down, so the row that was
+last changes index. Whatever is kept alongside the rows has to be moved the
+same way.
 
-@function Bitset:difference
-@tparam Bitset lhs the source bitset.
-@tparam Bitset rhs the bitset to "subtract" from the source.
-@treturn Bitset a newly allocated bitset with all bits set that are set in `lhs` but not in `rhs`.
-@see Bitset:difference_mut
+@function SignatureTable:remove
+@tparam num row the index of the row to remove.
+@treturn ?num the index the last row had before it moved to `row`, or `nil` if
+`row` was the last row.
 */
-static int bs_difference(lua_State *L) {
-    const Bitset *const lhs = luaL_checkudata(L, 1, LUA_BITSET_TYPENAME);
-    const Bitset *const rhs = luaL_checkudata(L, 2, LUA_BITSET_TYPENAME);
+static int sigtable_remove(lua_State *L) {
+    SigTable *const t = check_sigtable(L, 1);
+    const size_t r = check_row_index(L, 2, t);
 
-    Bitset *const out = bs_alloc(L, lhs->len);
-    memcpy(lhs->bits, out->bits, lhs->len * sizeof(block_t));
+    st_swap_remove(t, r);
 
-    size_t blk;
-    for (blk = 0; blk < lhs->len; blk++) {
-        out->bits[blk] &= ~rhs->bits[blk];
+    if (r == t->len) {
+        lua_pushnil(L);
+    } else {
+        lua_pushinteger(L, (lua_Integer)t->len);
     }
 
     return 1;
 }
 
 
-/*** The in-place asymmetric difference of two bitsets.
-Clears any bits in the left-hand operand if they are set in the right-hand.
+/*** Counts the rows in the table.
+@function SignatureTable:count
+@treturn num the number of rows.
+*/
+static int sigtable_count(lua_State *L) {
+    lua_pushinteger(L, (lua_Integer)check_sigtable(L, 1)->len);
+    return 1;
+}
 
-NOTE: `Bitset:difference_mut` is a _destructive_ operation. That is, it modifies
-the left-hand operand in-place instead of allocating a new bitset to hold the
-result. For a constructive asymmetric difference operation, see
-@{Bitset:difference}.
 
-@function Bitset:difference_mut
-@tparam Bitset lhs the bitset to modify.
-@tparam Bitset rhs the bitset to "subtract" from the left-hand.
-@treturn Bitset the left-hand bitset is modified in place, but returned for convenience.
-@see Bitset:difference
+/*** Gets the width of the table's rows.
+@function SignatureTable:width
+@treturn num the number of bits in a row: 64, 128 or 256.
 */
-static int bs_difference_mut(lua_State *L) {
-    Bitset *const lhs = luaL_checkudata(L, 1, LUA_BITSET_TYPENAME);
-    const Bitset *const rhs = luaL_checkudata(L, 2, LUA_BITSET_TYPENAME);
+static int sigtable_width(lua_State *L) {
+    lua_pushinteger(L,
+        (lua_Integer)(check_sigtable(L, 1)->words * FIXED_WORD_BITS));
+    return 1;
+}
 
-    const size_t len = (lhs->len > rhs->len) ? rhs->len : lhs->len;
 
-    size_t blk;
-    for (blk = 0; blk < len; blk++) {
-        lhs->bits[blk] &= ~rhs->bits[blk];
-    }
+/*** Removes every row, keeping the memory for reuse.
+@function SignatureTable:clear
+@treturn SignatureTable the emptied table.
+*/
+static int sigtable_clear(lua_State *L) {
+    check_sigtable(L, 1)->len = 0;
 
-    lua_pushvalue(L, 1);
+    lua_settop(L, 1);
     return 1;
 }
 
 
-/*** The symmetric difference of two bitsets.
-Returns a newly allocated bitset with bits set iff they are set in only the
-left-hand operand or the right-hand operand, but not both.
+// Rows a match into an index array can go through without allocating.
+#define MATCH_TMP_BLOCKS 64
 
-NOTE: `Bitset:symmetric_diff` is a _constructive_ operation. That is, it
-allocates a new bitset to hold the result rather than modifying the operands
-in-place. For an in-place symmetric difference operation, see
-@{Bitset:symmetric_diff_mut}.
 
-@function Bitset:symmetric_diff
-@tparam Bitset lhs the left-hand bitset for the symmetric difference operation.
-@tparam Bitset rhs the right-hand bitset for the symmetric difference operation.
-@treturn Bitset a newly allocated bitset with all bits set that are set in either `lhs` or `rhs`, but not in both.
-@see Bitset:symmetric_diff_mut
+/*** Finds every row matching a query.
+A row matches if it has every bit of `all`, none of the bits of `none`, and at
+least one bit of `any`, unless `any` has no bits set. Any of the masks can be
+`nil` to leave it out. This is the same as testing
+`all <= row and not row:intersects(none) and row:intersects(any)` for each
+row, but done for all of them in one scan.
+
+The result goes into `out`. Given a bitset, bit `i` of it is set exactly when
+row `i` matches. Given a table, it's filled with the indices of the matching
+rows, in increasing order, from 1, and anything in it past them is cleared, so
+the same table can be reused every frame.
+
+@usage
+local rows = {}
+
+for _,query in ipairs(queries) do
+    local _, n = archetypes:match(query.all, query.none, query.any, rows)
+    -- ...
+end
+
+@function SignatureTable:match
+@tparam ?Bitset|FixedBitset all the bits every matching row has.
+@tparam ?Bitset|FixedBitset none the bits no matching row has.
+@tparam ?Bitset|FixedBitset any bits of which every matching row has at least
+one, the query's optional part.
+@tparam[opt] Bitset|table out where to write the matches. If not given, a new
+bitset.
+@treturn Bitset|table `out`.
+@treturn num the number of matching rows, if `out` is a table.
 */
-static int bs_symmetric_diff(lua_State *L) {
-    const Bitset *const lhs = luaL_checkudata(L, 1, LUA_BITSET_TYPENAME);
-    const Bitset *const rhs = luaL_checkudata(L, 2, LUA_BITSET_TYPENAME);
+static int sigtable_match(lua_State *L) {
+    const SigTable *const t = check_sigtable(L, 1);
 
-    size_t min_len;
-    Bitset* out;
+    uint64_t all[FIXED_MAX_BITS / FIXED_WORD_BITS];
+    uint64_t none[FIXED_MAX_BITS / FIXED_WORD_BITS];
+    uint64_t any[FIXED_MAX_BITS / FIXED_WORD_BITS];
 
-    if (lhs->len > rhs->len) {
-        out = bs_alloc(L, lhs->len);
+    check_row(L, 2, t, all);
+    check_row(L, 3, t, none);
+    check_row(L, 4, t, any);
 
-        const size_t len_diff = lhs->len - rhs->len;
-        memcpy(lhs->bits + len_diff, out->bits + len_diff,
-            len_diff * sizeof(block_t));
+    const size_t nblocks = (t->len + BITWIDTH - 1) / BITWIDTH;
 
-        min_len = rhs->len;
-    } else {
-        out = bs_alloc(L, rhs->len);
+    if (!lua_istable(L, 5)) {
+        Bitset *out;
 
-        const size_t len_diff = rhs->len - lhs->len;
-        memcpy(rhs->bits + len_diff, out->bits + len_diff,
-            len_diff * sizeof(block_t));
+        if (lua_isnoneornil(L, 5)) {
+            out = bs_alloc(L, nblocks, NULL);
+        } else {
+            out = check_bitset_mut(L, 5);
+            bs_resize(L, 5, out, nblocks);
+            lua_settop(L, 5);
+        }
 
-        min_len = lhs->len;
+        st_match(t, all, none, any, out->bits);
+        return 1;
     }
 
-    size_t blk;
-    for (blk = 0; blk < min_len; blk++) {
-        out->bits[blk] = lhs->bits[blk] ^ rhs->bits[blk];
-    }
+    lua_settop(L, 5);
 
-    return 1;
-}
+    block_t tmp[MATCH_TMP_BLOCKS];
+    block_t *const bits = (nblocks <= MATCH_TMP_BLOCKS) ? tmp :
+        (block_t*)lua_newuserdata(L, nblocks * sizeof(block_t));
 
+    st_match(t, all, none, any, bits);
 
-/*** The in-place symmetric difference of two bitsets.
-Modifies the left-hand operand to contain bits that are set in the right-hand
-but not in the left-hand, and clears any bits that are set in both.
+    int n = 0;
 
-NOTE: `Bitset:symmetric_diff_mut` is a _destructive_ operation. That is, it
-modifies the left-hand operand in-place instead of allocating a new bitset to
-hold the result. For a constructive symmetric difference operation, see
-@{Bitset:symmetric_diff}.
+    size_t blk;
+    for (blk = 0; blk < nblocks; blk++) {
+        block_t block = bits[blk];
 
-@function Bitset:symmetric_diff_mut
-@tparam Bitset lhs the bitset to modify.
-@tparam Bitset rhs the bitset to compare against.
-@treturn Bitset the left-hand bitset is modified in place, but returned for convenience.
-@see Bitset:symmetric_diff
-*/
-static int bs_symmetric_diff_mut(lua_State *L) {
-    Bitset *const lhs = luaL_checkudata(L, 1, LUA_BITSET_TYPENAME);
-    const Bitset *const rhs = luaL_checkudata(L, 2, LUA_BITSET_TYPENAME);
-
-    if (rhs->len > lhs->len) {
-        lhs->bits = (block_t*)realloc(lhs->bits,
-            rhs->len * sizeof(block_t));
-        memcpy(rhs->bits + lhs->len, lhs->bits + lhs->len,
-            (rhs->len - lhs->len) * sizeof(block_t));
-        lhs->len = rhs->len;
+        while (block != 0) {
+            lua_pushinteger(L,
+                (lua_Integer)(blk * BITWIDTH + BLOCK_CTZ(block)));
+            lua_rawseti(L, 5, ++n);
+
+            block &= block - 1;
+        }
     }
 
-    size_t blk;
-    for (blk = 0; blk < lhs->len; blk++) {
-        lhs->bits[blk] ^= rhs->bits[blk];
+    // Clear out whatever the table held from last time.
+    int i;
+    for (i = (int)lua_objlen(L, 5); i > n; i--) {
+        lua_pushnil(L);
+        lua_rawseti(L, 5, i);
     }
 
-    lua_pushvalue(L, 1);
-    return 1;
+    lua_pushvalue(L, 5);
+    lua_pushinteger(L, n);
+    return 2;
 }
 
 
-static int bs_eq(lua_State *L) {
-    const Bitset *const lhs = luaL_checkudata(L, 1, LUA_BITSET_TYPENAME);
-    const Bitset *const rhs = luaL_checkudata(L, 2, LUA_BITSET_TYPENAME);
+/*
+ * Plain C entry points, for the LuaJIT FFI front end in `bitset_ffi.lua`. These
+ * take a pointer to the bitset userdata's payload and skip all of the Lua API
+ * argument checking, so they can be called from inside compiled traces.
+ */
 
-    const Bitset* small;
-    const Bitset* large;
+LUALIB_API size_t laser_bitset_count(Bitset *bitset) {
+    return count_bits(bitset);
+}
 
-    if (lhs->len > rhs->len) {
-        large = lhs;
-        small = rhs;
-    } else {
-        large = rhs;
-        small = lhs;
-    }
 
-    size_t blk;
-    for (blk = 0; blk < small->len; blk++) {
-        if (small->bits[blk] != large->bits[blk]) {
-            lua_pushboolean(L, false);
-            return 1;
+LUALIB_API size_t laser_bitset_next_set(const Bitset *bitset, size_t idx) {
+    return find_next_set(bitset, idx);
+}
+
+
+// Sets the bits at `n` indices. If any of them is negative nothing is changed,
+// and `NO_BIT` is returned. If they don't all fit in the bitset's capacity
+// nothing is changed either, and the number of bits it has to have room for is
+// returned. Otherwise the bitset is lengthened as needed, and 0 is returned.
+LUALIB_API size_t laser_bitset_set_many(Bitset *bitset, const int32_t *idx,
+        size_t n) {
+    size_t top = 0;
+
+    size_t i;
+    for (i = 0; i < n; i++) {
+        if (idx[i] < 0) {
+            return NO_BIT;
         }
-    }
 
-    for (; blk < large->len; blk++) {
-        if (large->bits[blk] != 0) {
-            lua_pushboolean(L, false);
-            return 1;
+        if ((size_t)idx[i] >= top) {
+            top = (size_t)idx[i] + 1;
         }
     }
 
-    lua_pushboolean(L, true);
-    return 1;
-}
+    if (top > bitset->cap * BITWIDTH) {
+        return top;
+    }
 
+    const size_t len = (top + BITWIDTH - 1) / BITWIDTH;
 
-static int bs_subset(lua_State *L) {
-    const Bitset *const lhs = luaL_checkudata(L, 1, LUA_BITSET_TYPENAME);
-    const Bitset *const rhs = luaL_checkudata(L, 2, LUA_BITSET_TYPENAME);
+    if (len > bitset->len) {
+        memset(bitset->bits + bitset->len, 0,
+            (len - bitset->len) * sizeof(block_t));
+        bitset->len = len;
+    }
 
-    size_t blk;
-    if (lhs->len < rhs->len) {
-        for (blk = 0; blk < lhs->len; blk++) {
-            if ((lhs->bits[blk] | rhs->bits[blk]) != rhs->bits[blk]) {
-                lua_pushboolean(L, false);
-                return 1;
-            }
-        }
-    } else {
-        for (blk = 0; blk < rhs->len; blk++) {
-            if ((lhs->bits[blk] | rhs->bits[blk]) != rhs->bits[blk]) {
-                lua_pushboolean(L, false);
-                return 1;
-            }
-        }
+    block_t *const bits = bitset->bits;
+    size_t flips = 0;
 
-        for (; blk < lhs->len; blk++) {
-            if (lhs->bits[blk] != 0) {
-                lua_pushboolean(L, false);
-                return 1;
-            }
-        }
+    for (i = 0; i < n; i++) {
+        const block_t mask = JUST_ONE << ((size_t)idx[i] % BITWIDTH);
+
+        flips += !(bits[(size_t)idx[i] / BITWIDTH] & mask);
+        bits[(size_t)idx[i] / BITWIDTH] |= mask;
     }
 
-    lua_pushboolean(L, true);
-    return 1;
-}
+    if (flips > 0) {
+        bs_flipped(bitset, flips, true);
+    }
 
+    return 0;
+}
 
-static int bs_strict_subset(lua_State *L) {
-    const Bitset *const lhs = luaL_checkudata(L, 1, LUA_BITSET_TYPENAME);
-    const Bitset *const rhs = luaL_checkudata(L, 2, LUA_BITSET_TYPENAME);
 
-    bool strict = false;
-    size_t blk;
-    if (lhs->len < rhs->len) {
-        for (blk = 0; blk < lhs->len; blk++) {
-            if ((lhs->bits[blk] | rhs->bits[blk]) != rhs->bits[blk]) {
-                lua_pushboolean(L, false);
-                return 1;
-            } else if (lhs->bits[blk] != rhs->bits[blk]) {
-                strict = true;
-            }
+// Clears the bits at `n` indices. Returns `NO_BIT`, changing nothing, if any of
+// them is negative, and 0 otherwise.
+LUALIB_API size_t laser_bitset_clear_many(Bitset *bitset, const int32_t *idx,
+        size_t n) {
+    size_t i;
+    for (i = 0; i < n; i++) {
+        if (idx[i] < 0) {
+            return NO_BIT;
         }
+    }
 
-        for (; blk < rhs->len; blk++) {
-            if (rhs->bits[blk] != 0) {
-                strict = true;
-            }
-        }
-    } else {
-        for (blk = 0; blk < rhs->len; blk++) {
-            if ((lhs->bits[blk] | rhs->bits[blk]) != rhs->bits[blk]) {
-                lua_pushboolean(L, false);
-                return 1;
-            } else if (lhs->bits[blk] != rhs->bits[blk]) {
-                strict = true;
-            }
-        }
+    block_t *const bits = bitset->bits;
+    const size_t maxbits = bitset->len * BITWIDTH;
+    size_t flips = 0;
 
-        for (; blk < lhs->len; blk++) {
-            if (lhs->bits[blk] != 0) {
-                lua_pushboolean(L, false);
-                return 1;
-            }
+    for (i = 0; i < n; i++) {
+        const size_t at = (size_t)idx[i];
+
+        if (at < maxbits) {
+            const block_t mask = JUST_ONE << (at % BITWIDTH);
+
+            flips += !!(bits[at / BITWIDTH] & mask);
+            bits[at / BITWIDTH] &= ~mask;
         }
     }
 
-    lua_pushboolean(L, strict);
-    return 1;
+    if (flips > 0) {
+        bs_flipped(bitset, flips, false);
+    }
+
+    return 0;
 }
 
 
-static int dump_raw(lua_State *L) {
-    Bitset *bitset = luaL_checkudata(L, 1, LUA_BITSET_TYPENAME);
+static const luaL_reg bs_funcs[] = {
+    {"new", bs_new},
+    {"arena", bs_arena},
+    {"intersection_into", bs_intersection_into},
+    {"union_into", bs_union_into},
+    {"difference_into", bs_difference_into},
+    {"symmetric_diff_into", bs_symmetric_diff_into},
+    {"from_bytes", bs_from_bytes},
+    {"from_indices", bs_from_indices},
+    {"mmap", bs_mmap},
+    {"kernel", bs_kernel},
+    {"threads", bs_threads},
+    {"fixed", bs_fixed},
+    {"map", bs_map},
+    {"signature_table", bs_signature_table},
+    {NULL, NULL},
+};
 
-    lua_Integer int_idx = luaL_checkinteger(L, 2);
 
-    // A negative index is completely invalid.
-    if (int_idx < 0) {
-        luaL_argerror(L, 2, "expected positive index");
-    }
+static const luaL_reg arena_methods[] = {
+    {"new", arena_new},
+    {"reset", arena_reset},
+    {"memory", arena_memory},
+    {NULL, NULL},
+};
 
-    size_t idx = (size_t)int_idx;
 
-    lua_pushinteger(L, bitset->bits[idx]);
-    return 1;
-}
+static const luaL_reg map_methods[] = {
+    {"get", map_get},
+    {"set", map_set},
+    {"count", map_count},
+    {"clear", map_clear},
+    {"iter", map_iter},
+    {NULL, NULL},
+};
 
 
-static int dump_len(lua_State *L) {
-    Bitset *bitset = luaL_checkudata(L, 1, LUA_BITSET_TYPENAME);
+static const luaL_reg sigtable_methods[] = {
+    {"add", sigtable_add},
+    {"set", sigtable_set},
+    {"get", sigtable_get},
+    {"remove", sigtable_remove},
+    {"count", sigtable_count},
+    {"width", sigtable_width},
+    {"clear", sigtable_clear},
+    {"match", sigtable_match},
+    {NULL, NULL},
+};
 
-    lua_pushinteger(L, bitset->len);
-    return 1;
-}
 
+static const luaL_reg sigtable_mt[] = {
+    {"__gc", sigtable_gc},
+    {"__len", sigtable_count},
+    {NULL, NULL},
+};
 
-static const luaL_reg bs_funcs[] = {
-    {"new", bs_new},
+
+static const luaL_reg map_mt[] = {
+    {"__gc", map_gc},
+    {"__len", map_count},
     {NULL, NULL},
 };
 
@@ -910,7 +4207,20 @@ static const luaL_reg bs_methods[] = {
     {"clear_range", bs_clear_range},
     {"get", bs_get},
     {"get_range", bs_get_range},
+    {"set_many", bs_set_many},
+    {"clear_many", bs_clear_many},
+    {"get_many", bs_get_many},
+    {"to_indices", bs_to_indices},
+    {"next_set", bs_next_set},
+    {"prev_set", bs_prev_set},
+    {"next_clear", bs_next_clear},
+    {"find_first_clear", bs_find_first_clear},
+    {"find_clear_run", bs_find_clear_run},
+    {"acquire_run", bs_acquire_run},
+    {"iter", bs_iter},
     {"count", bs_count},
+    {"rank", bs_rank},
+    {"select", bs_select},
     {"intersection", bs_intersection},
     {"intersection_mut", bs_intersection_mut},
     {"union", bs_union},
@@ -919,16 +4229,60 @@ static const luaL_reg bs_methods[] = {
     {"difference_mut", bs_difference_mut},
     {"symmetric_diff", bs_symmetric_diff},
     {"symmetric_diff_mut", bs_symmetric_diff_mut},
+    {"intersection_into", bs_intersection_into},
+    {"union_into", bs_union_into},
+    {"difference_into", bs_difference_into},
+    {"symmetric_diff_into", bs_symmetric_diff_into},
+    {"intersection_count", bs_intersection_count},
+    {"union_count", bs_union_count},
+    {"difference_count", bs_difference_count},
+    {"symmetric_diff_count", bs_symmetric_diff_count},
+    {"jaccard", bs_jaccard},
+    {"intersects", bs_intersects},
+    {"is_disjoint", bs_is_disjoint},
+    {"hash", bs_hash},
+    {"reserve", bs_reserve_l},
+    {"shrink_to_fit", bs_shrink_to_fit},
+    {"capacity", bs_capacity},
+    {"reallocations", bs_reallocations},
     {"dump_raw", dump_raw},
     {"dump_len", dump_len},
+    {"to_bytes", bs_to_bytes},
+    {"sync", bs_sync},
     {NULL, NULL},
 };
 
 
+// Registers `funcs` into the table at `idx`, as closures over the
+// `NUM_UPVALUES` metatables on the stack starting at `mts`: the heap and inline
+// bitset metatables, then the fixed-width ones, then the map one.
+static void register_funcs(lua_State *L, int idx, const luaL_reg *funcs,
+        int mts) {
+    for (; funcs->name != NULL; funcs++) {
+        int i;
+        for (i = 0; i < NUM_UPVALUES; i++) {
+            lua_pushvalue(L, mts + i);
+        }
+
+        lua_pushcclosure(L, funcs->func, NUM_UPVALUES);
+        lua_setfield(L, idx, funcs->name);
+    }
+}
+
+
 LUALIB_API int luaopen_bitset(lua_State *L) {
-    luaL_register(L, LUA_BITSET_LIBNAME, bs_funcs);
+    bs_kernels_init();
+
+    static const luaL_reg no_funcs[] = {
+        {NULL, NULL},
+    };
 
-    // Push a new metatable for the bitset object onto the stack.
+    luaL_register(L, LUA_BITSET_LIBNAME, no_funcs);
+    const int lib = lua_gettop(L);
+
+    // Push new metatables for the bitset object onto the stack: one for
+    // bitsets with their blocks on the heap, and one without `__gc` for those
+    // with their blocks inline.
     if (luaL_newmetatable(L, LUA_BITSET_TYPENAME) == 0) {
         lua_pushstring(L, "Uh-oh! The string used in the bitset library to \
             identify the bitset metatable is taken in the registry! Sean \
@@ -937,34 +4291,145 @@ LUALIB_API int luaopen_bitset(lua_State *L) {
         lua_error(L);
     }
 
+    const int heap_mt = lua_gettop(L);
+
+    if (luaL_newmetatable(L, LUA_BITSET_INLINE_TYPENAME) == 0) {
+        lua_pushstring(L, "Uh-oh! The string used in the bitset library to \
+            identify the inline bitset metatable is taken in the registry! \
+            Sean didn't think this would happen, so you better tell him \
+            either through github or email at <sean@errno.com>.");
+        lua_error(L);
+    }
+
+    const int inline_mt = lua_gettop(L);
+
+    // And one for each width of fixed-width bitset, right after them, so that
+    // `register_funcs` can find all of them.
+    int slot;
+    for (slot = 1; slot <= FIXED_SLOTS; slot++) {
+        if (luaL_newmetatable(L, fixed_typenames[slot - 1]) == 0) {
+            lua_pushstring(L, "Uh-oh! The string used in the bitset library \
+                to identify a fixed-width bitset metatable is taken in the \
+                registry! Sean didn't think this would happen, so you better \
+                tell him either through github or email at \
+                <sean@errno.com>.");
+            lua_error(L);
+        }
+    }
+
+    // Then the one for maps.
+    if (luaL_newmetatable(L, LUA_BITSET_MAP_TYPENAME) == 0) {
+        lua_pushstring(L, "Uh-oh! The string used in the bitset library to \
+            identify the map metatable is taken in the registry! Sean \
+            didn't think this would happen, so you better tell him either \
+            through github or email at <sean@errno.com>.");
+        lua_error(L);
+    }
+
+    const int map = lua_gettop(L);
+
+    register_funcs(L, lib, bs_funcs, heap_mt);
+
     static const struct luaL_reg bs_mt[] = {
         {"__gc", bs_gc},
         {"__add", bs_union},
         {"__mul", bs_intersection},
         {"__sub", bs_difference},
         {"__len", bs_count},
-        {"__eq", bs_eq},
-        {"__lt", bs_strict_subset},
-        {"__le", bs_subset},
+        {"__eq", bs_compare_eq},
+        {"__lt", bs_compare_lt},
+        {"__le", bs_compare_le},
         {NULL, NULL},
     };
 
     // Make a new table, and populate it with our methods.
     lua_newtable(L);
-    luaL_register(L, NULL, bs_methods);
+    register_funcs(L, lua_gettop(L), bs_methods, heap_mt);
 
     // Set the index field of our metatable to the newly populated table.
-    lua_setfield(L, -2, "__index");
+    lua_setfield(L, heap_mt, "__index");
 
     // Populate the metatable with the rest of the metafunctions.
-    luaL_register(L, NULL, bs_mt);
+    register_funcs(L, heap_mt, bs_mt, heap_mt);
 
     // Push some debug info.
     lua_pushstring(L, AUTHOR_STRING);
-    lua_setfield(L, -2, "_AUTHOR");
+    lua_setfield(L, heap_mt, "_AUTHOR");
 
     lua_pushstring(L, VERSION_STRING);
-    lua_setfield(L, -2, "_VERSION");
+    lua_setfield(L, heap_mt, "_VERSION");
+
+    // The inline metatable is a copy of the other one, minus `__gc`. The
+    // metamethods have to be the very same closures for Lua to compare an
+    // inline bitset with a heap one.
+    lua_pushnil(L);
+    while (lua_next(L, heap_mt) != 0) {
+        lua_pushvalue(L, -2);
+        lua_insert(L, -2);
+        lua_rawset(L, inline_mt);
+    }
+
+    lua_pushnil(L);
+    lua_setfield(L, inline_mt, "__gc");
+
+    // Fixed-width bitsets have nothing to free.
+    for (slot = 1; slot <= FIXED_SLOTS; slot++) {
+        const int mt = inline_mt + slot;
+
+        lua_newtable(L);
+        register_funcs(L, lua_gettop(L), fixed_methods[slot - 1], heap_mt);
+        lua_setfield(L, mt, "__index");
+
+        register_funcs(L, mt, fixed_mts[slot - 1], heap_mt);
+
+        // The comparisons are the same closures as for bitsets, so that any
+        // two kinds of bitset can be compared.
+        static const char *const comparisons[] = { "__eq", "__lt", "__le" };
+
+        size_t i;
+        for (i = 0; i < sizeof(comparisons) / sizeof(*comparisons); i++) {
+            lua_getfield(L, heap_mt, comparisons[i]);
+            lua_setfield(L, mt, comparisons[i]);
+        }
+    }
+
+    if (luaL_newmetatable(L, LUA_BITSET_ARENA_TYPENAME) == 0) {
+        lua_pushstring(L, "Uh-oh! The string used in the bitset library to \
+            identify the arena metatable is taken in the registry! Sean \
+            didn't think this would happen, so you better tell him either \
+            through github or email at <sean@errno.com>.");
+        lua_error(L);
+    }
+
+    lua_newtable(L);
+    register_funcs(L, lua_gettop(L), arena_methods, heap_mt);
+    lua_setfield(L, -2, "__index");
+
+    lua_pushcfunction(L, arena_gc);
+    lua_setfield(L, -2, "__gc");
+
+    lua_newtable(L);
+    register_funcs(L, lua_gettop(L), map_methods, heap_mt);
+    lua_setfield(L, map, "__index");
+
+    register_funcs(L, map, map_mt, heap_mt);
+
+    if (luaL_newmetatable(L, LUA_BITSET_SIGTABLE_TYPENAME) == 0) {
+        lua_pushstring(L, "Uh-oh! The string used in the bitset library to \
+            identify the signature table metatable is taken in the registry! \
+            Sean didn't think this would happen, so you better tell him \
+            either through github or email at <sean@errno.com>.");
+        lua_error(L);
+    }
+
+    lua_newtable(L);
+    register_funcs(L, lua_gettop(L), sigtable_methods, heap_mt);
+    lua_setfield(L, -2, "__index");
+
+    register_funcs(L, lua_gettop(L), sigtable_mt, heap_mt);
+
+    // Pop the metatables, leaving the library table to be returned.
+    lua_pop(L, 5 + FIXED_SLOTS);
 
     return 1;
 }
@@ -0,0 +1,455 @@
+/*
+
+Copyright (c) 2016 Sean Leffler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+/// Bloom filters, for remembering which keys have been seen in a fraction of
+/// the memory a table would take. Asking a filter whether it contains a key
+/// it was given always says yes, but asking about other keys says yes too
+/// once in a while, about as often as the false positive rate it was made
+/// with. Keys are strings or numbers.
+///
+/// The filters are blocked: each key's bits all fall in one cache line, so
+/// adding or looking up a key costs a single cache miss at most. Adding and
+/// looking up whole arrays of keys at once lets those misses overlap as well.
+// @module bloom
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#include "bitset.h"
+#include "bloom.h"
+
+#define LUA_BLOOM_LIBNAME "bloom"
+#define LUA_BLOOM_TYPENAME "_bloom_ty"
+
+#define AUTHOR_STRING "Sean Leffler <sean@errno.com>"
+#define VERSION_STRING "1.0"
+
+// Keys are hashed this many at a time by the batch methods, so that the
+// blocks for all of them can be fetched together.
+#define BATCH 32
+
+/*** A Bloom filter.
+@type Bloom
+*/
+
+
+static Bloom *bl_check(lua_State *L, int idx) {
+    return luaL_checkudata(L, idx, LUA_BLOOM_TYPENAME);
+}
+
+
+// Pushes a new, empty filter. The blocks are part of the userdata, so nothing
+// needs freeing.
+static Bloom *bl_push(lua_State *L, size_t nblocks, unsigned k) {
+    const size_t size = bl_size(nblocks);
+
+    if (size == 0) {
+        luaL_error(L, "filter too big");
+    }
+
+    Bloom *const bl = (Bloom*)lua_newuserdata(L, size);
+    bl_init(bl, nblocks, k);
+
+    luaL_getmetatable(L, LUA_BLOOM_TYPENAME);
+    lua_setmetatable(L, -2);
+
+    return bl;
+}
+
+
+// Hashes the key at `idx`, or raises an error about argument `arg`.
+static uint64_t check_key(lua_State *L, int idx, int arg) {
+    switch (lua_type(L, idx)) {
+    case LUA_TSTRING: {
+        size_t n;
+        const char *const s = lua_tolstring(L, idx, &n);
+        return bl_hash_bytes(s, n);
+    }
+    case LUA_TNUMBER:
+        return bl_hash_number(lua_tonumber(L, idx));
+    default:
+        luaL_typerror(L, arg, "string or number");
+        return 0;
+    }
+}
+
+
+// Hashes entries `[i, i + n)` of the array at `arg` into `h`.
+static void check_keys(lua_State *L, int arg, size_t i, size_t n,
+        uint64_t *h) {
+    size_t j;
+    for (j = 0; j < n; j++) {
+        lua_rawgeti(L, arg, (int)(i + j));
+
+        const int t = lua_type(L, -1);
+
+        if (t != LUA_TSTRING && t != LUA_TNUMBER) {
+            luaL_argerror(L, arg, lua_pushfstring(L,
+                "expected string or number at position %d, got %s",
+                (int)(i + j), lua_typename(L, t)));
+        }
+
+        h[j] = check_key(L, -1, arg);
+        lua_pop(L, 1);
+    }
+}
+
+
+// The array argument of the batch methods at `arg`, and how many of its
+// entries to use, which is all of them unless the argument after it says.
+static size_t check_key_array(lua_State *L, int arg) {
+    luaL_checktype(L, arg, LUA_TTABLE);
+
+    const lua_Integer n =
+        luaL_optinteger(L, arg + 1, (lua_Integer)lua_objlen(L, arg));
+
+    if (n < 0) {
+        luaL_argerror(L, arg + 1, "expected positive count");
+    }
+
+    return (size_t)n;
+}
+
+
+// The second operand of a binary operation, which has to be the same shape as
+// the first.
+static const Bloom *check_compatible(lua_State *L, const Bloom *bl, int arg) {
+    const Bloom *const other = bl_check(L, arg);
+
+    if (!bl_compatible(bl, other)) {
+        luaL_argerror(L, arg,
+            "expected a filter made with the same size and rate");
+    }
+
+    return other;
+}
+
+
+/*** Allocate a new, empty filter.
+The filter is sized to hold `n` keys with a false positive rate of about `p`.
+Adding more keys than that works, but the rate goes up. If called with a
+filter instead, it is copied.
+
+@function new
+@tparam num|Bloom n how many keys the filter is meant to hold, or a filter to
+copy.
+@tparam[opt=0.01] num p the false positive rate to aim for, between 0 and 1.
+@treturn Bloom a newly allocated filter.
+*/
+static int bl_new(lua_State *L) {
+    if (lua_isuserdata(L, 1)) {
+        const Bloom *const src = bl_check(L, 1);
+        Bloom *const bl = bl_push(L, src->nblocks, src->k);
+        bl_copy(bl, src);
+        return 1;
+    }
+
+    const lua_Number n = luaL_checknumber(L, 1);
+    const lua_Number p = luaL_optnumber(L, 2, 0.01);
+
+    if (!(n >= 0)) {
+        luaL_argerror(L, 1, "expected positive size");
+    }
+
+    if (!(p > 0 && p < 1)) {
+        luaL_argerror(L, 2, "expected a rate between 0 and 1");
+    }
+
+    size_t nblocks;
+    unsigned k;
+
+    if (!bl_params(n, p, &nblocks, &k)) {
+        luaL_error(L, "filter too big");
+    }
+
+    bl_push(L, nblocks, k);
+    return 1;
+}
+
+
+/*** Adds a key to the filter.
+@function Bloom:add
+@tparam string|num key the key to add.
+@treturn Bloom the modified filter.
+*/
+static int bl_add_l(lua_State *L) {
+    Bloom *const bl = bl_check(L, 1);
+
+    bl_add(bl, check_key(L, 2, 2));
+
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+/*** Tests whether the filter may contain a key.
+@function Bloom:contains
+@tparam string|num key the key to look for.
+@treturn bool false if the key was never added, and true if it probably was.
+*/
+static int bl_contains_l(lua_State *L) {
+    const Bloom *const bl = bl_check(L, 1);
+
+    lua_pushboolean(L, bl_contains(bl, check_key(L, 2, 2)));
+    return 1;
+}
+
+
+/*** Adds each of an array of keys to the filter.
+Does the same as calling @{Bloom:add} on each key in turn, only faster.
+
+@function Bloom:add_many
+@tparam {string|num,...} keys the keys to add.
+@tparam[opt=#keys] num n how many of the keys to use.
+@treturn Bloom the modified filter.
+*/
+static int bl_add_many_l(lua_State *L) {
+    Bloom *const bl = bl_check(L, 1);
+    const size_t n = check_key_array(L, 2);
+
+    uint64_t h[BATCH];
+
+    size_t i;
+    for (i = 0; i < n; i += BATCH) {
+        const size_t m = (n - i < BATCH) ? n - i : BATCH;
+
+        check_keys(L, 2, i + 1, m, h);
+        bl_add_many(bl, h, m);
+    }
+
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+/*** Tests whether the filter may contain each of an array of keys.
+@function Bloom:contains_many
+@tparam {string|num,...} keys the keys to look for.
+@tparam[opt=#keys] num n how many of the keys to use.
+@treturn {bool,...} the result of @{Bloom:contains} for each key, in the same
+order as `keys`.
+*/
+static int bl_contains_many_l(lua_State *L) {
+    const Bloom *const bl = bl_check(L, 1);
+    const size_t n = check_key_array(L, 2);
+
+    uint64_t h[BATCH];
+    bool found[BATCH];
+
+    lua_createtable(L, (int)n, 0);
+
+    size_t i;
+    for (i = 0; i < n; i += BATCH) {
+        const size_t m = (n - i < BATCH) ? n - i : BATCH;
+
+        check_keys(L, 2, i + 1, m, h);
+        bl_contains_many(bl, h, m, found);
+
+        size_t j;
+        for (j = 0; j < m; j++) {
+            lua_pushboolean(L, found[j]);
+            lua_rawseti(L, -2, (int)(i + j + 1));
+        }
+    }
+
+    return 1;
+}
+
+
+/*** Makes a filter holding the keys of both of two filters.
+The filters have to have been made with the same size and false positive rate.
+The result is the same as if every key had been added to one filter.
+
+@function Bloom:union
+@tparam Bloom other the other filter.
+@treturn Bloom a newly allocated filter.
+*/
+static int bl_union_l(lua_State *L) {
+    const Bloom *const bl = bl_check(L, 1);
+    const Bloom *const other = check_compatible(L, bl, 2);
+
+    Bloom *const out = bl_push(L, bl->nblocks, bl->k);
+    bl_copy(out, bl);
+    bl_union(out, other);
+
+    return 1;
+}
+
+
+/*** Adds the keys of another filter to this one, in place.
+@function Bloom:union_mut
+@tparam Bloom other the other filter.
+@treturn Bloom the modified filter.
+@see Bloom:union
+*/
+static int bl_union_mut(lua_State *L) {
+    Bloom *const bl = bl_check(L, 1);
+    bl_union(bl, check_compatible(L, bl, 2));
+
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+/*** Removes every key from the filter.
+@function Bloom:clear
+@treturn Bloom the emptied filter.
+*/
+static int bl_clear_l(lua_State *L) {
+    Bloom *const bl = bl_check(L, 1);
+    bl_clear(bl);
+
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+/*** Estimates how many distinct keys the filter holds.
+Worked out from how many of its bits are set, so it's only approximate, but
+it's usually within a few percent until the filter is well past the size it
+was made for.
+
+@function Bloom:count
+@treturn num the estimated number of keys.
+*/
+static int bl_count(lua_State *L) {
+    const Bloom *const bl = bl_check(L, 1);
+
+    lua_pushnumber(L, floor(bl_estimate(bl) + 0.5));
+    return 1;
+}
+
+
+/*** Gets the size of the filter in bits.
+@function Bloom:bits
+@treturn num the number of bits in the filter.
+*/
+static int bl_bits_l(lua_State *L) {
+    lua_pushinteger(L, (lua_Integer)bl_bits(bl_check(L, 1)));
+    return 1;
+}
+
+
+/*** Gets the number of bits each key sets.
+@function Bloom:hashes
+@treturn num the number of bits per key.
+*/
+static int bl_hashes(lua_State *L) {
+    lua_pushinteger(L, (lua_Integer)bl_check(L, 1)->k);
+    return 1;
+}
+
+
+/*** Gets how many bytes the filter takes up.
+@function Bloom:memory
+@treturn num the size of the filter's userdata, in bytes.
+*/
+static int bl_memory(lua_State *L) {
+    lua_pushinteger(L, (lua_Integer)bl_size(bl_check(L, 1)->nblocks));
+    return 1;
+}
+
+
+/*** Tests whether two filters have exactly the same bits set.
+@function Bloom:eq
+@tparam Bloom other the other filter.
+@treturn bool true if the filters are the same shape and have the same bits set.
+*/
+static int bl_eq(lua_State *L) {
+    const Bloom *const a = bl_check(L, 1);
+    const Bloom *const b = bl_check(L, 2);
+
+    lua_pushboolean(L, bl_compatible(a, b) &&
+        bs_kern->eq_blocks(a->bits, b->bits, a->nblocks * BL_BLOCK_WORDS));
+    return 1;
+}
+
+
+static const luaL_reg bl_funcs[] = {
+    {"new", bl_new},
+    {NULL, NULL},
+};
+
+
+static const luaL_reg bl_methods[] = {
+    {"add", bl_add_l},
+    {"contains", bl_contains_l},
+    {"add_many", bl_add_many_l},
+    {"contains_many", bl_contains_many_l},
+    {"union", bl_union_l},
+    {"union_mut", bl_union_mut},
+    {"clear", bl_clear_l},
+    {"count", bl_count},
+    {"bits", bl_bits_l},
+    {"hashes", bl_hashes},
+    {"memory", bl_memory},
+    {"eq", bl_eq},
+    {NULL, NULL},
+};
+
+
+LUALIB_API int luaopen_bloom(lua_State *L) {
+    bs_kernels_init();
+
+    luaL_register(L, LUA_BLOOM_LIBNAME, bl_funcs);
+
+    if (luaL_newmetatable(L, LUA_BLOOM_TYPENAME) == 0) {
+        lua_pushstring(L, "Uh-oh! The string used in the bloom library to \
+            identify the bloom metatable is taken in the registry! Sean \
+            didn't think this would happen, so you better tell him either \
+            through github or email at <sean@errno.com>.");
+        lua_error(L);
+    }
+
+    static const struct luaL_reg bl_mt[] = {
+        {"__add", bl_union_l},
+        {"__len", bl_count},
+        {"__eq", bl_eq},
+        {NULL, NULL},
+    };
+
+    lua_newtable(L);
+    luaL_register(L, NULL, bl_methods);
+    lua_setfield(L, -2, "__index");
+
+    luaL_register(L, NULL, bl_mt);
+
+    lua_pushstring(L, AUTHOR_STRING);
+    lua_setfield(L, -2, "_AUTHOR");
+
+    lua_pushstring(L, VERSION_STRING);
+    lua_setfield(L, -2, "_VERSION");
+
+    // Pop the metatable, leaving the library table to be returned.
+    lua_pop(L, 1);
+
+    return 1;
+}
@@ -0,0 +1,1049 @@
+/*
+
+Copyright (c) 2016 Sean Leffler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+/// A bitset with summary layers, for sparse sets over a large index space.
+/// The bits are stored densely, as in a `Bitset`, but above them sit two layers
+/// of summary bits marking which 64-bit words are in use. Iterating, counting
+/// and combining hierarchical bitsets skip over empty regions 64 or 4096 words
+/// at a time, so they cost time in proportion to the words in use rather than
+/// the highest index.
+///
+/// Hierarchical bitsets have the set algebra, counting, searching and
+/// serialization methods of bitsets, and any operation taking a bitset operand
+/// also accepts a dense `Bitset` there. Methods tied to a dense layout, like
+/// `rank`, `select` or `shrink_to_fit`, are left out.
+// @module hibitset
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#include "bitset.h"
+#include "bitset_lua.h"
+#include "hibitset.h"
+
+#define ERRORMSG_OUT_OF_MEMORY "Error: out of memory! Could not allocate hierarchical bitset."
+
+#define LUA_HIBITSET_LIBNAME "hibitset"
+#define LUA_HIBITSET_TYPENAME "_hibitset_ty"
+
+#define AUTHOR_STRING "Sean Leffler <sean@errno.com>"
+#define VERSION_STRING "1.0"
+
+/*** A hierarchical bitset type.
+@type HiBitset
+*/
+
+
+static void error_out_of_memory(lua_State *L) {
+    lua_pushliteral(L, ERRORMSG_OUT_OF_MEMORY);
+    lua_error(L);
+}
+
+
+// The layers are allocated with Lua's own allocator, so they show up in
+// `collectgarbage("count")` along with everything else.
+static HiBitset* hb_push(lua_State *L) {
+    HiBitset *const h = (HiBitset*)lua_newuserdata(L, sizeof(HiBitset));
+
+    void *ud;
+    const lua_Alloc alloc = lua_getallocf(L, &ud);
+    hb_init(h, alloc, ud);
+
+    luaL_getmetatable(L, LUA_HIBITSET_TYPENAME);
+    lua_setmetatable(L, -2);
+
+    return h;
+}
+
+
+static int hb_gc(lua_State *L) {
+    HiBitset *h = luaL_checkudata(L, 1, LUA_HIBITSET_TYPENAME);
+    hb_free(h);
+    return 0;
+}
+
+
+static bool has_metatable(lua_State *L, int idx, const char *tname) {
+    if (lua_touserdata(L, idx) == NULL || !lua_getmetatable(L, idx)) {
+        return false;
+    }
+
+    luaL_getmetatable(L, tname);
+    const bool eq = lua_rawequal(L, -1, -2);
+    lua_pop(L, 2);
+
+    return eq;
+}
+
+
+// Checks that an operand is a hierarchical bitset or a dense one, returning the
+// dense one or NULL.
+static const Bitset *check_dense_operand(lua_State *L, int idx) {
+    if (has_metatable(L, idx, LUA_HIBITSET_TYPENAME)) {
+        return NULL;
+    }
+
+    const Bitset *const bitset = bs_test(L, idx);
+
+    if (bitset == NULL) {
+        luaL_typerror(L, idx, "hibitset or bitset");
+    }
+
+    return bitset;
+}
+
+
+// Fetches the second operand of a binary operation, which may be a
+// hierarchical bitset or a dense bitset. Bitsets are converted into `tmp`,
+// which the caller must free with `hb_free` when done (it's harmless to do so
+// for hierarchical operands too.)
+static const HiBitset *check_operand(lua_State *L, int idx, HiBitset *tmp) {
+    void *ud;
+    const lua_Alloc alloc = lua_getallocf(L, &ud);
+    hb_init(tmp, alloc, ud);
+
+    if (has_metatable(L, idx, LUA_HIBITSET_TYPENAME)) {
+        return lua_touserdata(L, idx);
+    }
+
+    const Bitset *const bitset = check_dense_operand(L, idx);
+
+    if (!hb_from_blocks(tmp, alloc, ud, bitset->bits, bitset->len)) {
+        error_out_of_memory(L);
+    }
+
+    return tmp;
+}
+
+
+static size_t check_index(lua_State *L, int arg) {
+    const lua_Integer int_idx = luaL_checkinteger(L, arg);
+
+    // A negative index is completely invalid.
+    if (int_idx < 0) {
+        luaL_argerror(L, arg, "expected positive index");
+    }
+
+    return (size_t)int_idx;
+}
+
+
+// Checks a `[lo, hi)` range, swapping the bounds if need be.
+static void check_range(lua_State *L, size_t *lo, size_t *hi) {
+    const lua_Integer int_lo = luaL_checkinteger(L, 2);
+    const lua_Integer int_hi = luaL_checkinteger(L, 3);
+
+    if (int_lo < 0) {
+        luaL_argerror(L, 2, "expected positive lower bound");
+    }
+
+    if (int_hi < 0) {
+        luaL_argerror(L, 3, "expected positive upper bound");
+    }
+
+    *lo = (size_t)int_lo;
+    *hi = (size_t)int_hi;
+
+    if (*lo > *hi) {
+        const size_t tmp = *lo;
+        *lo = *hi;
+        *hi = tmp;
+    }
+}
+
+
+/*** Allocate a new hierarchical bitset.
+If called with a number, room is made for that many bits up front; if called
+with a hierarchical bitset or a dense `Bitset`, its contents are copied.
+
+@function new
+@tparam[opt] num|HiBitset|Bitset src the number of bits to make room for, or a bitset to copy.
+@treturn HiBitset a newly allocated hierarchical bitset.
+*/
+static int hb_new(lua_State *L) {
+    if (lua_isnoneornil(L, 1)) {
+        hb_push(L);
+        return 1;
+    }
+
+    if (lua_type(L, 1) == LUA_TNUMBER) {
+        const size_t nbits = check_index(L, 1);
+        HiBitset *const h = hb_push(L);
+
+        if (!hb_reserve(h, nbits)) {
+            error_out_of_memory(L);
+        }
+
+        return 1;
+    }
+
+    HiBitset tmp;
+    const HiBitset *const src = check_operand(L, 1, &tmp);
+
+    HiBitset *const dst = hb_push(L);
+    const bool ok = hb_copy(dst, src);
+
+    hb_free(&tmp);
+
+    if (!ok) {
+        error_out_of_memory(L);
+    }
+
+    return 1;
+}
+
+
+/*** Sets a single bit in the bitset, at a given index.
+The bitset is modified in place, but for convenience, it is also returned.
+
+@function HiBitset:set
+@tparam num idx the index of the bit to set.
+@treturn HiBitset the modified bitset.
+*/
+static int hb_set_lua(lua_State *L) {
+    HiBitset *h = luaL_checkudata(L, 1, LUA_HIBITSET_TYPENAME);
+    const size_t idx = check_index(L, 2);
+
+    if (!hb_set(h, idx)) {
+        error_out_of_memory(L);
+    }
+
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+/*** Sets a range of bits in the bitset, `[lo, hi)`.
+@function HiBitset:set_range
+@tparam num lo the low index of the range to set.
+@tparam num hi the high index of the range to set.
+@treturn HiBitset the modified bitset.
+*/
+static int hb_set_range_lua(lua_State *L) {
+    HiBitset *h = luaL_checkudata(L, 1, LUA_HIBITSET_TYPENAME);
+
+    size_t lo, hi;
+    check_range(L, &lo, &hi);
+
+    if (!hb_set_range(h, lo, hi)) {
+        error_out_of_memory(L);
+    }
+
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+/*** Clears a single bit in the bitset, at a given index.
+@function HiBitset:clear
+@tparam num idx the index of the bit to clear.
+@treturn HiBitset the modified bitset.
+*/
+static int hb_clear_lua(lua_State *L) {
+    HiBitset *h = luaL_checkudata(L, 1, LUA_HIBITSET_TYPENAME);
+
+    hb_clear(h, check_index(L, 2));
+
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+/*** Clears a range of bits in the bitset, `[lo, hi)`.
+@function HiBitset:clear_range
+@tparam num lo the low index of the range to clear.
+@tparam num hi the high index of the range to clear.
+@treturn HiBitset the modified bitset.
+*/
+static int hb_clear_range_lua(lua_State *L) {
+    HiBitset *h = luaL_checkudata(L, 1, LUA_HIBITSET_TYPENAME);
+
+    size_t lo, hi;
+    check_range(L, &lo, &hi);
+
+    hb_clear_range(h, lo, hi);
+
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+/*** Gets a single bit in the bitset, at a given index.
+@function HiBitset:get
+@tparam num idx the index of the bit to get.
+@treturn bool whether the bit is set.
+*/
+static int hb_get_lua(lua_State *L) {
+    const HiBitset *h = luaL_checkudata(L, 1, LUA_HIBITSET_TYPENAME);
+
+    lua_pushboolean(L, hb_get(h, check_index(L, 2)));
+    return 1;
+}
+
+
+/*** Gets a range of bits in the bitset, as a table.
+@function HiBitset:get_range
+@tparam num lo the low bound of the range to get.
+@tparam num hi the high bound of the range to get.
+@treturn {bool,...} the range set. Indexing starts at 1, and ends at `hi - lo + 1`.
+*/
+static int hb_get_range(lua_State *L) {
+    const HiBitset *h = luaL_checkudata(L, 1, LUA_HIBITSET_TYPENAME);
+
+    size_t lo, hi;
+    check_range(L, &lo, &hi);
+
+    lua_createtable(L, (int)(hi - lo), 0);
+
+    size_t idx;
+    for (idx = lo; idx < hi; idx++) {
+        lua_pushboolean(L, hb_get(h, idx));
+        lua_rawseti(L, -2, (int)(idx - lo + 1));
+    }
+
+    return 1;
+}
+
+
+/*** Counts how many bits are set in the bitset. Also available as `#`.
+@function HiBitset:count
+@treturn num the number of set bits.
+*/
+static int hb_count_lua(lua_State *L) {
+    const HiBitset *h = luaL_checkudata(L, 1, LUA_HIBITSET_TYPENAME);
+
+    lua_pushinteger(L, (lua_Integer)hb_count(h));
+    return 1;
+}
+
+
+static int push_binop(lua_State *L, hb_op op) {
+    const HiBitset *const lhs = luaL_checkudata(L, 1, LUA_HIBITSET_TYPENAME);
+
+    HiBitset tmp;
+    const HiBitset *const rhs = check_operand(L, 2, &tmp);
+
+    HiBitset *const out = hb_push(L);
+    const bool ok = hb_binop(op, out, lhs, rhs);
+
+    hb_free(&tmp);
+
+    if (!ok) {
+        error_out_of_memory(L);
+    }
+
+    return 1;
+}
+
+
+static int mut_binop(lua_State *L, hb_op op) {
+    HiBitset *const lhs = luaL_checkudata(L, 1, LUA_HIBITSET_TYPENAME);
+
+    HiBitset tmp;
+    const HiBitset *const rhs = check_operand(L, 2, &tmp);
+
+    const bool ok = hb_binop_mut(op, lhs, rhs);
+
+    hb_free(&tmp);
+
+    if (!ok) {
+        error_out_of_memory(L);
+    }
+
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+/*** The intersection of two bitsets. Also available as the `*` operator.
+@function HiBitset:intersection
+@tparam HiBitset lhs the left-hand bitset to intersect.
+@tparam HiBitset|Bitset rhs the right-hand bitset to intersect.
+@treturn HiBitset a newly allocated bitset containing the intersection.
+@see HiBitset:intersection_mut
+*/
+static int hb_intersection(lua_State *L) {
+    return push_binop(L, HB_AND);
+}
+
+
+/*** The in-place intersection of two bitsets.
+@function HiBitset:intersection_mut
+@tparam HiBitset lhs the left-hand bitset to intersect. Is mutated to contain the intersection.
+@tparam HiBitset|Bitset rhs the right-hand bitset to intersect.
+@treturn HiBitset the left-hand bitset is modified in-place, but returned for convenience.
+@see HiBitset:intersection
+*/
+static int hb_intersection_mut(lua_State *L) {
+    return mut_binop(L, HB_AND);
+}
+
+
+/*** The union of two bitsets. Also available as the `+` operator.
+@function HiBitset:union
+@tparam HiBitset lhs the left-hand bitset to union.
+@tparam HiBitset|Bitset rhs the right-hand bitset to union.
+@treturn HiBitset a newly allocated bitset containing the union.
+@see HiBitset:union_mut
+*/
+static int hb_union(lua_State *L) {
+    return push_binop(L, HB_OR);
+}
+
+
+/*** The in-place union of two bitsets.
+@function HiBitset:union_mut
+@tparam HiBitset lhs the left-hand bitset to union. Is mutated to contain the union.
+@tparam HiBitset|Bitset rhs the right-hand bitset to union.
+@treturn HiBitset the left-hand bitset is modified in-place, but returned for convenience.
+@see HiBitset:union
+*/
+static int hb_union_mut(lua_State *L) {
+    return mut_binop(L, HB_OR);
+}
+
+
+/*** The asymmetric difference of two bitsets. Also available as the `-` operator.
+@function HiBitset:difference
+@tparam HiBitset lhs the source bitset.
+@tparam HiBitset|Bitset rhs the bitset to "subtract" from the source.
+@treturn HiBitset a newly allocated bitset with all bits set that are set in `lhs` but not in `rhs`.
+@see HiBitset:difference_mut
+*/
+static int hb_difference(lua_State *L) {
+    return push_binop(L, HB_ANDNOT);
+}
+
+
+/*** The in-place asymmetric difference of two bitsets.
+@function HiBitset:difference_mut
+@tparam HiBitset lhs the bitset to modify.
+@tparam HiBitset|Bitset rhs the bitset to "subtract" from the left-hand.
+@treturn HiBitset the left-hand bitset is modified in place, but returned for convenience.
+@see HiBitset:difference
+*/
+static int hb_difference_mut(lua_State *L) {
+    return mut_binop(L, HB_ANDNOT);
+}
+
+
+/*** The symmetric difference of two bitsets.
+@function HiBitset:symmetric_diff
+@tparam HiBitset lhs the left-hand bitset.
+@tparam HiBitset|Bitset rhs the right-hand bitset.
+@treturn HiBitset a newly allocated bitset with all bits set that are set in either `lhs` or `rhs`, but not in both.
+@see HiBitset:symmetric_diff_mut
+*/
+static int hb_symmetric_diff(lua_State *L) {
+    return push_binop(L, HB_XOR);
+}
+
+
+/*** The in-place symmetric difference of two bitsets.
+@function HiBitset:symmetric_diff_mut
+@tparam HiBitset lhs the bitset to modify.
+@tparam HiBitset|Bitset rhs the bitset to compare against.
+@treturn HiBitset the left-hand bitset is modified in place, but returned for convenience.
+@see HiBitset:symmetric_diff
+*/
+static int hb_symmetric_diff_mut(lua_State *L) {
+    return mut_binop(L, HB_XOR);
+}
+
+
+// Writes `lhs op rhs` into `out`. When `out` is the left-hand operand this is
+// done in place; otherwise the result is built separately and replaces the
+// contents of `out`, since `out` may also be the right-hand operand.
+static int into_binop(lua_State *L, hb_op op) {
+    HiBitset *const out = luaL_checkudata(L, 1, LUA_HIBITSET_TYPENAME);
+
+    // Check the right-hand operand first, so that a converted left-hand one
+    // isn't leaked when it's the wrong type.
+    check_dense_operand(L, 3);
+
+    HiBitset lhs_tmp, rhs_tmp;
+    const HiBitset *const lhs = check_operand(L, 2, &lhs_tmp);
+    const HiBitset *const rhs = check_operand(L, 3, &rhs_tmp);
+
+    bool ok;
+
+    if (lhs == out) {
+        ok = hb_binop_mut(op, out, rhs);
+    } else {
+        HiBitset result;
+        ok = hb_binop(op, &result, lhs, rhs);
+
+        if (ok) {
+            hb_free(out);
+            *out = result;
+        }
+    }
+
+    hb_free(&lhs_tmp);
+    hb_free(&rhs_tmp);
+
+    if (!ok) {
+        error_out_of_memory(L);
+    }
+
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+/*** The intersection of two bitsets, written into a third.
+Gives the same result as @{HiBitset:intersection}, but overwrites `out` instead
+of allocating a new bitset. `out` may be one of the operands, and is updated in
+place when it is `lhs`. Also available as `hibitset.intersection_into`.
+
+@function HiBitset:intersection_into
+@tparam HiBitset out the bitset to write the intersection into.
+@tparam HiBitset|Bitset lhs the left-hand bitset to intersect.
+@tparam HiBitset|Bitset rhs the right-hand bitset to intersect.
+@treturn HiBitset `out`, for convenience.
+@see HiBitset:intersection
+*/
+static int hb_intersection_into(lua_State *L) {
+    return into_binop(L, HB_AND);
+}
+
+
+/*** The union of two bitsets, written into a third.
+Gives the same result as @{HiBitset:union}, but overwrites `out` instead of
+allocating a new bitset. `out` may be one of the operands, and is updated in
+place when it is `lhs`. Also available as `hibitset.union_into`.
+
+@function HiBitset:union_into
+@tparam HiBitset out the bitset to write the union into.
+@tparam HiBitset|Bitset lhs the left-hand bitset to union.
+@tparam HiBitset|Bitset rhs the right-hand bitset to union.
+@treturn HiBitset `out`, for convenience.
+@see HiBitset:union
+*/
+static int hb_union_into(lua_State *L) {
+    return into_binop(L, HB_OR);
+}
+
+
+/*** The asymmetric difference of two bitsets, written into a third.
+Gives the same result as @{HiBitset:difference}, but overwrites `out` instead
+of allocating a new bitset. `out` may be one of the operands, and is updated in
+place when it is `lhs`. Also available as `hibitset.difference_into`.
+
+@function HiBitset:difference_into
+@tparam HiBitset out the bitset to write the difference into.
+@tparam HiBitset|Bitset lhs the source bitset.
+@tparam HiBitset|Bitset rhs the bitset to "subtract" from the source.
+@treturn HiBitset `out`, for convenience.
+@see HiBitset:difference
+*/
+static int hb_difference_into(lua_State *L) {
+    return into_binop(L, HB_ANDNOT);
+}
+
+
+/*** The symmetric difference of two bitsets, written into a third.
+Gives the same result as @{HiBitset:symmetric_diff}, but overwrites `out`
+instead of allocating a new bitset. `out` may be one of the operands, and is
+updated in place when it is `lhs`. Also available as
+`hibitset.symmetric_diff_into`.
+
+@function HiBitset:symmetric_diff_into
+@tparam HiBitset out the bitset to write the symmetric difference into.
+@tparam HiBitset|Bitset lhs the left-hand bitset.
+@tparam HiBitset|Bitset rhs the right-hand bitset.
+@treturn HiBitset `out`, for convenience.
+@see HiBitset:symmetric_diff
+*/
+static int hb_symmetric_diff_into(lua_State *L) {
+    return into_binop(L, HB_XOR);
+}
+
+
+// The counts of `lhs`, `rhs` and their intersection, from which the rest of
+// the counting functions follow without allocating.
+static void check_counts(lua_State *L, size_t *lhs_n, size_t *rhs_n,
+        size_t *both) {
+    const HiBitset *const lhs = luaL_checkudata(L, 1, LUA_HIBITSET_TYPENAME);
+
+    HiBitset tmp;
+    const HiBitset *const rhs = check_operand(L, 2, &tmp);
+
+    *lhs_n = hb_count(lhs);
+    *rhs_n = hb_count(rhs);
+    *both = hb_intersection_count(lhs, rhs);
+
+    hb_free(&tmp);
+}
+
+
+/*** Counts the bits set in both of two bitsets, without allocating.
+@function HiBitset:intersection_count
+@tparam HiBitset lhs the left-hand bitset.
+@tparam HiBitset|Bitset rhs the right-hand bitset.
+@treturn num the number of bits set in both.
+*/
+static int hb_intersection_count_lua(lua_State *L) {
+    const HiBitset *const lhs = luaL_checkudata(L, 1, LUA_HIBITSET_TYPENAME);
+
+    HiBitset tmp;
+    const HiBitset *const rhs = check_operand(L, 2, &tmp);
+
+    const size_t n = hb_intersection_count(lhs, rhs);
+    hb_free(&tmp);
+
+    lua_pushinteger(L, (lua_Integer)n);
+    return 1;
+}
+
+
+/*** Counts the bits set in either of two bitsets, without allocating.
+@function HiBitset:union_count
+@tparam HiBitset lhs the left-hand bitset.
+@tparam HiBitset|Bitset rhs the right-hand bitset.
+@treturn num the number of bits set in `lhs`, `rhs`, or both.
+*/
+static int hb_union_count(lua_State *L) {
+    size_t lhs_n, rhs_n, both;
+    check_counts(L, &lhs_n, &rhs_n, &both);
+
+    lua_pushinteger(L, (lua_Integer)(lhs_n + rhs_n - both));
+    return 1;
+}
+
+
+/*** Counts the bits set in one bitset but not in another, without allocating.
+@function HiBitset:difference_count
+@tparam HiBitset lhs the source bitset.
+@tparam HiBitset|Bitset rhs the bitset to "subtract" from the source.
+@treturn num the number of bits set in `lhs` but not in `rhs`.
+*/
+static int hb_difference_count(lua_State *L) {
+    size_t lhs_n, rhs_n, both;
+    check_counts(L, &lhs_n, &rhs_n, &both);
+
+    lua_pushinteger(L, (lua_Integer)(lhs_n - both));
+    return 1;
+}
+
+
+/*** Counts the bits set in exactly one of two bitsets, without allocating.
+@function HiBitset:symmetric_diff_count
+@tparam HiBitset lhs the left-hand bitset.
+@tparam HiBitset|Bitset rhs the right-hand bitset.
+@treturn num the number of bits set in either `lhs` or `rhs`, but not in both.
+*/
+static int hb_symmetric_diff_count(lua_State *L) {
+    size_t lhs_n, rhs_n, both;
+    check_counts(L, &lhs_n, &rhs_n, &both);
+
+    lua_pushinteger(L, (lua_Integer)(lhs_n + rhs_n - 2 * both));
+    return 1;
+}
+
+
+/*** The Jaccard similarity of two bitsets.
+That is, the size of their intersection divided by the size of their union,
+from 0 for disjoint bitsets to 1 for equal ones. Two empty bitsets are equal,
+and so have a similarity of 1.
+
+@function HiBitset:jaccard
+@tparam HiBitset lhs the left-hand bitset.
+@tparam HiBitset|Bitset rhs the right-hand bitset.
+@treturn num the Jaccard similarity of `lhs` and `rhs`.
+*/
+static int hb_jaccard(lua_State *L) {
+    size_t lhs_n, rhs_n, both;
+    check_counts(L, &lhs_n, &rhs_n, &both);
+
+    const size_t uni = lhs_n + rhs_n - both;
+
+    lua_pushnumber(L, uni == 0 ? 1.0 : (lua_Number)both / (lua_Number)uni);
+    return 1;
+}
+
+
+/*** Tests whether two bitsets have any bits set in common.
+@function HiBitset:intersects
+@tparam HiBitset lhs the left-hand bitset.
+@tparam HiBitset|Bitset rhs the right-hand bitset.
+@treturn bool whether some bit is set in both.
+*/
+static int hb_intersects_lua(lua_State *L) {
+    const HiBitset *const lhs = luaL_checkudata(L, 1, LUA_HIBITSET_TYPENAME);
+
+    HiBitset tmp;
+    const HiBitset *const rhs = check_operand(L, 2, &tmp);
+
+    const bool any = hb_intersects(lhs, rhs);
+    hb_free(&tmp);
+
+    lua_pushboolean(L, any);
+    return 1;
+}
+
+
+/*** Tests whether two bitsets have no bits set in common.
+@function HiBitset:is_disjoint
+@tparam HiBitset lhs the left-hand bitset.
+@tparam HiBitset|Bitset rhs the right-hand bitset.
+@treturn bool whether no bit is set in both.
+*/
+static int hb_is_disjoint(lua_State *L) {
+    hb_intersects_lua(L);
+    lua_pushboolean(L, !lua_toboolean(L, -1));
+    return 1;
+}
+
+
+/*** Tests whether two bitsets have the same bits set.
+Also available as the `==` operator, although Lua only uses that between two
+hierarchical bitsets.
+
+@function HiBitset:eq
+@tparam HiBitset lhs the left-hand bitset.
+@tparam HiBitset|Bitset rhs the right-hand bitset.
+@treturn bool whether the same bits are set in both.
+*/
+static int hb_eq(lua_State *L) {
+    const HiBitset *const lhs = luaL_checkudata(L, 1, LUA_HIBITSET_TYPENAME);
+
+    HiBitset tmp;
+    const HiBitset *const rhs = check_operand(L, 2, &tmp);
+
+    const bool eq = hb_equals(lhs, rhs);
+    hb_free(&tmp);
+
+    lua_pushboolean(L, eq);
+    return 1;
+}
+
+
+/*** Tests whether every bit set in this bitset is set in another.
+Also available as the `<=` operator.
+
+@function HiBitset:subset
+@tparam HiBitset lhs the possible subset.
+@tparam HiBitset|Bitset rhs the possible superset.
+@treturn bool whether `lhs` is a subset of `rhs`.
+*/
+static int hb_subset_of(lua_State *L) {
+    const HiBitset *const lhs = luaL_checkudata(L, 1, LUA_HIBITSET_TYPENAME);
+
+    HiBitset tmp;
+    const HiBitset *const rhs = check_operand(L, 2, &tmp);
+
+    const bool subset = hb_subset(lhs, rhs);
+    hb_free(&tmp);
+
+    lua_pushboolean(L, subset);
+    return 1;
+}
+
+
+static int hb_strict_subset_of(lua_State *L) {
+    const HiBitset *const lhs = luaL_checkudata(L, 1, LUA_HIBITSET_TYPENAME);
+
+    HiBitset tmp;
+    const HiBitset *const rhs = check_operand(L, 2, &tmp);
+
+    const bool strict = hb_subset(lhs, rhs) && hb_count(lhs) < hb_count(rhs);
+    hb_free(&tmp);
+
+    lua_pushboolean(L, strict);
+    return 1;
+}
+
+
+static void push_bit_index(lua_State *L, const HiBitset *h, size_t from) {
+    const size_t idx = hb_next(h, from);
+
+    if (idx != HB_NONE) {
+        lua_pushinteger(L, (lua_Integer)idx);
+    } else {
+        lua_pushnil(L);
+    }
+}
+
+
+/*** Finds the first set bit at or after a given index.
+@function HiBitset:next_set
+@tparam num idx the index to start searching at.
+@treturn ?num the index of the next set bit, or `nil` if there are none.
+*/
+static int hb_next_set(lua_State *L) {
+    const HiBitset *h = luaL_checkudata(L, 1, LUA_HIBITSET_TYPENAME);
+
+    push_bit_index(L, h, check_index(L, 2));
+    return 1;
+}
+
+
+/*** Finds the last set bit at or before a given index.
+@function HiBitset:prev_set
+@tparam num idx the index to start searching backwards from.
+@treturn ?num the index of the previous set bit, or `nil` if there are none.
+*/
+static int hb_prev_set(lua_State *L) {
+    const HiBitset *h = luaL_checkudata(L, 1, LUA_HIBITSET_TYPENAME);
+    const size_t idx = hb_prev(h, check_index(L, 2));
+
+    if (idx != HB_NONE) {
+        lua_pushinteger(L, (lua_Integer)idx);
+    } else {
+        lua_pushnil(L);
+    }
+
+    return 1;
+}
+
+
+/*** Finds the first clear bit at or after a given index.
+Since bits past the end of the bitset are clear, this always finds one.
+
+@function HiBitset:next_clear
+@tparam num idx the index to start searching at.
+@treturn num the index of the next clear bit.
+*/
+static int hb_next_clear_lua(lua_State *L) {
+    const HiBitset *h = luaL_checkudata(L, 1, LUA_HIBITSET_TYPENAME);
+
+    lua_pushinteger(L, (lua_Integer)hb_next_clear(h, check_index(L, 2)));
+    return 1;
+}
+
+
+static int hb_iter_next(lua_State *L) {
+    const HiBitset *h = luaL_checkudata(L, 1, LUA_HIBITSET_TYPENAME);
+    const lua_Integer prev = luaL_checkinteger(L, 2);
+
+    push_bit_index(L, h, prev < 0 ? 0 : (size_t)prev + 1);
+    return 1;
+}
+
+
+/*** Iterates over the indices of the set bits, in increasing order.
+@function HiBitset:iter
+@tparam[opt=0] num from the index to start iterating at.
+@return an iterator function, the bitset, and the starting state.
+*/
+static int hb_iter(lua_State *L) {
+    luaL_checkudata(L, 1, LUA_HIBITSET_TYPENAME);
+
+    const lua_Integer from = luaL_optinteger(L, 2, 0);
+
+    if (from < 0) {
+        luaL_argerror(L, 2, "expected positive index");
+    }
+
+    lua_pushcfunction(L, hb_iter_next);
+    lua_pushvalue(L, 1);
+    lua_pushinteger(L, from - 1);
+    return 3;
+}
+
+
+/*** Gets the indices of all of the set bits, as an array.
+@function HiBitset:to_indices
+@treturn {num,...} the indices of the set bits, in increasing order.
+*/
+static int hb_to_indices(lua_State *L) {
+    const HiBitset *h = luaL_checkudata(L, 1, LUA_HIBITSET_TYPENAME);
+
+    lua_createtable(L, (int)hb_count(h), 0);
+
+    int i = 1;
+    size_t idx;
+
+    for (idx = hb_next(h, 0); idx != HB_NONE; idx = hb_next(h, idx + 1)) {
+        lua_pushinteger(L, (lua_Integer)idx);
+        lua_rawseti(L, -2, i++);
+    }
+
+    return 1;
+}
+
+
+/*** The number of bytes of heap memory used by the bitset, summaries included.
+@function HiBitset:memory
+@treturn num the number of bytes allocated, not counting the userdata itself.
+*/
+static int hb_memory_lua(lua_State *L) {
+    const HiBitset *h = luaL_checkudata(L, 1, LUA_HIBITSET_TYPENAME);
+
+    lua_pushinteger(L, (lua_Integer)hb_memory(h));
+    return 1;
+}
+
+
+// Pushes a dense bitset with the same bits set as `h`.
+static void push_bitset(lua_State *L, const HiBitset *h) {
+    // Let the bitset module allocate the bitset the way it likes.
+    lua_getglobal(L, "require");
+    lua_pushliteral(L, LUA_BITSET_LIBNAME);
+    lua_call(L, 1, 1);
+    lua_getfield(L, -1, "new");
+    lua_remove(L, -2);
+
+    lua_pushinteger(L, (lua_Integer)(h->len[0] * HB_WORD_BITS));
+    lua_call(L, 1, 1);
+
+    Bitset *const bitset = bs_check(L, -1);
+    hb_to_blocks(h, bitset->bits, bitset->len);
+    bs_invalidate(bitset);
+}
+
+
+/*** Converts the bitset to a dense `Bitset`.
+Requires the `bitset` module.
+
+@function HiBitset:to_bitset
+@treturn Bitset a newly allocated bitset with the same bits set.
+*/
+static int hb_to_bitset(lua_State *L) {
+    const HiBitset *h = luaL_checkudata(L, 1, LUA_HIBITSET_TYPENAME);
+
+    push_bitset(L, h);
+    return 1;
+}
+
+
+/*** Serializes the bitset to a string.
+The encodings are those of @{Bitset:to_bytes}, so the string can be read back
+with `bitset.from_bytes`. Requires the `bitset` module.
+
+@function HiBitset:to_bytes
+@tparam[opt="raw"] string encoding either `"raw"` or `"rle"`.
+@treturn string the serialized bitset.
+*/
+static int hb_to_bytes(lua_State *L) {
+    const HiBitset *h = luaL_checkudata(L, 1, LUA_HIBITSET_TYPENAME);
+
+    push_bitset(L, h);
+    lua_getfield(L, -1, "to_bytes");
+    lua_insert(L, -2);
+    lua_pushvalue(L, 2);
+    lua_call(L, 2, 1);
+
+    return 1;
+}
+
+
+static const luaL_reg hb_funcs[] = {
+    {"new", hb_new},
+    {"intersection_into", hb_intersection_into},
+    {"union_into", hb_union_into},
+    {"difference_into", hb_difference_into},
+    {"symmetric_diff_into", hb_symmetric_diff_into},
+    {NULL, NULL},
+};
+
+
+static const luaL_reg hb_methods[] = {
+    {"set", hb_set_lua},
+    {"set_range", hb_set_range_lua},
+    {"clear", hb_clear_lua},
+    {"clear_range", hb_clear_range_lua},
+    {"get", hb_get_lua},
+    {"get_range", hb_get_range},
+    {"count", hb_count_lua},
+    {"intersection", hb_intersection},
+    {"intersection_mut", hb_intersection_mut},
+    {"union", hb_union},
+    {"union_mut", hb_union_mut},
+    {"difference", hb_difference},
+    {"difference_mut", hb_difference_mut},
+    {"symmetric_diff", hb_symmetric_diff},
+    {"symmetric_diff_mut", hb_symmetric_diff_mut},
+    {"intersection_into", hb_intersection_into},
+    {"union_into", hb_union_into},
+    {"difference_into", hb_difference_into},
+    {"symmetric_diff_into", hb_symmetric_diff_into},
+    {"intersection_count", hb_intersection_count_lua},
+    {"union_count", hb_union_count},
+    {"difference_count", hb_difference_count},
+    {"symmetric_diff_count", hb_symmetric_diff_count},
+    {"jaccard", hb_jaccard},
+    {"intersects", hb_intersects_lua},
+    {"is_disjoint", hb_is_disjoint},
+    {"eq", hb_eq},
+    {"subset", hb_subset_of},
+    {"next_set", hb_next_set},
+    {"prev_set", hb_prev_set},
+    {"next_clear", hb_next_clear_lua},
+    {"iter", hb_iter},
+    {"to_indices", hb_to_indices},
+    {"memory", hb_memory_lua},
+    {"to_bitset", hb_to_bitset},
+    {"to_bytes", hb_to_bytes},
+    {NULL, NULL},
+};
+
+
+LUALIB_API int luaopen_hibitset(lua_State *L) {
+    luaL_register(L, LUA_HIBITSET_LIBNAME, hb_funcs);
+
+    if (luaL_newmetatable(L, LUA_HIBITSET_TYPENAME) == 0) {
+        lua_pushstring(L, "Uh-oh! The string used in the hibitset library to \
+            identify the hibitset metatable is taken in the registry! Sean \
+            didn't think this would happen, so you better tell him either \
+            through github or email at <sean@errno.com>.");
+        lua_error(L);
+    }
+
+    static const struct luaL_reg hb_mt[] = {
+        {"__gc", hb_gc},
+        {"__add", hb_union},
+        {"__mul", hb_intersection},
+        {"__sub", hb_difference},
+        {"__len", hb_count_lua},
+        {"__eq", hb_eq},
+        {"__lt", hb_strict_subset_of},
+        {"__le", hb_subset_of},
+        {NULL, NULL},
+    };
+
+    lua_newtable(L);
+    luaL_register(L, NULL, hb_methods);
+    lua_setfield(L, -2, "__index");
+
+    luaL_register(L, NULL, hb_mt);
+
+    lua_pushstring(L, AUTHOR_STRING);
+    lua_setfield(L, -2, "_AUTHOR");
+
+    lua_pushstring(L, VERSION_STRING);
+    lua_setfield(L, -2, "_VERSION");
+
+    // Pop the metatable, leaving the library table to be returned.
+    lua_pop(L, 1);
+
+    return 1;
+}
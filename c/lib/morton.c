@@ -0,0 +1,1052 @@
+/*
+
+Copyright (c) 2016 Sean Leffler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+/// Morton (Z-order) encoding and decoding of 2D and 3D points, for spatial
+/// hashing and sorting. The bits of the coordinates are interleaved, x in the
+/// lowest bit, so that points near each other in space mostly end up near each
+/// other in code order.
+///
+/// Codes for 16-bit 2D and 10-bit 3D coordinates fit in a Lua number and are
+/// returned as one. Codes for 32-bit 2D and 21-bit 3D coordinates need up to
+/// 64 bits, which a Lua number can't hold exactly, so they are returned as two
+/// 32-bit halves, `hi, lo`. Compare `hi` first, then `lo`, to order them.
+///
+/// Every function has a `_batch` version which works on whole tables of
+/// coordinates or codes at once, to avoid one call from Lua per point. On
+/// LuaJIT, `morton_ffi` goes further and lets them work on FFI arrays.
+///
+/// The module also has a Morton-ordered spatial index, `Index`, for
+/// broad-phase collision and range queries.
+// @module morton
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#include "bitset.h"
+#include "bitset_lua.h"
+#include "morton.h"
+#include "zindex.h"
+
+#define ERRORMSG_OUT_OF_MEMORY "Error: out of memory! Could not grow spatial index."
+
+#define LUA_MORTON_LIBNAME "morton"
+
+#define AUTHOR_STRING "Sean Leffler <sean@errno.com>"
+#define VERSION_STRING "1.0"
+
+// How many points the batch functions convert per call into the kernels.
+#define BATCH_CHUNK 256
+
+
+static void error_out_of_memory(lua_State *L) {
+    lua_pushliteral(L, ERRORMSG_OUT_OF_MEMORY);
+    lua_error(L);
+}
+
+
+// The four kinds of code, and what they hold.
+typedef struct codec {
+    int dims;
+    int wide;
+    uint32_t coord_max;
+    // For wide codes, the largest `hi` half; `lo` can be anything.
+    uint32_t code_max;
+} codec;
+
+static const codec CODEC2_16 = { 2, 0, MORTON2_16_MAX, 0xFFFFFFFFu };
+static const codec CODEC2_32 = { 2, 1, MORTON2_32_MAX, 0xFFFFFFFFu };
+static const codec CODEC3_10 = { 3, 0, MORTON3_10_MAX, 0x3FFFFFFFu };
+static const codec CODEC3_21 = { 3, 1, MORTON3_21_MAX, 0x7FFFFFFFu };
+
+
+static void encode(const codec *c, uint32_t *const xyz[3], uint32_t *codes,
+        uint64_t *wide_codes, size_t n) {
+    if (c == &CODEC2_16) {
+        morton_kern->encode2_16(xyz[0], xyz[1], codes, n);
+    } else if (c == &CODEC2_32) {
+        morton_kern->encode2_32(xyz[0], xyz[1], wide_codes, n);
+    } else if (c == &CODEC3_10) {
+        morton_kern->encode3_10(xyz[0], xyz[1], xyz[2], codes, n);
+    } else {
+        morton_kern->encode3_21(xyz[0], xyz[1], xyz[2], wide_codes, n);
+    }
+}
+
+
+static void decode(const codec *c, const uint32_t *codes,
+        const uint64_t *wide_codes, uint32_t *const xyz[3], size_t n) {
+    if (c == &CODEC2_16) {
+        morton_kern->decode2_16(codes, xyz[0], xyz[1], n);
+    } else if (c == &CODEC2_32) {
+        morton_kern->decode2_32(wide_codes, xyz[0], xyz[1], n);
+    } else if (c == &CODEC3_10) {
+        morton_kern->decode3_10(codes, xyz[0], xyz[1], xyz[2], n);
+    } else {
+        morton_kern->decode3_21(wide_codes, xyz[0], xyz[1], xyz[2], n);
+    }
+}
+
+
+static uint32_t check_value(lua_State *L, int arg, uint32_t max,
+        const char *what) {
+    const lua_Number v = luaL_checknumber(L, arg);
+
+    if (!(v >= 0 && v <= max)) {
+        luaL_argerror(L, arg, lua_pushfstring(L, "%s out of range", what));
+    }
+
+    return (uint32_t)v;
+}
+
+
+// Reads `t[first + 1]` through `t[first + n]` for the batch functions.
+static void read_values(lua_State *L, int arg, size_t first, size_t n,
+        uint32_t max, const char *what, uint32_t *out) {
+    size_t i;
+    for (i = 0; i < n; i++) {
+        lua_rawgeti(L, arg, (int)(first + i + 1));
+
+        const lua_Number v = lua_tonumber(L, -1);
+
+        if (!lua_isnumber(L, -1) || !(v >= 0 && v <= max)) {
+            luaL_argerror(L, arg, lua_pushfstring(L,
+                "%s at index %d missing or out of range", what,
+                (int)(first + i + 1)));
+        }
+
+        out[i] = (uint32_t)v;
+        lua_pop(L, 1);
+    }
+}
+
+
+static void write_values(lua_State *L, int arg, size_t first, size_t n,
+        const uint32_t *values) {
+    size_t i;
+    for (i = 0; i < n; i++) {
+        lua_pushnumber(L, values[i]);
+        lua_rawseti(L, arg, (int)(first + i + 1));
+    }
+}
+
+
+// Makes sure there is an output table at `arg`, creating one if it's nil.
+static void check_out(lua_State *L, int arg, size_t n) {
+    if (lua_isnoneornil(L, arg)) {
+        if (lua_gettop(L) < arg) {
+            lua_settop(L, arg);
+        }
+
+        lua_createtable(L, (int)n, 0);
+        lua_replace(L, arg);
+    } else {
+        luaL_checktype(L, arg, LUA_TTABLE);
+    }
+}
+
+
+// The batch length is that of the first input table; any others must be at
+// least as long.
+static size_t check_batch(lua_State *L, int ninputs) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    const size_t n = lua_objlen(L, 1);
+
+    int arg;
+    for (arg = 2; arg <= ninputs; arg++) {
+        luaL_checktype(L, arg, LUA_TTABLE);
+
+        if (lua_objlen(L, arg) < n) {
+            luaL_argerror(L, arg, "shorter than the first argument");
+        }
+    }
+
+    return n;
+}
+
+
+static int encode_one(lua_State *L, const codec *c) {
+    uint32_t x, y, z = 0, code;
+    uint64_t wide_code;
+    uint32_t *const xyz[3] = { &x, &y, &z };
+
+    x = check_value(L, 1, c->coord_max, "coordinate");
+    y = check_value(L, 2, c->coord_max, "coordinate");
+
+    if (c->dims == 3) {
+        z = check_value(L, 3, c->coord_max, "coordinate");
+    }
+
+    encode(c, xyz, &code, &wide_code, 1);
+
+    if (c->wide) {
+        lua_pushnumber(L, (uint32_t)(wide_code >> 32));
+        lua_pushnumber(L, (uint32_t)wide_code);
+        return 2;
+    }
+
+    lua_pushnumber(L, code);
+    return 1;
+}
+
+
+static int decode_one(lua_State *L, const codec *c) {
+    uint32_t x, y, z, code = 0;
+    uint64_t wide_code = 0;
+    uint32_t *const xyz[3] = { &x, &y, &z };
+
+    if (c->wide) {
+        const uint32_t hi = check_value(L, 1, c->code_max, "code");
+        const uint32_t lo = check_value(L, 2, 0xFFFFFFFFu, "code");
+        wide_code = ((uint64_t)hi << 32) | lo;
+    } else {
+        code = check_value(L, 1, c->code_max, "code");
+    }
+
+    decode(c, &code, &wide_code, xyz, 1);
+
+    lua_pushnumber(L, x);
+    lua_pushnumber(L, y);
+
+    if (c->dims == 3) {
+        lua_pushnumber(L, z);
+    }
+
+    return c->dims;
+}
+
+
+static int encode_batch(lua_State *L, const codec *c) {
+    const size_t n = check_batch(L, c->dims);
+    const int nout = c->wide ? 2 : 1;
+
+    int i;
+    for (i = 1; i <= nout; i++) {
+        check_out(L, c->dims + i, n);
+    }
+
+    uint32_t coords[3][BATCH_CHUNK];
+    uint32_t codes[BATCH_CHUNK];
+    uint64_t wide_codes[BATCH_CHUNK];
+    uint32_t *const xyz[3] = { coords[0], coords[1], coords[2] };
+
+    size_t first;
+    for (first = 0; first < n; first += BATCH_CHUNK) {
+        const size_t len = n - first < BATCH_CHUNK ? n - first : BATCH_CHUNK;
+
+        int d;
+        for (d = 0; d < c->dims; d++) {
+            read_values(L, d + 1, first, len, c->coord_max, "coordinate",
+                coords[d]);
+        }
+
+        encode(c, xyz, codes, wide_codes, len);
+
+        if (c->wide) {
+            size_t j;
+            for (j = 0; j < len; j++) {
+                codes[j] = (uint32_t)(wide_codes[j] >> 32);
+            }
+            write_values(L, c->dims + 1, first, len, codes);
+
+            for (j = 0; j < len; j++) {
+                codes[j] = (uint32_t)wide_codes[j];
+            }
+            write_values(L, c->dims + 2, first, len, codes);
+        } else {
+            write_values(L, c->dims + 1, first, len, codes);
+        }
+    }
+
+    lua_settop(L, c->dims + nout);
+    return nout;
+}
+
+
+static int decode_batch(lua_State *L, const codec *c) {
+    const int nin = c->wide ? 2 : 1;
+    const size_t n = check_batch(L, nin);
+
+    int i;
+    for (i = 1; i <= c->dims; i++) {
+        check_out(L, nin + i, n);
+    }
+
+    uint32_t coords[3][BATCH_CHUNK];
+    uint32_t codes[BATCH_CHUNK];
+    uint64_t wide_codes[BATCH_CHUNK];
+    uint32_t *const xyz[3] = { coords[0], coords[1], coords[2] };
+
+    size_t first;
+    for (first = 0; first < n; first += BATCH_CHUNK) {
+        const size_t len = n - first < BATCH_CHUNK ? n - first : BATCH_CHUNK;
+
+        if (c->wide) {
+            // Borrow the coordinate buffers to read the two halves into.
+            read_values(L, 1, first, len, c->code_max, "code", coords[0]);
+            read_values(L, 2, first, len, 0xFFFFFFFFu, "code", coords[1]);
+
+            size_t j;
+            for (j = 0; j < len; j++) {
+                wide_codes[j] = ((uint64_t)coords[0][j] << 32) | coords[1][j];
+            }
+        } else {
+            read_values(L, 1, first, len, c->code_max, "code", codes);
+        }
+
+        decode(c, codes, wide_codes, xyz, len);
+
+        int d;
+        for (d = 0; d < c->dims; d++) {
+            write_values(L, nin + d + 1, first, len, coords[d]);
+        }
+    }
+
+    lua_settop(L, nin + c->dims);
+    return c->dims;
+}
+
+
+/*** Encodes a 2D point with 16-bit coordinates.
+@function encode2_16
+@tparam int x in `[0, 65535]`.
+@tparam int y in `[0, 65535]`.
+@treturn int the 32-bit code.
+*/
+static int m_encode2_16(lua_State *L) {
+    return encode_one(L, &CODEC2_16);
+}
+
+
+/*** Decodes a code from `encode2_16`.
+@function decode2_16
+@tparam int code
+@treturn int x
+@treturn int y
+*/
+static int m_decode2_16(lua_State *L) {
+    return decode_one(L, &CODEC2_16);
+}
+
+
+/*** Encodes a 2D point with 32-bit coordinates.
+@function encode2_32
+@tparam int x in `[0, 2^32 - 1]`.
+@tparam int y in `[0, 2^32 - 1]`.
+@treturn int the high 32 bits of the code.
+@treturn int the low 32 bits of the code.
+*/
+static int m_encode2_32(lua_State *L) {
+    return encode_one(L, &CODEC2_32);
+}
+
+
+/*** Decodes a code from `encode2_32`.
+@function decode2_32
+@tparam int hi the high 32 bits of the code.
+@tparam int lo the low 32 bits of the code.
+@treturn int x
+@treturn int y
+*/
+static int m_decode2_32(lua_State *L) {
+    return decode_one(L, &CODEC2_32);
+}
+
+
+/*** Encodes a 3D point with 10-bit coordinates.
+@function encode3_10
+@tparam int x in `[0, 1023]`.
+@tparam int y in `[0, 1023]`.
+@tparam int z in `[0, 1023]`.
+@treturn int the 30-bit code.
+*/
+static int m_encode3_10(lua_State *L) {
+    return encode_one(L, &CODEC3_10);
+}
+
+
+/*** Decodes a code from `encode3_10`.
+@function decode3_10
+@tparam int code
+@treturn int x
+@treturn int y
+@treturn int z
+*/
+static int m_decode3_10(lua_State *L) {
+    return decode_one(L, &CODEC3_10);
+}
+
+
+/*** Encodes a 3D point with 21-bit coordinates.
+@function encode3_21
+@tparam int x in `[0, 2^21 - 1]`.
+@tparam int y in `[0, 2^21 - 1]`.
+@tparam int z in `[0, 2^21 - 1]`.
+@treturn int the high 31 bits of the 63-bit code.
+@treturn int the low 32 bits of the code.
+*/
+static int m_encode3_21(lua_State *L) {
+    return encode_one(L, &CODEC3_21);
+}
+
+
+/*** Decodes a code from `encode3_21`.
+@function decode3_21
+@tparam int hi the high bits of the code.
+@tparam int lo the low 32 bits of the code.
+@treturn int x
+@treturn int y
+@treturn int z
+*/
+static int m_decode3_21(lua_State *L) {
+    return decode_one(L, &CODEC3_21);
+}
+
+
+/*** Encodes many 2D points with 16-bit coordinates at once.
+The number of points is the length of `xs`.
+@function encode2_16_batch
+@tparam {int,...} xs
+@tparam {int,...} ys
+@tparam[opt] table codes a table to write the codes into.
+@treturn {int,...} the codes.
+*/
+static int m_encode2_16_batch(lua_State *L) {
+    return encode_batch(L, &CODEC2_16);
+}
+
+
+/*** Decodes many codes from `encode2_16` at once.
+@function decode2_16_batch
+@tparam {int,...} codes
+@tparam[opt] table xs a table to write the x coordinates into.
+@tparam[opt] table ys a table to write the y coordinates into.
+@treturn {int,...} xs
+@treturn {int,...} ys
+*/
+static int m_decode2_16_batch(lua_State *L) {
+    return decode_batch(L, &CODEC2_16);
+}
+
+
+/*** Encodes many 2D points with 32-bit coordinates at once.
+@function encode2_32_batch
+@tparam {int,...} xs
+@tparam {int,...} ys
+@tparam[opt] table his a table to write the high halves of the codes into.
+@tparam[opt] table los a table to write the low halves of the codes into.
+@treturn {int,...} his
+@treturn {int,...} los
+*/
+static int m_encode2_32_batch(lua_State *L) {
+    return encode_batch(L, &CODEC2_32);
+}
+
+
+/*** Decodes many codes from `encode2_32` at once.
+@function decode2_32_batch
+@tparam {int,...} his
+@tparam {int,...} los
+@tparam[opt] table xs
+@tparam[opt] table ys
+@treturn {int,...} xs
+@treturn {int,...} ys
+*/
+static int m_decode2_32_batch(lua_State *L) {
+    return decode_batch(L, &CODEC2_32);
+}
+
+
+/*** Encodes many 3D points with 10-bit coordinates at once.
+@function encode3_10_batch
+@tparam {int,...} xs
+@tparam {int,...} ys
+@tparam {int,...} zs
+@tparam[opt] table codes
+@treturn {int,...} codes
+*/
+static int m_encode3_10_batch(lua_State *L) {
+    return encode_batch(L, &CODEC3_10);
+}
+
+
+/*** Decodes many codes from `encode3_10` at once.
+@function decode3_10_batch
+@tparam {int,...} codes
+@tparam[opt] table xs
+@tparam[opt] table ys
+@tparam[opt] table zs
+@treturn {int,...} xs
+@treturn {int,...} ys
+@treturn {int,...} zs
+*/
+static int m_decode3_10_batch(lua_State *L) {
+    return decode_batch(L, &CODEC3_10);
+}
+
+
+/*** Encodes many 3D points with 21-bit coordinates at once.
+@function encode3_21_batch
+@tparam {int,...} xs
+@tparam {int,...} ys
+@tparam {int,...} zs
+@tparam[opt] table his
+@tparam[opt] table los
+@treturn {int,...} his
+@treturn {int,...} los
+*/
+static int m_encode3_21_batch(lua_State *L) {
+    return encode_batch(L, &CODEC3_21);
+}
+
+
+/*** Decodes many codes from `encode3_21` at once.
+@function decode3_21_batch
+@tparam {int,...} his
+@tparam {int,...} los
+@tparam[opt] table xs
+@tparam[opt] table ys
+@tparam[opt] table zs
+@treturn {int,...} xs
+@treturn {int,...} ys
+@treturn {int,...} zs
+*/
+static int m_decode3_21_batch(lua_State *L) {
+    return decode_batch(L, &CODEC3_21);
+}
+
+
+/*** Query or change the implementation in use.
+When the module is loaded, `"bmi2"` (PDEP/PEXT) is selected if the CPU has fast
+BMI2 instructions, and the portable `"magic"` bit-twiddling version otherwise.
+Older AMD CPUs have BMI2, but run it too slowly to be worth it.
+
+@function kernel
+@tparam[opt] string name the implementation to switch to.
+@treturn string the name of the implementation in use.
+@treturn {string,...} the names of all implementations available on this CPU.
+*/
+static int m_kernel(lua_State *L) {
+    if (!lua_isnoneornil(L, 1)) {
+        const char *const name = luaL_checkstring(L, 1);
+        const morton_kernels *const kern = morton_kernels_find(name);
+
+        if (kern == NULL) {
+            luaL_argerror(L, 1, "implementation not available on this CPU");
+        }
+
+        morton_kern = kern;
+    }
+
+    lua_pushstring(L, morton_kern->name);
+
+    lua_newtable(L);
+
+    int n = 0;
+    size_t i;
+    for (i = 0; morton_kernel_names[i] != NULL; i++) {
+        if (morton_kernels_find(morton_kernel_names[i]) != NULL) {
+            lua_pushstring(L, morton_kernel_names[i]);
+            lua_rawseti(L, -2, ++n);
+        }
+    }
+
+    return 2;
+}
+
+
+/*
+ * Plain C entry points, for the LuaJIT FFI front end in `morton_ffi.lua`. These
+ * work on arrays directly, so there are no Lua tables or argument checking in
+ * the way.
+ */
+
+LUALIB_API void laser_morton_encode2_16(const uint32_t *x, const uint32_t *y,
+        uint32_t *codes, size_t n) {
+    morton_kern->encode2_16(x, y, codes, n);
+}
+
+
+LUALIB_API void laser_morton_decode2_16(const uint32_t *codes,
+        uint32_t *x, uint32_t *y, size_t n) {
+    morton_kern->decode2_16(codes, x, y, n);
+}
+
+
+LUALIB_API void laser_morton_encode2_32(const uint32_t *x, const uint32_t *y,
+        uint64_t *codes, size_t n) {
+    morton_kern->encode2_32(x, y, codes, n);
+}
+
+
+LUALIB_API void laser_morton_decode2_32(const uint64_t *codes,
+        uint32_t *x, uint32_t *y, size_t n) {
+    morton_kern->decode2_32(codes, x, y, n);
+}
+
+
+LUALIB_API void laser_morton_encode3_10(const uint32_t *x, const uint32_t *y,
+        const uint32_t *z, uint32_t *codes, size_t n) {
+    morton_kern->encode3_10(x, y, z, codes, n);
+}
+
+
+LUALIB_API void laser_morton_decode3_10(const uint32_t *codes,
+        uint32_t *x, uint32_t *y, uint32_t *z, size_t n) {
+    morton_kern->decode3_10(codes, x, y, z, n);
+}
+
+
+LUALIB_API void laser_morton_encode3_21(const uint32_t *x, const uint32_t *y,
+        const uint32_t *z, uint64_t *codes, size_t n) {
+    morton_kern->encode3_21(x, y, z, codes, n);
+}
+
+
+LUALIB_API void laser_morton_decode3_21(const uint64_t *codes,
+        uint32_t *x, uint32_t *y, uint32_t *z, size_t n) {
+    morton_kern->decode3_21(codes, x, y, z, n);
+}
+
+
+/*** A Morton-ordered spatial index over boxes, for broad-phase queries.
+A linear quadtree (or octree, in 3D): space is divided into a grid of
+`2^16 x 2^16` cells (`2^10` per side in 3D) of a given size, and every box is
+filed under the smallest tree node that covers it. The tree is stored as one
+array of entries sorted by Morton code, so there is nothing to rebalance.
+Boxes outside the grid still work, but all end up on its edges, so pick a cell
+size which makes the grid cover the world.
+
+Entities are identified by non-negative integer IDs, like bitset indices; the
+index uses memory in proportion to the largest ID as well as the number of
+entities. Queries write their results into either a `Bitset` or a table you
+pass in, so they don't allocate any Lua tables of their own.
+@type Index
+*/
+
+#define LUA_ZINDEX_TYPENAME "_morton_index_ty"
+
+
+static int zi_push(lua_State *L, int dims) {
+    const lua_Number cell = luaL_checknumber(L, 1);
+    double origin[3] = { 0, 0, 0 };
+
+    if (!(cell > 0)) {
+        luaL_argerror(L, 1, "expected positive cell size");
+    }
+
+    int d;
+    for (d = 0; d < dims; d++) {
+        origin[d] = luaL_optnumber(L, d + 2, 0);
+    }
+
+    ZIndex *const z = (ZIndex*)lua_newuserdata(L, sizeof(ZIndex));
+    zi_init(z, dims, cell, origin);
+
+    luaL_getmetatable(L, LUA_ZINDEX_TYPENAME);
+    lua_setmetatable(L, -2);
+
+    return 1;
+}
+
+
+/*** Create a new, empty 2D index.
+@function quadtree
+@tparam num cell_size the width and height of each grid cell.
+@tparam[opt=0] num x the left edge of the grid.
+@tparam[opt=0] num y the top edge of the grid.
+@treturn Index
+*/
+static int zi_quadtree(lua_State *L) {
+    return zi_push(L, 2);
+}
+
+
+/*** Create a new, empty 3D index.
+@function octree
+@tparam num cell_size the size of each grid cell along every axis.
+@tparam[opt=0] num x
+@tparam[opt=0] num y
+@tparam[opt=0] num z
+@treturn Index
+*/
+static int zi_octree(lua_State *L) {
+    return zi_push(L, 3);
+}
+
+
+static int zi_gc(lua_State *L) {
+    ZIndex *z = luaL_checkudata(L, 1, LUA_ZINDEX_TYPENAME);
+    zi_free(z);
+    return 0;
+}
+
+
+static uint32_t check_id(lua_State *L, int arg) {
+    const lua_Number id = luaL_checknumber(L, arg);
+
+    if (!(id >= 0 && id < ZI_NONE)) {
+        luaL_argerror(L, arg, "expected positive ID");
+    }
+
+    return (uint32_t)id;
+}
+
+
+// Reads a box's minimum coordinates, then its maximums, starting at `arg`. If
+// the maximums are left out, the box is a point.
+static void check_box(lua_State *L, const ZIndex *z, int arg, double min[3],
+        double max[3]) {
+    int d;
+    for (d = 0; d < z->dims; d++) {
+        min[d] = luaL_checknumber(L, arg + d);
+    }
+
+    for (d = 0; d < z->dims; d++) {
+        max[d] = lua_isnoneornil(L, arg + z->dims + d)
+            ? min[d] : luaL_checknumber(L, arg + z->dims + d);
+    }
+}
+
+
+// Writes the IDs found by the last query into a `Bitset` or a table at `arg`,
+// and returns how many there were.
+static int push_found(lua_State *L, const ZIndex *z, int arg) {
+    const size_t n = z->nfound;
+    size_t i;
+
+    if (lua_istable(L, arg)) {
+        for (i = 0; i < n; i++) {
+            lua_pushnumber(L, z->found[i]);
+            lua_rawseti(L, arg, (int)(i + 1));
+        }
+
+        // Clear out anything left over from a longer set of results, so that
+        // `#` gives the number of results.
+        for (i = n + 1; ; i++) {
+            lua_rawgeti(L, arg, (int)i);
+            const int done = lua_isnil(L, -1);
+            lua_pop(L, 1);
+
+            if (done) {
+                break;
+            }
+
+            lua_pushnil(L);
+            lua_rawseti(L, arg, (int)i);
+        }
+    } else {
+        Bitset *const bs = bs_check(L, arg);
+        uint32_t top = 0;
+
+        for (i = 0; i < n; i++) {
+            if (z->found[i] > top) {
+                top = z->found[i];
+            }
+        }
+
+        // Growing the bitset is left to the bitset module, through its `set`.
+        if (n > 0 && top / BITWIDTH >= bs->len) {
+            lua_getfield(L, arg, "set");
+            lua_pushvalue(L, arg);
+            lua_pushnumber(L, top);
+            lua_call(L, 2, 0);
+        }
+
+        // Like a table, the bitset ends up holding just these results, so the
+        // same one can be reused from query to query.
+        memset(bs->bits, 0, bs->len * sizeof(block_t));
+
+        for (i = 0; i < n; i++) {
+            bs->bits[z->found[i] / BITWIDTH] |= JUST_ONE << (z->found[i] % BITWIDTH);
+        }
+
+        bs_invalidate(bs);
+    }
+
+    lua_pushinteger(L, (lua_Integer)n);
+    return 1;
+}
+
+
+/*** Replaces everything in the index at once.
+Much faster than updating entities one at a time when most of them have moved.
+
+@function Index:rebuild
+@tparam {int,...} ids the entity IDs.
+@tparam {num,...} boxes the boxes of the entities, flattened: for each entity,
+its minimum x and y (and z) followed by its maximum x and y (and z).
+@treturn Index the index.
+*/
+static int zi_rebuild_l(lua_State *L) {
+    ZIndex *const z = luaL_checkudata(L, 1, LUA_ZINDEX_TYPENAME);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    luaL_checktype(L, 3, LUA_TTABLE);
+
+    const size_t n = lua_objlen(L, 2);
+    const size_t per = 2 * (size_t)z->dims;
+
+    if (lua_objlen(L, 3) < n * per) {
+        luaL_argerror(L, 3, "expected a box for every ID");
+    }
+
+    uint32_t *const ids = lua_newuserdata(L, n * sizeof(uint32_t) + 1);
+    double *const boxes = lua_newuserdata(L, n * per * sizeof(double) + 1);
+
+    size_t i;
+    for (i = 0; i < n; i++) {
+        lua_rawgeti(L, 2, (int)(i + 1));
+
+        const lua_Number id = lua_tonumber(L, -1);
+
+        if (!lua_isnumber(L, -1) || !(id >= 0 && id < ZI_NONE)) {
+            luaL_argerror(L, 2, "expected positive IDs");
+        }
+
+        ids[i] = (uint32_t)id;
+        lua_pop(L, 1);
+    }
+
+    for (i = 0; i < n * per; i++) {
+        lua_rawgeti(L, 3, (int)(i + 1));
+
+        if (!lua_isnumber(L, -1)) {
+            luaL_argerror(L, 3, "expected numbers");
+        }
+
+        boxes[i] = lua_tonumber(L, -1);
+        lua_pop(L, 1);
+    }
+
+    if (!zi_rebuild(z, ids, boxes, n)) {
+        error_out_of_memory(L);
+    }
+
+    lua_settop(L, 1);
+    return 1;
+}
+
+
+/*** Adds an entity, or moves it if it's already there.
+Cheap if the entity hasn't moved far.
+
+@function Index:update
+@tparam int id the entity ID.
+@tparam num min_x
+@tparam num min_y
+@tparam[opt] num min_z (3D only)
+@tparam[opt=min_x] num max_x
+@tparam[opt=min_y] num max_y
+@tparam[opt=min_z] num max_z (3D only)
+@treturn Index the index.
+*/
+static int zi_update_l(lua_State *L) {
+    ZIndex *const z = luaL_checkudata(L, 1, LUA_ZINDEX_TYPENAME);
+    const uint32_t id = check_id(L, 2);
+    double min[3], max[3];
+
+    check_box(L, z, 3, min, max);
+
+    if (!zi_update(z, id, min, max)) {
+        error_out_of_memory(L);
+    }
+
+    lua_settop(L, 1);
+    return 1;
+}
+
+
+/*** Removes an entity.
+@function Index:remove
+@tparam int id the entity ID.
+@treturn bool whether the entity was in the index.
+*/
+static int zi_remove_l(lua_State *L) {
+    ZIndex *const z = luaL_checkudata(L, 1, LUA_ZINDEX_TYPENAME);
+    lua_pushboolean(L, zi_remove(z, check_id(L, 2)));
+    return 1;
+}
+
+
+/*** Finds the entities whose boxes overlap (or touch) a box.
+@function Index:query
+@tparam num min_x
+@tparam num min_y
+@tparam[opt] num min_z (3D only)
+@tparam num max_x
+@tparam num max_y
+@tparam[opt] num max_z (3D only)
+@tparam Bitset|table out where to put the IDs found. A bitset is cleared and
+has their bits set; a table gets them stored from index 1 on, and anything
+after them cleared.
+@treturn int the number of entities found.
+*/
+static int zi_query_l(lua_State *L) {
+    ZIndex *const z = luaL_checkudata(L, 1, LUA_ZINDEX_TYPENAME);
+    double min[3], max[3];
+
+    int d;
+    for (d = 0; d < z->dims; d++) {
+        min[d] = luaL_checknumber(L, 2 + d);
+        max[d] = luaL_checknumber(L, 2 + z->dims + d);
+    }
+
+    const int out = 2 + 2 * z->dims;
+    if (!lua_istable(L, out)) {
+        bs_check(L, out);
+    }
+
+    if (!zi_query(z, min, max)) {
+        error_out_of_memory(L);
+    }
+
+    return push_found(L, z, out);
+}
+
+
+/*** Finds the entities nearest to a point.
+Distance is measured to the closest point of each entity's box, so the point
+being inside a box counts as a distance of zero.
+
+@function Index:nearest
+@tparam num x
+@tparam num y
+@tparam[opt] num z (3D only)
+@tparam int k how many entities to find, at most.
+@tparam Bitset|table out where to put the IDs found, as with `Index:query`. A
+table gets them in order, nearest first.
+@treturn int the number of entities found.
+*/
+static int zi_nearest_l(lua_State *L) {
+    ZIndex *const z = luaL_checkudata(L, 1, LUA_ZINDEX_TYPENAME);
+    double point[3];
+
+    int d;
+    for (d = 0; d < z->dims; d++) {
+        point[d] = luaL_checknumber(L, 2 + d);
+    }
+
+    const lua_Integer k = luaL_checkinteger(L, 2 + z->dims);
+    if (k < 0) {
+        luaL_argerror(L, 2 + z->dims, "expected positive count");
+    }
+
+    const int out = 3 + z->dims;
+    if (!lua_istable(L, out)) {
+        bs_check(L, out);
+    }
+
+    if (!zi_nearest(z, point, (size_t)k)) {
+        error_out_of_memory(L);
+    }
+
+    return push_found(L, z, out);
+}
+
+
+/*** The number of entities in the index.
+@function Index:count
+@treturn int
+*/
+static int zi_count(lua_State *L) {
+    ZIndex *const z = luaL_checkudata(L, 1, LUA_ZINDEX_TYPENAME);
+    lua_pushinteger(L, (lua_Integer)z->len);
+    return 1;
+}
+
+
+static const luaL_reg zi_methods[] = {
+    {"rebuild", zi_rebuild_l},
+    {"update", zi_update_l},
+    {"remove", zi_remove_l},
+    {"query", zi_query_l},
+    {"nearest", zi_nearest_l},
+    {"count", zi_count},
+    {NULL, NULL},
+};
+
+
+static const luaL_reg m_funcs[] = {
+    {"encode2_16", m_encode2_16},
+    {"decode2_16", m_decode2_16},
+    {"encode2_32", m_encode2_32},
+    {"decode2_32", m_decode2_32},
+    {"encode3_10", m_encode3_10},
+    {"decode3_10", m_decode3_10},
+    {"encode3_21", m_encode3_21},
+    {"decode3_21", m_decode3_21},
+    {"encode2_16_batch", m_encode2_16_batch},
+    {"decode2_16_batch", m_decode2_16_batch},
+    {"encode2_32_batch", m_encode2_32_batch},
+    {"decode2_32_batch", m_decode2_32_batch},
+    {"encode3_10_batch", m_encode3_10_batch},
+    {"decode3_10_batch", m_decode3_10_batch},
+    {"encode3_21_batch", m_encode3_21_batch},
+    {"decode3_21_batch", m_decode3_21_batch},
+    {"kernel", m_kernel},
+    {"quadtree", zi_quadtree},
+    {"octree", zi_octree},
+    {NULL, NULL},
+};
+
+
+LUALIB_API int luaopen_morton(lua_State *L) {
+    morton_kernels_init();
+
+    luaL_register(L, LUA_MORTON_LIBNAME, m_funcs);
+
+    lua_pushstring(L, AUTHOR_STRING);
+    lua_setfield(L, -2, "_AUTHOR");
+
+    lua_pushstring(L, VERSION_STRING);
+    lua_setfield(L, -2, "_VERSION");
+
+    if (luaL_newmetatable(L, LUA_ZINDEX_TYPENAME) == 0) {
+        lua_pushstring(L, "Uh-oh! The string used in the morton library to \
+            identify the index metatable is taken in the registry! Sean \
+            didn't think this would happen, so you better tell him either \
+            through github or email at <sean@errno.com>.");
+        lua_error(L);
+    }
+
+    static const struct luaL_reg zi_mt[] = {
+        {"__gc", zi_gc},
+        {"__len", zi_count},
+        {NULL, NULL},
+    };
+
+    lua_newtable(L);
+    luaL_register(L, NULL, zi_methods);
+    lua_setfield(L, -2, "__index");
+
+    luaL_register(L, NULL, zi_mt);
+
+    // Pop the metatable, leaving the library table to be returned.
+    lua_pop(L, 1);
+
+    return 1;
+}
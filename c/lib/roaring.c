@@ -0,0 +1,717 @@
+/*
+
+Copyright (c) 2016 Sean Leffler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+/// A compressed bitmap for sparse sets, in the style of Roaring bitmaps.
+/// Where a dense `Bitset` costs memory in proportion to the highest index ever
+/// set, a roaring bitmap costs memory in proportion to how many bits are set
+/// (or how many runs of them there are.) Indices are limited to 32 bits.
+///
+/// Roaring bitmaps have the bitset methods for setting, clearing and getting
+/// bits and ranges, counting, set algebra, `eq`, `subset`, `next_set` and
+/// `iter`, along with the operators. Any operation taking a second operand
+/// also accepts a dense `Bitset` there, so long as it has no bits set past the
+/// largest index.
+// @module roaring
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#include "bitset.h"
+#include "bitset_lua.h"
+#include "roaring.h"
+
+#define ERRORMSG_OUT_OF_MEMORY "Error: out of memory! Could not allocate roaring bitmap."
+
+#define LUA_ROARING_LIBNAME "roaring"
+#define LUA_ROARING_TYPENAME "_roaring_ty"
+
+#define AUTHOR_STRING "Sean Leffler <sean@errno.com>"
+#define VERSION_STRING "1.0"
+
+/*** A compressed bitmap type.
+@type Roaring
+*/
+
+
+static void error_out_of_memory(lua_State *L) {
+    lua_pushliteral(L, ERRORMSG_OUT_OF_MEMORY);
+    lua_error(L);
+}
+
+
+static Roaring* rr_push(lua_State *L) {
+    Roaring *const r = (Roaring*)lua_newuserdata(L, sizeof(Roaring));
+    rr_init(r);
+
+    luaL_getmetatable(L, LUA_ROARING_TYPENAME);
+    lua_setmetatable(L, -2);
+
+    return r;
+}
+
+
+static int rr_gc(lua_State *L) {
+    Roaring *r = luaL_checkudata(L, 1, LUA_ROARING_TYPENAME);
+    rr_free(r);
+    return 0;
+}
+
+
+static bool has_metatable(lua_State *L, int idx, const char *tname) {
+    if (lua_touserdata(L, idx) == NULL || !lua_getmetatable(L, idx)) {
+        return false;
+    }
+
+    luaL_getmetatable(L, tname);
+    const bool eq = lua_rawequal(L, -1, -2);
+    lua_pop(L, 2);
+
+    return eq;
+}
+
+
+// Fetches the second operand of a binary operation, which may be a roaring
+// bitmap or a dense bitset. Bitsets are wrapped in `view`, which the caller
+// must free with `rr_free` when done (it's harmless to do so for roaring
+// operands too.) A bitset with bits set past `RR_MAX_INDEX` is an error, since
+// the view can't hold them and the answer would be wrong without them.
+static const Roaring *check_operand(lua_State *L, int idx, Roaring *view) {
+    rr_init(view);
+
+    if (has_metatable(L, idx, LUA_ROARING_TYPENAME)) {
+        return lua_touserdata(L, idx);
+    }
+
+    const Bitset *const bitset = bs_test(L, idx);
+
+    if (bitset == NULL) {
+        luaL_typerror(L, idx, "roaring or bitset");
+    }
+
+    size_t blk;
+    for (blk = ((size_t)RR_MAX_INDEX + 1) / BITWIDTH; blk < bitset->len;
+            blk++) {
+        if (bitset->bits[blk] != 0) {
+            luaL_argerror(L, idx, "has bits set past the largest index");
+        }
+    }
+
+    if (!rr_view_blocks(view, bitset->bits, bitset->len)) {
+        error_out_of_memory(L);
+    }
+
+    return view;
+}
+
+
+static uint32_t check_index(lua_State *L, int arg) {
+    const lua_Integer int_idx = luaL_checkinteger(L, arg);
+
+    // A negative index is completely invalid.
+    if (int_idx < 0) {
+        luaL_argerror(L, arg, "expected positive index");
+    }
+
+    if ((uint64_t)int_idx > RR_MAX_INDEX) {
+        luaL_argerror(L, arg, "index out of range");
+    }
+
+    return (uint32_t)int_idx;
+}
+
+
+// Checks a `[lo, hi)` range, swapping the bounds if need be.
+static void check_range(lua_State *L, uint64_t *lo, uint64_t *hi) {
+    const lua_Integer int_lo = luaL_checkinteger(L, 2);
+    const lua_Integer int_hi = luaL_checkinteger(L, 3);
+
+    if (int_lo < 0) {
+        luaL_argerror(L, 2, "expected positive lower bound");
+    }
+
+    if (int_hi < 0) {
+        luaL_argerror(L, 3, "expected positive upper bound");
+    }
+
+    *lo = (uint64_t)int_lo;
+    *hi = (uint64_t)int_hi;
+
+    if (*lo > *hi) {
+        const uint64_t tmp = *lo;
+        *lo = *hi;
+        *hi = tmp;
+    }
+
+    if (*hi > (uint64_t)RR_MAX_INDEX + 1) {
+        luaL_argerror(L, 3, "index out of range");
+    }
+}
+
+
+/*** Allocate a new roaring bitmap.
+If called with a roaring bitmap or a dense `Bitset`, its contents are copied.
+
+@function new
+@tparam[opt] Roaring|Bitset src a bitmap or bitset to copy.
+@treturn Roaring a newly allocated roaring bitmap.
+*/
+static int rr_new(lua_State *L) {
+    if (lua_isnoneornil(L, 1)) {
+        rr_push(L);
+        return 1;
+    }
+
+    Roaring view;
+    const Roaring *const src = check_operand(L, 1, &view);
+
+    Roaring *const dst = rr_push(L);
+    const bool ok = rr_copy(dst, src);
+
+    rr_free(&view);
+
+    if (!ok) {
+        error_out_of_memory(L);
+    }
+
+    return 1;
+}
+
+
+/*** Sets a single bit in the bitmap, at a given index.
+The bitmap is modified in place, but for convenience, it is also returned.
+
+@function Roaring:set
+@tparam num idx the index of the bit to set.
+@treturn Roaring the modified bitmap.
+*/
+static int rr_set(lua_State *L) {
+    Roaring *r = luaL_checkudata(L, 1, LUA_ROARING_TYPENAME);
+    const uint32_t idx = check_index(L, 2);
+
+    if (rr_add(r, idx) < 0) {
+        error_out_of_memory(L);
+    }
+
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+/*** Sets a range of bits in the bitmap, `[lo, hi)`.
+Whole 64K-bit chunks covered by the range are stored as a single run.
+
+@function Roaring:set_range
+@tparam num lo the low index of the range to set.
+@tparam num hi the high index of the range to set.
+@treturn Roaring the modified bitmap.
+*/
+static int rr_set_range(lua_State *L) {
+    Roaring *r = luaL_checkudata(L, 1, LUA_ROARING_TYPENAME);
+
+    uint64_t lo, hi;
+    check_range(L, &lo, &hi);
+
+    if (!rr_add_range(r, lo, hi)) {
+        error_out_of_memory(L);
+    }
+
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+/*** Clears a single bit in the bitmap, at a given index.
+@function Roaring:clear
+@tparam num idx the index of the bit to clear.
+@treturn Roaring the modified bitmap.
+*/
+static int rr_clear(lua_State *L) {
+    Roaring *r = luaL_checkudata(L, 1, LUA_ROARING_TYPENAME);
+    const uint32_t idx = check_index(L, 2);
+
+    if (rr_remove(r, idx) < 0) {
+        error_out_of_memory(L);
+    }
+
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+/*** Clears a range of bits in the bitmap, `[lo, hi)`.
+@function Roaring:clear_range
+@tparam num lo the low index of the range to clear.
+@tparam num hi the high index of the range to clear.
+@treturn Roaring the modified bitmap.
+*/
+static int rr_clear_range(lua_State *L) {
+    Roaring *r = luaL_checkudata(L, 1, LUA_ROARING_TYPENAME);
+
+    uint64_t lo, hi;
+    check_range(L, &lo, &hi);
+
+    if (!rr_remove_range(r, lo, hi)) {
+        error_out_of_memory(L);
+    }
+
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+/*** Gets a single bit in the bitmap, at a given index.
+@function Roaring:get
+@tparam num idx the index of the bit to get.
+@treturn bool whether the bit is set.
+*/
+static int rr_get(lua_State *L) {
+    const Roaring *r = luaL_checkudata(L, 1, LUA_ROARING_TYPENAME);
+    const lua_Integer int_idx = luaL_checkinteger(L, 2);
+
+    // A negative index is completely invalid.
+    if (int_idx < 0) {
+        luaL_argerror(L, 2, "expected positive index");
+    }
+
+    lua_pushboolean(L, (uint64_t)int_idx <= RR_MAX_INDEX &&
+        rr_contains(r, (uint32_t)int_idx));
+    return 1;
+}
+
+
+/*** Counts how many bits are set in the bitmap. Also available as `#`.
+@function Roaring:count
+@treturn num the number of set bits.
+*/
+static int rr_count(lua_State *L) {
+    const Roaring *r = luaL_checkudata(L, 1, LUA_ROARING_TYPENAME);
+
+    lua_pushinteger(L, (lua_Integer)rr_cardinality(r));
+    return 1;
+}
+
+
+static int push_binop(lua_State *L, rr_op op) {
+    const Roaring *const lhs = luaL_checkudata(L, 1, LUA_ROARING_TYPENAME);
+
+    Roaring view;
+    const Roaring *const rhs = check_operand(L, 2, &view);
+
+    Roaring *const out = rr_push(L);
+    const bool ok = rr_binop(op, out, lhs, rhs);
+
+    rr_free(&view);
+
+    if (!ok) {
+        error_out_of_memory(L);
+    }
+
+    return 1;
+}
+
+
+static int mut_binop(lua_State *L, rr_op op) {
+    Roaring *const lhs = luaL_checkudata(L, 1, LUA_ROARING_TYPENAME);
+
+    Roaring view;
+    const Roaring *const rhs = check_operand(L, 2, &view);
+
+    Roaring out;
+    const bool ok = rr_binop(op, &out, lhs, rhs);
+
+    rr_free(&view);
+
+    if (!ok) {
+        error_out_of_memory(L);
+    }
+
+    rr_free(lhs);
+    *lhs = out;
+
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+/*** The intersection of two bitmaps. Also available as the `*` operator.
+@function Roaring:intersection
+@tparam Roaring lhs the left-hand bitmap to intersect.
+@tparam Roaring|Bitset rhs the right-hand bitmap or bitset to intersect.
+@treturn Roaring a newly allocated bitmap containing the intersection.
+@see Roaring:intersection_mut
+*/
+static int rr_intersection(lua_State *L) {
+    return push_binop(L, RR_AND);
+}
+
+
+/*** The in-place intersection of two bitmaps.
+@function Roaring:intersection_mut
+@tparam Roaring lhs the left-hand bitmap to intersect. Is mutated to contain the intersection.
+@tparam Roaring|Bitset rhs the right-hand bitmap or bitset to intersect.
+@treturn Roaring the left-hand bitmap is modified in-place, but returned for convenience.
+@see Roaring:intersection
+*/
+static int rr_intersection_mut(lua_State *L) {
+    return mut_binop(L, RR_AND);
+}
+
+
+/*** The union of two bitmaps. Also available as the `+` operator.
+@function Roaring:union
+@tparam Roaring lhs the left-hand bitmap to union.
+@tparam Roaring|Bitset rhs the right-hand bitmap or bitset to union.
+@treturn Roaring a newly allocated bitmap containing the union.
+@see Roaring:union_mut
+*/
+static int rr_union(lua_State *L) {
+    return push_binop(L, RR_OR);
+}
+
+
+/*** The in-place union of two bitmaps.
+@function Roaring:union_mut
+@tparam Roaring lhs the left-hand bitmap to union. Is mutated to contain the union.
+@tparam Roaring|Bitset rhs the right-hand bitmap or bitset to union.
+@treturn Roaring the left-hand bitmap is modified in-place, but returned for convenience.
+@see Roaring:union
+*/
+static int rr_union_mut(lua_State *L) {
+    return mut_binop(L, RR_OR);
+}
+
+
+/*** The asymmetric difference of two bitmaps. Also available as the `-` operator.
+@function Roaring:difference
+@tparam Roaring lhs the source bitmap.
+@tparam Roaring|Bitset rhs the bitmap or bitset to "subtract" from the source.
+@treturn Roaring a newly allocated bitmap with all bits set that are set in `lhs` but not in `rhs`.
+@see Roaring:difference_mut
+*/
+static int rr_difference(lua_State *L) {
+    return push_binop(L, RR_ANDNOT);
+}
+
+
+/*** The in-place asymmetric difference of two bitmaps.
+@function Roaring:difference_mut
+@tparam Roaring lhs the bitmap to modify.
+@tparam Roaring|Bitset rhs the bitmap or bitset to "subtract" from the left-hand.
+@treturn Roaring the left-hand bitmap is modified in place, but returned for convenience.
+@see Roaring:difference
+*/
+static int rr_difference_mut(lua_State *L) {
+    return mut_binop(L, RR_ANDNOT);
+}
+
+
+/*** The symmetric difference of two bitmaps.
+@function Roaring:symmetric_diff
+@tparam Roaring lhs the left-hand bitmap.
+@tparam Roaring|Bitset rhs the right-hand bitmap or bitset.
+@treturn Roaring a newly allocated bitmap with all bits set that are set in either `lhs` or `rhs`, but not in both.
+@see Roaring:symmetric_diff_mut
+*/
+static int rr_symmetric_diff(lua_State *L) {
+    return push_binop(L, RR_XOR);
+}
+
+
+/*** The in-place symmetric difference of two bitmaps.
+@function Roaring:symmetric_diff_mut
+@tparam Roaring lhs the bitmap to modify.
+@tparam Roaring|Bitset rhs the bitmap or bitset to compare against.
+@treturn Roaring the left-hand bitmap is modified in place, but returned for convenience.
+@see Roaring:symmetric_diff
+*/
+static int rr_symmetric_diff_mut(lua_State *L) {
+    return mut_binop(L, RR_XOR);
+}
+
+
+/*** Tests whether two bitmaps have the same bits set.
+Also available as the `==` operator, although Lua only uses that between two
+roaring bitmaps.
+
+@function Roaring:eq
+@tparam Roaring lhs the left-hand bitmap.
+@tparam Roaring|Bitset rhs the right-hand bitmap or bitset.
+@treturn bool whether the same bits are set in both.
+*/
+static int rr_eq(lua_State *L) {
+    const Roaring *const lhs = luaL_checkudata(L, 1, LUA_ROARING_TYPENAME);
+
+    Roaring view;
+    const Roaring *const rhs = check_operand(L, 2, &view);
+
+    const bool eq = rr_equals(lhs, rhs);
+    rr_free(&view);
+
+    lua_pushboolean(L, eq);
+    return 1;
+}
+
+
+/*** Tests whether every bit set in this bitmap is set in another.
+Also available as the `<=` operator.
+
+@function Roaring:subset
+@tparam Roaring lhs the possible subset.
+@tparam Roaring|Bitset rhs the possible superset.
+@treturn bool whether `lhs` is a subset of `rhs`.
+*/
+static int rr_subset_of(lua_State *L) {
+    const Roaring *const lhs = luaL_checkudata(L, 1, LUA_ROARING_TYPENAME);
+
+    Roaring view;
+    const Roaring *const rhs = check_operand(L, 2, &view);
+
+    const bool subset = rr_subset(lhs, rhs);
+    rr_free(&view);
+
+    lua_pushboolean(L, subset);
+    return 1;
+}
+
+
+static int rr_strict_subset_of(lua_State *L) {
+    const Roaring *const lhs = luaL_checkudata(L, 1, LUA_ROARING_TYPENAME);
+
+    Roaring view;
+    const Roaring *const rhs = check_operand(L, 2, &view);
+
+    const bool strict = rr_subset(lhs, rhs) &&
+        rr_cardinality(lhs) < rr_cardinality(rhs);
+    rr_free(&view);
+
+    lua_pushboolean(L, strict);
+    return 1;
+}
+
+
+static void push_bit_index(lua_State *L, const Roaring *r, uint64_t from) {
+    uint32_t idx;
+
+    if (rr_next(r, from, &idx)) {
+        lua_pushinteger(L, (lua_Integer)idx);
+    } else {
+        lua_pushnil(L);
+    }
+}
+
+
+/*** Finds the first set bit at or after a given index.
+@function Roaring:next_set
+@tparam num idx the index to start searching at.
+@treturn ?num the index of the next set bit, or `nil` if there are none.
+*/
+static int rr_next_set(lua_State *L) {
+    const Roaring *r = luaL_checkudata(L, 1, LUA_ROARING_TYPENAME);
+    const lua_Integer int_idx = luaL_checkinteger(L, 2);
+
+    // A negative index is completely invalid.
+    if (int_idx < 0) {
+        luaL_argerror(L, 2, "expected positive index");
+    }
+
+    push_bit_index(L, r, (uint64_t)int_idx);
+    return 1;
+}
+
+
+static int rr_iter_next(lua_State *L) {
+    const Roaring *r = luaL_checkudata(L, 1, LUA_ROARING_TYPENAME);
+    const lua_Integer prev = luaL_checkinteger(L, 2);
+
+    push_bit_index(L, r, prev < 0 ? 0 : (uint64_t)prev + 1);
+    return 1;
+}
+
+
+/*** Iterates over the indices of the set bits, in increasing order.
+@function Roaring:iter
+@tparam[opt=0] num from the index to start iterating at.
+@return an iterator function, the bitmap, and the starting state.
+*/
+static int rr_iter(lua_State *L) {
+    luaL_checkudata(L, 1, LUA_ROARING_TYPENAME);
+
+    const lua_Integer from = luaL_optinteger(L, 2, 0);
+
+    if (from < 0) {
+        luaL_argerror(L, 2, "expected positive index");
+    }
+
+    lua_pushcfunction(L, rr_iter_next);
+    lua_pushvalue(L, 1);
+    lua_pushinteger(L, from - 1);
+    return 3;
+}
+
+
+/*** Compacts the bitmap.
+Converts every chunk to whichever of the array, bitmap and run representations
+is smallest, and gives back unused memory. Worth calling on bitmaps which will
+be kept around for a while without changing much.
+
+@function Roaring:optimize
+@treturn Roaring the bitmap, for convenience.
+*/
+static int rr_optimize_lua(lua_State *L) {
+    Roaring *r = luaL_checkudata(L, 1, LUA_ROARING_TYPENAME);
+
+    if (!rr_optimize(r)) {
+        error_out_of_memory(L);
+    }
+
+    lua_pushvalue(L, 1);
+    return 1;
+}
+
+
+/*** The number of bytes of heap memory used by the bitmap.
+@function Roaring:memory
+@treturn num the number of bytes allocated, not counting the userdata itself.
+*/
+static int rr_memory_lua(lua_State *L) {
+    const Roaring *r = luaL_checkudata(L, 1, LUA_ROARING_TYPENAME);
+
+    lua_pushinteger(L, (lua_Integer)rr_memory(r));
+    return 1;
+}
+
+
+/*** Converts the bitmap to a dense `Bitset`.
+Requires the `bitset` module.
+
+@function Roaring:to_bitset
+@treturn Bitset a newly allocated bitset with the same bits set.
+*/
+static int rr_to_bitset(lua_State *L) {
+    const Roaring *r = luaL_checkudata(L, 1, LUA_ROARING_TYPENAME);
+
+    // Let the bitset module allocate the bitset the way it likes.
+    lua_getglobal(L, "require");
+    lua_pushliteral(L, LUA_BITSET_LIBNAME);
+    lua_call(L, 1, 1);
+    lua_getfield(L, -1, "new");
+
+    lua_Integer nbits = 0;
+
+    if (r->len > 0) {
+        const rr_container *const last = &r->cs[r->len - 1];
+        nbits = ((lua_Integer)last->key + 1) * RR_CHUNK_BITS;
+    }
+
+    lua_pushinteger(L, nbits);
+    lua_call(L, 1, 1);
+
+    Bitset *const bitset = bs_check(L, -1);
+    rr_to_blocks(r, bitset->bits, bitset->len);
+    bs_invalidate(bitset);
+
+    return 1;
+}
+
+
+static const luaL_reg rr_funcs[] = {
+    {"new", rr_new},
+    {NULL, NULL},
+};
+
+
+static const luaL_reg rr_methods[] = {
+    {"set", rr_set},
+    {"set_range", rr_set_range},
+    {"clear", rr_clear},
+    {"clear_range", rr_clear_range},
+    {"get", rr_get},
+    {"count", rr_count},
+    {"intersection", rr_intersection},
+    {"intersection_mut", rr_intersection_mut},
+    {"union", rr_union},
+    {"union_mut", rr_union_mut},
+    {"difference", rr_difference},
+    {"difference_mut", rr_difference_mut},
+    {"symmetric_diff", rr_symmetric_diff},
+    {"symmetric_diff_mut", rr_symmetric_diff_mut},
+    {"eq", rr_eq},
+    {"subset", rr_subset_of},
+    {"next_set", rr_next_set},
+    {"iter", rr_iter},
+    {"optimize", rr_optimize_lua},
+    {"memory", rr_memory_lua},
+    {"to_bitset", rr_to_bitset},
+    {NULL, NULL},
+};
+
+
+LUALIB_API int luaopen_roaring(lua_State *L) {
+    bs_kernels_init();
+
+    luaL_register(L, LUA_ROARING_LIBNAME, rr_funcs);
+
+    if (luaL_newmetatable(L, LUA_ROARING_TYPENAME) == 0) {
+        lua_pushstring(L, "Uh-oh! The string used in the roaring library to \
+            identify the roaring metatable is taken in the registry! Sean \
+            didn't think this would happen, so you better tell him either \
+            through github or email at <sean@errno.com>.");
+        lua_error(L);
+    }
+
+    static const struct luaL_reg rr_mt[] = {
+        {"__gc", rr_gc},
+        {"__add", rr_union},
+        {"__mul", rr_intersection},
+        {"__sub", rr_difference},
+        {"__len", rr_count},
+        {"__eq", rr_eq},
+        {"__lt", rr_strict_subset_of},
+        {"__le", rr_subset_of},
+        {NULL, NULL},
+    };
+
+    lua_newtable(L);
+    luaL_register(L, NULL, rr_methods);
+    lua_setfield(L, -2, "__index");
+
+    luaL_register(L, NULL, rr_mt);
+
+    lua_pushstring(L, AUTHOR_STRING);
+    lua_setfield(L, -2, "_AUTHOR");
+
+    lua_pushstring(L, VERSION_STRING);
+    lua_setfield(L, -2, "_VERSION");
+
+    // Pop the metatable, leaving the library table to be returned.
+    lua_pop(L, 1);
+
+    return 1;
+}
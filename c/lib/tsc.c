@@ -0,0 +1,191 @@
+/*
+
+Copyright (c) 2016 Sean Leffler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+/// High-resolution timers for the benchmarks. `os.clock` measures CPU time in
+/// coarse steps and costs a system call; this gives a monotonic nanosecond
+/// clock, the CPU's time-stamp counter where there is one, and a way to time a
+/// function over many calls without going back to Lua for the clock.
+// @module tsc
+
+#include <stdint.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define TSC_X86 1
+#include <x86intrin.h>
+#endif
+
+#define LUA_TSC_LIBNAME "tsc"
+
+#define AUTHOR_STRING "Sean Leffler <sean@errno.com>"
+#define VERSION_STRING "1.0"
+
+
+static double now_ns(void) {
+#if defined(_WIN32)
+    LARGE_INTEGER count, freq;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return (double)count.QuadPart * 1e9 / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+#endif
+}
+
+
+static double now_cycles(void) {
+#ifdef TSC_X86
+    // Don't let the read drift up or down past the code being timed.
+    _mm_lfence();
+    const uint64_t t = __rdtsc();
+    _mm_lfence();
+    return (double)t;
+#else
+    return now_ns();
+#endif
+}
+
+
+/*** The time in nanoseconds since some fixed point in the past.
+@function now
+@treturn num
+*/
+static int tsc_now(lua_State *L) {
+    lua_pushnumber(L, now_ns());
+    return 1;
+}
+
+
+/*** The CPU's time-stamp counter.
+On CPUs without one, this is the same as `now`. Modern x86 CPUs tick it at a
+constant rate, regardless of the current clock speed; see `ticks_per_ns`.
+
+@function cycles
+@treturn num
+*/
+static int tsc_cycles(lua_State *L) {
+    lua_pushnumber(L, now_cycles());
+    return 1;
+}
+
+
+/*** How fast `cycles` ticks, measured against `now` over a few milliseconds.
+The measurement is taken once and remembered.
+
+@function ticks_per_ns
+@treturn num
+*/
+static int tsc_ticks_per_ns(lua_State *L) {
+    static double rate = 0;
+
+    if (rate == 0) {
+        const double c0 = now_cycles(), t0 = now_ns();
+        double t1;
+
+        do {
+            t1 = now_ns();
+        } while (t1 - t0 < 10e6);
+
+        rate = (now_cycles() - c0) / (t1 - t0);
+    }
+
+    lua_pushnumber(L, rate);
+    return 1;
+}
+
+
+/*** Times calls to a function.
+Calls `fn(...)` `iterations` times in a row, reading the clocks only before and
+after.
+
+@function measure
+@tparam function fn the function to time.
+@tparam int iterations how many times to call it.
+@param ... arguments to pass to `fn`.
+@treturn num nanoseconds per call.
+@treturn num time-stamp counter ticks per call.
+*/
+static int tsc_measure(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    const lua_Integer iterations = luaL_checkinteger(L, 2);
+
+    if (iterations < 1) {
+        luaL_argerror(L, 2, "expected positive iteration count");
+    }
+
+    const int nargs = lua_gettop(L) - 2;
+
+    lua_Integer i;
+    int a;
+
+    const double t0 = now_ns(), c0 = now_cycles();
+
+    for (i = 0; i < iterations; i++) {
+        lua_pushvalue(L, 1);
+
+        for (a = 0; a < nargs; a++) {
+            lua_pushvalue(L, 3 + a);
+        }
+
+        lua_call(L, nargs, 0);
+    }
+
+    const double c1 = now_cycles(), t1 = now_ns();
+
+    lua_pushnumber(L, (t1 - t0) / (double)iterations);
+    lua_pushnumber(L, (c1 - c0) / (double)iterations);
+    return 2;
+}
+
+
+static const luaL_reg tsc_funcs[] = {
+    {"now", tsc_now},
+    {"cycles", tsc_cycles},
+    {"ticks_per_ns", tsc_ticks_per_ns},
+    {"measure", tsc_measure},
+    {NULL, NULL},
+};
+
+
+LUALIB_API int luaopen_tsc(lua_State *L) {
+    luaL_register(L, LUA_TSC_LIBNAME, tsc_funcs);
+
+    lua_pushstring(L, AUTHOR_STRING);
+    lua_setfield(L, -2, "_AUTHOR");
+
+    lua_pushstring(L, VERSION_STRING);
+    lua_setfield(L, -2, "_VERSION");
+
+    return 1;
+}
@@ -0,0 +1,123 @@
+/*
+
+Copyright (c) 2016 Sean Leffler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include <stdint.h>
+
+#include "arena.h"
+
+// Chunk data starts this far into a chunk, so that it stays aligned.
+#define AR_HEADER \
+    ((sizeof(ar_chunk) + AR_ALIGN - 1) / AR_ALIGN * AR_ALIGN)
+
+
+void ar_init(Arena *a, ar_alloc_fn alloc, void *ud) {
+    a->alloc = alloc;
+    a->ud = ud;
+    a->head = NULL;
+    a->cur = NULL;
+    a->reserved = 0;
+}
+
+
+void ar_free(Arena *a) {
+    ar_chunk *c = a->head;
+
+    while (c != NULL) {
+        ar_chunk *const next = c->next;
+        a->alloc(a->ud, c, AR_HEADER + c->size, 0);
+        c = next;
+    }
+
+    a->head = NULL;
+    a->cur = NULL;
+    a->reserved = 0;
+}
+
+
+void *ar_alloc(Arena *a, size_t size) {
+    if (size > SIZE_MAX - AR_HEADER - AR_ALIGN) {
+        return NULL;
+    }
+
+    size = (size + AR_ALIGN - 1) / AR_ALIGN * AR_ALIGN;
+
+    // Chunks after `cur` have been emptied by a reset; skip any that are too
+    // small for this.
+    while (a->cur != NULL && a->cur->used + size > a->cur->size) {
+        if (a->cur->next == NULL) {
+            break;
+        }
+
+        a->cur = a->cur->next;
+    }
+
+    if (a->cur == NULL || a->cur->used + size > a->cur->size) {
+        // Each chunk is at least twice the size of the last, so a growing
+        // arena only needs a logarithmic number of them.
+        size_t chunk_size = AR_MIN_CHUNK;
+
+        if (a->cur != NULL && 2 * a->cur->size > chunk_size) {
+            chunk_size = 2 * a->cur->size;
+        }
+
+        if (size > chunk_size) {
+            chunk_size = size;
+        }
+
+        ar_chunk *const c = a->alloc(a->ud, NULL, 0, AR_HEADER + chunk_size);
+
+        if (c == NULL) {
+            return NULL;
+        }
+
+        c->next = NULL;
+        c->size = chunk_size;
+        c->used = 0;
+
+        if (a->cur != NULL) {
+            a->cur->next = c;
+        } else {
+            a->head = c;
+        }
+
+        a->cur = c;
+        a->reserved += AR_HEADER + chunk_size;
+    }
+
+    void *const p = (char*)a->cur + AR_HEADER + a->cur->used;
+    a->cur->used += size;
+
+    return p;
+}
+
+
+void ar_reset(Arena *a) {
+    ar_chunk *c;
+
+    for (c = a->head; c != NULL; c = c->next) {
+        c->used = 0;
+    }
+
+    a->cur = a->head;
+}
@@ -0,0 +1,590 @@
+/*
+
+Copyright (c) 2016 Sean Leffler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "bitgrid.h"
+
+// `BITWIDTH` is unsigned, which doesn't mix well with negative offsets.
+#define SIGNED_BITWIDTH ((ptrdiff_t)BITWIDTH)
+
+
+static size_t stride_for(size_t width) {
+    return width / BITWIDTH + (width % BITWIDTH != 0);
+}
+
+
+// The bits of the last block of a row which are cells rather than padding.
+static block_t last_mask(const BitGrid *g) {
+    const size_t r = g->width % BITWIDTH;
+
+    return (r == 0) ? ALL_ONES : ((block_t)1 << r) - 1;
+}
+
+
+// The bits of block `j` which fall in `[lo, hi)`, for a non-empty range
+// overlapping the block.
+static block_t span_mask(size_t j, size_t lo, size_t hi) {
+    const size_t first = j * BITWIDTH;
+    const size_t a = (lo > first) ? lo - first : 0;
+    const size_t b = (hi - first < BITWIDTH) ? hi - first : BITWIDTH;
+
+    return (ALL_ONES << a) & (ALL_ONES >> (BITWIDTH - b));
+}
+
+
+// The `BITWIDTH` bits of a row of `len` blocks starting at bit `pos`, which
+// may be up to a block before the start of the row. Bits off either end read
+// as clear.
+static block_t extract(const block_t *row, size_t len, ptrdiff_t pos) {
+    if (pos < 0) {
+        return (len == 0 || -pos >= SIGNED_BITWIDTH) ? 0 : row[0] << -pos;
+    }
+
+    const size_t i = (size_t)pos / BITWIDTH;
+    const size_t s = (size_t)pos % BITWIDTH;
+
+    if (i >= len) {
+        return 0;
+    }
+
+    block_t v = row[i] >> s;
+
+    if (s != 0 && i + 1 < len) {
+        v |= row[i + 1] << (BITWIDTH - s);
+    }
+
+    return v;
+}
+
+
+static block_t apply(bg_op op, block_t d, block_t v) {
+    switch (op) {
+    case BG_COPY: return v;
+    case BG_AND: return d & v;
+    case BG_OR: return d | v;
+    case BG_ANDNOT: return d & ~v;
+    case BG_XOR: return d ^ v;
+    }
+
+    return d;
+}
+
+
+size_t bg_size(size_t width, size_t height) {
+    const size_t stride = stride_for(width);
+    const size_t rows = height + BG_SCRATCH_ROWS;
+
+    if (rows < height) {
+        return 0;
+    }
+
+    if (stride > 0 &&
+            rows > (SIZE_MAX - sizeof(BitGrid)) / sizeof(block_t) / stride) {
+        return 0;
+    }
+
+    return sizeof(BitGrid) + stride * rows * sizeof(block_t);
+}
+
+
+void bg_init(BitGrid *g, size_t width, size_t height) {
+    g->width = width;
+    g->height = height;
+    g->stride = stride_for(width);
+
+    memset(g->bits, 0,
+        g->stride * (height + BG_SCRATCH_ROWS) * sizeof(block_t));
+}
+
+
+size_t bg_count(const BitGrid *g) {
+    return bs_kern->popcount_blocks(g->bits, g->stride * g->height);
+}
+
+
+bool bg_equals(const BitGrid *a, const BitGrid *b) {
+    return a->width == b->width && a->height == b->height &&
+        bs_kern->eq_blocks(a->bits, b->bits, a->stride * a->height);
+}
+
+
+// Clips `[*x, *x + *w)` to `[0, size)`, leaving `*w` zero or less if nothing's
+// left of it.
+static void clip(ptrdiff_t *x, ptrdiff_t *w, size_t size) {
+    if (*x < 0) {
+        *w += *x;
+        *x = 0;
+    }
+
+    if ((size_t)*x >= size) {
+        *w = 0;
+    } else if (*w > (ptrdiff_t)(size - (size_t)*x)) {
+        *w = (ptrdiff_t)(size - (size_t)*x);
+    }
+}
+
+
+void bg_fill(BitGrid *g, ptrdiff_t x, ptrdiff_t y, ptrdiff_t w, ptrdiff_t h,
+        bool value) {
+    clip(&x, &w, g->width);
+    clip(&y, &h, g->height);
+
+    if (w <= 0 || h <= 0) {
+        return;
+    }
+
+    const size_t lo = (size_t)x, hi = (size_t)(x + w);
+    ptrdiff_t row;
+
+    for (row = y; row < y + h; row++) {
+        block_t *const bits = bg_row(g, (size_t)row);
+        size_t j;
+
+        for (j = lo / BITWIDTH; j <= (hi - 1) / BITWIDTH; j++) {
+            const block_t m = span_mask(j, lo, hi);
+            bits[j] = value ? (bits[j] | m) : (bits[j] & ~m);
+        }
+    }
+}
+
+
+// Shifts one row by `dx` cells. Working from the end the bits move towards
+// means `dst` may be `src`.
+static void shift_row(block_t *dst, const block_t *src, size_t stride,
+        ptrdiff_t dx, block_t mask) {
+    const ptrdiff_t n = (ptrdiff_t)stride;
+    ptrdiff_t i;
+
+    if (dx >= 0) {
+        const ptrdiff_t q = dx / SIGNED_BITWIDTH, r = dx % SIGNED_BITWIDTH;
+
+        for (i = n - 1; i >= 0; i--) {
+            const ptrdiff_t k = i - q;
+            block_t v = 0;
+
+            if (k >= 0) {
+                v = src[k] << r;
+            }
+
+            if (r != 0 && k >= 1) {
+                v |= src[k - 1] >> (SIGNED_BITWIDTH - r);
+            }
+
+            dst[i] = v;
+        }
+    } else {
+        const ptrdiff_t q = -dx / SIGNED_BITWIDTH, r = -dx % SIGNED_BITWIDTH;
+
+        for (i = 0; i < n; i++) {
+            const ptrdiff_t k = i + q;
+            block_t v = 0;
+
+            if (k < n) {
+                v = src[k] >> r;
+            }
+
+            if (r != 0 && k + 1 < n) {
+                v |= src[k + 1] << (SIGNED_BITWIDTH - r);
+            }
+
+            dst[i] = v;
+        }
+    }
+
+    dst[stride - 1] &= mask;
+}
+
+
+void bg_shift(BitGrid *dst, const BitGrid *src, ptrdiff_t dx, ptrdiff_t dy) {
+    const size_t stride = src->stride;
+    const ptrdiff_t h = (ptrdiff_t)src->height;
+
+    if (stride == 0) {
+        return;
+    }
+
+    // Rows are visited from the end they move towards, so that each is read
+    // before it's overwritten.
+    const ptrdiff_t first = (dy > 0) ? h - 1 : 0;
+    const ptrdiff_t step = (dy > 0) ? -1 : 1;
+    ptrdiff_t y;
+
+    for (y = first; y >= 0 && y < h; y += step) {
+        block_t *const out = bg_row(dst, (size_t)y);
+        const ptrdiff_t from = y - dy;
+
+        if (from < 0 || from >= h) {
+            memset(out, 0, stride * sizeof(block_t));
+        } else {
+            shift_row(out, bg_row(src, (size_t)from), stride, dx,
+                last_mask(src));
+        }
+    }
+}
+
+
+void bg_blit(bg_op op, BitGrid *dst, ptrdiff_t dx, ptrdiff_t dy,
+        const BitGrid *src, ptrdiff_t sx, ptrdiff_t sy, ptrdiff_t w,
+        ptrdiff_t h) {
+    // Clip the source rectangle, moving the destination along with it, and
+    // then the other way around.
+    if (sx < 0) { dx -= sx; w += sx; sx = 0; }
+    if (sy < 0) { dy -= sy; h += sy; sy = 0; }
+    if (dx < 0) { sx -= dx; w += dx; dx = 0; }
+    if (dy < 0) { sy -= dy; h += dy; dy = 0; }
+
+    clip(&sx, &w, src->width);
+    clip(&sy, &h, src->height);
+    clip(&dx, &w, dst->width);
+    clip(&dy, &h, dst->height);
+
+    if (w <= 0 || h <= 0) {
+        return;
+    }
+
+    // Blitting a grid onto itself, the rows are visited from the end they
+    // move towards, and each is copied aside before it's read, so that it
+    // doesn't matter how the rectangles overlap.
+    const bool alias = (dst == src);
+    block_t *const scratch = bg_row(dst, dst->height);
+
+    const ptrdiff_t first = (alias && dy > sy) ? h - 1 : 0;
+    const ptrdiff_t step = (alias && dy > sy) ? -1 : 1;
+
+    const size_t lo = (size_t)dx, hi = (size_t)(dx + w);
+    ptrdiff_t i;
+
+    for (i = first; i >= 0 && i < h; i += step) {
+        const block_t *in = bg_row(src, (size_t)(sy + i));
+        block_t *const out = bg_row(dst, (size_t)(dy + i));
+
+        if (alias) {
+            memcpy(scratch, in, src->stride * sizeof(block_t));
+            in = scratch;
+        }
+
+        size_t j;
+        for (j = lo / BITWIDTH; j <= (hi - 1) / BITWIDTH; j++) {
+            const block_t m = span_mask(j, lo, hi);
+            const block_t v = extract(in, src->stride,
+                (ptrdiff_t)(j * BITWIDTH) - dx + sx);
+
+            out[j] = (out[j] & ~m) | (apply(op, out[j], v) & m);
+        }
+    }
+}
+
+
+// What the neighbourhood operations need to know, besides the rows.
+typedef struct hood {
+    size_t stride;
+    block_t mask;
+    // What cells off the grid read as, all clear or all set.
+    block_t fill;
+    bool diagonal;
+    unsigned born;
+    unsigned survive;
+} hood;
+
+
+// Block `i` of a row, with everything off the grid (a NULL row, blocks off
+// either end, and the padding) reading as the fill.
+static inline block_t load(const hood *n, const block_t *row, ptrdiff_t i) {
+    if (row == NULL || i < 0 || (size_t)i >= n->stride) {
+        return n->fill;
+    }
+
+    block_t v = row[i];
+
+    if ((size_t)i == n->stride - 1) {
+        v |= n->fill & ~n->mask;
+    }
+
+    return v;
+}
+
+
+// A window of three blocks of a row, `w[1]` being the one being worked on,
+// which slides along one block at a time so that each is only loaded once.
+static inline void window_start(const hood *n, const block_t *row,
+        block_t w[3]) {
+    w[0] = load(n, row, -1);
+    w[1] = load(n, row, 0);
+    w[2] = load(n, row, 1);
+}
+
+
+// Slides the window on from block `i` to block `i + 1`.
+static inline void window_next(const hood *n, const block_t *row,
+        block_t w[3], ptrdiff_t i) {
+    w[0] = w[1];
+    w[1] = w[2];
+    w[2] = load(n, row, i + 2);
+}
+
+
+// The neighbours to the west and east of the cells of the middle block: bit
+// `b` of the result is cell `b - 1` or `b + 1`.
+static inline block_t west(const block_t w[3]) {
+    return (w[1] << 1) | (w[0] >> (BITWIDTH - 1));
+}
+
+
+static inline block_t east(const block_t w[3]) {
+    return (w[1] >> 1) | (w[2] << (BITWIDTH - 1));
+}
+
+
+typedef void (*row_fn)(const hood *n, block_t *out, const block_t *above,
+    const block_t *row, const block_t *below);
+
+
+// Runs `fn` over every row of `src`, writing into `dst`, with the rows above
+// and below (NULL off the grid.) Each row is copied into `dst`'s scratch space
+// before its output is written, so that the row above is still there to read
+// when `dst` is `src`.
+static void each_row(BitGrid *dst, const BitGrid *src, const hood *n,
+        row_fn fn) {
+    const size_t stride = src->stride;
+    block_t *const scratch = bg_row(dst, dst->height);
+    const block_t *above = NULL;
+
+    if (stride == 0) {
+        return;
+    }
+
+    size_t y;
+    for (y = 0; y < src->height; y++) {
+        block_t *const row = scratch + (y % 2) * stride;
+        memcpy(row, bg_row(src, y), stride * sizeof(block_t));
+
+        const block_t *const below =
+            (y + 1 < src->height) ? bg_row(src, y + 1) : NULL;
+
+        block_t *const out = bg_row(dst, y);
+        fn(n, out, above, row, below);
+        out[stride - 1] &= n->mask;
+
+        above = row;
+    }
+}
+
+
+static void dilate_row(const hood *n, block_t *out, const block_t *above,
+        const block_t *row, const block_t *below) {
+    block_t a[3], r[3], b[3];
+    window_start(n, above, a);
+    window_start(n, row, r);
+    window_start(n, below, b);
+
+    ptrdiff_t i;
+    for (i = 0; i < (ptrdiff_t)n->stride; i++) {
+        block_t v = r[1] | west(r) | east(r) | a[1] | b[1];
+
+        if (n->diagonal) {
+            v |= west(a) | east(a) | west(b) | east(b);
+        }
+
+        out[i] = v;
+
+        window_next(n, above, a, i);
+        window_next(n, row, r, i);
+        window_next(n, below, b, i);
+    }
+}
+
+
+static void erode_row(const hood *n, block_t *out, const block_t *above,
+        const block_t *row, const block_t *below) {
+    block_t a[3], r[3], b[3];
+    window_start(n, above, a);
+    window_start(n, row, r);
+    window_start(n, below, b);
+
+    ptrdiff_t i;
+    for (i = 0; i < (ptrdiff_t)n->stride; i++) {
+        block_t v = r[1] & west(r) & east(r) & a[1] & b[1];
+
+        if (n->diagonal) {
+            v &= west(a) & east(a) & west(b) & east(b);
+        }
+
+        out[i] = v;
+
+        window_next(n, above, a, i);
+        window_next(n, row, r, i);
+        window_next(n, below, b, i);
+    }
+}
+
+
+void bg_dilate(BitGrid *dst, const BitGrid *src, bool diagonal) {
+    const hood n = { src->stride, last_mask(src), 0, diagonal, 0, 0 };
+    each_row(dst, src, &n, dilate_row);
+}
+
+
+void bg_erode(BitGrid *dst, const BitGrid *src, bool diagonal) {
+    const hood n = { src->stride, last_mask(src), ALL_ONES, diagonal, 0, 0 };
+    each_row(dst, src, &n, erode_row);
+}
+
+
+// Adds a block of neighbours to a bit-sliced count, `c[k]` holding bit `k` of
+// each cell's count. Counts never go past 8, so four bits are plenty.
+static inline void count_in(block_t c[4], block_t v) {
+    int k;
+    for (k = 0; k < 4; k++) {
+        const block_t carry = c[k] & v;
+        c[k] ^= v;
+        v = carry;
+    }
+}
+
+
+// `s ? x1 : x0`, a bit at a time.
+static inline block_t mux(block_t s, block_t x0, block_t x1) {
+    return x0 ^ ((x0 ^ x1) & s);
+}
+
+
+// Applies a truth table of one bit to every cell of `c0`: bit `k` of `f` is
+// the result where `c0` is `k`.
+static inline block_t pick(unsigned f, block_t c0) {
+    switch (f & 3) {
+    case 1: return ~c0;
+    case 2: return c0;
+    case 3: return ALL_ONES;
+    default: return 0;
+    }
+}
+
+
+// The cells whose count is one of those in `rule`, bit `n` of which stands for
+// a count of `n`. The rule is a truth table on the bits of the count, picked
+// through a bit at a time. A count of 8 is the only one with `c[3]` set, so
+// the other bits only need looking at below that.
+static inline block_t matching(unsigned rule, const block_t c[4]) {
+    const block_t low = mux(c[2],
+        mux(c[1], pick(rule, c[0]), pick(rule >> 2, c[0])),
+        mux(c[1], pick(rule >> 4, c[0]), pick(rule >> 6, c[0])));
+
+    return mux(c[3], low, (rule & 0x100) ? ALL_ONES : 0);
+}
+
+
+static void step_row(const hood *n, block_t *out, const block_t *above,
+        const block_t *row, const block_t *below) {
+    block_t a[3], r[3], b[3];
+    window_start(n, above, a);
+    window_start(n, row, r);
+    window_start(n, below, b);
+
+    ptrdiff_t i;
+    for (i = 0; i < (ptrdiff_t)n->stride; i++) {
+        block_t c[4] = { 0, 0, 0, 0 };
+
+        count_in(c, west(a));
+        count_in(c, a[1]);
+        count_in(c, east(a));
+        count_in(c, west(r));
+        count_in(c, east(r));
+        count_in(c, west(b));
+        count_in(c, b[1]);
+        count_in(c, east(b));
+
+        // Not `r[1]`, which has the padding filled in.
+        const block_t alive = row[i];
+
+        out[i] = (~alive & matching(n->born, c)) |
+            (alive & matching(n->survive, c));
+
+        window_next(n, above, a, i);
+        window_next(n, row, r, i);
+        window_next(n, below, b, i);
+    }
+}
+
+
+void bg_step(BitGrid *dst, const BitGrid *src, unsigned born,
+        unsigned survive, bool edge) {
+    const hood n = {
+        src->stride, last_mask(src), edge ? ALL_ONES : 0, true, born, survive,
+    };
+
+    each_row(dst, src, &n, step_row);
+}
+
+
+size_t bg_flat_blocks(const BitGrid *g) {
+    const size_t cells = g->width * g->height;
+
+    return cells / BITWIDTH + (cells % BITWIDTH != 0);
+}
+
+
+void bg_to_flat(const BitGrid *g, block_t *bits) {
+    const size_t len = bg_flat_blocks(g);
+
+    size_t y;
+    for (y = 0; y < g->height; y++) {
+        const block_t *const row = bg_row(g, y);
+
+        size_t j;
+        for (j = 0; j < g->stride; j++) {
+            // Padding is clear, so whatever spills past the end of the row
+            // is zero.
+            const size_t pos = y * g->width + j * BITWIDTH;
+            const size_t i = pos / BITWIDTH, s = pos % BITWIDTH;
+
+            bits[i] |= row[j] << s;
+
+            if (s != 0 && i + 1 < len) {
+                bits[i + 1] |= row[j] >> (BITWIDTH - s);
+            }
+        }
+    }
+}
+
+
+void bg_from_flat(BitGrid *g, const block_t *bits, size_t len) {
+    const block_t mask = last_mask(g);
+
+    size_t y;
+    for (y = 0; y < g->height; y++) {
+        block_t *const row = bg_row(g, y);
+
+        size_t j;
+        for (j = 0; j < g->stride; j++) {
+            const size_t pos = y * g->width + j * BITWIDTH;
+            row[j] = extract(bits, len, (ptrdiff_t)pos);
+        }
+
+        if (g->stride > 0) {
+            row[g->stride - 1] &= mask;
+        }
+    }
+}
@@ -0,0 +1,271 @@
+/*
+
+Copyright (c) 2016 Sean Leffler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bloom.h"
+
+// Keys don't spread evenly over the blocks, and the fuller blocks give more
+// false positives than the emptier ones make up for, more so the more bits
+// each key sets. Blocked filters are made this much bigger than a plain one
+// for rate `p`, to bring the rate back down to about what was asked for.
+static double oversize(double p) {
+    const double r = log(p) / 24;
+
+    return 1 + r * r;
+}
+
+
+#if defined(__GNUC__)
+#define PREFETCH(p, rw) __builtin_prefetch((p), (rw))
+#else
+#define PREFETCH(p, rw) ((void)(p))
+#endif
+
+// Seeds for the two kinds of key, so that they hash apart.
+#define SEED_BYTES UINT64_C(0x243f6a8885a308d3)
+#define SEED_NUMBER UINT64_C(0x13198a2e03707344)
+
+
+bool bl_params(double n, double p, size_t *nblocks, unsigned *k) {
+    if (n < 1) {
+        n = 1;
+    }
+
+    const double ln2 = log(2.0);
+    const double bits = oversize(p) * -n * log(p) / (ln2 * ln2);
+    const double blocks = ceil(bits / BL_BLOCK_BITS);
+
+    if (!(blocks < (double)(SIZE_MAX / BL_BLOCK_BYTES) - 1)) {
+        return false;
+    }
+
+    const double best_k = floor(-log(p) / ln2 + 0.5);
+
+    *nblocks = (blocks < 1) ? 1 : (size_t)blocks;
+    *k = (best_k < 1) ? 1 : (best_k > BL_MAX_K) ? BL_MAX_K : (unsigned)best_k;
+
+    return true;
+}
+
+
+size_t bl_size(size_t nblocks) {
+    if (nblocks > (SIZE_MAX - sizeof(Bloom)) / BL_BLOCK_BYTES - 1) {
+        return 0;
+    }
+
+    // Room for the blocks wherever the first cache-line boundary falls.
+    return sizeof(Bloom) + (nblocks + 1) * BL_BLOCK_BYTES;
+}
+
+
+void bl_init(Bloom *bl, size_t nblocks, unsigned k) {
+    const uintptr_t at = (uintptr_t)bl->storage;
+
+    bl->nblocks = nblocks;
+    bl->k = k;
+    bl->bits = (block_t*)((at + BL_BLOCK_BYTES - 1) &
+        ~(uintptr_t)(BL_BLOCK_BYTES - 1));
+
+    bl_clear(bl);
+}
+
+
+void bl_clear(Bloom *bl) {
+    memset(bl->bits, 0, bl->nblocks * BL_BLOCK_BYTES);
+}
+
+
+void bl_copy(Bloom *dst, const Bloom *src) {
+    bl_init(dst, src->nblocks, src->k);
+    memcpy(dst->bits, src->bits, src->nblocks * BL_BLOCK_BYTES);
+}
+
+
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 32;
+    x *= UINT64_C(0xd6e8feb86659fd93);
+    x ^= x >> 32;
+    x *= UINT64_C(0xd6e8feb86659fd93);
+    x ^= x >> 32;
+
+    return x;
+}
+
+
+uint64_t bl_hash_bytes(const void *p, size_t n) {
+    const unsigned char *s = (const unsigned char*)p;
+    uint64_t h = SEED_BYTES ^ ((uint64_t)n * UINT64_C(0x9e3779b97f4a7c15));
+    uint64_t w;
+
+    // One multiply per word; `mix64` at the end does the rest of the mixing.
+    for (; n >= 8; n -= 8, s += 8) {
+        memcpy(&w, s, 8);
+        h = (h ^ w) * UINT64_C(0xd6e8feb86659fd93);
+        h ^= h >> 32;
+    }
+
+    // The last few bytes, read without a loop or a call to `memcpy`; the
+    // length went into the seed, so overlapping reads are fine.
+    if (n >= 4) {
+        uint32_t lo, hi;
+        memcpy(&lo, s, 4);
+        memcpy(&hi, s + n - 4, 4);
+        h = (h ^ (((uint64_t)hi << 32) | lo)) * UINT64_C(0xd6e8feb86659fd93);
+    } else if (n > 0) {
+        w = ((uint64_t)s[0] << 16) | ((uint64_t)s[n / 2] << 8) | s[n - 1];
+        h = (h ^ w) * UINT64_C(0xd6e8feb86659fd93);
+    }
+
+    return mix64(h);
+}
+
+
+uint64_t bl_hash_number(double x) {
+    uint64_t w;
+
+    // Integers hash by value, so that 0 and -0 are the same key.
+    if (x == floor(x) && x >= -9.2e18 && x <= 9.2e18) {
+        w = (uint64_t)(int64_t)x;
+    } else {
+        memcpy(&w, &x, sizeof(w));
+    }
+
+    return mix64(w ^ SEED_NUMBER);
+}
+
+
+// The block a hash falls in, from its high half. Multiplying and shifting maps
+// it onto the blocks without a division.
+static size_t block_of(const Bloom *bl, uint64_t h) {
+    return (size_t)(((h >> 32) * (uint64_t)bl->nblocks) >> 32);
+}
+
+
+// Odd multipliers, one for each bit a key sets.
+static const uint64_t salts[BL_MAX_K] = {
+    UINT64_C(0x9e3779b97f4a7c15), UINT64_C(0xbf58476d1ce4e5b9),
+    UINT64_C(0x94d049bb133111eb), UINT64_C(0xd6e8feb86659fd93),
+    UINT64_C(0xa0761d6478bd642f), UINT64_C(0xe7037ed1a0b428db),
+    UINT64_C(0x8ebc6af09c88c6e3), UINT64_C(0x589965cc75374cc3),
+    UINT64_C(0x1d8e4e27c47d124f), UINT64_C(0xc2b2ae3d27d4eb4f),
+    UINT64_C(0x165667b19e3779f9), UINT64_C(0x27d4eb2f165667c5),
+    UINT64_C(0x85ebca77c2b2ae63), UINT64_C(0xff51afd7ed558ccd),
+    UINT64_C(0xc4ceb9fe1a85ec53), UINT64_C(0x2545f4914f6cdd1d),
+};
+
+
+// Bit `i` of the bits a hash sets within its block, from its low half: the
+// top bits of it times the `i`th salt. The multiplies don't depend on each
+// other, so they can all go at once.
+static uint32_t bit_of(uint64_t h, unsigned i) {
+    const uint64_t x = (h << 32) | (h & 0xffffffff);
+
+    return (uint32_t)((x * salts[i]) >> 55);
+}
+
+
+void bl_add(Bloom *bl, uint64_t h) {
+    block_t *const block = bl->bits + block_of(bl, h) * BL_BLOCK_WORDS;
+
+    unsigned i;
+    for (i = 0; i < bl->k; i++) {
+        const uint32_t pos = bit_of(h, i);
+        block[pos / BITWIDTH] |= JUST_ONE << (pos % BITWIDTH);
+    }
+}
+
+
+bool bl_contains(const Bloom *bl, uint64_t h) {
+    const block_t *const block = bl->bits + block_of(bl, h) * BL_BLOCK_WORDS;
+
+    // Any missing bit will do, so there's no point branching on each one.
+    block_t missing = 0;
+
+    unsigned i;
+    for (i = 0; i < bl->k; i++) {
+        const uint32_t pos = bit_of(h, i);
+        missing |= ~block[pos / BITWIDTH] & (JUST_ONE << (pos % BITWIDTH));
+    }
+
+    return missing == 0;
+}
+
+
+void bl_add_many(Bloom *bl, const uint64_t *h, size_t n) {
+    size_t i;
+    for (i = 0; i < n; i++) {
+        PREFETCH(bl->bits + block_of(bl, h[i]) * BL_BLOCK_WORDS, 1);
+    }
+
+    for (i = 0; i < n; i++) {
+        bl_add(bl, h[i]);
+    }
+}
+
+
+void bl_contains_many(const Bloom *bl, const uint64_t *h, size_t n,
+        bool *out) {
+    size_t i;
+    for (i = 0; i < n; i++) {
+        PREFETCH(bl->bits + block_of(bl, h[i]) * BL_BLOCK_WORDS, 0);
+    }
+
+    for (i = 0; i < n; i++) {
+        out[i] = bl_contains(bl, h[i]);
+    }
+}
+
+
+bool bl_compatible(const Bloom *a, const Bloom *b) {
+    return a->nblocks == b->nblocks && a->k == b->k;
+}
+
+
+void bl_union(Bloom *dst, const Bloom *src) {
+    bs_kern->or_blocks(dst->bits, dst->bits, src->bits,
+        dst->nblocks * BL_BLOCK_WORDS);
+}
+
+
+double bl_estimate(const Bloom *bl) {
+    const double m = (double)bl_bits(bl);
+    const double x = (double)bs_kern->popcount_blocks(bl->bits,
+        bl->nblocks * BL_BLOCK_WORDS);
+
+    if (x >= m) {
+        return INFINITY;
+    }
+
+    return -(m / bl->k) * log(1 - x / m);
+}
+
+
+size_t bl_bits(const Bloom *bl) {
+    return bl->nblocks * BL_BLOCK_BITS;
+}
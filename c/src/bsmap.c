@@ -0,0 +1,280 @@
+/*
+
+Copyright (c) 2016 Sean Leffler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bsmap.h"
+
+#define BM_MIN_CAP 16
+
+
+void bm_init(BsMap *m, bm_alloc_fn alloc, void *ud) {
+    m->alloc = alloc;
+    m->ud = ud;
+    m->cap = 0;
+    m->count = 0;
+    m->slots = NULL;
+}
+
+
+static void free_key(BsMap *m, bm_entry *e) {
+    if (e->len > BM_INLINE_BLOCKS) {
+        m->alloc(m->ud, e->key.heap, e->len * sizeof(block_t), 0);
+    }
+}
+
+
+void bm_clear(BsMap *m) {
+    size_t i;
+    for (i = 0; i < m->cap; i++) {
+        if (m->slots[i].used) {
+            free_key(m, &m->slots[i]);
+            m->slots[i].used = false;
+        }
+    }
+
+    m->count = 0;
+}
+
+
+void bm_free(BsMap *m) {
+    bm_clear(m);
+    m->alloc(m->ud, m->slots, m->cap * sizeof(bm_entry), 0);
+    bm_init(m, m->alloc, m->ud);
+}
+
+
+size_t bm_trim(const block_t *bits, size_t len) {
+    while (len > 0 && bits[len - 1] == 0) {
+        len--;
+    }
+
+    return len;
+}
+
+
+#define HASH_MUL UINT64_C(0xd6e8feb86659fd93)
+
+
+static inline uint64_t mix(uint64_t h, uint64_t w) {
+    h = (h ^ w) * HASH_MUL;
+    return h ^ (h >> 32);
+}
+
+
+static inline uint64_t load_word(const block_t *bits) {
+    uint64_t w;
+    memcpy(&w, bits, sizeof(w));
+    return w;
+}
+
+
+uint64_t bm_hash(const block_t *bits, size_t len) {
+    // Mix the key 64 bits at a time into four independent lanes, so that
+    // their multiplies overlap instead of waiting on each other.
+    const size_t per_word = sizeof(uint64_t) / sizeof(block_t);
+
+    uint64_t a = UINT64_C(0x9e3779b97f4a7c15) ^ len;
+    uint64_t b = UINT64_C(0x3c6ef372fe94f82a);
+    uint64_t c = UINT64_C(0xdaa66d2c7ddf743f);
+    uint64_t d = UINT64_C(0x78dde6e5fd29f054);
+
+    size_t i;
+    for (i = 0; i + 4 * per_word <= len; i += 4 * per_word) {
+        a = mix(a, load_word(bits + i));
+        b = mix(b, load_word(bits + i + per_word));
+        c = mix(c, load_word(bits + i + 2 * per_word));
+        d = mix(d, load_word(bits + i + 3 * per_word));
+    }
+
+    for (; i < len; i++) {
+        a = mix(a, bits[i]);
+    }
+
+    return mix(mix(mix(mix(a, b), c), d), 0);
+}
+
+
+const block_t *bm_key(const bm_entry *e) {
+    return (e->len > BM_INLINE_BLOCKS) ? e->key.heap : e->key.inline_bits;
+}
+
+
+static bool matches(const bm_entry *e, const block_t *bits, size_t len,
+        uint64_t hash) {
+    return e->hash == hash && e->len == len &&
+        memcmp(bm_key(e), bits, len * sizeof(block_t)) == 0;
+}
+
+
+// The slot holding the key, or else the empty slot where it would go.
+static size_t probe(const BsMap *m, const block_t *bits, size_t len,
+        uint64_t hash) {
+    const size_t mask = m->cap - 1;
+    size_t i = (size_t)hash & mask;
+
+    while (m->slots[i].used && !matches(&m->slots[i], bits, len, hash)) {
+        i = (i + 1) & mask;
+    }
+
+    return i;
+}
+
+
+bm_entry *bm_find(const BsMap *m, const block_t *bits, size_t len,
+        uint64_t hash) {
+    if (m->count == 0) {
+        return NULL;
+    }
+
+    bm_entry *const e = &m->slots[probe(m, bits, len, hash)];
+
+    return e->used ? e : NULL;
+}
+
+
+// Moves every entry into a table of `cap` slots. The keys stay where they are.
+static bool rehash(BsMap *m, size_t cap) {
+    bm_entry *const slots =
+        (bm_entry*)m->alloc(m->ud, NULL, 0, cap * sizeof(bm_entry));
+
+    if (slots == NULL) {
+        return false;
+    }
+
+    size_t i;
+    for (i = 0; i < cap; i++) {
+        slots[i].used = false;
+    }
+
+    for (i = 0; i < m->cap; i++) {
+        const bm_entry *const e = &m->slots[i];
+
+        if (e->used) {
+            size_t j = (size_t)e->hash & (cap - 1);
+
+            while (slots[j].used) {
+                j = (j + 1) & (cap - 1);
+            }
+
+            slots[j] = *e;
+        }
+    }
+
+    m->alloc(m->ud, m->slots, m->cap * sizeof(bm_entry), 0);
+    m->slots = slots;
+    m->cap = cap;
+
+    return true;
+}
+
+
+bm_entry *bm_insert(BsMap *m, const block_t *bits, size_t len, uint64_t hash,
+        int ref, bool *added) {
+    if ((m->count + 1) * 8 > m->cap * BM_MAX_LOAD &&
+            !rehash(m, (m->cap == 0) ? BM_MIN_CAP : 2 * m->cap)) {
+        return NULL;
+    }
+
+    bm_entry *const e = &m->slots[probe(m, bits, len, hash)];
+
+    if (e->used) {
+        *added = false;
+        return e;
+    }
+
+    block_t *key = e->key.inline_bits;
+
+    if (len > BM_INLINE_BLOCKS) {
+        key = (block_t*)m->alloc(m->ud, NULL, 0, len * sizeof(block_t));
+
+        if (key == NULL) {
+            return NULL;
+        }
+
+        e->key.heap = key;
+    }
+
+    memcpy(key, bits, len * sizeof(block_t));
+
+    e->hash = hash;
+    e->len = len;
+    e->ref = ref;
+    e->used = true;
+
+    m->count++;
+    *added = true;
+
+    return e;
+}
+
+
+bool bm_remove(BsMap *m, const block_t *bits, size_t len, uint64_t hash,
+        int *ref) {
+    bm_entry *const e = bm_find(m, bits, len, hash);
+
+    if (e == NULL) {
+        return false;
+    }
+
+    *ref = e->ref;
+    free_key(m, e);
+
+    // Shift back any later entries that would have landed at or before the
+    // hole, so that probing for them still finds them.
+    const size_t mask = m->cap - 1;
+    size_t hole = (size_t)(e - m->slots);
+    size_t i = (hole + 1) & mask;
+
+    while (m->slots[i].used) {
+        const size_t home = (size_t)m->slots[i].hash & mask;
+
+        // Whether `home` is cyclically outside `(hole, i]`.
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            m->slots[hole] = m->slots[i];
+            hole = i;
+        }
+
+        i = (i + 1) & mask;
+    }
+
+    m->slots[hole].used = false;
+    m->count--;
+
+    return true;
+}
+
+
+bm_entry *bm_next(const BsMap *m, size_t *i) {
+    for (; *i < m->cap; (*i)++) {
+        if (m->slots[*i].used) {
+            return &m->slots[(*i)++];
+        }
+    }
+
+    return NULL;
+}
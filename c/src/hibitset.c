@@ -0,0 +1,779 @@
+/*
+
+Copyright (c) 2016 Sean Leffler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+// Hierarchical bitsets. Everything that walks over the bits goes through
+// `hb_walk`, which follows the summaries down to the non-zero words, so
+// the cost of an operation depends on the words in use rather than the length.
+// Binary operations work in place where they can: `hb_binop` copies the left
+// operand and then does the in-place operation on the copy, apart from
+// intersections, which only ever need the words the two have in common.
+
+#include <string.h>
+
+#include "hibitset.h"
+
+#define WORD_CTZ(x) ((size_t)__builtin_ctzll(x))
+#define WORD_MSB(x) ((size_t)(HB_WORD_BITS - 1 - __builtin_clzll(x)))
+#define WORD_POPCOUNT(x) ((size_t)__builtin_popcountll(x))
+
+#define ALL_WORD ((uint64_t)~(uint64_t)0)
+
+// The bit for index `i` within its word.
+#define WORD_BIT(i) ((uint64_t)1 << ((i) % HB_WORD_BITS))
+
+// Dense bitset blocks in one of our words.
+#define BLOCKS_PER_WORD (HB_WORD_BITS / BITWIDTH)
+
+
+static size_t words_for(size_t n) {
+    return n / HB_WORD_BITS + (n % HB_WORD_BITS != 0);
+}
+
+
+void hb_init(HiBitset *h, hb_alloc_fn alloc, void *ud) {
+    h->alloc = alloc;
+    h->ud = ud;
+
+    int k;
+    for (k = 0; k < HB_LAYERS; k++) {
+        h->layers[k] = NULL;
+        h->len[k] = 0;
+    }
+}
+
+
+void hb_free(HiBitset *h) {
+    int k;
+    for (k = 0; k < HB_LAYERS; k++) {
+        if (h->layers[k] != NULL) {
+            h->alloc(h->ud, h->layers[k], h->len[k] * sizeof(uint64_t), 0);
+        }
+
+        h->layers[k] = NULL;
+        h->len[k] = 0;
+    }
+}
+
+
+// Grows the bits to exactly `n` words, and the summaries to match. Every
+// layer is allocated before anything is changed, so that running out of
+// memory leaves the bitset as it was.
+static bool grow(HiBitset *h, size_t n) {
+    if (n <= h->len[0]) {
+        return true;
+    }
+
+    size_t want[HB_LAYERS];
+    uint64_t *fresh[HB_LAYERS];
+    int k;
+
+    for (k = 0; k < HB_LAYERS; k++) {
+        want[k] = (k == 0) ? n : words_for(want[k - 1]);
+        fresh[k] = NULL;
+    }
+
+    for (k = 0; k < HB_LAYERS; k++) {
+        if (want[k] == h->len[k]) {
+            continue;
+        }
+
+        fresh[k] = h->alloc(h->ud, NULL, 0, want[k] * sizeof(uint64_t));
+
+        if (fresh[k] == NULL) {
+            while (k-- > 0) {
+                if (fresh[k] != NULL) {
+                    h->alloc(h->ud, fresh[k], want[k] * sizeof(uint64_t), 0);
+                }
+            }
+
+            return false;
+        }
+    }
+
+    for (k = 0; k < HB_LAYERS; k++) {
+        if (fresh[k] == NULL) {
+            continue;
+        }
+
+        const size_t old = h->len[k];
+
+        if (old > 0) {
+            memcpy(fresh[k], h->layers[k], old * sizeof(uint64_t));
+            h->alloc(h->ud, h->layers[k], old * sizeof(uint64_t), 0);
+        }
+
+        memset(fresh[k] + old, 0, (want[k] - old) * sizeof(uint64_t));
+
+        h->layers[k] = fresh[k];
+        h->len[k] = want[k];
+    }
+
+    return true;
+}
+
+
+bool hb_reserve(HiBitset *h, size_t nbits) {
+    const size_t n = words_for(nbits);
+
+    if (n <= h->len[0]) {
+        return true;
+    }
+
+    // Grow geometrically, so that setting bits in increasing order doesn't
+    // copy everything each time.
+    const size_t doubled = h->len[0] * 2;
+
+    return grow(h, doubled > n ? doubled : n);
+}
+
+
+bool hb_copy(HiBitset *dst, const HiBitset *src) {
+    hb_init(dst, src->alloc, src->ud);
+
+    if (!grow(dst, src->len[0])) {
+        return false;
+    }
+
+    int k;
+    for (k = 0; k < HB_LAYERS; k++) {
+        if (src->len[k] > 0) {
+            memcpy(dst->layers[k], src->layers[k],
+                src->len[k] * sizeof(uint64_t));
+        }
+    }
+
+    return true;
+}
+
+
+// Records that word `w` of the bits is non-zero. Stops climbing as soon as a
+// summary bit was already set, since the ones above it must be too.
+static void mark(HiBitset *h, size_t w) {
+    int k;
+    for (k = 1; k < HB_LAYERS; k++) {
+        uint64_t *const word = &h->layers[k][w / HB_WORD_BITS];
+        const uint64_t bit = WORD_BIT(w);
+
+        if (*word & bit) {
+            return;
+        }
+
+        *word |= bit;
+        w /= HB_WORD_BITS;
+    }
+}
+
+
+// Records that word `w` of the bits has become zero, clearing summary bits up
+// to the first summary word that still has others set.
+static void unmark(HiBitset *h, size_t w) {
+    int k;
+    for (k = 1; k < HB_LAYERS; k++) {
+        uint64_t *const word = &h->layers[k][w / HB_WORD_BITS];
+        *word &= ~WORD_BIT(w);
+
+        if (*word != 0) {
+            return;
+        }
+
+        w /= HB_WORD_BITS;
+    }
+}
+
+
+// Stores `val` in word `w` of the bits, keeping the summaries right.
+static void store(HiBitset *h, size_t w, uint64_t val) {
+    h->layers[0][w] = val;
+
+    if (val != 0) {
+        mark(h, w);
+    } else {
+        unmark(h, w);
+    }
+}
+
+
+// Word `i` of layer `k` of `a`, or of `a & b` if `b` isn't NULL.
+static uint64_t layer_word(const HiBitset *a, const HiBitset *b, int k,
+        size_t i) {
+    uint64_t x = (i < a->len[k]) ? a->layers[k][i] : 0;
+
+    if (b != NULL) {
+        x &= (i < b->len[k]) ? b->layers[k][i] : 0;
+    }
+
+    return x;
+}
+
+
+// Walks over the non-zero words of the bits of `a`, or the words non-zero in
+// both `a` and `b` if `b` isn't NULL (they may still have no bits in common.)
+// `masks[k]` holds the bits of summary layer `k` yet to be visited, and
+// `base[k]` the index of the first word they stand for in the layer below, so
+// each step only goes up as far as the first summary with anything left. Only
+// the top layer is scanned word by word.
+//
+// The bitsets may be modified while walking, as long as it's only the words
+// already visited.
+typedef struct hb_walk {
+    const HiBitset *a;
+    const HiBitset *b;
+    uint64_t masks[HB_LAYERS];
+    size_t base[HB_LAYERS];
+    size_t top;
+    size_t top_len;
+} hb_walk;
+
+
+// Starts a walk at word `w`.
+static void walk_init(hb_walk *it, const HiBitset *a, const HiBitset *b,
+        size_t w) {
+    it->a = a;
+    it->b = b;
+    it->top_len = a->len[HB_LAYERS - 1];
+
+    if (b != NULL && b->len[HB_LAYERS - 1] < it->top_len) {
+        it->top_len = b->len[HB_LAYERS - 1];
+    }
+
+    // Summary bit `j` of layer `k` stands for word `j` of layer `k - 1`. The
+    // bit leading to `w` is kept in the bottom summary, but dropped above it,
+    // since the masks below are loaded here already.
+    size_t j = w;
+    int k;
+
+    for (k = 1; k < HB_LAYERS; k++) {
+        const size_t i = j / HB_WORD_BITS;
+        uint64_t mask = ALL_WORD << (j % HB_WORD_BITS);
+
+        if (k > 1) {
+            mask &= ~WORD_BIT(j);
+        }
+
+        it->masks[k] = layer_word(a, b, k, i) & mask;
+        it->base[k] = i * HB_WORD_BITS;
+        j = i;
+    }
+
+    it->top = j;
+}
+
+
+// The next word in the walk, or `HB_NONE`.
+static size_t walk_next(hb_walk *it) {
+    for (;;) {
+        uint64_t *const bottom = &it->masks[1];
+
+        if (*bottom != 0) {
+            const size_t w = it->base[1] + WORD_CTZ(*bottom);
+            *bottom &= *bottom - 1;
+            return w;
+        }
+
+        int k = 2;
+
+        while (k < HB_LAYERS && it->masks[k] == 0) {
+            k++;
+        }
+
+        if (k == HB_LAYERS) {
+            if (++it->top >= it->top_len) {
+                it->top = it->top_len;
+                return HB_NONE;
+            }
+
+            it->masks[HB_LAYERS - 1] =
+                layer_word(it->a, it->b, HB_LAYERS - 1, it->top);
+            it->base[HB_LAYERS - 1] = it->top * HB_WORD_BITS;
+            continue;
+        }
+
+        const size_t child = it->base[k] + WORD_CTZ(it->masks[k]);
+        it->masks[k] &= it->masks[k] - 1;
+
+        it->masks[k - 1] = layer_word(it->a, it->b, k - 1, child);
+        it->base[k - 1] = child * HB_WORD_BITS;
+    }
+}
+
+
+bool hb_set(HiBitset *h, size_t idx) {
+    if (!hb_reserve(h, idx + 1)) {
+        return false;
+    }
+
+    const size_t w = idx / HB_WORD_BITS;
+
+    h->layers[0][w] |= WORD_BIT(idx);
+    mark(h, w);
+
+    return true;
+}
+
+
+void hb_clear(HiBitset *h, size_t idx) {
+    const size_t w = idx / HB_WORD_BITS;
+
+    if (w >= h->len[0]) {
+        return;
+    }
+
+    uint64_t *const word = &h->layers[0][w];
+
+    if (*word & WORD_BIT(idx)) {
+        *word &= ~WORD_BIT(idx);
+
+        if (*word == 0) {
+            unmark(h, w);
+        }
+    }
+}
+
+
+bool hb_get(const HiBitset *h, size_t idx) {
+    const size_t w = idx / HB_WORD_BITS;
+
+    return w < h->len[0] && (h->layers[0][w] & WORD_BIT(idx)) != 0;
+}
+
+
+// The bits of word `w` which fall in `[lo, hi)`, for a non-empty range
+// overlapping the word.
+static uint64_t range_mask(size_t w, size_t lo, size_t hi) {
+    const size_t first = w * HB_WORD_BITS;
+    const size_t lo_bit = (lo > first) ? lo - first : 0;
+    const size_t hi_bit =
+        (hi - first < HB_WORD_BITS) ? hi - first : HB_WORD_BITS;
+
+    return (ALL_WORD << lo_bit) & (ALL_WORD >> (HB_WORD_BITS - hi_bit));
+}
+
+
+bool hb_set_range(HiBitset *h, size_t lo, size_t hi) {
+    if (lo >= hi) {
+        return true;
+    }
+
+    if (!hb_reserve(h, hi)) {
+        return false;
+    }
+
+    const size_t last = (hi - 1) / HB_WORD_BITS;
+    size_t w;
+
+    for (w = lo / HB_WORD_BITS; w <= last; w++) {
+        h->layers[0][w] |= range_mask(w, lo, hi);
+        mark(h, w);
+    }
+
+    return true;
+}
+
+
+void hb_clear_range(HiBitset *h, size_t lo, size_t hi) {
+    if (hi > h->len[0] * HB_WORD_BITS) {
+        hi = h->len[0] * HB_WORD_BITS;
+    }
+
+    if (lo >= hi) {
+        return;
+    }
+
+    // Only the words with bits set need looking at.
+    const size_t last = (hi - 1) / HB_WORD_BITS;
+    size_t w;
+
+    hb_walk it;
+    walk_init(&it, h, NULL, lo / HB_WORD_BITS);
+
+    while ((w = walk_next(&it)) != HB_NONE && w <= last) {
+        store(h, w, h->layers[0][w] & ~range_mask(w, lo, hi));
+    }
+}
+
+
+size_t hb_count(const HiBitset *h) {
+    size_t sum = 0;
+    size_t w;
+
+    hb_walk it;
+    walk_init(&it, h, NULL, 0);
+
+    while ((w = walk_next(&it)) != HB_NONE) {
+        sum += WORD_POPCOUNT(h->layers[0][w]);
+    }
+
+    return sum;
+}
+
+
+size_t hb_next(const HiBitset *h, size_t from) {
+    size_t w = from / HB_WORD_BITS;
+
+    if (w >= h->len[0]) {
+        return HB_NONE;
+    }
+
+    const uint64_t m = h->layers[0][w] & (ALL_WORD << (from % HB_WORD_BITS));
+
+    if (m != 0) {
+        return w * HB_WORD_BITS + WORD_CTZ(m);
+    }
+
+    hb_walk it;
+    walk_init(&it, h, NULL, w + 1);
+    w = walk_next(&it);
+
+    if (w == HB_NONE) {
+        return HB_NONE;
+    }
+
+    return w * HB_WORD_BITS + WORD_CTZ(h->layers[0][w]);
+}
+
+
+// The last non-zero word at or before `j` in layer `k`, or `HB_NONE`. Each
+// layer is searched through the summary above it, so only the top layer is
+// scanned word by word.
+static size_t last_word(const HiBitset *h, int k, size_t j) {
+    if (k == HB_LAYERS - 1) {
+        do {
+            if (h->layers[k][j] != 0) {
+                return j;
+            }
+        } while (j-- > 0);
+
+        return HB_NONE;
+    }
+
+    const uint64_t *const summary = h->layers[k + 1];
+    size_t i = j / HB_WORD_BITS;
+    uint64_t m = summary[i] &
+        (ALL_WORD >> (HB_WORD_BITS - 1 - j % HB_WORD_BITS));
+
+    if (m == 0) {
+        if (i == 0) {
+            return HB_NONE;
+        }
+
+        i = last_word(h, k + 1, i - 1);
+
+        if (i == HB_NONE) {
+            return HB_NONE;
+        }
+
+        m = summary[i];
+    }
+
+    return i * HB_WORD_BITS + WORD_MSB(m);
+}
+
+
+size_t hb_prev(const HiBitset *h, size_t from) {
+    if (h->len[0] == 0) {
+        return HB_NONE;
+    }
+
+    size_t w = from / HB_WORD_BITS;
+    uint64_t m;
+
+    if (w >= h->len[0]) {
+        w = h->len[0] - 1;
+        m = h->layers[0][w];
+    } else {
+        m = h->layers[0][w] &
+            (ALL_WORD >> (HB_WORD_BITS - 1 - from % HB_WORD_BITS));
+    }
+
+    if (m == 0) {
+        if (w == 0) {
+            return HB_NONE;
+        }
+
+        w = last_word(h, 0, w - 1);
+
+        if (w == HB_NONE) {
+            return HB_NONE;
+        }
+
+        m = h->layers[0][w];
+    }
+
+    return w * HB_WORD_BITS + WORD_MSB(m);
+}
+
+
+size_t hb_next_clear(const HiBitset *h, size_t from) {
+    size_t w = from / HB_WORD_BITS;
+
+    if (w >= h->len[0]) {
+        return from;
+    }
+
+    uint64_t m = ~h->layers[0][w] & (ALL_WORD << (from % HB_WORD_BITS));
+
+    while (m == 0) {
+        if (++w == h->len[0]) {
+            return w * HB_WORD_BITS;
+        }
+
+        m = ~h->layers[0][w];
+    }
+
+    return w * HB_WORD_BITS + WORD_CTZ(m);
+}
+
+
+bool hb_binop_mut(hb_op op, HiBitset *a, const HiBitset *b) {
+    const uint64_t *const bw = b->layers[0];
+    hb_walk it;
+    size_t w;
+
+    switch (op) {
+    case HB_AND:
+        // Every word of `a` has to be looked at, since any that `b` doesn't
+        // have are cleared.
+        walk_init(&it, a, NULL, 0);
+
+        while ((w = walk_next(&it)) != HB_NONE) {
+            const uint64_t r = a->layers[0][w] & ((w < b->len[0]) ? bw[w] : 0);
+
+            if (r != a->layers[0][w]) {
+                store(a, w, r);
+            }
+        }
+        break;
+
+    case HB_ANDNOT:
+        walk_init(&it, a, b, 0);
+
+        while ((w = walk_next(&it)) != HB_NONE) {
+            const uint64_t r = a->layers[0][w] & ~bw[w];
+
+            if (r != a->layers[0][w]) {
+                store(a, w, r);
+            }
+        }
+        break;
+
+    case HB_OR:
+    case HB_XOR:
+        if (!grow(a, b->len[0])) {
+            return false;
+        }
+
+        walk_init(&it, b, NULL, 0);
+
+        while ((w = walk_next(&it)) != HB_NONE) {
+            store(a, w, (op == HB_OR) ?
+                a->layers[0][w] | bw[w] : a->layers[0][w] ^ bw[w]);
+        }
+        break;
+    }
+
+    return true;
+}
+
+
+bool hb_binop(hb_op op, HiBitset *out, const HiBitset *a, const HiBitset *b) {
+    if (op != HB_AND) {
+        if (!hb_copy(out, a) || !hb_binop_mut(op, out, b)) {
+            hb_free(out);
+            return false;
+        }
+
+        return true;
+    }
+
+    hb_init(out, a->alloc, a->ud);
+
+    // Only make room up to the last word the two have in common, which for
+    // sparse sets is usually far short of either.
+    hb_walk it;
+    size_t w, last = HB_NONE;
+
+    walk_init(&it, a, b, 0);
+
+    while ((w = walk_next(&it)) != HB_NONE) {
+        if (a->layers[0][w] & b->layers[0][w]) {
+            last = w;
+        }
+    }
+
+    if (last == HB_NONE) {
+        return true;
+    }
+
+    if (!grow(out, last + 1)) {
+        return false;
+    }
+
+    walk_init(&it, a, b, 0);
+
+    while ((w = walk_next(&it)) != HB_NONE && w <= last) {
+        const uint64_t r = a->layers[0][w] & b->layers[0][w];
+
+        if (r != 0) {
+            out->layers[0][w] = r;
+            mark(out, w);
+        }
+    }
+
+    return true;
+}
+
+
+size_t hb_intersection_count(const HiBitset *a, const HiBitset *b) {
+    size_t sum = 0;
+    size_t w;
+
+    hb_walk it;
+    walk_init(&it, a, b, 0);
+
+    while ((w = walk_next(&it)) != HB_NONE) {
+        sum += WORD_POPCOUNT(a->layers[0][w] & b->layers[0][w]);
+    }
+
+    return sum;
+}
+
+
+bool hb_intersects(const HiBitset *a, const HiBitset *b) {
+    size_t w;
+
+    hb_walk it;
+    walk_init(&it, a, b, 0);
+
+    while ((w = walk_next(&it)) != HB_NONE) {
+        if (a->layers[0][w] & b->layers[0][w]) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+bool hb_equals(const HiBitset *a, const HiBitset *b) {
+    hb_walk ia, ib;
+    walk_init(&ia, a, NULL, 0);
+    walk_init(&ib, b, NULL, 0);
+
+    size_t wa = walk_next(&ia);
+    size_t wb = walk_next(&ib);
+
+    while (wa == wb) {
+        if (wa == HB_NONE) {
+            return true;
+        }
+
+        if (a->layers[0][wa] != b->layers[0][wb]) {
+            return false;
+        }
+
+        wa = walk_next(&ia);
+        wb = walk_next(&ib);
+    }
+
+    return false;
+}
+
+
+bool hb_subset(const HiBitset *a, const HiBitset *b) {
+    size_t w;
+
+    hb_walk it;
+    walk_init(&it, a, NULL, 0);
+
+    while ((w = walk_next(&it)) != HB_NONE) {
+        if (w >= b->len[0] || (a->layers[0][w] & ~b->layers[0][w]) != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+size_t hb_memory(const HiBitset *h) {
+    size_t sum = 0;
+
+    int k;
+    for (k = 0; k < HB_LAYERS; k++) {
+        sum += h->len[k] * sizeof(uint64_t);
+    }
+
+    return sum;
+}
+
+
+bool hb_from_blocks(HiBitset *h, hb_alloc_fn alloc, void *ud,
+        const block_t *bits, size_t len) {
+    hb_init(h, alloc, ud);
+
+    // Trailing zero blocks don't need room.
+    while (len > 0 && bits[len - 1] == 0) {
+        len--;
+    }
+
+    if (!grow(h, (len + BLOCKS_PER_WORD - 1) / BLOCKS_PER_WORD)) {
+        return false;
+    }
+
+    size_t w;
+    for (w = 0; w < h->len[0]; w++) {
+        uint64_t word = 0;
+
+        size_t j;
+        for (j = 0; j < BLOCKS_PER_WORD && w * BLOCKS_PER_WORD + j < len; j++) {
+            word |= (uint64_t)bits[w * BLOCKS_PER_WORD + j] << (j * BITWIDTH);
+        }
+
+        if (word != 0) {
+            h->layers[0][w] = word;
+            mark(h, w);
+        }
+    }
+
+    return true;
+}
+
+
+void hb_to_blocks(const HiBitset *h, block_t *bits, size_t len) {
+    size_t w;
+
+    hb_walk it;
+    walk_init(&it, h, NULL, 0);
+
+    while ((w = walk_next(&it)) != HB_NONE) {
+        size_t j;
+        for (j = 0; j < BLOCKS_PER_WORD; j++) {
+            const size_t blk = w * BLOCKS_PER_WORD + j;
+
+            if (blk < len) {
+                bits[blk] |= (block_t)(h->layers[0][w] >> (j * BITWIDTH));
+            }
+        }
+    }
+}
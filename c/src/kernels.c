@@ -0,0 +1,753 @@
+/*
+
+Copyright (c) 2016 Sean Leffler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+// Set-algebra kernels over raw bitset blocks. There's a portable scalar
+// implementation which works on 64-bit words, and on x86 an SSE2 and an AVX2
+// implementation. The best one the CPU supports is picked once, at load time.
+//
+// The vector implementations are compiled with per-function target attributes,
+// so none of this needs special compiler flags and the module still loads on
+// CPUs without AVX2.
+
+#include <string.h>
+
+#include "bitset.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define BS_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+// How many blocks fit into a 64-bit word.
+#define WORD_BLOCKS (sizeof(uint64_t) / sizeof(block_t))
+
+
+/*
+ * Scalar kernels. Blocks are loaded 64 bits at a time through `memcpy`, which
+ * compilers turn into a single unaligned load.
+ */
+
+#define SCALAR_BINOP(fname, expr) \
+static void fname(block_t *dst, const block_t *a, const block_t *b, \
+        size_t n) { \
+    size_t i = 0; \
+    for (; i + WORD_BLOCKS <= n; i += WORD_BLOCKS) { \
+        uint64_t x, y, r; \
+        memcpy(&x, a + i, sizeof(x)); \
+        memcpy(&y, b + i, sizeof(y)); \
+        r = (expr); \
+        memcpy(dst + i, &r, sizeof(r)); \
+    } \
+    for (; i < n; i++) { \
+        const block_t x = a[i], y = b[i]; \
+        dst[i] = (expr); \
+    } \
+}
+
+SCALAR_BINOP(and_scalar, x & y)
+SCALAR_BINOP(or_scalar, x | y)
+SCALAR_BINOP(andnot_scalar, x & ~y)
+SCALAR_BINOP(xor_scalar, x ^ y)
+
+
+static bool eq_scalar(const block_t *a, const block_t *b, size_t n) {
+    size_t i = 0;
+    for (; i + WORD_BLOCKS <= n; i += WORD_BLOCKS) {
+        uint64_t x, y;
+        memcpy(&x, a + i, sizeof(x));
+        memcpy(&y, b + i, sizeof(y));
+
+        if (x != y) {
+            return false;
+        }
+    }
+
+    for (; i < n; i++) {
+        if (a[i] != b[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+static bool subset_scalar(const block_t *a, const block_t *b, size_t n) {
+    size_t i = 0;
+    for (; i + WORD_BLOCKS <= n; i += WORD_BLOCKS) {
+        uint64_t x, y;
+        memcpy(&x, a + i, sizeof(x));
+        memcpy(&y, b + i, sizeof(y));
+
+        if ((x & ~y) != 0) {
+            return false;
+        }
+    }
+
+    for (; i < n; i++) {
+        if ((a[i] & ~b[i]) != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+static bool zero_scalar(const block_t *a, size_t n) {
+    size_t i = 0;
+    for (; i + WORD_BLOCKS <= n; i += WORD_BLOCKS) {
+        uint64_t x;
+        memcpy(&x, a + i, sizeof(x));
+
+        if (x != 0) {
+            return false;
+        }
+    }
+
+    for (; i < n; i++) {
+        if (a[i] != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+static size_t popcount_scalar(const block_t *a, size_t n) {
+    size_t sum = 0, i = 0;
+    for (; i + WORD_BLOCKS <= n; i += WORD_BLOCKS) {
+        uint64_t x;
+        memcpy(&x, a + i, sizeof(x));
+        sum += __builtin_popcountll(x);
+    }
+
+    for (; i < n; i++) {
+        sum += __builtin_popcountll(a[i]);
+    }
+
+    return sum;
+}
+
+
+// Fused binary operation and population count. `attrs` lets the same loop be
+// compiled again with POPCNT enabled.
+#define SCALAR_POPCOUNT_BINOP(fname, attrs, expr) \
+attrs \
+static size_t fname(const block_t *a, const block_t *b, size_t n) { \
+    size_t sum = 0, i = 0; \
+    for (; i + WORD_BLOCKS <= n; i += WORD_BLOCKS) { \
+        uint64_t x, y; \
+        memcpy(&x, a + i, sizeof(x)); \
+        memcpy(&y, b + i, sizeof(y)); \
+        sum += __builtin_popcountll(expr); \
+    } \
+    for (; i < n; i++) { \
+        const block_t x = a[i], y = b[i]; \
+        sum += __builtin_popcountll((block_t)(expr)); \
+    } \
+    return sum; \
+}
+
+SCALAR_POPCOUNT_BINOP(and_popcount_scalar, , x & y)
+SCALAR_POPCOUNT_BINOP(or_popcount_scalar, , x | y)
+SCALAR_POPCOUNT_BINOP(andnot_popcount_scalar, , x & ~y)
+SCALAR_POPCOUNT_BINOP(xor_popcount_scalar, , x ^ y)
+
+
+static bool intersects_scalar(const block_t *a, const block_t *b, size_t n) {
+    size_t i = 0;
+    for (; i + WORD_BLOCKS <= n; i += WORD_BLOCKS) {
+        uint64_t x, y;
+        memcpy(&x, a + i, sizeof(x));
+        memcpy(&y, b + i, sizeof(y));
+
+        if ((x & y) != 0) {
+            return true;
+        }
+    }
+
+    for (; i < n; i++) {
+        if ((a[i] & b[i]) != 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+static bool any_set(const uint64_t *words, size_t n) {
+    size_t w;
+    for (w = 0; w < n; w++) {
+        if (words[w] != 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+// Matches `n` rows, at most a block's worth, starting at row `first`.
+static block_t match_block_scalar(const uint64_t *cols, size_t stride,
+        size_t words, size_t first, size_t n, const uint64_t *all,
+        const uint64_t *none, const uint64_t *any, bool need_any) {
+    block_t bits = 0;
+
+    size_t i;
+    for (i = 0; i < n; i++) {
+        uint64_t miss = 0, hit = 0;
+
+        size_t w;
+        for (w = 0; w < words; w++) {
+            const uint64_t x = cols[w * stride + first + i];
+            miss |= (all[w] & ~x) | (none[w] & x);
+            hit |= any[w] & x;
+        }
+
+        bits |= (block_t)(miss == 0 && (hit != 0 || !need_any)) << i;
+    }
+
+    return bits;
+}
+
+
+static void match_rows_scalar(block_t *out, const uint64_t *cols,
+        size_t stride, size_t words, size_t n, const uint64_t *all,
+        const uint64_t *none, const uint64_t *any) {
+    const bool need_any = any_set(any, words);
+
+    size_t blk;
+    for (blk = 0; blk * BITWIDTH < n; blk++) {
+        const size_t first = blk * BITWIDTH;
+        const size_t rows = (n - first < BITWIDTH) ? n - first : BITWIDTH;
+
+        out[blk] = match_block_scalar(cols, stride, words, first, rows,
+            all, none, any, need_any);
+    }
+}
+
+
+static const bs_kernels kernels_scalar = {
+    "scalar",
+    and_scalar,
+    or_scalar,
+    andnot_scalar,
+    xor_scalar,
+    eq_scalar,
+    subset_scalar,
+    zero_scalar,
+    popcount_scalar,
+    and_popcount_scalar,
+    or_popcount_scalar,
+    andnot_popcount_scalar,
+    xor_popcount_scalar,
+    intersects_scalar,
+    match_rows_scalar,
+};
+
+
+#ifdef BS_X86
+
+/*
+ * SSE2 kernels, 128 bits at a time. The leftover blocks go through the scalar
+ * kernels.
+ */
+
+#define SSE2_BLOCKS (sizeof(__m128i) / sizeof(block_t))
+
+#define SSE2_BINOP(fname, scalar, intrin) \
+__attribute__((target("sse2"))) \
+static void fname(block_t *dst, const block_t *a, const block_t *b, \
+        size_t n) { \
+    size_t i = 0; \
+    for (; i + SSE2_BLOCKS <= n; i += SSE2_BLOCKS) { \
+        const __m128i x = _mm_loadu_si128((const __m128i*)(a + i)); \
+        const __m128i y = _mm_loadu_si128((const __m128i*)(b + i)); \
+        _mm_storeu_si128((__m128i*)(dst + i), intrin); \
+    } \
+    scalar(dst + i, a + i, b + i, n - i); \
+}
+
+SSE2_BINOP(and_sse2, and_scalar, _mm_and_si128(x, y))
+SSE2_BINOP(or_sse2, or_scalar, _mm_or_si128(x, y))
+SSE2_BINOP(andnot_sse2, andnot_scalar, _mm_andnot_si128(y, x))
+SSE2_BINOP(xor_sse2, xor_scalar, _mm_xor_si128(x, y))
+
+
+__attribute__((target("sse2")))
+static bool eq_sse2(const block_t *a, const block_t *b, size_t n) {
+    size_t i = 0;
+    for (; i + SSE2_BLOCKS <= n; i += SSE2_BLOCKS) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+        const __m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xFFFF) {
+            return false;
+        }
+    }
+
+    return eq_scalar(a + i, b + i, n - i);
+}
+
+
+__attribute__((target("sse2")))
+static bool subset_sse2(const block_t *a, const block_t *b, size_t n) {
+    const __m128i zero = _mm_setzero_si128();
+
+    size_t i = 0;
+    for (; i + SSE2_BLOCKS <= n; i += SSE2_BLOCKS) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+        const __m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+        const __m128i extra = _mm_andnot_si128(y, x);
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(extra, zero)) != 0xFFFF) {
+            return false;
+        }
+    }
+
+    return subset_scalar(a + i, b + i, n - i);
+}
+
+
+__attribute__((target("sse2")))
+static bool zero_sse2(const block_t *a, size_t n) {
+    const __m128i zero = _mm_setzero_si128();
+
+    size_t i = 0;
+    for (; i + SSE2_BLOCKS <= n; i += SSE2_BLOCKS) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, zero)) != 0xFFFF) {
+            return false;
+        }
+    }
+
+    return zero_scalar(a + i, n - i);
+}
+
+
+// SSE2 has no good way to count bits, but nearly every CPU that has SSE2 also
+// has POPCNT; if so, `bs_kernels_find` hands out `kernels_sse2_popcnt`.
+__attribute__((target("popcnt")))
+static size_t popcount_popcnt(const block_t *a, size_t n) {
+    size_t sum = 0, i = 0;
+    for (; i + WORD_BLOCKS <= n; i += WORD_BLOCKS) {
+        uint64_t x;
+        memcpy(&x, a + i, sizeof(x));
+        sum += __builtin_popcountll(x);
+    }
+
+    for (; i < n; i++) {
+        sum += __builtin_popcountll(a[i]);
+    }
+
+    return sum;
+}
+
+
+#define POPCNT_ATTRS __attribute__((target("popcnt")))
+
+SCALAR_POPCOUNT_BINOP(and_popcount_popcnt, POPCNT_ATTRS, x & y)
+SCALAR_POPCOUNT_BINOP(or_popcount_popcnt, POPCNT_ATTRS, x | y)
+SCALAR_POPCOUNT_BINOP(andnot_popcount_popcnt, POPCNT_ATTRS, x & ~y)
+SCALAR_POPCOUNT_BINOP(xor_popcount_popcnt, POPCNT_ATTRS, x ^ y)
+
+
+__attribute__((target("sse2")))
+static bool intersects_sse2(const block_t *a, const block_t *b, size_t n) {
+    const __m128i zero = _mm_setzero_si128();
+
+    size_t i = 0;
+    for (; i + SSE2_BLOCKS <= n; i += SSE2_BLOCKS) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+        const __m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+        const __m128i both = _mm_and_si128(x, y);
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(both, zero)) != 0xFFFF) {
+            return true;
+        }
+    }
+
+    return intersects_scalar(a + i, b + i, n - i);
+}
+
+
+static const bs_kernels kernels_sse2 = {
+    "sse2",
+    and_sse2,
+    or_sse2,
+    andnot_sse2,
+    xor_sse2,
+    eq_sse2,
+    subset_sse2,
+    zero_sse2,
+    popcount_scalar,
+    and_popcount_scalar,
+    or_popcount_scalar,
+    andnot_popcount_scalar,
+    xor_popcount_scalar,
+    intersects_sse2,
+    // Without a 64-bit compare, SSE2 doesn't beat the scalar scan.
+    match_rows_scalar,
+};
+
+
+// The same, counting with POPCNT. A separate table rather than patching the
+// one above, since other threads may be using the kernels at any time.
+static const bs_kernels kernels_sse2_popcnt = {
+    "sse2",
+    and_sse2,
+    or_sse2,
+    andnot_sse2,
+    xor_sse2,
+    eq_sse2,
+    subset_sse2,
+    zero_sse2,
+    popcount_popcnt,
+    and_popcount_popcnt,
+    or_popcount_popcnt,
+    andnot_popcount_popcnt,
+    xor_popcount_popcnt,
+    intersects_sse2,
+    match_rows_scalar,
+};
+
+
+/*
+ * AVX2 kernels, 256 bits at a time.
+ */
+
+#define AVX2_BLOCKS (sizeof(__m256i) / sizeof(block_t))
+
+#define AVX2_BINOP(fname, scalar, intrin) \
+__attribute__((target("avx2"))) \
+static void fname(block_t *dst, const block_t *a, const block_t *b, \
+        size_t n) { \
+    size_t i = 0; \
+    for (; i + AVX2_BLOCKS <= n; i += AVX2_BLOCKS) { \
+        const __m256i x = _mm256_loadu_si256((const __m256i*)(a + i)); \
+        const __m256i y = _mm256_loadu_si256((const __m256i*)(b + i)); \
+        _mm256_storeu_si256((__m256i*)(dst + i), intrin); \
+    } \
+    scalar(dst + i, a + i, b + i, n - i); \
+}
+
+AVX2_BINOP(and_avx2, and_scalar, _mm256_and_si256(x, y))
+AVX2_BINOP(or_avx2, or_scalar, _mm256_or_si256(x, y))
+AVX2_BINOP(andnot_avx2, andnot_scalar, _mm256_andnot_si256(y, x))
+AVX2_BINOP(xor_avx2, xor_scalar, _mm256_xor_si256(x, y))
+
+
+__attribute__((target("avx2")))
+static bool eq_avx2(const block_t *a, const block_t *b, size_t n) {
+    size_t i = 0;
+    for (; i + AVX2_BLOCKS <= n; i += AVX2_BLOCKS) {
+        const __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+        const __m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+        const __m256i diff = _mm256_xor_si256(x, y);
+
+        if (!_mm256_testz_si256(diff, diff)) {
+            return false;
+        }
+    }
+
+    return eq_scalar(a + i, b + i, n - i);
+}
+
+
+__attribute__((target("avx2")))
+static bool subset_avx2(const block_t *a, const block_t *b, size_t n) {
+    size_t i = 0;
+    for (; i + AVX2_BLOCKS <= n; i += AVX2_BLOCKS) {
+        const __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+        const __m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+
+        // testc(y, x) is set iff (~y & x) == 0.
+        if (!_mm256_testc_si256(y, x)) {
+            return false;
+        }
+    }
+
+    return subset_scalar(a + i, b + i, n - i);
+}
+
+
+__attribute__((target("avx2")))
+static bool zero_avx2(const block_t *a, size_t n) {
+    size_t i = 0;
+    for (; i + AVX2_BLOCKS <= n; i += AVX2_BLOCKS) {
+        const __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+
+        if (!_mm256_testz_si256(x, x)) {
+            return false;
+        }
+    }
+
+    return zero_scalar(a + i, n - i);
+}
+
+
+// Nibble-lookup population count: each byte is split into two nibbles which
+// index a 16-entry table through `vpshufb`, and the per-byte counts are summed
+// into 64-bit lanes with `vpsadbw`.
+__attribute__((target("avx2")))
+static inline __m256i popcount_lanes_avx2(__m256i x) {
+    const __m256i lookup = _mm256_setr_epi8(
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0F);
+
+    const __m256i lo = _mm256_and_si256(x, low_mask);
+    const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), low_mask);
+    const __m256i cnt = _mm256_add_epi8(
+        _mm256_shuffle_epi8(lookup, lo),
+        _mm256_shuffle_epi8(lookup, hi));
+
+    return _mm256_sad_epu8(cnt, _mm256_setzero_si256());
+}
+
+
+__attribute__((target("avx2")))
+static inline size_t sum_lanes_avx2(__m256i acc) {
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, acc);
+
+    return (size_t)(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+}
+
+
+__attribute__((target("avx2,popcnt")))
+static size_t popcount_avx2(const block_t *a, size_t n) {
+    __m256i acc = _mm256_setzero_si256();
+
+    size_t i = 0;
+    for (; i + AVX2_BLOCKS <= n; i += AVX2_BLOCKS) {
+        const __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+        acc = _mm256_add_epi64(acc, popcount_lanes_avx2(x));
+    }
+
+    return sum_lanes_avx2(acc) + popcount_popcnt(a + i, n - i);
+}
+
+
+#define AVX2_POPCOUNT_BINOP(fname, scalar, intrin) \
+__attribute__((target("avx2,popcnt"))) \
+static size_t fname(const block_t *a, const block_t *b, size_t n) { \
+    __m256i acc = _mm256_setzero_si256(); \
+    size_t i = 0; \
+    for (; i + AVX2_BLOCKS <= n; i += AVX2_BLOCKS) { \
+        const __m256i x = _mm256_loadu_si256((const __m256i*)(a + i)); \
+        const __m256i y = _mm256_loadu_si256((const __m256i*)(b + i)); \
+        acc = _mm256_add_epi64(acc, popcount_lanes_avx2(intrin)); \
+    } \
+    return sum_lanes_avx2(acc) + scalar(a + i, b + i, n - i); \
+}
+
+AVX2_POPCOUNT_BINOP(and_popcount_avx2, and_popcount_popcnt,
+    _mm256_and_si256(x, y))
+AVX2_POPCOUNT_BINOP(or_popcount_avx2, or_popcount_popcnt,
+    _mm256_or_si256(x, y))
+AVX2_POPCOUNT_BINOP(andnot_popcount_avx2, andnot_popcount_popcnt,
+    _mm256_andnot_si256(y, x))
+AVX2_POPCOUNT_BINOP(xor_popcount_avx2, xor_popcount_popcnt,
+    _mm256_xor_si256(x, y))
+
+
+__attribute__((target("avx2")))
+static bool intersects_avx2(const block_t *a, const block_t *b, size_t n) {
+    size_t i = 0;
+    for (; i + AVX2_BLOCKS <= n; i += AVX2_BLOCKS) {
+        const __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+        const __m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+
+        // testz(x, y) is set iff (x & y) == 0.
+        if (!_mm256_testz_si256(x, y)) {
+            return true;
+        }
+    }
+
+    return intersects_scalar(a + i, b + i, n - i);
+}
+
+
+// Four rows at a time: each column is read straight through, a 256-bit load
+// covering the same word of four consecutive rows.
+__attribute__((target("avx2")))
+static void match_rows_avx2(block_t *out, const uint64_t *cols,
+        size_t stride, size_t words, size_t n, const uint64_t *all,
+        const uint64_t *none, const uint64_t *any) {
+    const bool need_any = any_set(any, words);
+    const __m256i zero = _mm256_setzero_si256();
+
+    size_t blk = 0;
+    for (; (blk + 1) * BITWIDTH <= n; blk++) {
+        block_t bits = 0;
+
+        size_t g;
+        for (g = 0; g < BITWIDTH; g += 4) {
+            const uint64_t *const rows = cols + blk * BITWIDTH + g;
+            __m256i miss = zero, hit = zero;
+
+            size_t w;
+            for (w = 0; w < words; w++) {
+                const __m256i x =
+                    _mm256_loadu_si256((const __m256i*)(rows + w * stride));
+
+                miss = _mm256_or_si256(miss, _mm256_andnot_si256(x,
+                    _mm256_set1_epi64x((long long)all[w])));
+                miss = _mm256_or_si256(miss, _mm256_and_si256(x,
+                    _mm256_set1_epi64x((long long)none[w])));
+                hit = _mm256_or_si256(hit, _mm256_and_si256(x,
+                    _mm256_set1_epi64x((long long)any[w])));
+            }
+
+            __m256i ok = _mm256_cmpeq_epi64(miss, zero);
+
+            if (need_any) {
+                ok = _mm256_andnot_si256(_mm256_cmpeq_epi64(hit, zero), ok);
+            }
+
+            bits |= (block_t)_mm256_movemask_pd(_mm256_castsi256_pd(ok)) << g;
+        }
+
+        out[blk] = bits;
+    }
+
+    if (blk * BITWIDTH < n) {
+        out[blk] = match_block_scalar(cols, stride, words, blk * BITWIDTH,
+            n - blk * BITWIDTH, all, none, any, need_any);
+    }
+}
+
+
+static const bs_kernels kernels_avx2 = {
+    "avx2",
+    and_avx2,
+    or_avx2,
+    andnot_avx2,
+    xor_avx2,
+    eq_avx2,
+    subset_avx2,
+    zero_avx2,
+    popcount_avx2,
+    and_popcount_avx2,
+    or_popcount_avx2,
+    andnot_popcount_avx2,
+    xor_popcount_avx2,
+    intersects_avx2,
+    match_rows_avx2,
+};
+
+
+#define CPU_SSE2    0x1
+#define CPU_POPCNT  0x2
+#define CPU_AVX2    0x4
+
+static int cpu_features(void) {
+    unsigned int eax, ebx, ecx, edx;
+    int features = 0;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return 0;
+    }
+
+    if (edx & bit_SSE2) {
+        features |= CPU_SSE2;
+    }
+
+    if (ecx & bit_POPCNT) {
+        features |= CPU_POPCNT;
+    }
+
+    // AVX2 also needs the OS to be saving the YMM registers for us, which we
+    // check through XGETBV.
+    if ((ecx & bit_OSXSAVE) && (ecx & bit_AVX)) {
+        unsigned int xcr0_lo, xcr0_hi;
+        __asm__ ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+
+        if ((xcr0_lo & 0x6) == 0x6 && __get_cpuid_max(0, NULL) >= 7) {
+            __cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+            if (ebx & bit_AVX2) {
+                features |= CPU_AVX2;
+            }
+        }
+    }
+
+    return features;
+}
+
+#endif
+
+
+const bs_kernels *bs_kern = &kernels_scalar;
+
+const char *const bs_kernel_names[] = {
+    "scalar",
+#ifdef BS_X86
+    "sse2",
+    "avx2",
+#endif
+    NULL,
+};
+
+
+const bs_kernels *bs_kernels_find(const char *name) {
+    if (strcmp(name, "scalar") == 0) {
+        return &kernels_scalar;
+    }
+
+#ifdef BS_X86
+    const int features = cpu_features();
+
+    if (strcmp(name, "sse2") == 0 && (features & CPU_SSE2)) {
+        return (features & CPU_POPCNT) ? &kernels_sse2_popcnt : &kernels_sse2;
+    }
+
+    // The AVX2 kernels count bits with POPCNT too.
+    if (strcmp(name, "avx2") == 0 && (features & CPU_AVX2) &&
+            (features & CPU_POPCNT)) {
+        return &kernels_avx2;
+    }
+#endif
+
+    return NULL;
+}
+
+
+void bs_kernels_init(void) {
+    // Prefer the widest kernels available, falling back to scalar.
+    size_t i;
+    for (i = 0; bs_kernel_names[i] != NULL; i++) {
+        const bs_kernels *const kern = bs_kernels_find(bs_kernel_names[i]);
+
+        if (kern != NULL) {
+            bs_kern = kern;
+        }
+    }
+}
@@ -0,0 +1,183 @@
+/*
+
+Copyright (c) 2016 Sean Leffler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include <errno.h>
+#include <stdint.h>
+
+#include "mapping.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+static bool fail_closing(int fd) {
+    const int err = errno;
+    close(fd);
+    errno = err;
+    return false;
+}
+
+
+bool mp_open(Mapping *m, const char *path, size_t size, size_t unit,
+        bool shared) {
+    m->fd = -1;
+    m->shared = shared;
+    m->addr = NULL;
+    m->size = 0;
+
+    const int fd = open(path, shared ? (O_RDWR | O_CREAT) : O_RDONLY, 0666);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) != 0) {
+        return fail_closing(fd);
+    }
+
+    if ((uintmax_t)st.st_size > SIZE_MAX) {
+        errno = EFBIG;
+        return fail_closing(fd);
+    }
+
+    const size_t file_size = (size_t)st.st_size;
+
+    if (!shared) {
+        size = file_size;
+    } else {
+        // Whatever wrote the file may have left off a partial unit at the end,
+        // and writes to the part of it past the end of the file would be lost.
+        if (file_size > size) {
+            size = file_size;
+        }
+
+        size = (size + unit - 1) / unit * unit;
+
+        if (file_size < size && ftruncate(fd, (off_t)size) != 0) {
+            return fail_closing(fd);
+        }
+    }
+
+    if (size > 0) {
+        void *const addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+            shared ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+
+        if (addr == MAP_FAILED) {
+            return fail_closing(fd);
+        }
+
+        m->addr = addr;
+        m->size = size;
+    }
+
+    // A private mapping stays valid without the file being open.
+    if (shared) {
+        m->fd = fd;
+    } else {
+        close(fd);
+    }
+
+    return true;
+}
+
+
+void mp_close(Mapping *m) {
+    if (m->addr != NULL) {
+        munmap(m->addr, m->size);
+    }
+
+    if (m->fd >= 0) {
+        close(m->fd);
+    }
+
+    m->fd = -1;
+    m->addr = NULL;
+    m->size = 0;
+}
+
+
+bool mp_resize(Mapping *m, size_t size) {
+    if (ftruncate(m->fd, (off_t)size) != 0) {
+        return false;
+    }
+
+    // Map the new size before letting go of the old mapping, so that the old
+    // one is still good if this fails.
+    void *const addr =
+        mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, m->fd, 0);
+
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+
+    if (m->addr != NULL) {
+        munmap(m->addr, m->size);
+    }
+
+    m->addr = addr;
+    m->size = size;
+    return true;
+}
+
+
+bool mp_sync(const Mapping *m) {
+    return m->addr == NULL || msync(m->addr, m->size, MS_SYNC) == 0;
+}
+
+#else
+
+bool mp_open(Mapping *m, const char *path, size_t size, size_t unit,
+        bool shared) {
+    m->fd = -1;
+    m->shared = shared;
+    m->addr = NULL;
+    m->size = 0;
+
+    errno = ENOSYS;
+    return false;
+}
+
+
+void mp_close(Mapping *m) {
+}
+
+
+bool mp_resize(Mapping *m, size_t size) {
+    errno = ENOSYS;
+    return false;
+}
+
+
+bool mp_sync(const Mapping *m) {
+    errno = ENOSYS;
+    return false;
+}
+
+#endif
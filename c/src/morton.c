@@ -0,0 +1,330 @@
+/*
+
+Copyright (c) 2016 Sean Leffler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+// Morton encoding and decoding, with a BMI2 implementation built on PDEP/PEXT
+// and a portable one built on the usual shift-and-mask "magic bits". The BMI2
+// one is only compiled for x86-64, and only picked at runtime if the CPU has
+// a fast PDEP/PEXT.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "morton.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define MORTON_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#define MASK2_X32 0x55555555u
+#define MASK2_X64 0x5555555555555555ull
+#define MASK3_X32 0x09249249u
+#define MASK3_X64 0x1249249249249249ull
+
+
+/*
+ * Magic bits. Each `part` spreads the bits of a coordinate out so that there
+ * are one or two zero bits between each of them, and each `compact` undoes it.
+ */
+
+static inline uint32_t part1by1_32(uint32_t x) {
+    x &= 0x0000FFFFu;
+    x = (x | (x << 8)) & 0x00FF00FFu;
+    x = (x | (x << 4)) & 0x0F0F0F0Fu;
+    x = (x | (x << 2)) & 0x33333333u;
+    x = (x | (x << 1)) & 0x55555555u;
+    return x;
+}
+
+
+static inline uint32_t compact1by1_32(uint32_t x) {
+    x &= 0x55555555u;
+    x = (x | (x >> 1)) & 0x33333333u;
+    x = (x | (x >> 2)) & 0x0F0F0F0Fu;
+    x = (x | (x >> 4)) & 0x00FF00FFu;
+    x = (x | (x >> 8)) & 0x0000FFFFu;
+    return x;
+}
+
+
+static inline uint64_t part1by1_64(uint64_t x) {
+    x &= 0x00000000FFFFFFFFull;
+    x = (x | (x << 16)) & 0x0000FFFF0000FFFFull;
+    x = (x | (x << 8)) & 0x00FF00FF00FF00FFull;
+    x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0Full;
+    x = (x | (x << 2)) & 0x3333333333333333ull;
+    x = (x | (x << 1)) & 0x5555555555555555ull;
+    return x;
+}
+
+
+static inline uint64_t compact1by1_64(uint64_t x) {
+    x &= 0x5555555555555555ull;
+    x = (x | (x >> 1)) & 0x3333333333333333ull;
+    x = (x | (x >> 2)) & 0x0F0F0F0F0F0F0F0Full;
+    x = (x | (x >> 4)) & 0x00FF00FF00FF00FFull;
+    x = (x | (x >> 8)) & 0x0000FFFF0000FFFFull;
+    x = (x | (x >> 16)) & 0x00000000FFFFFFFFull;
+    return x;
+}
+
+
+static inline uint32_t part1by2_32(uint32_t x) {
+    x &= 0x000003FFu;
+    x = (x | (x << 16)) & 0x030000FFu;
+    x = (x | (x << 8)) & 0x0300F00Fu;
+    x = (x | (x << 4)) & 0x030C30C3u;
+    x = (x | (x << 2)) & 0x09249249u;
+    return x;
+}
+
+
+static inline uint32_t compact1by2_32(uint32_t x) {
+    x &= 0x09249249u;
+    x = (x | (x >> 2)) & 0x030C30C3u;
+    x = (x | (x >> 4)) & 0x0300F00Fu;
+    x = (x | (x >> 8)) & 0x030000FFu;
+    x = (x | (x >> 16)) & 0x000003FFu;
+    return x;
+}
+
+
+static inline uint64_t part1by2_64(uint64_t x) {
+    x &= 0x00000000001FFFFFull;
+    x = (x | (x << 32)) & 0x001F00000000FFFFull;
+    x = (x | (x << 16)) & 0x001F0000FF0000FFull;
+    x = (x | (x << 8)) & 0x100F00F00F00F00Full;
+    x = (x | (x << 4)) & 0x10C30C30C30C30C3ull;
+    x = (x | (x << 2)) & 0x1249249249249249ull;
+    return x;
+}
+
+
+static inline uint64_t compact1by2_64(uint64_t x) {
+    x &= 0x1249249249249249ull;
+    x = (x | (x >> 2)) & 0x10C30C30C30C30C3ull;
+    x = (x | (x >> 4)) & 0x100F00F00F00F00Full;
+    x = (x | (x >> 8)) & 0x001F0000FF0000FFull;
+    x = (x | (x >> 16)) & 0x001F00000000FFFFull;
+    x = (x | (x >> 32)) & 0x00000000001FFFFFull;
+    return x;
+}
+
+
+/*
+ * The batch loops are the same for every implementation; only the per-point
+ * spreading and compacting differ.
+ */
+
+#define ENCODE2(fname, code_t, spread, attr) \
+attr static void fname(const uint32_t *x, const uint32_t *y, \
+        code_t *codes, size_t n) { \
+    size_t i; \
+    for (i = 0; i < n; i++) { \
+        codes[i] = spread(x[i]) | (spread(y[i]) << 1); \
+    } \
+}
+
+#define DECODE2(fname, code_t, compact, attr) \
+attr static void fname(const code_t *codes, uint32_t *x, uint32_t *y, \
+        size_t n) { \
+    size_t i; \
+    for (i = 0; i < n; i++) { \
+        x[i] = (uint32_t)compact(codes[i]); \
+        y[i] = (uint32_t)compact(codes[i] >> 1); \
+    } \
+}
+
+#define ENCODE3(fname, code_t, spread, attr) \
+attr static void fname(const uint32_t *x, const uint32_t *y, \
+        const uint32_t *z, code_t *codes, size_t n) { \
+    size_t i; \
+    for (i = 0; i < n; i++) { \
+        codes[i] = spread(x[i]) | (spread(y[i]) << 1) | (spread(z[i]) << 2); \
+    } \
+}
+
+#define DECODE3(fname, code_t, compact, attr) \
+attr static void fname(const code_t *codes, uint32_t *x, uint32_t *y, \
+        uint32_t *z, size_t n) { \
+    size_t i; \
+    for (i = 0; i < n; i++) { \
+        x[i] = (uint32_t)compact(codes[i]); \
+        y[i] = (uint32_t)compact(codes[i] >> 1); \
+        z[i] = (uint32_t)compact(codes[i] >> 2); \
+    } \
+}
+
+#define NO_ATTR
+
+ENCODE2(encode2_16_magic, uint32_t, part1by1_32, NO_ATTR)
+DECODE2(decode2_16_magic, uint32_t, compact1by1_32, NO_ATTR)
+ENCODE2(encode2_32_magic, uint64_t, part1by1_64, NO_ATTR)
+DECODE2(decode2_32_magic, uint64_t, compact1by1_64, NO_ATTR)
+ENCODE3(encode3_10_magic, uint32_t, part1by2_32, NO_ATTR)
+DECODE3(decode3_10_magic, uint32_t, compact1by2_32, NO_ATTR)
+ENCODE3(encode3_21_magic, uint64_t, part1by2_64, NO_ATTR)
+DECODE3(decode3_21_magic, uint64_t, compact1by2_64, NO_ATTR)
+
+static const morton_kernels kernels_magic = {
+    "magic",
+    encode2_16_magic,
+    decode2_16_magic,
+    encode2_32_magic,
+    decode2_32_magic,
+    encode3_10_magic,
+    decode3_10_magic,
+    encode3_21_magic,
+    decode3_21_magic,
+};
+
+
+#ifdef MORTON_X86
+
+/*
+ * BMI2. PDEP scatters the low bits of its source into the set bits of a mask,
+ * and PEXT gathers them back, which is exactly one coordinate's worth of a
+ * Morton code each.
+ */
+
+#define BMI2 __attribute__((target("bmi2")))
+
+#define PDEP2_32(v) _pdep_u32((v), MASK2_X32)
+#define PEXT2_32(v) _pext_u32((v), MASK2_X32)
+#define PDEP2_64(v) _pdep_u64((v), MASK2_X64)
+#define PEXT2_64(v) _pext_u64((v), MASK2_X64)
+#define PDEP3_32(v) _pdep_u32((v), MASK3_X32)
+#define PEXT3_32(v) _pext_u32((v), MASK3_X32)
+#define PDEP3_64(v) _pdep_u64((v), MASK3_X64)
+#define PEXT3_64(v) _pext_u64((v), MASK3_X64)
+
+ENCODE2(encode2_16_bmi2, uint32_t, PDEP2_32, BMI2)
+DECODE2(decode2_16_bmi2, uint32_t, PEXT2_32, BMI2)
+ENCODE2(encode2_32_bmi2, uint64_t, PDEP2_64, BMI2)
+DECODE2(decode2_32_bmi2, uint64_t, PEXT2_64, BMI2)
+ENCODE3(encode3_10_bmi2, uint32_t, PDEP3_32, BMI2)
+DECODE3(decode3_10_bmi2, uint32_t, PEXT3_32, BMI2)
+ENCODE3(encode3_21_bmi2, uint64_t, PDEP3_64, BMI2)
+DECODE3(decode3_21_bmi2, uint64_t, PEXT3_64, BMI2)
+
+static const morton_kernels kernels_bmi2 = {
+    "bmi2",
+    encode2_16_bmi2,
+    decode2_16_bmi2,
+    encode2_32_bmi2,
+    decode2_32_bmi2,
+    encode3_10_bmi2,
+    decode3_10_bmi2,
+    encode3_21_bmi2,
+    decode3_21_bmi2,
+};
+
+
+#define CPU_BMI2      0x1
+#define CPU_SLOW_PDEP 0x2
+
+static int cpu_features(void) {
+    unsigned int eax, ebx, ecx, edx;
+    int features = 0;
+
+    if (__get_cpuid_max(0, NULL) < 7) {
+        return 0;
+    }
+
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+    if (!(ebx & bit_BMI2)) {
+        return 0;
+    }
+
+    features |= CPU_BMI2;
+
+    // AMD implemented PDEP and PEXT in microcode before Zen 3 (family 19h),
+    // at a cost of hundreds of cycles for masks like ours. The magic bits are
+    // much faster there.
+    char vendor[13];
+    __cpuid(0, eax, ebx, ecx, edx);
+    memcpy(vendor, &ebx, 4);
+    memcpy(vendor + 4, &edx, 4);
+    memcpy(vendor + 8, &ecx, 4);
+    vendor[12] = '\0';
+
+    if (strcmp(vendor, "AuthenticAMD") == 0) {
+        __cpuid(1, eax, ebx, ecx, edx);
+
+        unsigned int family = (eax >> 8) & 0xF;
+        if (family == 0xF) {
+            family += (eax >> 20) & 0xFF;
+        }
+
+        if (family < 0x19) {
+            features |= CPU_SLOW_PDEP;
+        }
+    }
+
+    return features;
+}
+
+#endif
+
+
+const morton_kernels *morton_kern = &kernels_magic;
+
+const char *const morton_kernel_names[] = {
+    "magic",
+#ifdef MORTON_X86
+    "bmi2",
+#endif
+    NULL,
+};
+
+
+const morton_kernels *morton_kernels_find(const char *name) {
+    if (strcmp(name, "magic") == 0) {
+        return &kernels_magic;
+    }
+
+#ifdef MORTON_X86
+    if (strcmp(name, "bmi2") == 0 && (cpu_features() & CPU_BMI2)) {
+        return &kernels_bmi2;
+    }
+#endif
+
+    return NULL;
+}
+
+
+void morton_kernels_init(void) {
+#ifdef MORTON_X86
+    if (cpu_features() == CPU_BMI2) {
+        morton_kern = &kernels_bmi2;
+        return;
+    }
+#endif
+
+    morton_kern = &kernels_magic;
+}
@@ -0,0 +1,466 @@
+/*
+
+Copyright (c) 2016 Sean Leffler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "pool.h"
+
+// Chunks are a whole number of these many blocks (4 KiB), so that threads
+// writing neighbouring chunks never share a cache line.
+#define CHUNK_ALIGN 1024
+
+// Each thread gets about this many chunks, so that one running late doesn't
+// hold everybody else up.
+#define CHUNKS_PER_THREAD 4
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <pthread.h>
+#include <unistd.h>
+
+static struct {
+    // Held by whoever is running an operation on the pool, or reconfiguring
+    // it. Callers that can't get it run on their own thread instead.
+    pthread_mutex_t run_lock;
+
+    // Guards everything below, and goes with the two condition variables:
+    // `wake` for the workers to wait for a job, and `done` for the caller to
+    // wait for them to finish it.
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+
+    pthread_t workers[BS_POOL_MAX_THREADS - 1];
+    size_t started;
+
+    size_t threads;
+    size_t min_blocks;
+
+    // Bumped for each job, so that the workers can tell a new one from the one
+    // they just did. Every worker takes part in every job, even if only to
+    // find there's nothing left to claim, and `busy` counts the ones that
+    // haven't yet.
+    unsigned long job;
+    size_t busy;
+    bool quit;
+
+    bs_task_fn fn;
+    void *ctx;
+    size_t n;
+    size_t chunk;
+    // The first block no thread has claimed yet.
+    size_t next;
+} pool = {
+    PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_COND_INITIALIZER,
+    PTHREAD_COND_INITIALIZER,
+    {0}, 0,
+    0, BS_POOL_MIN_BLOCKS,
+    0, 0, false,
+    NULL, NULL, 0, 0, 0,
+};
+
+
+// Claims and runs chunks of the current job until there are none left.
+static void work(void) {
+    for (;;) {
+        const size_t lo =
+            __atomic_fetch_add(&pool.next, pool.chunk, __ATOMIC_RELAXED);
+
+        if (lo >= pool.n) {
+            return;
+        }
+
+        const size_t hi = (pool.n - lo > pool.chunk) ? lo + pool.chunk : pool.n;
+        pool.fn(pool.ctx, lo, hi);
+    }
+}
+
+
+// Workers are handed the number of the last job before they were started, so
+// that they wait for the next one.
+static void *worker_main(void *arg) {
+    unsigned long seen = (unsigned long)(uintptr_t)arg;
+
+    pthread_mutex_lock(&pool.lock);
+
+    for (;;) {
+        while (!pool.quit && pool.job == seen) {
+            pthread_cond_wait(&pool.wake, &pool.lock);
+        }
+
+        if (pool.quit) {
+            break;
+        }
+
+        seen = pool.job;
+        pthread_mutex_unlock(&pool.lock);
+
+        work();
+
+        pthread_mutex_lock(&pool.lock);
+
+        if (--pool.busy == 0) {
+            pthread_cond_signal(&pool.done);
+        }
+    }
+
+    pthread_mutex_unlock(&pool.lock);
+    return NULL;
+}
+
+
+// Stops and joins every worker. Called with `run_lock` held, so there's no job
+// running.
+static void stop_workers(void) {
+    pthread_mutex_lock(&pool.lock);
+    pool.quit = true;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    size_t i;
+    for (i = 0; i < pool.started; i++) {
+        pthread_join(pool.workers[i], NULL);
+    }
+
+    pool.started = 0;
+    pool.quit = false;
+}
+
+
+// Starts as many workers as the settings ask for, or as many as the system
+// lets us. Called with `run_lock` held.
+static void start_workers(void) {
+    // Jobs are only posted with `run_lock` held, so this can't change under us.
+    const unsigned long job = pool.job;
+
+    while (pool.started + 1 < pool.threads) {
+        if (pthread_create(&pool.workers[pool.started], NULL, worker_main,
+                (void*)(uintptr_t)job) != 0) {
+            break;
+        }
+
+        pool.started++;
+    }
+}
+
+
+static size_t default_threads(void) {
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (cpus < 1) {
+        return 1;
+    }
+
+    return ((size_t)cpus < BS_POOL_MAX_THREADS) ?
+        (size_t)cpus : BS_POOL_MAX_THREADS;
+}
+
+
+void bs_pool_run(size_t n, bs_task_fn fn, void *ctx) {
+    if (n < __atomic_load_n(&pool.min_blocks, __ATOMIC_RELAXED) ||
+            pthread_mutex_trylock(&pool.run_lock) != 0) {
+        fn(ctx, 0, n);
+        return;
+    }
+
+    if (pool.threads == 0) {
+        pool.threads = default_threads();
+    }
+
+    start_workers();
+
+    if (pool.started == 0) {
+        pthread_mutex_unlock(&pool.run_lock);
+        fn(ctx, 0, n);
+        return;
+    }
+
+    const size_t pieces = (pool.started + 1) * CHUNKS_PER_THREAD;
+    size_t chunk = (n / pieces + CHUNK_ALIGN - 1) / CHUNK_ALIGN * CHUNK_ALIGN;
+
+    if (chunk == 0) {
+        chunk = CHUNK_ALIGN;
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    pool.fn = fn;
+    pool.ctx = ctx;
+    pool.n = n;
+    pool.chunk = chunk;
+    pool.next = 0;
+    pool.busy = pool.started;
+    pool.job++;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    work();
+
+    pthread_mutex_lock(&pool.lock);
+
+    while (pool.busy > 0) {
+        pthread_cond_wait(&pool.done, &pool.lock);
+    }
+
+    pthread_mutex_unlock(&pool.lock);
+    pthread_mutex_unlock(&pool.run_lock);
+}
+
+
+size_t bs_pool_threads(void) {
+    pthread_mutex_lock(&pool.run_lock);
+
+    if (pool.threads == 0) {
+        pool.threads = default_threads();
+    }
+
+    const size_t threads = pool.threads;
+    pthread_mutex_unlock(&pool.run_lock);
+
+    return threads;
+}
+
+
+size_t bs_pool_min_blocks(void) {
+    return __atomic_load_n(&pool.min_blocks, __ATOMIC_RELAXED);
+}
+
+
+bool bs_pool_configure(size_t threads, size_t min_blocks) {
+    if (threads < 1) {
+        threads = 1;
+    } else if (threads > BS_POOL_MAX_THREADS) {
+        threads = BS_POOL_MAX_THREADS;
+    }
+
+    pthread_mutex_lock(&pool.run_lock);
+
+    // Fewer threads means stopping some workers, and it's simplest to stop
+    // them all; the next big operation starts the right number again.
+    if (threads < pool.started + 1) {
+        stop_workers();
+    }
+
+    pool.threads = threads;
+    __atomic_store_n(&pool.min_blocks, min_blocks, __ATOMIC_RELAXED);
+
+    pthread_mutex_unlock(&pool.run_lock);
+    return true;
+}
+
+
+#if defined(__GNUC__)
+// The workers run code from this library, so they have to be gone before it's
+// unloaded, which `lua_close` does.
+__attribute__((destructor)) static void pool_shutdown(void) {
+    pthread_mutex_lock(&pool.run_lock);
+    stop_workers();
+    pthread_mutex_unlock(&pool.run_lock);
+}
+#endif
+
+#else
+
+static size_t min_blocks = BS_POOL_MIN_BLOCKS;
+
+
+void bs_pool_run(size_t n, bs_task_fn fn, void *ctx) {
+    fn(ctx, 0, n);
+}
+
+
+size_t bs_pool_threads(void) {
+    return 1;
+}
+
+
+size_t bs_pool_min_blocks(void) {
+    return min_blocks;
+}
+
+
+bool bs_pool_configure(size_t threads, size_t blocks) {
+    min_blocks = blocks;
+
+    if (threads > 1) {
+        errno = ENOSYS;
+        return false;
+    }
+
+    return true;
+}
+
+#endif
+
+
+// The parallel kernels. Each one packs its arguments into a `par_args`, and
+// the tasks unpack them and call the matching kernel of `bs_kern` on their
+// piece. Results are gathered with atomics; the tests also set `stop` when
+// they know the answer, so that the chunks not yet started can skip the work.
+
+typedef struct par_args {
+    block_t *dst;
+    const block_t *a;
+    const block_t *b;
+    size_t sum;
+    int stop;
+} par_args;
+
+
+#define MAP_KERNEL(fname, kernel) \
+static void fname##_task(void *ctx, size_t lo, size_t hi) { \
+    par_args *const args = ctx; \
+    bs_kern->kernel(args->dst + lo, args->a + lo, args->b + lo, hi - lo); \
+} \
+\
+static void fname(block_t *dst, const block_t *a, const block_t *b, \
+        size_t n) { \
+    par_args args = { dst, a, b, 0, 0 }; \
+    bs_pool_run(n, fname##_task, &args); \
+}
+
+MAP_KERNEL(and_par, and_blocks)
+MAP_KERNEL(or_par, or_blocks)
+MAP_KERNEL(andnot_par, andnot_blocks)
+MAP_KERNEL(xor_par, xor_blocks)
+
+
+#define COUNT_KERNEL(fname, kernel) \
+static void fname##_task(void *ctx, size_t lo, size_t hi) { \
+    par_args *const args = ctx; \
+    const size_t sum = bs_kern->kernel(args->a + lo, args->b + lo, hi - lo); \
+    __atomic_fetch_add(&args->sum, sum, __ATOMIC_RELAXED); \
+} \
+\
+static size_t fname(const block_t *a, const block_t *b, size_t n) { \
+    par_args args = { NULL, a, b, 0, 0 }; \
+    bs_pool_run(n, fname##_task, &args); \
+    return args.sum; \
+}
+
+COUNT_KERNEL(and_popcount_par, and_popcount_blocks)
+COUNT_KERNEL(or_popcount_par, or_popcount_blocks)
+COUNT_KERNEL(andnot_popcount_par, andnot_popcount_blocks)
+COUNT_KERNEL(xor_popcount_par, xor_popcount_blocks)
+
+
+static void popcount_task(void *ctx, size_t lo, size_t hi) {
+    par_args *const args = ctx;
+    const size_t sum = bs_kern->popcount_blocks(args->a + lo, hi - lo);
+    __atomic_fetch_add(&args->sum, sum, __ATOMIC_RELAXED);
+}
+
+
+static size_t popcount_par(const block_t *a, size_t n) {
+    par_args args = { NULL, a, NULL, 0, 0 };
+    bs_pool_run(n, popcount_task, &args);
+    return args.sum;
+}
+
+
+// Tests that hold when they hold for every piece. `intersects` is the odd one
+// out, holding when it holds for any piece, and so stops on true.
+#define TEST_KERNEL(fname, kernel, stop_on) \
+static void fname##_task(void *ctx, size_t lo, size_t hi) { \
+    par_args *const args = ctx; \
+    if (__atomic_load_n(&args->stop, __ATOMIC_RELAXED)) { \
+        return; \
+    } \
+    if (bs_kern->kernel(args->a + lo, args->b + lo, hi - lo) == stop_on) { \
+        __atomic_store_n(&args->stop, 1, __ATOMIC_RELAXED); \
+    } \
+} \
+\
+static bool fname(const block_t *a, const block_t *b, size_t n) { \
+    par_args args = { NULL, a, b, 0, 0 }; \
+    bs_pool_run(n, fname##_task, &args); \
+    return args.stop ? stop_on : !stop_on; \
+}
+
+TEST_KERNEL(eq_par, eq_blocks, false)
+TEST_KERNEL(subset_par, subset_blocks, false)
+TEST_KERNEL(intersects_par, intersects_blocks, true)
+
+
+static void zero_task(void *ctx, size_t lo, size_t hi) {
+    par_args *const args = ctx;
+
+    if (__atomic_load_n(&args->stop, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    if (!bs_kern->zero_blocks(args->a + lo, hi - lo)) {
+        __atomic_store_n(&args->stop, 1, __ATOMIC_RELAXED);
+    }
+}
+
+
+static bool zero_par(const block_t *a, size_t n) {
+    par_args args = { NULL, a, NULL, 0, 0 };
+    bs_pool_run(n, zero_task, &args);
+    return !args.stop;
+}
+
+
+// Matching works over rows, several blocks' worth of words for each bit it
+// writes, and tables big enough to be worth splitting are rare, so it always
+// runs on the calling thread.
+static void match_rows_par(block_t *out, const uint64_t *cols, size_t stride,
+        size_t words, size_t n, const uint64_t *all, const uint64_t *none,
+        const uint64_t *any) {
+    bs_kern->match_rows(out, cols, stride, words, n, all, none, any);
+}
+
+
+const bs_kernels bs_par = {
+    "parallel",
+    and_par, or_par, andnot_par, xor_par,
+    eq_par, subset_par, zero_par,
+    popcount_par,
+    and_popcount_par, or_popcount_par, andnot_popcount_par, xor_popcount_par,
+    intersects_par,
+    match_rows_par,
+};
+
+
+typedef struct copy_args {
+    block_t *dst;
+    const unsigned char *src;
+} copy_args;
+
+
+static void copy_task(void *ctx, size_t lo, size_t hi) {
+    copy_args *const args = ctx;
+    memcpy(args->dst + lo, args->src + lo * sizeof(block_t),
+        (hi - lo) * sizeof(block_t));
+}
+
+
+void bs_par_copy(block_t *dst, const void *src, size_t n) {
+    copy_args args = { dst, src };
+    bs_pool_run(n, copy_task, &args);
+}
@@ -0,0 +1,1207 @@
+/*
+
+Copyright (c) 2016 Sean Leffler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+// Roaring bitmap containers. Arrays are the common case for sparse sets, so
+// array/array operations are done by merging; everything else is done by
+// expanding both operands into plain bitmaps on the stack and handing them to
+// the bitset kernels. Run containers only come out of `rr_add_range` (for whole
+// chunks) and `rr_optimize`, and are expanded again as soon as they're modified
+// one bit at a time.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "roaring.h"
+
+#define ARRAY(c) ((uint16_t*)(c)->data)
+#define BITMAP(c) ((block_t*)(c)->data)
+#define RUNS(c) ((rr_run*)(c)->data)
+
+#define BITMAP_BYTES (RR_BITMAP_BLOCKS * sizeof(block_t))
+
+
+/*
+ * Plain bitmaps.
+ */
+
+static bool bitmap_get(const block_t *bm, uint32_t v) {
+    return (bm[v / BITWIDTH] & (JUST_ONE << (v % BITWIDTH))) != 0;
+}
+
+
+static void bitmap_set(block_t *bm, uint32_t v) {
+    bm[v / BITWIDTH] |= JUST_ONE << (v % BITWIDTH);
+}
+
+
+static void bitmap_clear(block_t *bm, uint32_t v) {
+    bm[v / BITWIDTH] &= ~(JUST_ONE << (v % BITWIDTH));
+}
+
+
+// Sets or clears the bits `[lo, hi)`.
+static void bitmap_fill(block_t *bm, uint32_t lo, uint32_t hi, bool value) {
+    if (lo >= hi) {
+        return;
+    }
+
+    const size_t lo_blk = lo / BITWIDTH;
+    const size_t hi_blk = (hi - 1) / BITWIDTH;
+
+    block_t lo_mask = ALL_ONES << (lo % BITWIDTH);
+    const block_t hi_mask = ALL_ONES >> (BITWIDTH - 1 - (hi - 1) % BITWIDTH);
+
+    if (lo_blk == hi_blk) {
+        lo_mask &= hi_mask;
+    }
+
+    if (value) {
+        bm[lo_blk] |= lo_mask;
+    } else {
+        bm[lo_blk] &= ~lo_mask;
+    }
+
+    if (hi_blk > lo_blk) {
+        memset(bm + lo_blk + 1, value ? 0xFF : 0,
+            (hi_blk - lo_blk - 1) * sizeof(block_t));
+
+        if (value) {
+            bm[hi_blk] |= hi_mask;
+        } else {
+            bm[hi_blk] &= ~hi_mask;
+        }
+    }
+}
+
+
+// The first set bit at or after `from`, or -1.
+static int32_t bitmap_next(const block_t *bm, uint32_t from) {
+    if (from >= RR_CHUNK_BITS) {
+        return -1;
+    }
+
+    size_t blk = from / BITWIDTH;
+    block_t word = bm[blk] & (ALL_ONES << (from % BITWIDTH));
+
+    while (word == 0) {
+        if (++blk >= RR_BITMAP_BLOCKS) {
+            return -1;
+        }
+
+        word = bm[blk];
+    }
+
+    return (int32_t)(blk * BITWIDTH + BLOCK_CTZ(word));
+}
+
+
+/*
+ * Containers.
+ */
+
+static uint32_t array_lower_bound(const uint16_t *a, uint32_t n, uint16_t v) {
+    uint32_t lo = 0, hi = n;
+
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+
+        if (a[mid] < v) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+
+// The index of the last run starting at or before `v`, or -1.
+static int64_t run_search(const rr_run *runs, uint32_t n, uint16_t v) {
+    uint32_t lo = 0, hi = n;
+
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+
+        if (runs[mid].start <= v) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return (int64_t)lo - 1;
+}
+
+
+static void c_free(rr_container *c) {
+    if (!c->borrowed) {
+        free(c->data);
+    }
+
+    c->data = NULL;
+}
+
+
+static bool c_contains(const rr_container *c, uint16_t v) {
+    switch (c->type) {
+    case RR_ARRAY: {
+        const uint32_t i = array_lower_bound(ARRAY(c), c->n, v);
+        return i < c->n && ARRAY(c)[i] == v;
+    }
+    case RR_BITMAP:
+        return bitmap_get(BITMAP(c), v);
+    default: {
+        const int64_t i = run_search(RUNS(c), c->n, v);
+        return i >= 0 && v <= RUNS(c)[i].last;
+    }
+    }
+}
+
+
+// Expands any container into a plain bitmap.
+static void c_to_bitmap(const rr_container *c, block_t *bm) {
+    uint32_t i;
+
+    switch (c->type) {
+    case RR_ARRAY:
+        memset(bm, 0, BITMAP_BYTES);
+
+        for (i = 0; i < c->n; i++) {
+            bitmap_set(bm, ARRAY(c)[i]);
+        }
+        break;
+    case RR_BITMAP:
+        memcpy(bm, BITMAP(c), BITMAP_BYTES);
+        break;
+    default:
+        memset(bm, 0, BITMAP_BYTES);
+
+        for (i = 0; i < c->n; i++) {
+            bitmap_fill(bm, RUNS(c)[i].start, (uint32_t)RUNS(c)[i].last + 1,
+                true);
+        }
+        break;
+    }
+}
+
+
+// A bitmap of the container's contents: the container's own storage if it's a
+// bitmap, or `buf` filled in otherwise.
+static const block_t *c_bitmap_of(const rr_container *c, block_t *buf) {
+    if (c->type == RR_BITMAP) {
+        return BITMAP(c);
+    }
+
+    c_to_bitmap(c, buf);
+    return buf;
+}
+
+
+// Builds an array or bitmap container, whichever is appropriate, from a plain
+// bitmap with `card` bits set. Any old contents of `out` are not freed.
+static bool c_from_bitmap(rr_container *out, uint16_t key, const block_t *bm,
+        uint32_t card) {
+    out->key = key;
+    out->borrowed = 0;
+    out->card = card;
+
+    if (card <= RR_ARRAY_MAX) {
+        uint16_t *const values = malloc((card ? card : 1) * sizeof(uint16_t));
+
+        if (values == NULL) {
+            return false;
+        }
+
+        uint32_t n = 0;
+        size_t blk;
+        for (blk = 0; blk < RR_BITMAP_BLOCKS; blk++) {
+            block_t word = bm[blk];
+
+            while (word != 0) {
+                values[n++] = (uint16_t)(blk * BITWIDTH + BLOCK_CTZ(word));
+                word &= word - 1;
+            }
+        }
+
+        out->type = RR_ARRAY;
+        out->data = values;
+        out->n = out->cap = card;
+    } else {
+        block_t *const bits = malloc(BITMAP_BYTES);
+
+        if (bits == NULL) {
+            return false;
+        }
+
+        memcpy(bits, bm, BITMAP_BYTES);
+
+        out->type = RR_BITMAP;
+        out->data = bits;
+        out->n = out->cap = 0;
+    }
+
+    return true;
+}
+
+
+static bool c_from_array(rr_container *out, uint16_t key, const uint16_t *values,
+        uint32_t n) {
+    if (n > RR_ARRAY_MAX) {
+        block_t bm[RR_BITMAP_BLOCKS];
+        memset(bm, 0, BITMAP_BYTES);
+
+        uint32_t i;
+        for (i = 0; i < n; i++) {
+            bitmap_set(bm, values[i]);
+        }
+
+        return c_from_bitmap(out, key, bm, n);
+    }
+
+    uint16_t *const copy = malloc((n ? n : 1) * sizeof(uint16_t));
+
+    if (copy == NULL) {
+        return false;
+    }
+
+    memcpy(copy, values, n * sizeof(uint16_t));
+
+    out->key = key;
+    out->type = RR_ARRAY;
+    out->borrowed = 0;
+    out->card = out->n = out->cap = n;
+    out->data = copy;
+    return true;
+}
+
+
+static bool c_copy(rr_container *dst, const rr_container *src) {
+    switch (src->type) {
+    case RR_ARRAY:
+        return c_from_array(dst, src->key, ARRAY(src), src->n);
+    case RR_BITMAP:
+        // Borrowed bitmaps can be arbitrarily sparse, so they go through
+        // `c_from_bitmap` to get the right container type.
+        return c_from_bitmap(dst, src->key, BITMAP(src), src->card);
+    default: {
+        rr_run *const runs = malloc(src->n * sizeof(rr_run));
+
+        if (runs == NULL) {
+            return false;
+        }
+
+        memcpy(runs, RUNS(src), src->n * sizeof(rr_run));
+
+        *dst = *src;
+        dst->borrowed = 0;
+        dst->cap = src->n;
+        dst->data = runs;
+        return true;
+    }
+    }
+}
+
+
+// Replaces a container's storage with a freshly built array or bitmap. `bm` may
+// be the container's own bitmap.
+static bool c_rebuild(rr_container *c, const block_t *bm, uint32_t card) {
+    rr_container fresh;
+
+    if (!c_from_bitmap(&fresh, c->key, bm, card)) {
+        return false;
+    }
+
+    c_free(c);
+    *c = fresh;
+    return true;
+}
+
+
+// Run containers are expanded before being modified a bit at a time.
+static bool c_expand_runs(rr_container *c) {
+    block_t bm[RR_BITMAP_BLOCKS];
+
+    c_to_bitmap(c, bm);
+    return c_rebuild(c, bm, c->card);
+}
+
+
+static int c_add(rr_container *c, uint16_t v) {
+    if (c_contains(c, v)) {
+        return 0;
+    }
+
+    if (c->type == RR_RUN && !c_expand_runs(c)) {
+        return -1;
+    }
+
+    // A full array turns into a bitmap.
+    if (c->type == RR_ARRAY && c->n == RR_ARRAY_MAX) {
+        block_t *const bits = malloc(BITMAP_BYTES);
+
+        if (bits == NULL) {
+            return -1;
+        }
+
+        c_to_bitmap(c, bits);
+        c_free(c);
+
+        c->type = RR_BITMAP;
+        c->n = c->cap = 0;
+        c->data = bits;
+    }
+
+    if (c->type == RR_ARRAY) {
+        if (c->n == c->cap) {
+            uint32_t cap = c->cap ? c->cap * 2 : 4;
+
+            if (cap > RR_ARRAY_MAX) {
+                cap = RR_ARRAY_MAX;
+            }
+
+            uint16_t *const values = realloc(c->data, cap * sizeof(uint16_t));
+
+            if (values == NULL) {
+                return -1;
+            }
+
+            c->data = values;
+            c->cap = cap;
+        }
+
+        uint16_t *const values = ARRAY(c);
+        const uint32_t i = array_lower_bound(values, c->n, v);
+
+        memmove(values + i + 1, values + i, (c->n - i) * sizeof(uint16_t));
+        values[i] = v;
+        c->n++;
+    } else {
+        bitmap_set(BITMAP(c), v);
+    }
+
+    c->card++;
+    return 1;
+}
+
+
+static int c_remove(rr_container *c, uint16_t v) {
+    if (!c_contains(c, v)) {
+        return 0;
+    }
+
+    if (c->type == RR_RUN && !c_expand_runs(c)) {
+        return -1;
+    }
+
+    if (c->type == RR_ARRAY) {
+        uint16_t *const values = ARRAY(c);
+        const uint32_t i = array_lower_bound(values, c->n, v);
+
+        memmove(values + i, values + i + 1, (c->n - i - 1) * sizeof(uint16_t));
+        c->n--;
+        c->card--;
+    } else {
+        bitmap_clear(BITMAP(c), v);
+        c->card--;
+
+        // Shrinking back down to an array can fail, but the bitmap is still
+        // perfectly good if it does.
+        if (c->card <= RR_ARRAY_MAX) {
+            c_rebuild(c, BITMAP(c), c->card);
+        }
+    }
+
+    return 1;
+}
+
+
+static uint32_t merge_arrays(rr_op op, const uint16_t *a, uint32_t na,
+        const uint16_t *b, uint32_t nb, uint16_t *out) {
+    const bool keep_a = op != RR_AND;
+    const bool keep_b = op == RR_OR || op == RR_XOR;
+    const bool keep_both = op == RR_AND || op == RR_OR;
+
+    uint32_t i = 0, j = 0, k = 0;
+
+    while (i < na && j < nb) {
+        if (a[i] < b[j]) {
+            if (keep_a) {
+                out[k++] = a[i];
+            }
+            i++;
+        } else if (a[i] > b[j]) {
+            if (keep_b) {
+                out[k++] = b[j];
+            }
+            j++;
+        } else {
+            if (keep_both) {
+                out[k++] = a[i];
+            }
+            i++;
+            j++;
+        }
+    }
+
+    if (keep_a) {
+        for (; i < na; i++) {
+            out[k++] = a[i];
+        }
+    }
+
+    if (keep_b) {
+        for (; j < nb; j++) {
+            out[k++] = b[j];
+        }
+    }
+
+    return k;
+}
+
+
+// Keeps the values of array container `a` which are (or, if `keep` is false,
+// aren't) in `b`.
+static bool filter_array(rr_container *out, const rr_container *a,
+        const rr_container *b, bool keep) {
+    uint16_t values[RR_ARRAY_MAX];
+    uint32_t n = 0, i;
+
+    for (i = 0; i < a->n; i++) {
+        if (c_contains(b, ARRAY(a)[i]) == keep) {
+            values[n++] = ARRAY(a)[i];
+        }
+    }
+
+    return c_from_array(out, a->key, values, n);
+}
+
+
+// `out` may come back with a cardinality of zero, in which case it holds no
+// storage worth keeping, but still needs `c_free`.
+static bool c_binop(rr_op op, rr_container *out, const rr_container *a,
+        const rr_container *b) {
+    if (a->type == RR_ARRAY && b->type == RR_ARRAY) {
+        uint16_t values[2 * RR_ARRAY_MAX];
+        const uint32_t n =
+            merge_arrays(op, ARRAY(a), a->n, ARRAY(b), b->n, values);
+
+        return c_from_array(out, a->key, values, n);
+    }
+
+    if (op == RR_AND && a->type == RR_ARRAY) {
+        return filter_array(out, a, b, true);
+    }
+
+    if (op == RR_AND && b->type == RR_ARRAY) {
+        return filter_array(out, b, a, true);
+    }
+
+    if (op == RR_ANDNOT && a->type == RR_ARRAY) {
+        return filter_array(out, a, b, false);
+    }
+
+    block_t abuf[RR_BITMAP_BLOCKS];
+    block_t bbuf[RR_BITMAP_BLOCKS];
+
+    const block_t *const abits = c_bitmap_of(a, abuf);
+    const block_t *const bbits = c_bitmap_of(b, bbuf);
+
+    switch (op) {
+    case RR_AND:
+        bs_kern->and_blocks(abuf, abits, bbits, RR_BITMAP_BLOCKS);
+        break;
+    case RR_OR:
+        bs_kern->or_blocks(abuf, abits, bbits, RR_BITMAP_BLOCKS);
+        break;
+    case RR_ANDNOT:
+        bs_kern->andnot_blocks(abuf, abits, bbits, RR_BITMAP_BLOCKS);
+        break;
+    case RR_XOR:
+        bs_kern->xor_blocks(abuf, abits, bbits, RR_BITMAP_BLOCKS);
+        break;
+    }
+
+    const uint32_t card =
+        (uint32_t)bs_kern->popcount_blocks(abuf, RR_BITMAP_BLOCKS);
+
+    return c_from_bitmap(out, a->key, abuf, card);
+}
+
+
+static bool c_equals(const rr_container *a, const rr_container *b) {
+    if (a->card != b->card) {
+        return false;
+    }
+
+    if (a->type == RR_ARRAY && b->type == RR_ARRAY) {
+        return memcmp(a->data, b->data, a->n * sizeof(uint16_t)) == 0;
+    }
+
+    block_t abuf[RR_BITMAP_BLOCKS];
+    block_t bbuf[RR_BITMAP_BLOCKS];
+
+    return bs_kern->eq_blocks(c_bitmap_of(a, abuf), c_bitmap_of(b, bbuf),
+        RR_BITMAP_BLOCKS);
+}
+
+
+static bool c_subset(const rr_container *a, const rr_container *b) {
+    if (a->card > b->card) {
+        return false;
+    }
+
+    if (a->type == RR_ARRAY) {
+        uint32_t i;
+        for (i = 0; i < a->n; i++) {
+            if (!c_contains(b, ARRAY(a)[i])) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    block_t abuf[RR_BITMAP_BLOCKS];
+    block_t bbuf[RR_BITMAP_BLOCKS];
+
+    return bs_kern->subset_blocks(c_bitmap_of(a, abuf), c_bitmap_of(b, bbuf),
+        RR_BITMAP_BLOCKS);
+}
+
+
+// The first set bit at or after `from` in the container, or -1.
+static int32_t c_next(const rr_container *c, uint16_t from) {
+    switch (c->type) {
+    case RR_ARRAY: {
+        const uint32_t i = array_lower_bound(ARRAY(c), c->n, from);
+        return i < c->n ? ARRAY(c)[i] : -1;
+    }
+    case RR_BITMAP:
+        return bitmap_next(BITMAP(c), from);
+    default: {
+        int64_t i = run_search(RUNS(c), c->n, from);
+
+        if (i >= 0 && from <= RUNS(c)[i].last) {
+            return from;
+        }
+
+        i++;
+        return i < c->n ? RUNS(c)[i].start : -1;
+    }
+    }
+}
+
+
+static size_t c_memory(const rr_container *c) {
+    if (c->borrowed) {
+        return 0;
+    }
+
+    switch (c->type) {
+    case RR_ARRAY:
+        return c->cap * sizeof(uint16_t);
+    case RR_BITMAP:
+        return BITMAP_BYTES;
+    default:
+        return c->cap * sizeof(rr_run);
+    }
+}
+
+
+/*
+ * Roaring bitmaps.
+ */
+
+void rr_init(Roaring *r) {
+    r->cs = NULL;
+    r->len = 0;
+    r->cap = 0;
+}
+
+
+void rr_free(Roaring *r) {
+    size_t i;
+    for (i = 0; i < r->len; i++) {
+        c_free(&r->cs[i]);
+    }
+
+    free(r->cs);
+    rr_init(r);
+}
+
+
+// The position of the container with `key`, or where it would be inserted.
+static size_t find_key(const Roaring *r, uint16_t key, bool *found) {
+    size_t lo = 0, hi = r->len;
+
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+
+        if (r->cs[mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    *found = lo < r->len && r->cs[lo].key == key;
+    return lo;
+}
+
+
+static bool reserve(Roaring *r, size_t extra) {
+    if (r->len + extra <= r->cap) {
+        return true;
+    }
+
+    size_t cap = r->cap ? r->cap * 2 : 4;
+
+    if (cap < r->len + extra) {
+        cap = r->len + extra;
+    }
+
+    rr_container *const cs = realloc(r->cs, cap * sizeof(rr_container));
+
+    if (cs == NULL) {
+        return false;
+    }
+
+    r->cs = cs;
+    r->cap = cap;
+    return true;
+}
+
+
+static bool insert_at(Roaring *r, size_t pos, const rr_container *c) {
+    if (!reserve(r, 1)) {
+        return false;
+    }
+
+    memmove(r->cs + pos + 1, r->cs + pos,
+        (r->len - pos) * sizeof(rr_container));
+    r->cs[pos] = *c;
+    r->len++;
+    return true;
+}
+
+
+static void remove_at(Roaring *r, size_t pos) {
+    c_free(&r->cs[pos]);
+    memmove(r->cs + pos, r->cs + pos + 1,
+        (r->len - pos - 1) * sizeof(rr_container));
+    r->len--;
+}
+
+
+// Appends `c` to `r`, or frees it if it's empty.
+static bool append(Roaring *r, rr_container *c) {
+    if (c->card == 0) {
+        c_free(c);
+        return true;
+    }
+
+    if (!reserve(r, 1)) {
+        c_free(c);
+        return false;
+    }
+
+    r->cs[r->len++] = *c;
+    return true;
+}
+
+
+bool rr_copy(Roaring *dst, const Roaring *src) {
+    rr_init(dst);
+
+    if (!reserve(dst, src->len)) {
+        return false;
+    }
+
+    size_t i;
+    for (i = 0; i < src->len; i++) {
+        if (!c_copy(&dst->cs[i], &src->cs[i])) {
+            rr_free(dst);
+            return false;
+        }
+
+        dst->len++;
+    }
+
+    return true;
+}
+
+
+int rr_add(Roaring *r, uint32_t idx) {
+    const uint16_t key = (uint16_t)(idx >> 16);
+    const uint16_t low = (uint16_t)idx;
+
+    bool found;
+    const size_t pos = find_key(r, key, &found);
+
+    if (found) {
+        return c_add(&r->cs[pos], low);
+    }
+
+    rr_container c;
+
+    if (!c_from_array(&c, key, &low, 1)) {
+        return -1;
+    }
+
+    if (!insert_at(r, pos, &c)) {
+        c_free(&c);
+        return -1;
+    }
+
+    return 1;
+}
+
+
+int rr_remove(Roaring *r, uint32_t idx) {
+    bool found;
+    const size_t pos = find_key(r, (uint16_t)(idx >> 16), &found);
+
+    if (!found) {
+        return 0;
+    }
+
+    const int removed = c_remove(&r->cs[pos], (uint16_t)idx);
+
+    if (r->cs[pos].card == 0) {
+        remove_at(r, pos);
+    }
+
+    return removed;
+}
+
+
+bool rr_contains(const Roaring *r, uint32_t idx) {
+    bool found;
+    const size_t pos = find_key(r, (uint16_t)(idx >> 16), &found);
+
+    return found && c_contains(&r->cs[pos], (uint16_t)idx);
+}
+
+
+uint64_t rr_cardinality(const Roaring *r) {
+    uint64_t sum = 0;
+
+    size_t i;
+    for (i = 0; i < r->len; i++) {
+        sum += r->cs[i].card;
+    }
+
+    return sum;
+}
+
+
+static bool fill_range(Roaring *r, uint64_t lo, uint64_t hi, bool value) {
+    if (lo >= hi) {
+        return true;
+    }
+
+    const uint32_t first = (uint32_t)(lo >> 16);
+    const uint32_t last = (uint32_t)((hi - 1) >> 16);
+
+    uint32_t key;
+    for (key = first; key <= last; key++) {
+        const uint32_t clo = key == first ? (uint32_t)(lo & 0xFFFF) : 0;
+        const uint32_t chi =
+            key == last ? (uint32_t)((hi - 1) & 0xFFFF) + 1 : RR_CHUNK_BITS;
+
+        bool found;
+        const size_t pos = find_key(r, (uint16_t)key, &found);
+
+        if (clo == 0 && chi == RR_CHUNK_BITS) {
+            // Whole chunks are either dropped or become a single run.
+            if (!value) {
+                if (found) {
+                    remove_at(r, pos);
+                }
+
+                continue;
+            }
+
+            rr_run *const run = malloc(sizeof(rr_run));
+
+            if (run == NULL) {
+                return false;
+            }
+
+            run->start = 0;
+            run->last = RR_CHUNK_BITS - 1;
+
+            rr_container c = {
+                (uint16_t)key, RR_RUN, 0, RR_CHUNK_BITS, 1, 1, run
+            };
+
+            if (found) {
+                c_free(&r->cs[pos]);
+                r->cs[pos] = c;
+            } else if (!insert_at(r, pos, &c)) {
+                c_free(&c);
+                return false;
+            }
+
+            continue;
+        }
+
+        if (!found && !value) {
+            continue;
+        }
+
+        block_t bm[RR_BITMAP_BLOCKS];
+
+        if (found) {
+            c_to_bitmap(&r->cs[pos], bm);
+        } else {
+            memset(bm, 0, BITMAP_BYTES);
+        }
+
+        bitmap_fill(bm, clo, chi, value);
+
+        const uint32_t card =
+            (uint32_t)bs_kern->popcount_blocks(bm, RR_BITMAP_BLOCKS);
+
+        if (found) {
+            if (card == 0) {
+                remove_at(r, pos);
+            } else if (!c_rebuild(&r->cs[pos], bm, card)) {
+                return false;
+            }
+        } else {
+            rr_container c;
+
+            if (!c_from_bitmap(&c, (uint16_t)key, bm, card)) {
+                return false;
+            }
+
+            if (!insert_at(r, pos, &c)) {
+                c_free(&c);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+bool rr_add_range(Roaring *r, uint64_t lo, uint64_t hi) {
+    return fill_range(r, lo, hi, true);
+}
+
+
+bool rr_remove_range(Roaring *r, uint64_t lo, uint64_t hi) {
+    return fill_range(r, lo, hi, false);
+}
+
+
+bool rr_binop(rr_op op, Roaring *out, const Roaring *a, const Roaring *b) {
+    const bool keep_a = op != RR_AND;
+    const bool keep_b = op == RR_OR || op == RR_XOR;
+
+    rr_init(out);
+
+    size_t i = 0, j = 0;
+
+    while (i < a->len || j < b->len) {
+        rr_container c;
+        c.card = 0;
+        c.data = NULL;
+        c.borrowed = 0;
+
+        bool ok = true;
+
+        if (j >= b->len || (i < a->len && a->cs[i].key < b->cs[j].key)) {
+            if (keep_a) {
+                ok = c_copy(&c, &a->cs[i]);
+            }
+            i++;
+        } else if (i >= a->len || b->cs[j].key < a->cs[i].key) {
+            if (keep_b) {
+                ok = c_copy(&c, &b->cs[j]);
+            }
+            j++;
+        } else {
+            ok = c_binop(op, &c, &a->cs[i], &b->cs[j]);
+            i++;
+            j++;
+        }
+
+        if (!ok || !append(out, &c)) {
+            rr_free(out);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+bool rr_equals(const Roaring *a, const Roaring *b) {
+    if (a->len != b->len) {
+        return false;
+    }
+
+    size_t i;
+    for (i = 0; i < a->len; i++) {
+        if (a->cs[i].key != b->cs[i].key || !c_equals(&a->cs[i], &b->cs[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+bool rr_subset(const Roaring *a, const Roaring *b) {
+    size_t j = 0;
+
+    size_t i;
+    for (i = 0; i < a->len; i++) {
+        while (j < b->len && b->cs[j].key < a->cs[i].key) {
+            j++;
+        }
+
+        if (j >= b->len || b->cs[j].key != a->cs[i].key ||
+                !c_subset(&a->cs[i], &b->cs[j])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+bool rr_next(const Roaring *r, uint64_t from, uint32_t *out) {
+    if (from > RR_MAX_INDEX) {
+        return false;
+    }
+
+    const uint16_t key = (uint16_t)(from >> 16);
+
+    bool found;
+    size_t pos = find_key(r, key, &found);
+
+    for (; pos < r->len; pos++) {
+        const rr_container *const c = &r->cs[pos];
+        const uint16_t low = c->key == key ? (uint16_t)from : 0;
+        const int32_t next = c_next(c, low);
+
+        if (next >= 0) {
+            *out = ((uint32_t)c->key << 16) | (uint32_t)next;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+// Counts the runs of set bits in a bitmap.
+static uint32_t count_runs(const block_t *bm) {
+    uint32_t runs = 0;
+    block_t carry = 0;
+
+    size_t blk;
+    for (blk = 0; blk < RR_BITMAP_BLOCKS; blk++) {
+        const block_t word = bm[blk];
+
+        // A run starts wherever a set bit follows a clear one.
+        runs += (uint32_t)__builtin_popcountll(word & ~((word << 1) | carry));
+        carry = word >> (BITWIDTH - 1);
+    }
+
+    return runs;
+}
+
+
+static bool c_to_runs(rr_container *c, const block_t *bm, uint32_t nruns) {
+    rr_run *const runs = malloc(nruns * sizeof(rr_run));
+
+    if (runs == NULL) {
+        return false;
+    }
+
+    uint32_t n = 0;
+    block_t inverse[RR_BITMAP_BLOCKS];
+
+    size_t blk;
+    for (blk = 0; blk < RR_BITMAP_BLOCKS; blk++) {
+        inverse[blk] = ~bm[blk];
+    }
+
+    int32_t start = bitmap_next(bm, 0);
+
+    while (start >= 0) {
+        int32_t end = bitmap_next(inverse, (uint32_t)start);
+
+        if (end < 0) {
+            end = RR_CHUNK_BITS;
+        }
+
+        runs[n].start = (uint16_t)start;
+        runs[n].last = (uint16_t)(end - 1);
+        n++;
+
+        start = bitmap_next(bm, (uint32_t)end);
+    }
+
+    c_free(c);
+    c->type = RR_RUN;
+    c->n = c->cap = n;
+    c->data = runs;
+    return true;
+}
+
+
+bool rr_optimize(Roaring *r) {
+    size_t i;
+    for (i = 0; i < r->len; i++) {
+        rr_container *const c = &r->cs[i];
+
+        block_t bm[RR_BITMAP_BLOCKS];
+        c_to_bitmap(c, bm);
+
+        const uint32_t nruns = count_runs(bm);
+        const size_t run_size = nruns * sizeof(rr_run);
+        const size_t other_size = c->card <= RR_ARRAY_MAX ?
+            c->card * sizeof(uint16_t) : BITMAP_BYTES;
+
+        bool ok;
+
+        if (run_size < other_size) {
+            ok = c->type == RR_RUN || c_to_runs(c, bm, nruns);
+        } else if (c->type == RR_RUN ||
+                (c->type == RR_ARRAY && c->cap > c->n)) {
+            ok = c_rebuild(c, bm, c->card);
+        } else {
+            ok = true;
+        }
+
+        if (!ok) {
+            return false;
+        }
+    }
+
+    // Give back any slack in the container list, too.
+    if (r->len > 0 && r->len < r->cap) {
+        rr_container *const cs = realloc(r->cs, r->len * sizeof(rr_container));
+
+        if (cs != NULL) {
+            r->cs = cs;
+            r->cap = r->len;
+        }
+    }
+
+    return true;
+}
+
+
+size_t rr_memory(const Roaring *r) {
+    size_t sum = r->cap * sizeof(rr_container);
+
+    size_t i;
+    for (i = 0; i < r->len; i++) {
+        sum += c_memory(&r->cs[i]);
+    }
+
+    return sum;
+}
+
+
+bool rr_view_blocks(Roaring *view, const block_t *bits, size_t len) {
+    rr_init(view);
+
+    const size_t max_len = ((size_t)RR_MAX_INDEX + 1) / BITWIDTH;
+
+    if (len > max_len) {
+        len = max_len;
+    }
+
+    size_t blk;
+    for (blk = 0; blk < len; blk += RR_BITMAP_BLOCKS) {
+        const size_t n =
+            len - blk < RR_BITMAP_BLOCKS ? len - blk : RR_BITMAP_BLOCKS;
+        const uint32_t card = (uint32_t)bs_kern->popcount_blocks(bits + blk, n);
+
+        if (card == 0) {
+            continue;
+        }
+
+        rr_container c;
+        c.key = (uint16_t)(blk / RR_BITMAP_BLOCKS);
+        c.type = RR_BITMAP;
+        c.card = card;
+        c.n = c.cap = 0;
+
+        if (n == RR_BITMAP_BLOCKS) {
+            c.borrowed = 1;
+            c.data = (void*)(bits + blk);
+        } else {
+            // The last chunk is short, so it gets padded out in a copy.
+            block_t *const padded = calloc(RR_BITMAP_BLOCKS, sizeof(block_t));
+
+            if (padded == NULL) {
+                rr_free(view);
+                return false;
+            }
+
+            memcpy(padded, bits + blk, n * sizeof(block_t));
+
+            c.borrowed = 0;
+            c.data = padded;
+        }
+
+        if (!append(view, &c)) {
+            rr_free(view);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+void rr_to_blocks(const Roaring *r, block_t *bits, size_t len) {
+    size_t i;
+    for (i = 0; i < r->len; i++) {
+        const rr_container *const c = &r->cs[i];
+        const size_t base = (size_t)c->key * RR_BITMAP_BLOCKS;
+
+        if (base >= len) {
+            break;
+        }
+
+        const size_t n =
+            len - base < RR_BITMAP_BLOCKS ? len - base : RR_BITMAP_BLOCKS;
+
+        block_t buf[RR_BITMAP_BLOCKS];
+        const block_t *const bm = c_bitmap_of(c, buf);
+
+        bs_kern->or_blocks(bits + base, bits + base, bm, n);
+    }
+}
@@ -0,0 +1,125 @@
+/*
+
+Copyright (c) 2016 Sean Leffler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sigtable.h"
+
+#define ST_MIN_CAP 16
+
+
+void st_init(SigTable *t, st_alloc_fn alloc, void *ud, size_t words) {
+    t->alloc = alloc;
+    t->ud = ud;
+    t->words = words;
+    t->len = 0;
+    t->cap = 0;
+    t->cols = NULL;
+}
+
+
+void st_free(SigTable *t) {
+    t->alloc(t->ud, t->cols, t->words * t->cap * sizeof(uint64_t), 0);
+    st_init(t, t->alloc, t->ud, t->words);
+}
+
+
+bool st_reserve(SigTable *t, size_t cap) {
+    if (cap <= t->cap) {
+        return true;
+    }
+
+    uint64_t *const cols = (uint64_t*)t->alloc(t->ud, NULL, 0,
+        t->words * cap * sizeof(uint64_t));
+
+    if (cols == NULL) {
+        return false;
+    }
+
+    // Every column starts somewhere new, so they can't just be reallocated. A
+    // new table has no columns yet, and `memcpy` mustn't be passed NULL even
+    // to copy nothing.
+    if (t->cols != NULL) {
+        size_t w;
+        for (w = 0; w < t->words; w++) {
+            memcpy(cols + w * cap, t->cols + w * t->cap,
+                t->len * sizeof(uint64_t));
+        }
+
+        t->alloc(t->ud, t->cols, t->words * t->cap * sizeof(uint64_t), 0);
+    }
+
+    t->cols = cols;
+    t->cap = cap;
+
+    return true;
+}
+
+
+bool st_push(SigTable *t, const uint64_t *row) {
+    if (t->len == t->cap &&
+            !st_reserve(t, (t->cap < ST_MIN_CAP) ? ST_MIN_CAP : 2 * t->cap)) {
+        return false;
+    }
+
+    st_set(t, t->len++, row);
+    return true;
+}
+
+
+void st_set(SigTable *t, size_t r, const uint64_t *row) {
+    size_t w;
+    for (w = 0; w < t->words; w++) {
+        t->cols[w * t->cap + r] = row[w];
+    }
+}
+
+
+void st_get(const SigTable *t, size_t r, uint64_t *row) {
+    size_t w;
+    for (w = 0; w < t->words; w++) {
+        row[w] = t->cols[w * t->cap + r];
+    }
+}
+
+
+void st_swap_remove(SigTable *t, size_t r) {
+    const size_t last = --t->len;
+
+    size_t w;
+    for (w = 0; w < t->words; w++) {
+        t->cols[w * t->cap + r] = t->cols[w * t->cap + last];
+    }
+}
+
+
+void st_match(const SigTable *t, const uint64_t *all, const uint64_t *none,
+        const uint64_t *any, block_t *out) {
+    bs_kern->match_rows(out, t->cols, t->cap, t->words, t->len,
+        all, none, any);
+}
@@ -0,0 +1,819 @@
+/*
+
+Copyright (c) 2016 Sean Leffler
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "morton.h"
+#include "zindex.h"
+
+// How many boxes `zi_rebuild` encodes per call into the Morton kernels.
+#define KEY_CHUNK 256
+
+
+void zi_init(ZIndex *z, int dims, double cell, const double origin[3]) {
+    memset(z, 0, sizeof(*z));
+
+    z->dims = dims;
+    z->levels = dims == 2 ? ZI_LEVELS2 : ZI_LEVELS3;
+    z->cell = cell;
+
+    int d;
+    for (d = 0; d < dims; d++) {
+        z->origin[d] = origin[d];
+    }
+}
+
+
+void zi_free(ZIndex *z) {
+    free(z->entries);
+    free(z->slots);
+    free(z->found);
+    free(z->hits);
+    free(z->nodes);
+
+    z->entries = NULL;
+    z->slots = NULL;
+    z->found = NULL;
+    z->hits = NULL;
+    z->nodes = NULL;
+    z->len = z->cap = z->nslots = z->nfound = z->found_cap = 0;
+    z->hits_cap = z->nodes_cap = 0;
+}
+
+
+static bool grow(void **buf, size_t *cap, size_t want, size_t size) {
+    if (want <= *cap) {
+        return true;
+    }
+
+    size_t new_cap = *cap ? *cap * 2 : 64;
+    if (new_cap < want) {
+        new_cap = want;
+    }
+
+    void *const grown = realloc(*buf, new_cap * size);
+
+    if (grown == NULL) {
+        return false;
+    }
+
+    *buf = grown;
+    *cap = new_cap;
+    return true;
+}
+
+
+static bool ensure_slot(ZIndex *z, uint32_t id) {
+    if (id < z->nslots) {
+        return true;
+    }
+
+    size_t old = z->nslots;
+
+    if (!grow((void**)&z->slots, &z->nslots, (size_t)id + 1, sizeof(uint32_t))) {
+        return false;
+    }
+
+    size_t i;
+    for (i = old; i < z->nslots; i++) {
+        z->slots[i] = ZI_NONE;
+    }
+
+    return true;
+}
+
+
+static bool emit(ZIndex *z, uint32_t id) {
+    if (!grow((void**)&z->found, &z->found_cap, z->nfound + 1, sizeof(uint32_t))) {
+        return false;
+    }
+
+    z->found[z->nfound++] = id;
+    return true;
+}
+
+
+static uint32_t to_cell(const ZIndex *z, int d, double v) {
+    const double c = floor((v - z->origin[d]) / z->cell);
+    const double last = (double)(((uint32_t)1 << z->levels) - 1);
+
+    // Written this way round so that NaNs end up in cell zero.
+    if (!(c >= 0)) {
+        return 0;
+    }
+
+    return c > last ? (uint32_t)last : (uint32_t)c;
+}
+
+
+static inline uint32_t bit_length(uint32_t x) {
+    return x ? 32 - (uint32_t)__builtin_clz(x) : 0;
+}
+
+
+// Fills in a normalized box, plus the level and per-axis node coordinates
+// (in units of that level's nodes) it gets filed under.
+static void place(const ZIndex *z, zi_entry *e, const double *min,
+        const double *max, uint32_t node[3]) {
+    uint32_t lo[3] = { 0, 0, 0 }, hi[3] = { 0, 0, 0 };
+    uint32_t diff = 0;
+
+    int d;
+    for (d = 0; d < z->dims; d++) {
+        e->min[d] = min[d] <= max[d] ? min[d] : max[d];
+        e->max[d] = min[d] <= max[d] ? max[d] : min[d];
+
+        lo[d] = to_cell(z, d, e->min[d]);
+        hi[d] = to_cell(z, d, e->max[d]);
+        diff |= lo[d] ^ hi[d];
+    }
+
+    e->level = bit_length(diff);
+
+    for (d = 0; d < 3; d++) {
+        node[d] = lo[d] >> e->level;
+    }
+}
+
+
+static uint32_t node_key(const ZIndex *z, uint32_t code, uint32_t level) {
+    return (uint32_t)((uint64_t)code << (z->dims * level));
+}
+
+
+static void key_one(const ZIndex *z, zi_entry *e, const double *min,
+        const double *max) {
+    uint32_t node[3], code;
+
+    place(z, e, min, max, node);
+
+    if (z->dims == 2) {
+        morton_kern->encode2_16(&node[0], &node[1], &code, 1);
+    } else {
+        morton_kern->encode3_10(&node[0], &node[1], &node[2], &code, 1);
+    }
+
+    e->key = node_key(z, code, e->level);
+}
+
+
+// Whether `a` sorts strictly before `b`: by key, with bigger nodes first.
+static inline bool before(const zi_entry *a, const zi_entry *b) {
+    return a->key < b->key || (a->key == b->key && a->level > b->level);
+}
+
+
+// First position whose entry doesn't sort before `e`.
+static size_t lower_bound_entry(const ZIndex *z, const zi_entry *e) {
+    size_t lo = 0, hi = z->len;
+
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+
+        if (before(&z->entries[mid], e)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+
+// First position in `[lo, hi)` with a key of at least `key`.
+static size_t lower_bound_key(const ZIndex *z, size_t lo, size_t hi,
+        uint64_t key) {
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+
+        if (z->entries[mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+
+static void fix_slots(ZIndex *z, size_t lo, size_t hi) {
+    size_t i;
+    for (i = lo; i < hi; i++) {
+        z->slots[z->entries[i].id] = (uint32_t)i;
+    }
+}
+
+
+bool zi_rebuild(ZIndex *z, const uint32_t *ids, const double *boxes, size_t n) {
+    size_t i;
+
+    for (i = 0; i < z->len; i++) {
+        z->slots[z->entries[i].id] = ZI_NONE;
+    }
+
+    z->len = 0;
+
+    if (n > ZI_MAX_ENTRIES
+            || !grow((void**)&z->entries, &z->cap, n, sizeof(zi_entry))) {
+        return false;
+    }
+
+    // Gather the boxes, dropping earlier duplicates.
+    const int dims = z->dims;
+
+    for (i = 0; i < n; i++) {
+        const uint32_t id = ids[i];
+
+        if (!ensure_slot(z, id)) {
+            for (i = 0; i < z->len; i++) {
+                z->slots[z->entries[i].id] = ZI_NONE;
+            }
+
+            z->len = 0;
+            return false;
+        }
+
+        if (z->slots[id] == ZI_NONE) {
+            z->slots[id] = (uint32_t)z->len;
+            z->entries[z->len++].id = id;
+        }
+
+        zi_entry *const e = &z->entries[z->slots[id]];
+        memcpy(e->min, boxes + i * 2 * dims, dims * sizeof(double));
+        memcpy(e->max, boxes + i * 2 * dims + dims, dims * sizeof(double));
+    }
+
+    const size_t len = z->len;
+
+    // Key everything a chunk at a time through the Morton kernels, and pack
+    // the sort keys: node key, then level (bigger first), then position.
+    uint64_t *const sort = malloc(2 * len * sizeof(uint64_t) + 1);
+    zi_entry *const sorted = malloc(len * sizeof(zi_entry) + 1);
+
+    if (sort == NULL || sorted == NULL) {
+        free(sort);
+        free(sorted);
+
+        for (i = 0; i < len; i++) {
+            z->slots[z->entries[i].id] = ZI_NONE;
+        }
+
+        z->len = 0;
+        return false;
+    }
+
+    size_t first;
+    for (first = 0; first < len; first += KEY_CHUNK) {
+        const size_t count = len - first < KEY_CHUNK ? len - first : KEY_CHUNK;
+        uint32_t node[3][KEY_CHUNK], codes[KEY_CHUNK];
+
+        for (i = 0; i < count; i++) {
+            zi_entry *const e = &z->entries[first + i];
+            uint32_t at[3];
+            double min[3], max[3];
+
+            memcpy(min, e->min, sizeof(min));
+            memcpy(max, e->max, sizeof(max));
+            place(z, e, min, max, at);
+
+            node[0][i] = at[0];
+            node[1][i] = at[1];
+            node[2][i] = at[2];
+        }
+
+        if (dims == 2) {
+            morton_kern->encode2_16(node[0], node[1], codes, count);
+        } else {
+            morton_kern->encode3_10(node[0], node[1], node[2], codes, count);
+        }
+
+        for (i = 0; i < count; i++) {
+            zi_entry *const e = &z->entries[first + i];
+            e->key = node_key(z, codes[i], e->level);
+
+            sort[first + i] = ((uint64_t)e->key << 32)
+                | ((uint64_t)(31 - e->level) << 27)
+                | (first + i);
+        }
+    }
+
+    // LSD radix sort on the top 37 bits, a byte at a time.
+    uint64_t *src = sort, *dst = sort + len;
+    unsigned shift;
+
+    for (shift = 27; shift < 64; shift += 8) {
+        size_t counts[256] = { 0 };
+
+        for (i = 0; i < len; i++) {
+            counts[(src[i] >> shift) & 0xFF]++;
+        }
+
+        // Skip passes where every entry has the same digit.
+        if (len == 0 || counts[(src[0] >> shift) & 0xFF] == len) {
+            continue;
+        }
+
+        size_t total = 0;
+        int b;
+        for (b = 0; b < 256; b++) {
+            const size_t c = counts[b];
+            counts[b] = total;
+            total += c;
+        }
+
+        for (i = 0; i < len; i++) {
+            dst[counts[(src[i] >> shift) & 0xFF]++] = src[i];
+        }
+
+        uint64_t *const tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    for (i = 0; i < len; i++) {
+        sorted[i] = z->entries[src[i] & (ZI_MAX_ENTRIES - 1)];
+    }
+
+    memcpy(z->entries, sorted, len * sizeof(zi_entry));
+    fix_slots(z, 0, len);
+
+    free(sort);
+    free(sorted);
+    return true;
+}
+
+
+static void remove_at(ZIndex *z, size_t pos) {
+    z->slots[z->entries[pos].id] = ZI_NONE;
+
+    memmove(z->entries + pos, z->entries + pos + 1,
+        (z->len - pos - 1) * sizeof(zi_entry));
+    z->len--;
+
+    fix_slots(z, pos, z->len);
+}
+
+
+bool zi_update(ZIndex *z, uint32_t id, const double min[3], const double max[3]) {
+    zi_entry e;
+    e.id = id;
+    key_one(z, &e, min, max);
+
+    if (id < z->nslots && z->slots[id] != ZI_NONE) {
+        const size_t pos = z->slots[id];
+        zi_entry *const old = &z->entries[pos];
+
+        if (old->key == e.key && old->level == e.level) {
+            *old = e;
+            return true;
+        }
+
+        // Slide everything between the old and new positions over by one,
+        // rather than removing and reinserting.
+        size_t to = lower_bound_entry(z, &e);
+
+        if (to > pos) {
+            to--;
+            memmove(z->entries + pos, z->entries + pos + 1,
+                (to - pos) * sizeof(zi_entry));
+            z->entries[to] = e;
+            fix_slots(z, pos, to + 1);
+        } else {
+            memmove(z->entries + to + 1, z->entries + to,
+                (pos - to) * sizeof(zi_entry));
+            z->entries[to] = e;
+            fix_slots(z, to, pos + 1);
+        }
+
+        return true;
+    }
+
+    if (z->len >= ZI_MAX_ENTRIES
+            || !ensure_slot(z, id)
+            || !grow((void**)&z->entries, &z->cap, z->len + 1, sizeof(zi_entry))) {
+        return false;
+    }
+
+    const size_t to = lower_bound_entry(z, &e);
+
+    memmove(z->entries + to + 1, z->entries + to,
+        (z->len - to) * sizeof(zi_entry));
+    z->entries[to] = e;
+    z->len++;
+
+    fix_slots(z, to, z->len);
+    return true;
+}
+
+
+bool zi_remove(ZIndex *z, uint32_t id) {
+    if (id >= z->nslots || z->slots[id] == ZI_NONE) {
+        return false;
+    }
+
+    remove_at(z, z->slots[id]);
+    return true;
+}
+
+
+static bool overlaps(const zi_entry *e, int dims, const double *min,
+        const double *max) {
+    int d;
+    for (d = 0; d < dims; d++) {
+        if (e->max[d] < min[d] || e->min[d] > max[d]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+typedef struct query_ctx {
+    ZIndex *z;
+    const double *min;
+    const double *max;
+    uint32_t lo[3];
+    uint32_t hi[3];
+} query_ctx;
+
+
+// Visits the node at `level` starting at cell `node`, whose entries (minus any
+// belonging to its ancestors) are `[lo, hi)`.
+static bool query_node(query_ctx *q, uint32_t level, const uint32_t node[3],
+        size_t lo, size_t hi) {
+    ZIndex *const z = q->z;
+    const int dims = z->dims;
+    const uint32_t size = (uint32_t)1 << level;
+    bool inside = true;
+
+    int d;
+    for (d = 0; d < dims; d++) {
+        const uint32_t last = node[d] + (size - 1);
+
+        if (last < q->lo[d] || node[d] > q->hi[d]) {
+            return true;
+        }
+
+        if (node[d] < q->lo[d] || last > q->hi[d]) {
+            inside = false;
+        }
+    }
+
+    // Entries in this node and below it are in the query's cells, but they
+    // still have to actually overlap the query box.
+    if (inside || level == 0) {
+        size_t i;
+        for (i = lo; i < hi; i++) {
+            if (overlaps(&z->entries[i], dims, q->min, q->max)
+                    && !emit(z, z->entries[i].id)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    const uint64_t base = z->entries[lo].key
+        & ~(((uint64_t)1 << (dims * level)) - 1);
+
+    // This node's own entries come first.
+    while (lo < hi && z->entries[lo].level == level) {
+        if (overlaps(&z->entries[lo], dims, q->min, q->max)
+                && !emit(z, z->entries[lo].id)) {
+            return false;
+        }
+
+        lo++;
+    }
+
+    const uint64_t child_span = (uint64_t)1 << (dims * (level - 1));
+    const uint32_t half = size >> 1;
+
+    unsigned c;
+    for (c = 0; c < (1u << dims) && lo < hi; c++) {
+        const size_t end = lower_bound_key(z, lo, hi, base + (c + 1) * child_span);
+
+        if (end > lo) {
+            uint32_t child[3] = { node[0], node[1], node[2] };
+
+            for (d = 0; d < dims; d++) {
+                child[d] += ((c >> d) & 1) * half;
+            }
+
+            if (!query_node(q, level - 1, child, lo, end)) {
+                return false;
+            }
+        }
+
+        lo = end;
+    }
+
+    return true;
+}
+
+
+bool zi_query(ZIndex *z, const double min[3], const double max[3]) {
+    query_ctx q;
+    double lo[3], hi[3];
+
+    z->nfound = 0;
+
+    int d;
+    for (d = 0; d < z->dims; d++) {
+        lo[d] = min[d] <= max[d] ? min[d] : max[d];
+        hi[d] = min[d] <= max[d] ? max[d] : min[d];
+
+        q.lo[d] = to_cell(z, d, lo[d]);
+        q.hi[d] = to_cell(z, d, hi[d]);
+    }
+
+    q.z = z;
+    q.min = lo;
+    q.max = hi;
+
+    if (z->len == 0) {
+        return true;
+    }
+
+    const uint32_t root[3] = { 0, 0, 0 };
+    return query_node(&q, z->levels, root, 0, z->len);
+}
+
+
+/*
+ * k-nearest is a best-first search: nodes wait in a min-heap ordered by how
+ * close they could possibly be to the point, and the best `k` boxes so far in
+ * a max-heap, until the closest node left is further away than the furthest
+ * box kept.
+ */
+
+typedef struct near_node {
+    double dist;
+    uint32_t level;
+    uint32_t node[3];
+    size_t lo;
+    size_t hi;
+} near_node;
+
+typedef struct near_hit {
+    double dist;
+    uint32_t id;
+} near_hit;
+
+
+// Squared distance from `p` to a box, zero if it's inside.
+static double box_dist(int dims, const double *p, const double *min,
+        const double *max) {
+    double sum = 0;
+
+    int d;
+    for (d = 0; d < dims; d++) {
+        double delta = 0;
+
+        if (p[d] < min[d]) {
+            delta = min[d] - p[d];
+        } else if (p[d] > max[d]) {
+            delta = p[d] - max[d];
+        }
+
+        sum += delta * delta;
+    }
+
+    return sum;
+}
+
+
+// A lower bound on the distance to anything filed under a node. Boxes off the
+// edge of the grid are clamped onto its edge cells, so nodes on an edge have
+// to be treated as reaching out to infinity beyond it.
+static double node_dist(const ZIndex *z, const double *p, uint32_t level,
+        const uint32_t node[3]) {
+    const uint32_t size = (uint32_t)1 << level;
+    const uint32_t last = ((uint32_t)1 << z->levels) - 1;
+    double min[3], max[3];
+
+    int d;
+    for (d = 0; d < z->dims; d++) {
+        min[d] = node[d] == 0 ? -HUGE_VAL
+            : z->origin[d] + node[d] * z->cell;
+        max[d] = node[d] + (size - 1) == last ? HUGE_VAL
+            : z->origin[d] + ((double)node[d] + size) * z->cell;
+    }
+
+    return box_dist(z->dims, p, min, max);
+}
+
+
+static bool heap_push_node(ZIndex *z, size_t *n, near_node node) {
+    if (!grow(&z->nodes, &z->nodes_cap, *n + 1, sizeof(near_node))) {
+        return false;
+    }
+
+    near_node *const heap = z->nodes;
+    size_t i = (*n)++;
+
+    while (i > 0 && heap[(i - 1) / 2].dist > node.dist) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+
+    heap[i] = node;
+    return true;
+}
+
+
+static near_node heap_pop_node(near_node *heap, size_t *n) {
+    const near_node top = heap[0];
+    const near_node last = heap[--*n];
+    size_t i = 0;
+
+    for (;;) {
+        size_t child = 2 * i + 1;
+
+        if (child >= *n) {
+            break;
+        }
+
+        if (child + 1 < *n && heap[child + 1].dist < heap[child].dist) {
+            child++;
+        }
+
+        if (heap[child].dist >= last.dist) {
+            break;
+        }
+
+        heap[i] = heap[child];
+        i = child;
+    }
+
+    if (*n > 0) {
+        heap[i] = last;
+    }
+
+    return top;
+}
+
+
+// Max-heap sift-down for the hits, so the furthest one is on top.
+static void sift_down_hit(near_hit *heap, size_t n, size_t i) {
+    const near_hit h = heap[i];
+
+    for (;;) {
+        size_t child = 2 * i + 1;
+
+        if (child >= n) {
+            break;
+        }
+
+        if (child + 1 < n && heap[child + 1].dist > heap[child].dist) {
+            child++;
+        }
+
+        if (heap[child].dist <= h.dist) {
+            break;
+        }
+
+        heap[i] = heap[child];
+        i = child;
+    }
+
+    heap[i] = h;
+}
+
+
+static void add_hit(near_hit *heap, size_t *n, size_t k, near_hit h) {
+    if (*n < k) {
+        size_t i = (*n)++;
+
+        while (i > 0 && heap[(i - 1) / 2].dist < h.dist) {
+            heap[i] = heap[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+
+        heap[i] = h;
+    } else if (h.dist < heap[0].dist) {
+        heap[0] = h;
+        sift_down_hit(heap, *n, 0);
+    }
+}
+
+
+bool zi_nearest(ZIndex *z, const double point[3], size_t k) {
+    const int dims = z->dims;
+
+    z->nfound = 0;
+
+    if (k > z->len) {
+        k = z->len;
+    }
+
+    if (k == 0) {
+        return true;
+    }
+
+    if (!grow(&z->hits, &z->hits_cap, k, sizeof(near_hit))
+            || !grow((void**)&z->found, &z->found_cap, k, sizeof(uint32_t))) {
+        return false;
+    }
+
+    near_hit *const hits = z->hits;
+    size_t nhits = 0, nnodes = 0;
+
+    const near_node root = { 0, z->levels, { 0, 0, 0 }, 0, z->len };
+
+    if (!heap_push_node(z, &nnodes, root)) {
+        return false;
+    }
+
+    while (nnodes > 0) {
+        const near_node n = heap_pop_node(z->nodes, &nnodes);
+
+        if (nhits == k && n.dist > hits[0].dist) {
+            break;
+        }
+
+        size_t lo = n.lo;
+        const uint64_t base = z->entries[lo].key
+            & ~(((uint64_t)1 << (dims * n.level)) - 1);
+
+        while (lo < n.hi && (n.level == 0 || z->entries[lo].level == n.level)) {
+            const zi_entry *const e = &z->entries[lo];
+            const near_hit h = { box_dist(dims, point, e->min, e->max), e->id };
+
+            add_hit(hits, &nhits, k, h);
+            lo++;
+        }
+
+        if (n.level == 0) {
+            continue;
+        }
+
+        const uint64_t child_span = (uint64_t)1 << (dims * (n.level - 1));
+        const uint32_t half = ((uint32_t)1 << n.level) >> 1;
+
+        unsigned c;
+        for (c = 0; c < (1u << dims) && lo < n.hi; c++) {
+            const size_t end = lower_bound_key(z, lo, n.hi,
+                base + (c + 1) * child_span);
+
+            if (end > lo) {
+                near_node child = { 0, n.level - 1,
+                    { n.node[0], n.node[1], n.node[2] }, lo, end };
+
+                int d;
+                for (d = 0; d < dims; d++) {
+                    child.node[d] += ((c >> d) & 1) * half;
+                }
+
+                child.dist = node_dist(z, point, child.level, child.node);
+
+                if ((nhits < k || child.dist <= hits[0].dist)
+                        && !heap_push_node(z, &nnodes, child)) {
+                    return false;
+                }
+            }
+
+            lo = end;
+        }
+    }
+
+    // Empty the hit heap from the back, furthest first.
+    z->nfound = nhits;
+
+    while (nhits > 0) {
+        z->found[nhits - 1] = hits[0].id;
+        hits[0] = hits[--nhits];
+        sift_down_hit(hits, nhits, 0);
+    }
+
+    return true;
+}
@@ -0,0 +1,482 @@
+--- A LuaJIT FFI front end for the `bitset` module.
+-- Every call into a `lua_CFunction` is a trace exit for LuaJIT, so hot loops
+-- that get and set bits one at a time never get compiled. Requiring
+-- `bitset_ffi` swaps `get`, `set`, `clear`, `count`, `next_set`, `iter` and the
+-- `#` operator on _all_ bitsets for versions written against the FFI, which the
+-- JIT can inline into the surrounding trace. The same goes for `get`, `set`,
+-- `clear`, `eq`, `subset`, `intersects`, `is_disjoint` and the `==` and `<=`
+-- operators on fixed-width bitsets, which makes matching them against each
+-- other, as with component signatures, all compiled code. It also lets
+-- `set_many` and `clear_many` take an FFI buffer of `int32_t` indices as well
+-- as a table.
+--
+-- Nothing else changes: the methods take the same arguments and return the
+-- same results, and anything unusual (growing the bitset, bad arguments) falls
+-- back to the C implementation. On plain Lua, `bitset_ffi` is just `bitset`.
+-- @module bitset_ffi
+
+--- @usage
+local usage = [[
+local bitset = require 'bitset_ffi'
+
+local bs = bitset.new(1024)
+
+for i=0,1023,3 do
+    bs:set(i) -- No C call here.
+end
+]]
+
+require 'bitset'
+
+local bitset = bitset
+
+local has_ffi, ffi = pcall(require, 'ffi')
+
+if not has_ffi then
+    return bitset
+end
+
+local band, bor, bxor, bnot = bit.band, bit.bor, bit.bxor, bit.bnot
+local lshift, tobit = bit.lshift, bit.tobit
+local floor = math.floor
+local error, getmetatable, type, tonumber = error, getmetatable, type, tonumber
+
+-- These have to match `Bitset`, `block_t` and the FFI entry points in
+-- c/inc/bitset.h and c/lib/bitset.c.
+if not pcall(ffi.typeof, 'laser_bitset_t') then
+    ffi.cdef [[
+        typedef struct {
+            uint32_t *bits;
+            size_t len;
+            size_t cap;
+            size_t reallocs;
+            bool ranked;
+            size_t count;
+        } laser_bitset_t;
+
+        size_t laser_bitset_count(laser_bitset_t *bitset);
+        size_t laser_bitset_next_set(const laser_bitset_t *bitset, size_t idx);
+        size_t laser_bitset_set_many(laser_bitset_t *bitset,
+            const int32_t *idx, size_t n);
+        size_t laser_bitset_clear_many(laser_bitset_t *bitset,
+            const int32_t *idx, size_t n);
+    ]]
+end
+
+local BITWIDTH = 32
+
+local cast = ffi.cast
+local bitset_ptr = ffi.typeof('laser_bitset_t *')
+local block_ptr = ffi.typeof('uint32_t *')
+local index_ptr = ffi.typeof('const int32_t *')
+
+local NO_BIT = cast('size_t', -1)
+local NO_COUNT = NO_BIT
+
+-- Bitsets with their blocks inline and on the heap have different metatables,
+-- sharing the same methods.
+local registry = debug.getregistry()
+local mt, inline_mt = registry._bitset_ty, registry._bitset_inline_ty
+local methods = mt.__index
+
+-- Hang on to the C implementations to fall back on. They're stashed in the
+-- metatable so that loading this module twice doesn't wrap our own wrappers.
+local c = mt._c_methods or {
+    get = methods.get, set = methods.set, clear = methods.clear,
+    count = methods.count, next_set = methods.next_set, iter = methods.iter,
+    set_many = methods.set_many, clear_many = methods.clear_many,
+    reserve = methods.reserve,
+}
+
+mt._c_methods = c
+inline_mt._c_methods = c
+
+local c_get, c_set, c_clear = c.get, c.set, c.clear
+local c_count, c_next_set, c_iter = c.count, c.next_set, c.iter
+local c_set_many, c_clear_many, c_reserve = c.set_many, c.clear_many, c.reserve
+
+-- A bitset userdata converts to a pointer to its payload, which is the `Bitset`
+-- struct. The metatable check keeps us from scribbling over some other kind of
+-- userdata; the C functions raise the proper error for those.
+local function is_bitset(bs)
+    local m = getmetatable(bs)
+    return m == inline_mt or m == mt
+end
+
+
+local function is_index(idx)
+    return type(idx) == 'number' and idx >= 0
+end
+
+
+-- Keeps the cached count exact and throws out the rank index when a bit is
+-- flipped, like `bs_flipped` in C.
+local function flipped(bs, delta)
+    bs.ranked = false
+
+    if bs.count ~= NO_COUNT then
+        bs.count = bs.count + delta
+    end
+end
+
+
+function methods.get(self, idx)
+    if is_bitset(self) and is_index(idx) then
+        local bs = cast(bitset_ptr, self)
+        idx = floor(idx)
+
+        local blk = floor(idx / BITWIDTH)
+
+        if blk >= bs.len then
+            return false
+        end
+
+        return band(bs.bits[blk], lshift(1, idx % BITWIDTH)) ~= 0
+    end
+
+    return c_get(self, idx)
+end
+
+
+function methods.set(self, idx)
+    if is_bitset(self) and is_index(idx) then
+        local bs = cast(bitset_ptr, self)
+        idx = floor(idx)
+
+        local blk = floor(idx / BITWIDTH)
+
+        -- Growing the bitset is left to the C side.
+        if blk < bs.len then
+            -- Blocks read as unsigned, but `bit` works in signed numbers.
+            local old = tobit(bs.bits[blk])
+            local new = bor(old, lshift(1, idx % BITWIDTH))
+
+            if new ~= old then
+                bs.bits[blk] = new
+                flipped(bs, 1)
+            end
+
+            return self
+        end
+    end
+
+    return c_set(self, idx)
+end
+
+
+function methods.clear(self, idx)
+    if is_bitset(self) and is_index(idx) then
+        local bs = cast(bitset_ptr, self)
+        idx = floor(idx)
+
+        local blk = floor(idx / BITWIDTH)
+
+        if blk < bs.len then
+            local old = tobit(bs.bits[blk])
+            local new = band(old, bnot(lshift(1, idx % BITWIDTH)))
+
+            if new ~= old then
+                bs.bits[blk] = new
+                flipped(bs, -1)
+            end
+        end
+
+        return self
+    end
+
+    return c_clear(self, idx)
+end
+
+
+-- Fixed-width bitsets are nothing but their 64-bit words, so everything can be
+-- done on them here, reading the words as pairs of blocks. Which bit of which
+-- block an index lands in depends on the byte order, so single bits are left
+-- to C on big-endian machines.
+--
+-- LuaJIT keeps traces per function prototype, so closures shared between the
+-- widths would keep knocking each other's traces out. Instead each width gets
+-- its own copy of the methods, compiled from this template with the loops over
+-- the blocks written out in full: `$|(expr)` is replaced by `expr` for each
+-- block, with `[i]` standing for the block index, all ORed together.
+local fixed_template = [[
+local mt, width, little_endian, fc, is_index, cast, block_ptr,
+    band, bor, bxor, bnot, lshift, floor, getmetatable = ...
+
+local BITWIDTH = 32
+local methods = mt.__index
+
+local function is_fixed(bs)
+    return getmetatable(bs) == mt
+end
+
+local function in_range(idx)
+    return little_endian and is_index(idx) and idx < width
+end
+
+function methods.get(self, idx)
+    if is_fixed(self) and in_range(idx) then
+        idx = floor(idx)
+
+        local bits = cast(block_ptr, self)
+        return band(bits[floor(idx / BITWIDTH)], lshift(1, idx % BITWIDTH)) ~= 0
+    end
+
+    return fc.get(self, idx)
+end
+
+function methods.set(self, idx)
+    if is_fixed(self) and in_range(idx) then
+        idx = floor(idx)
+
+        local bits, blk = cast(block_ptr, self), floor(idx / BITWIDTH)
+        bits[blk] = bor(bits[blk], lshift(1, idx % BITWIDTH))
+
+        return self
+    end
+
+    return fc.set(self, idx)
+end
+
+function methods.clear(self, idx)
+    if is_fixed(self) and in_range(idx) then
+        idx = floor(idx)
+
+        local bits, blk = cast(block_ptr, self), floor(idx / BITWIDTH)
+        bits[blk] = band(bits[blk], bnot(lshift(1, idx % BITWIDTH)))
+
+        return self
+    end
+
+    return fc.clear(self, idx)
+end
+
+function methods.eq(self, other)
+    if is_fixed(self) and is_fixed(other) then
+        local a, b = cast(block_ptr, self), cast(block_ptr, other)
+        return $|(bxor(a[i], b[i])) == 0
+    end
+
+    return fc.eq(self, other)
+end
+
+function methods.subset(self, other)
+    if is_fixed(self) and is_fixed(other) then
+        local a, b = cast(block_ptr, self), cast(block_ptr, other)
+        return $|(band(a[i], bnot(b[i]))) == 0
+    end
+
+    return fc.subset(self, other)
+end
+
+function methods.intersects(self, other)
+    if is_fixed(self) and is_fixed(other) then
+        local a, b = cast(block_ptr, self), cast(block_ptr, other)
+        return $|(band(a[i], b[i])) ~= 0
+    end
+
+    return fc.intersects(self, other)
+end
+
+function methods.is_disjoint(self, other)
+    if is_fixed(self) and is_fixed(other) then
+        local a, b = cast(block_ptr, self), cast(block_ptr, other)
+        return $|(band(a[i], b[i])) == 0
+    end
+
+    return fc.is_disjoint(self, other)
+end
+]]
+
+local little_endian = ffi.abi('le')
+
+local function fixed(width, mt)
+    local methods = mt.__index
+
+    local fc = mt._c_methods or {
+        get = methods.get, set = methods.set, clear = methods.clear,
+        eq = methods.eq, subset = methods.subset,
+        intersects = methods.intersects, is_disjoint = methods.is_disjoint,
+    }
+
+    mt._c_methods = fc
+
+    local source = fixed_template:gsub('%$|(%b())', function(expr)
+        local joined = expr:sub(2, -2):gsub('%[i%]', '[0]')
+
+        for i=1,width / BITWIDTH - 1 do
+            joined = 'bor(' .. joined .. ', ' ..
+                expr:sub(2, -2):gsub('%[i%]', '[' .. i .. ']') .. ')'
+        end
+
+        return joined
+    end)
+
+    local compiled = assert((loadstring or load)(source, '=bitset_ffi fixed' .. width))
+
+    compiled(mt, width, little_endian, fc, is_index, cast, block_ptr,
+        band, bor, bxor, bnot, lshift, floor, getmetatable)
+end
+
+fixed(64, registry._bitset_fixed64_ty)
+fixed(128, registry._bitset_fixed128_ty)
+fixed(256, registry._bitset_fixed256_ty)
+
+-- Lua only calls a comparison metamethod if both operands have the very same
+-- one, so the C module shares its comparisons between all the bitset
+-- metatables. These take their place, going through the methods above when both
+-- operands are fixed-width bitsets of the same width, and to C otherwise.
+local fixed_mts = {
+    [registry._bitset_fixed64_ty] = true,
+    [registry._bitset_fixed128_ty] = true,
+    [registry._bitset_fixed256_ty] = true,
+}
+
+local c_compare = mt._c_compare or { eq = mt.__eq, le = mt.__le }
+mt._c_compare = c_compare
+
+local function compare_eq(a, b)
+    local m = getmetatable(a)
+
+    if fixed_mts[m] and getmetatable(b) == m then
+        return m.__index.eq(a, b)
+    end
+
+    return c_compare.eq(a, b)
+end
+
+local function compare_le(a, b)
+    local m = getmetatable(a)
+
+    if fixed_mts[m] and getmetatable(b) == m then
+        return m.__index.subset(a, b)
+    end
+
+    return c_compare.le(a, b)
+end
+
+for m in pairs(fixed_mts) do
+    m.__eq, m.__le = compare_eq, compare_le
+end
+
+mt.__eq, mt.__le = compare_eq, compare_le
+inline_mt.__eq, inline_mt.__le = compare_eq, compare_le
+
+
+-- The bulk operations stay in C, but calling them through the FFI instead of
+-- the Lua API keeps them inside the trace. That needs the module's own shared
+-- library, which we can only find through `package.searchpath`.
+local lib
+
+if package.searchpath then
+    local path = package.searchpath('bitset', package.cpath)
+
+    if path then
+        local loaded
+        loaded, lib = pcall(ffi.load, path)
+
+        if not loaded then
+            lib = nil
+        end
+    end
+end
+
+if not lib then
+    return bitset
+end
+
+
+function methods.count(self)
+    if is_bitset(self) then
+        local bs = cast(bitset_ptr, self)
+        local n = bs.count
+
+        if n ~= NO_COUNT then
+            return tonumber(n)
+        end
+
+        return tonumber(lib.laser_bitset_count(bs))
+    end
+
+    return c_count(self)
+end
+
+mt.__len = methods.count
+inline_mt.__len = methods.count
+
+
+local function next_set(self, idx)
+    local found = lib.laser_bitset_next_set(cast(bitset_ptr, self), idx)
+
+    if found == NO_BIT then
+        return nil
+    end
+
+    return tonumber(found)
+end
+
+
+function methods.next_set(self, idx)
+    if is_bitset(self) and is_index(idx) then
+        return next_set(self, floor(idx))
+    end
+
+    return c_next_set(self, idx)
+end
+
+
+local function iter_next(self, prev)
+    return next_set(self, prev + 1)
+end
+
+
+function methods.iter(self, from)
+    if is_bitset(self) and (from == nil or is_index(from)) then
+        return iter_next, self, floor(from or 0) - 1
+    end
+
+    return c_iter(self, from)
+end
+
+
+-- An FFI buffer of indices, with the count that has to come with it.
+local function is_buffer(indices, n)
+    return type(indices) == 'cdata' and is_index(n)
+end
+
+
+function methods.set_many(self, indices, n)
+    if is_bitset(self) and is_buffer(indices, n) then
+        local bs, idx = cast(bitset_ptr, self), cast(index_ptr, indices)
+        local need = lib.laser_bitset_set_many(bs, idx, n)
+
+        if need == NO_BIT then
+            error("bad argument #1 to 'set_many' (expected positive indices)", 2)
+        elseif need ~= 0 then
+            -- Growing the blocks is left to the C side, and then they all fit.
+            c_reserve(self, tonumber(need))
+            lib.laser_bitset_set_many(bs, idx, n)
+        end
+
+        return self
+    end
+
+    return c_set_many(self, indices, n)
+end
+
+
+function methods.clear_many(self, indices, n)
+    if is_bitset(self) and is_buffer(indices, n) then
+        local bs, idx = cast(bitset_ptr, self), cast(index_ptr, indices)
+
+        if lib.laser_bitset_clear_many(bs, idx, n) == NO_BIT then
+            error("bad argument #1 to 'clear_many' (expected positive indices)", 2)
+        end
+
+        return self
+    end
+
+    return c_clear_many(self, indices, n)
+end
+
+
+return bitset
@@ -0,0 +1,156 @@
+--- A LuaJIT FFI front end for the `morton` module.
+-- The `_batch` functions in `morton` save a call from Lua per point, but they
+-- still have to go through the Lua API for every table element they read or
+-- write, which costs several times more than the encoding itself. Requiring
+-- `morton_ffi` lets them take FFI arrays instead, which are handed straight to
+-- the C kernels.
+--
+-- Given arrays, each `_batch` function takes its inputs, then its outputs, then
+-- the number of points, and returns the outputs. Coordinates are `uint32_t`;
+-- codes are `uint32_t` for `2_16` and `3_10`, and whole `uint64_t`s (rather
+-- than two halves) for `2_32` and `3_21`. Given tables, they behave exactly as
+-- in `morton`. On plain Lua, `morton_ffi` is just `morton`.
+-- @module morton_ffi
+
+--- @usage
+local usage = [[
+local morton = require 'morton_ffi'
+local ffi = require 'ffi'
+
+local n = 10000
+local xs = ffi.new('uint32_t[?]', n)
+local ys = ffi.new('uint32_t[?]', n)
+local codes = ffi.new('uint32_t[?]', n)
+
+-- ... fill in xs and ys ...
+
+morton.encode2_16_batch(xs, ys, codes, n)
+]]
+
+require 'morton'
+
+local morton = morton
+
+local has_ffi, ffi = pcall(require, 'ffi')
+
+if not has_ffi then
+    return morton
+end
+
+local type = type
+
+-- These have to match the FFI entry points in c/lib/morton.c. Declaring them
+-- twice is an error, which we can ignore if this module is loaded again.
+pcall(ffi.cdef, [[
+    void laser_morton_encode2_16(const uint32_t *x, const uint32_t *y,
+        uint32_t *codes, size_t n);
+    void laser_morton_decode2_16(const uint32_t *codes,
+        uint32_t *x, uint32_t *y, size_t n);
+    void laser_morton_encode2_32(const uint32_t *x, const uint32_t *y,
+        uint64_t *codes, size_t n);
+    void laser_morton_decode2_32(const uint64_t *codes,
+        uint32_t *x, uint32_t *y, size_t n);
+    void laser_morton_encode3_10(const uint32_t *x, const uint32_t *y,
+        const uint32_t *z, uint32_t *codes, size_t n);
+    void laser_morton_decode3_10(const uint32_t *codes,
+        uint32_t *x, uint32_t *y, uint32_t *z, size_t n);
+    void laser_morton_encode3_21(const uint32_t *x, const uint32_t *y,
+        const uint32_t *z, uint64_t *codes, size_t n);
+    void laser_morton_decode3_21(const uint64_t *codes,
+        uint32_t *x, uint32_t *y, uint32_t *z, size_t n);
+]])
+
+-- The entry points live in the module's own shared library, which we can only
+-- find through `package.searchpath`.
+local lib
+
+if package.searchpath then
+    local path = package.searchpath('morton', package.cpath)
+
+    if path then
+        local loaded
+        loaded, lib = pcall(ffi.load, path)
+
+        if not loaded then
+            lib = nil
+        end
+    end
+end
+
+if not lib then
+    return morton
+end
+
+-- Hang on to the table versions to fall back on, stashed in the module so that
+-- loading this twice doesn't wrap our own wrappers. Tables are passed through
+-- positionally, so the argument names below only fit the array versions.
+local c = morton._c_batch or {}
+
+for _,name in ipairs({ '2_16', '2_32', '3_10', '3_21' }) do
+    c['encode' .. name] = c['encode' .. name] or morton['encode' .. name .. '_batch']
+    c['decode' .. name] = c['decode' .. name] or morton['decode' .. name .. '_batch']
+end
+
+morton._c_batch = c
+
+
+local function check_count(n, arg, fname)
+    if type(n) ~= 'number' or n < 0 then
+        error(("bad argument #%d to '%s' (count expected)"):format(arg, fname), 3)
+    end
+end
+
+
+for _,name in ipairs({ '2_16', '2_32' }) do
+    local encode, decode = lib['laser_morton_encode' .. name], lib['laser_morton_decode' .. name]
+    local c_encode, c_decode = c['encode' .. name], c['decode' .. name]
+
+    morton['encode' .. name .. '_batch'] = function(xs, ys, codes, n)
+        if type(xs) == 'cdata' then
+            check_count(n, 4, 'encode' .. name .. '_batch')
+            encode(xs, ys, codes, n)
+            return codes
+        end
+
+        return c_encode(xs, ys, codes, n)
+    end
+
+    morton['decode' .. name .. '_batch'] = function(codes, xs, ys, n)
+        if type(codes) == 'cdata' then
+            check_count(n, 4, 'decode' .. name .. '_batch')
+            decode(codes, xs, ys, n)
+            return xs, ys
+        end
+
+        return c_decode(codes, xs, ys, n)
+    end
+end
+
+
+for _,name in ipairs({ '3_10', '3_21' }) do
+    local encode, decode = lib['laser_morton_encode' .. name], lib['laser_morton_decode' .. name]
+    local c_encode, c_decode = c['encode' .. name], c['decode' .. name]
+
+    morton['encode' .. name .. '_batch'] = function(xs, ys, zs, codes, n)
+        if type(xs) == 'cdata' then
+            check_count(n, 5, 'encode' .. name .. '_batch')
+            encode(xs, ys, zs, codes, n)
+            return codes
+        end
+
+        return c_encode(xs, ys, zs, codes, n)
+    end
+
+    morton['decode' .. name .. '_batch'] = function(codes, xs, ys, zs, n)
+        if type(codes) == 'cdata' then
+            check_count(n, 5, 'decode' .. name .. '_batch')
+            decode(codes, xs, ys, zs, n)
+            return xs, ys, zs
+        end
+
+        return c_decode(codes, xs, ys, zs, n)
+    end
+end
+
+
+return morton
@@ -0,0 +1,143 @@
+--- Shared helpers for the `*_tsc_benchmark.lua` specs.
+-- Timing goes through the `tsc` module when it's built, and falls back on
+-- `os.clock` otherwise.
+--
+-- Results are reported as tab-separated rows, one per measurement, under a
+-- header line, so that runs from two builds can be compared. Rows are printed
+-- prefixed with `BENCH`, and if `LASER_BENCH_OUT` names a file they are also
+-- appended to it without the prefix. Run this file as a script on two such
+-- files to compare them:
+--
+--     luajit spec/bench.lua before.tsv after.tsv
+
+local has_tsc, tsc = pcall(require, 'tsc')
+
+local bench = {}
+
+-- What a row measured, then the measurements themselves. `variant` tells apart
+-- ways of doing the same operation, like a C call and its FFI counterpart.
+bench.COLUMNS = { 'suite', 'op', 'bits', 'density', 'variant', 'kernel',
+    'ns_per_op', 'gb_per_s', 'bytes' }
+
+local MEASUREMENTS = 3
+
+--- Seconds per call of `fn`, over `iterations` calls after a warm-up call.
+-- The loop stays in Lua rather than using `tsc.measure`, since calling back
+-- into Lua from C is expensive under LuaJIT and would swamp quick operations.
+function bench.time(iterations, fn)
+    fn()
+
+    local clock = has_tsc and tsc.now or os.clock
+    local start = clock()
+
+    for i=1,iterations do
+        fn()
+    end
+
+    local elapsed = clock() - start
+
+    return (has_tsc and elapsed / 1e9 or elapsed) / iterations
+end
+
+--- Like `bench.time`, but picks the number of iterations so that the whole
+-- measurement takes about `target` seconds (a twentieth of a second by
+-- default.) Returns seconds per call, and the number of iterations used.
+function bench.auto(fn, target)
+    target = target or 0.05
+
+    local once = bench.time(1, fn)
+    local iterations = math.max(1, math.min(1e7, math.floor(target / math.max(once, 1e-9))))
+
+    return bench.time(iterations, fn), iterations
+end
+
+local out_path = os.getenv('LASER_BENCH_OUT')
+local header_written = false
+
+local function emit(line)
+    print('BENCH\t' .. line)
+
+    if out_path then
+        local f = assert(io.open(out_path, 'a'))
+        f:write(line, '\n')
+        f:close()
+    end
+end
+
+--- Reports one measurement. `row` is keyed by the names in `bench.COLUMNS`;
+-- anything missing is written as `-`. Rows measuring memory rather than time
+-- leave out `ns_per_op` and give `bytes`.
+function bench.record(row)
+    if not header_written then
+        emit(table.concat(bench.COLUMNS, '\t'))
+        header_written = true
+    end
+
+    local fields = {}
+
+    for i,name in ipairs(bench.COLUMNS) do
+        local v = row[name]
+
+        if type(v) == 'number' and (name == 'ns_per_op' or name == 'gb_per_s') then
+            v = string.format('%.4g', v)
+        end
+
+        fields[i] = v == nil and '-' or tostring(v)
+    end
+
+    emit(table.concat(fields, '\t'))
+end
+
+-- Reads a results file into a table of `ns_per_op`s keyed by everything but the
+-- measurements. Rows without one, like memory rows, are left out.
+local function load_results(path)
+    local rows, order = {}, {}
+
+    for line in io.lines(path) do
+        line = line:gsub('^BENCH\t', '')
+
+        local fields = {}
+        for field in line:gmatch('[^\t]+') do
+            fields[#fields + 1] = field
+        end
+
+        local key = table.concat(fields, '\t', 1, #fields - MEASUREMENTS)
+        local ns = tonumber(fields[#fields - MEASUREMENTS + 1])
+
+        if fields[1] ~= bench.COLUMNS[1] and #fields == #bench.COLUMNS and ns then
+            if not rows[key] then
+                order[#order + 1] = key
+            end
+
+            rows[key] = ns
+        end
+    end
+
+    return rows, order
+end
+
+--- Prints the ratio of `ns_per_op` between two results files, slowest
+-- regressions first.
+function bench.compare(before_path, after_path)
+    local before = load_results(before_path)
+    local after, order = load_results(after_path)
+    local diffs = {}
+
+    for _,key in ipairs(order) do
+        if before[key] and before[key] > 0 and after[key] then
+            diffs[#diffs + 1] = { key = key, ratio = after[key] / before[key] }
+        end
+    end
+
+    table.sort(diffs, function(a, b) return a.ratio > b.ratio end)
+
+    for _,d in ipairs(diffs) do
+        print(string.format('%6.2fx\t%s', d.ratio, d.key))
+    end
+end
+
+if arg and arg[0] and arg[0]:match('bench%.lua$') and arg[1] and arg[2] then
+    bench.compare(arg[1], arg[2])
+end
+
+return bench
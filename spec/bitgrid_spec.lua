@@ -0,0 +1,295 @@
+package.path  = './spec/?.lua;./lib/?.lua;;' .. package.path
+
+require 'bitset'
+require 'bitgrid'
+
+local model = require 'model'
+
+-- Odd sizes, so that rows end partway through a block, along with some that
+-- end exactly on one.
+local SIZES = { {1, 1}, {37, 13}, {64, 5}, {100, 40}, {33, 33} }
+
+-- A cell of the model, with `fill` off the grid.
+local function cell(m, x, y, fill)
+    if x < 0 or y < 0 or x >= m.w or y >= m.h then
+        return fill
+    end
+
+    return m[y][x]
+end
+
+local function map_model(m, fn)
+    local out = { w = m.w, h = m.h }
+
+    for y=0,m.h - 1 do
+        out[y] = {}
+
+        for x=0,m.w - 1 do
+            out[y][x] = fn(x, y)
+        end
+    end
+
+    return out
+end
+
+local NEIGHBOURS = {
+    {-1, -1}, {0, -1}, {1, -1}, {-1, 0}, {1, 0}, {-1, 1}, {0, 1}, {1, 1},
+}
+
+local function neighbours(m, x, y, fill)
+    local n = 0
+
+    for _,d in ipairs(NEIGHBOURS) do
+        if cell(m, x + d[1], y + d[2], fill) then n = n + 1 end
+    end
+
+    return n
+end
+
+describe('bitgrid', function()
+    it('should exist', function()
+        assert.is_not_nil(bitgrid)
+        assert.is_not_nil(bitgrid.new)
+    end)
+
+    it('should set, clear, and get correctly', function()
+        local g = bitgrid.new(40, 3)
+
+        assert.are_equal(40, g:width())
+        assert.are_equal(3, g:height())
+        assert.are_equal(0, #g)
+
+        g:set(0, 0):set(39, 0):set(32, 1):set(31, 2)
+
+        assert.is_true(g:get(0, 0))
+        assert.is_true(g:get(39, 0))
+        assert.is_true(g:get(32, 1))
+        assert.is_true(g:get(31, 2))
+        assert.is_false(g:get(1, 0))
+        assert.is_false(g:get(40, 0))
+        assert.is_false(g:get(-1, 0))
+        assert.is_false(g:get(0, 3))
+        assert.are_equal(4, #g)
+
+        g:clear(39, 0)
+        assert.is_false(g:get(39, 0))
+
+        assert.has_error(function() g:set(40, 0) end)
+        assert.has_error(function() g:set(0, -1) end)
+        assert.has_error(function() bitgrid.new(-1, 5) end)
+
+        local ok, err = pcall(bitgrid.new, 2^32, 2^32)
+        assert.is_false(ok)
+        assert.is_not_nil(err:find('4294967296 by 4294967296', 1, true))
+
+        assert.is_true(bitgrid.new(g) == g)
+        assert.is_false(bitgrid.new(g):set(5, 2) == g)
+        assert.is_false(bitgrid.new(40, 4) == bitgrid.new(40, 3))
+    end)
+
+    it('should fill rectangles, clipped to the grid', function()
+        for _,size in ipairs(SIZES) do
+            local m = model.random_grid(size[1], size[2], 0.5)
+            local g = model.from_grid(bitgrid.new, m)
+
+            g:set_rect(-3, 2, 40, 7)
+            g:clear_rect(5, -1, 30, 3)
+
+            model.assert_grid_matches(g, map_model(m, function(x, y)
+                if x >= 5 and x < 35 and y < 2 then return false end
+                if x < 37 and y >= 2 and y < 9 then return true end
+                return m[y][x]
+            end))
+        end
+    end)
+
+    it('should shift correctly', function()
+        for _,size in ipairs(SIZES) do
+            local m = model.random_grid(size[1], size[2], 0.5)
+            local g = model.from_grid(bitgrid.new, m)
+
+            for _,d in ipairs({ {0, 0}, {1, 0}, {-1, 0}, {0, 1}, {0, -1}, {5, -3},
+                    {-33, 2}, {32, 1}, {-64, 0}, {70, 0}, {3, 100} }) do
+                local dx, dy = d[1], d[2]
+                local expected = map_model(m, function(x, y)
+                    return cell(m, x - dx, y - dy, false)
+                end)
+
+                model.assert_grid_matches(g:shift(dx, dy), expected)
+                model.assert_grid_matches(bitgrid.new(g):shift_mut(dx, dy),
+                    expected)
+            end
+
+            model.assert_grid_matches(g, m)
+        end
+    end)
+
+    it('should dilate and erode correctly', function()
+        local ORTHOGONAL = { {0, -1}, {-1, 0}, {1, 0}, {0, 1} }
+
+        for _,size in ipairs(SIZES) do
+            local m = model.random_grid(size[1], size[2], 0.3)
+            local g = model.from_grid(bitgrid.new, m)
+
+            for _,diagonal in ipairs({ true, false }) do
+                local dirs = diagonal and NEIGHBOURS or ORTHOGONAL
+
+                local dilated = map_model(m, function(x, y)
+                    local v = m[y][x]
+                    for _,d in ipairs(dirs) do
+                        v = v or cell(m, x + d[1], y + d[2], false)
+                    end
+                    return v
+                end)
+
+                local eroded = map_model(m, function(x, y)
+                    local v = m[y][x]
+                    for _,d in ipairs(dirs) do
+                        v = v and cell(m, x + d[1], y + d[2], true)
+                    end
+                    return v
+                end)
+
+                model.assert_grid_matches(g:dilate(diagonal), dilated)
+                model.assert_grid_matches(g:erode(diagonal), eroded)
+                model.assert_grid_matches(bitgrid.new(g):dilate_mut(diagonal),
+                    dilated)
+                model.assert_grid_matches(bitgrid.new(g):erode_mut(diagonal),
+                    eroded)
+            end
+        end
+    end)
+
+    it('should step cellular automata correctly', function()
+        local RULES = {
+            { 'B3/S23', { [3] = true }, { [2] = true, [3] = true } },
+            { 'B678/S345678', { [6] = true, [7] = true, [8] = true },
+                { [3] = true, [4] = true, [5] = true, [6] = true, [7] = true, [8] = true } },
+            { 's/b012345678', { [0] = true, [1] = true, [2] = true, [3] = true, [4] = true,
+                [5] = true, [6] = true, [7] = true, [8] = true }, {} },
+        }
+
+        for _,size in ipairs(SIZES) do
+            local m = model.random_grid(size[1], size[2], 0.45)
+            local g = model.from_grid(bitgrid.new, m)
+
+            for _,rule in ipairs(RULES) do
+                for _,edge in ipairs({ false, true }) do
+                    local expected = map_model(m, function(x, y)
+                        local n = neighbours(m, x, y, edge)
+                        if m[y][x] then return rule[3][n] == true end
+                        return rule[2][n] == true
+                    end)
+
+                    model.assert_grid_matches(g:step(rule[1], edge), expected)
+                    model.assert_grid_matches(bitgrid.new(g):step_mut(rule[1], edge),
+                        expected)
+                end
+            end
+        end
+
+        -- A glider comes back where it started, shifted, after four steps.
+        local glider = bitgrid.new(10, 10)
+        glider:set(1, 0):set(2, 1):set(0, 2):set(1, 2):set(2, 2)
+
+        local moved = bitgrid.new(glider)
+        for i=1,4 do moved:step_mut('B3/S23') end
+
+        assert.is_true(moved == glider:shift(1, 1))
+
+        assert.has_error(function() glider:step('3/23') end)
+        assert.has_error(function() glider:step('B9/S23') end)
+    end)
+
+    it('should blit rectangles correctly', function()
+        local OPS = {
+            { 'blit', function(d, s) return s end },
+            { 'blit_and', function(d, s) return d and s end },
+            { 'blit_or', function(d, s) return d or s end },
+            { 'blit_andnot', function(d, s) return d and not s end },
+            { 'blit_xor', function(d, s) return d ~= s end },
+        }
+
+        local RECTS = {
+            { 0, 0, 0, 0, 100, 100 }, { 3, 2, 1, 1, 10, 5 }, { -5, -2, 0, 0, 40, 9 },
+            { 30, 1, -4, 3, 20, 20 }, { 33, 0, 31, 2, 35, 4 }, { 2, 3, 60, 30, 50, 50 },
+        }
+
+        for _,ds in ipairs(SIZES) do
+            for _,ss in ipairs(SIZES) do
+                local md = model.random_grid(ds[1], ds[2], 0.5)
+                local ms = model.random_grid(ss[1], ss[2], 0.5)
+                local src = model.from_grid(bitgrid.new, ms)
+
+                for _,op in ipairs(OPS) do
+                    for _,r in ipairs(RECTS) do
+                        local x, y, sx, sy, w, h = unpack(r)
+
+                        local expected = map_model(md, function(cx, cy)
+                            local u, v = cx - x + sx, cy - y + sy
+
+                            if cx >= x and cy >= y and cx < x + w and cy < y + h and
+                                    u >= 0 and v >= 0 and u < ss[1] and v < ss[2] and
+                                    u >= sx and v >= sy then
+                                return op[2](md[cy][cx], ms[v][u])
+                            end
+
+                            return md[cy][cx]
+                        end)
+
+                        local g = model.from_grid(bitgrid.new, md)
+                        model.assert_grid_matches(g[op[1]](g, src, x, y, sx, sy, w, h),
+                            expected)
+                    end
+                end
+            end
+        end
+    end)
+
+    it('should blit a grid onto itself', function()
+        local m = model.random_grid(70, 30, 0.5)
+
+        for _,r in ipairs({ {5, 3, 0, 0}, {0, 0, 5, 3}, {40, 1, 3, 2}, {1, 20, 33, 0} }) do
+            local x, y, sx, sy = unpack(r)
+            local g = model.from_grid(bitgrid.new, m)
+
+            local expected = map_model(m, function(cx, cy)
+                local u, v = cx - x + sx, cy - y + sy
+
+                if cx >= x and cy >= y and u < 70 and v < 30 then
+                    return m[v][u]
+                end
+
+                return m[cy][cx]
+            end)
+
+            model.assert_grid_matches(g:blit(g, x, y, sx, sy), expected)
+        end
+    end)
+
+    it('should convert to and from flat bitsets', function()
+        for _,size in ipairs(SIZES) do
+            local w, h = size[1], size[2]
+            local m = model.random_grid(w, h, 0.5)
+            local g = model.from_grid(bitgrid.new, m)
+            local bs = g:to_bitset()
+
+            for y=0,h - 1 do
+                for x=0,w - 1 do
+                    assert.are_equal(m[y][x], bs:get(y * w + x))
+                end
+            end
+
+            assert.are_equal(g:count(), bs:count())
+            assert.is_true(bitgrid.from_bitset(bs, w, h) == g)
+        end
+
+        -- Extra bits are ignored, and missing ones are clear.
+        local bs = bitset.new():set(3):set(12):set(100)
+        local g = bitgrid.from_bitset(bs, 5, 4)
+
+        assert.is_true(g:get(3, 0))
+        assert.is_true(g:get(2, 2))
+        assert.are_equal(2, g:count())
+    end)
+end)
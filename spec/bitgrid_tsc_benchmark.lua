@@ -0,0 +1,95 @@
+package.path  = './spec/?.lua;./lib/?.lua;;' .. package.path
+
+require 'bitset'
+require 'bitgrid'
+
+-- Times the whole-grid operations on tile-map sized grids, and compares an
+-- automaton step against doing it cell by cell on a flat bitset with
+-- `y * w + x` indexing.
+
+local bench = require 'bench'
+local time = bench.time
+
+local function random_grid(w, h, density)
+    local g = bitgrid.new(w, h)
+
+    for y=0,h - 1 do
+        for x=0,w - 1 do
+            if math.random() < density then g:set(x, y) end
+        end
+    end
+
+    return g
+end
+
+-- B678/S345678 on a flat bitset, one cell at a time, with cells off the grid
+-- counting as set.
+local function flat_step(bs, w, h)
+    local out = bitset.new(w * h)
+
+    for y=0,h - 1 do
+        for x=0,w - 1 do
+            local n = 0
+
+            for dy=-1,1 do
+                for dx=-1,1 do
+                    if dx ~= 0 or dy ~= 0 then
+                        local cx, cy = x + dx, y + dy
+
+                        if cx < 0 or cy < 0 or cx >= w or cy >= h or bs:get(cy * w + cx) then
+                            n = n + 1
+                        end
+                    end
+                end
+            end
+
+            if n >= 6 or (n >= 3 and bs:get(y * w + x)) then
+                out:set(y * w + x)
+            end
+        end
+    end
+
+    return out
+end
+
+local OPS = {
+    { 'step', function(g) return g:step_mut('B678/S345678', true) end },
+    { 'dilate', function(g) return g:dilate_mut() end },
+    { 'erode', function(g) return g:erode_mut() end },
+    { 'shift', function(g) return g:shift_mut(3, -2) end },
+    { 'blit_or', function(g, src) return g:blit_or(src, 17, 9) end },
+    { 'count', function(g) return g:count() end },
+}
+
+describe('bitgrid', function()
+    for _,size in ipairs({ 256, 1024 }) do
+        it('should be word-parallel at ' .. size .. 'x' .. size, function()
+            local g = random_grid(size, size, 0.45)
+            local src = random_grid(size / 2, size / 2, 0.5)
+
+            for _,op in ipairs(OPS) do
+                local name, fn = op[1], op[2]
+                local t = time(20, function() return fn(g, src) end)
+
+                bench.record { suite = 'bitgrid', op = name, bits = size * size,
+                    density = 0.45, ns_per_op = t * 1e9 }
+            end
+        end)
+    end
+
+    it('should beat stepping a flat bitset cell by cell', function()
+        local w, h = 256, 256
+        local g = random_grid(w, h, 0.45)
+        local bs = g:to_bitset()
+
+        assert.is_true(flat_step(bs, w, h) == g:step('B678/S345678', true):to_bitset())
+
+        local t_flat = time(2, function() return flat_step(bs, w, h) end)
+        local t_grid = time(50, function() return g:step('B678/S345678', true) end)
+
+        bench.record { suite = 'bitgrid', op = 'step', bits = w * h,
+            density = 0.45, variant = 'flat', ns_per_op = t_flat * 1e9 }
+        bench.record { suite = 'bitgrid', op = 'step', bits = w * h,
+            density = 0.45, variant = 'grid', ns_per_op = t_grid * 1e9 }
+    end)
+end)
@@ -0,0 +1,208 @@
+package.path  = './spec/?.lua;./lib/?.lua;;' .. package.path
+
+local bitset = require 'bitset_ffi'
+
+describe('bitset_ffi', function()
+    it('should exist', function()
+        assert.is_not_nil(bitset)
+        assert.is_not_nil(bitset.new)
+    end)
+
+    it('should get, set, and clear correctly', function()
+        local a = bitset.new(64)
+
+        assert.is_false(a:get(0))
+
+        a:set(0)
+        a:set(31)
+        a:set(32)
+
+        assert.are_equal(1 + 2^31, a:dump_raw(0))
+        assert.are_equal(1, a:dump_raw(1))
+
+        assert.is_true(a:get(0))
+        assert.is_true(a:get(31))
+        assert.is_true(a:get(32))
+        assert.is_false(a:get(33))
+        assert.is_false(a:get(100000))
+
+        a:clear(31)
+        a:clear(100000)
+
+        assert.is_false(a:get(31))
+        assert.is_true(a:get(32))
+    end)
+
+    it('should grow when setting bits out of range', function()
+        local a = bitset.new()
+
+        a:set(1000)
+
+        assert.is_true(a:get(1000))
+        assert.is_false(a:get(999))
+        assert.are_equal(1, a:count())
+        assert.are_equal(1, #a)
+    end)
+
+    it('should return the bitset for chaining', function()
+        local a = bitset.new(64)
+
+        assert.are_equal(a, a:set(1):clear(2):set(3))
+        assert.are_equal(2, a:count())
+    end)
+
+    it('should keep the count up to date', function()
+        local a = bitset.new(64)
+
+        assert.are_equal(0, #a)
+
+        a:set(31)
+        a:set(31)
+        a:set(63)
+        a:clear(0)
+
+        assert.are_equal(2, a:count())
+
+        a:clear(31)
+        a:clear(31)
+
+        assert.are_equal(1, #a)
+
+        a:set_range(0, 10)
+        a:set(5)
+
+        assert.are_equal(11, #a)
+    end)
+
+    it('should keep rank and select up to date', function()
+        local a = bitset.new(10000)
+
+        a:set(5000)
+
+        assert.are_equal(1, a:rank(6000))
+        assert.are_equal(5000, a:select(0))
+
+        a:set(100)
+        a:clear(5000)
+
+        assert.are_equal(1, a:rank(6000))
+        assert.are_equal(100, a:select(0))
+        assert.is_nil(a:select(1))
+    end)
+
+    it('should raise the same errors as the C methods', function()
+        local a = bitset.new(64)
+
+        assert.has_error(function() a:get(-1) end)
+        assert.has_error(function() a:set(-1) end)
+        assert.has_error(function() a:clear(-1) end)
+        assert.has_error(function() a:set('nope') end)
+        assert.has_error(function() a.set(io.stdout, 1) end)
+    end)
+
+    it('should iterate and search correctly', function()
+        local a = bitset.new()
+        local expected = {}
+
+        for i=1,100 do
+            a:set(math.random(0, 10000))
+        end
+
+        for i=0,10000 do
+            if a:get(i) then
+                table.insert(expected, i)
+            end
+        end
+
+        local seen = {}
+
+        for i in a:iter() do
+            table.insert(seen, i)
+        end
+
+        assert.are_same(expected, seen)
+        assert.are_equal(expected[1], a:next_set(0))
+        assert.is_nil(a:next_set(expected[#expected] + 1))
+        assert.are_equal(#expected, a:count())
+    end)
+
+    it('should set and clear buffers of indices', function()
+        local has_ffi, ffi = pcall(require, 'ffi')
+
+        if not has_ffi then
+            return
+        end
+
+        local a, b = bitset.new(), bitset.new()
+        local buf = ffi.new('int32_t[?]', 300)
+
+        for i=0,299 do
+            buf[i] = math.random(0, 20000)
+            b:set(buf[i])
+        end
+
+        a:set_many(buf, 300)
+
+        assert.is_true(a == b)
+        assert.are_equal(b:count(), #a)
+
+        a:clear_many(buf, 100)
+
+        for i=0,99 do
+            b:clear(buf[i])
+        end
+
+        assert.is_true(a == b)
+        assert.are_equal(b:count(), #a)
+
+        -- Tables still go to the C methods.
+        a:set_many({ 3, 7 })
+
+        assert.is_true(a:get(3) and a:get(7))
+
+        buf[0] = -1
+
+        assert.has_error(function() a:set_many(buf, 1) end)
+        assert.has_error(function() a:clear_many(buf, 1) end)
+    end)
+
+    it('should work with fixed-width bitsets', function()
+        for _,width in ipairs({ 64, 128, 256 }) do
+            local a, b = bitset.fixed(width), bitset.fixed(width)
+            local ga, gb = bitset.new(), bitset.new()
+
+            for i=1,width / 4 do
+                local x, y = math.random(0, width - 1), math.random(0, width - 1)
+                a:set(x); ga:set(x)
+                b:set(y); gb:set(y)
+            end
+
+            a:set(width - 1):set(31):clear(0)
+            ga:set(width - 1):set(31):clear(0)
+
+            for i=0,width - 1 do
+                assert.are_equal(ga:get(i), a:get(i))
+            end
+
+            assert.is_true(a:eq(ga))
+            assert.are_equal(ga == gb, a == b)
+            assert.is_true(a == bitset.fixed(width, ga))
+            assert.is_true(a * b <= a)
+            assert.is_true(a <= a + b)
+            assert.are_equal(ga <= gb, a <= b)
+            assert.are_equal(ga:intersects(gb), a:intersects(b))
+            assert.are_equal(ga:is_disjoint(gb), a:is_disjoint(b))
+            assert.is_true(a:subset(ga + gb))
+
+            -- Comparisons with bitsets and other widths go through C.
+            assert.is_true(a == ga)
+            assert.is_true(ga == a)
+            assert.is_true(a <= ga + gb)
+            assert.is_true(ga * gb <= a)
+            assert.is_true(bitset.fixed(256, a) == a)
+
+            assert.has_error(function() a:set(width) end)
+            assert.has_error(function() a:get(-1) end)
+        end
+    end)
+end)
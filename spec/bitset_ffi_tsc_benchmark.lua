@@ -0,0 +1,40 @@
+package.path  = './spec/?.lua;./lib/?.lua;;' .. package.path
+
+local bitset = require 'bitset_ffi'
+
+-- Compares single-bit access through the FFI front end against the plain
+-- `lua_CFunction` methods it replaces.
+
+local bench = require 'bench'
+local time = bench.time
+
+describe('bitset_ffi', function()
+    it('should be faster than calling into C', function()
+        local nbits = 1024 * 1024
+        local a = bitset.new(nbits)
+
+        local mt = getmetatable(a)
+        local ffi_methods, c_methods = mt.__index, mt._c_methods
+
+        for _,name in ipairs({ 'set', 'get', 'clear' }) do
+            local ffi_fn, c_fn = ffi_methods[name], c_methods[name]
+
+            local function loop(fn)
+                return function()
+                    for i=0,nbits - 1,7 do
+                        fn(a, i)
+                    end
+                end
+            end
+
+            local per = math.ceil(nbits / 7)
+            local t_c = time(10, loop(c_fn)) / per
+            local t_ffi = time(10, loop(ffi_fn)) / per
+
+            bench.record { suite = 'bitset_ffi', op = name, bits = nbits,
+                variant = 'c', ns_per_op = t_c * 1e9 }
+            bench.record { suite = 'bitset_ffi', op = name, bits = nbits,
+                variant = 'ffi', ns_per_op = t_ffi * 1e9 }
+        end
+    end)
+end)
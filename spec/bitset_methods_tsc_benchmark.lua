@@ -0,0 +1,327 @@
+package.path  = './spec/?.lua;./lib/?.lua;;' .. package.path
+
+require 'bitset'
+
+local bench = require 'bench'
+
+-- Times every bitset method at sizes from one word to 64 Mbit, over sparse,
+-- half-full and dense bitsets, with whichever kernels are selected by default.
+-- Bulk operations also report throughput: the number of bytes of bitset read,
+-- divided by the time taken.
+--
+-- Results are recorded through `bench.record`, so they can be compared across
+-- builds with spec/bench.lua.
+
+local SIZES = { 64, 4096, 256 * 1024, 16 * 1024 * 1024, 64 * 1024 * 1024 }
+
+local DENSITIES = {
+    { 'sparse', 0.001 },
+    { 'half', 0.5 },
+    { 'dense', 0.999 },
+}
+
+-- Single-bit operations are run over this many random indices per call, to
+-- keep the timing overhead out of the numbers.
+local BATCH = 1024
+
+-- The methods as implemented in C; `bitset_ffi` replaces some of them, and it's
+-- only used here to build big bitsets quickly.
+local C = {}
+
+for name,fn in pairs(getmetatable(bitset.new()).__index) do
+    C[name] = fn
+end
+
+local has_ffi, ffi = pcall(require, 'ffi')
+
+if has_ffi then
+    require 'bitset_ffi'
+end
+
+local function random_bitset(nbits, density)
+    local bs = bitset.new(nbits - 1)
+
+    if has_ffi and density == 0.5 then
+        local raw = ffi.cast('laser_bitset_t *', bs)
+
+        for i=0,tonumber(raw.len) - 1 do
+            raw.bits[i] = math.random(0, 0xFFFF) * 0x10000 + math.random(0, 0xFFFF)
+        end
+
+        -- Writing the blocks behind the module's back leaves its cached count
+        -- and rank index wrong, so they have to be thrown out.
+        raw.count = ffi.cast('size_t', -1)
+        raw.ranked = false
+
+        return bs
+    end
+
+    if density > 0.5 then
+        bs:set_range(0, nbits)
+
+        for i=1,math.floor(nbits * (1 - density)) do
+            bs:clear(math.random(0, nbits - 1))
+        end
+    elseif density < 0.5 then
+        for i=1,math.max(1, math.floor(nbits * density)) do
+            bs:set(math.random(0, nbits - 1))
+        end
+    else
+        for i=0,nbits - 1 do
+            if math.random() < density then
+                bs:set(i)
+            end
+        end
+    end
+
+    return bs
+end
+
+-- Each entry is { name, fn(ctx), operations per call, bytes read per call }.
+-- Operations per call may be 'visited', meaning one per set bit iterated over,
+-- or 'counted', meaning one per bit set in `a`.
+--
+-- Every method is here apart from `sync`, which only applies to mapped files
+-- and would time the disk rather than the bitset.
+-- `ctx` has two random bitsets `a` and `b`, `same` equal to `a`, `a` serialized
+-- in both encodings as `raw` and `rle`, a scratch bitset `work` for the mutating
+-- methods, random indices `idx`, and random ranks of bits set in `a`, `ranks`.
+local function ops(nbits)
+    local bytes = nbits / 8
+
+    local function each_index(method)
+        return function(ctx)
+            local idx, work = ctx.idx, ctx.work
+
+            for i=1,BATCH do
+                method(work, idx[i])
+            end
+        end
+    end
+
+    return {
+        { 'new', function(ctx) return bitset.new(nbits - 1) end, 1, bytes },
+        { 'new_copy', function(ctx) return bitset.new(ctx.a) end, 1, bytes },
+        { 'set', each_index(C.set), BATCH },
+        -- Sets increasing bits in an empty bitset, so that it has to keep
+        -- growing.
+        { 'set_grow', function(ctx)
+            local bs, step = bitset.new(), nbits / BATCH
+
+            for i=0,BATCH - 1 do
+                C.set(bs, i * step)
+            end
+        end, BATCH },
+        { 'clear', each_index(C.clear), BATCH },
+        { 'get', each_index(C.get), BATCH },
+        { 'set_many', function(ctx) C.set_many(ctx.work, ctx.idx) end, BATCH },
+        { 'clear_many', function(ctx) C.clear_many(ctx.work, ctx.idx) end, BATCH },
+        { 'get_many', function(ctx) return C.get_many(ctx.a, ctx.idx) end, BATCH },
+        { 'set_range', function(ctx) C.set_range(ctx.work, 0, nbits) end, 1, bytes },
+        { 'clear_range', function(ctx) C.clear_range(ctx.work, 0, nbits) end, 1, bytes },
+        { 'get_range', function(ctx)
+            local idx, a = ctx.idx, ctx.a
+
+            for i=1,BATCH do
+                C.get_range(a, idx[i], idx[i] + 63)
+            end
+        end, BATCH },
+        { 'next_set', each_index(C.next_set), BATCH },
+        { 'prev_set', each_index(C.prev_set), BATCH },
+        { 'next_clear', each_index(C.next_clear), BATCH },
+        { 'find_first_clear', function(ctx) return C.find_first_clear(ctx.a) end, 1 },
+        -- From random indices, for runs of a few lengths. Dense bitsets make
+        -- these scan a long way.
+        { 'find_clear_run_4', function(ctx)
+            local idx, a = ctx.idx, ctx.a
+
+            for i=1,BATCH do
+                C.find_clear_run(a, 4, idx[i])
+            end
+        end, BATCH },
+        { 'find_clear_run_100', function(ctx)
+            local idx, a = ctx.idx, ctx.a
+
+            for i=1,BATCH do
+                C.find_clear_run(a, 100, idx[i])
+            end
+        end, BATCH },
+        -- Fills the scratch bitset from the front, one slot at a time.
+        { 'acquire_run', function(ctx)
+            local work = ctx.work
+
+            for i=1,BATCH do
+                C.acquire_run(work, 1)
+            end
+        end, BATCH },
+        -- Per set bit visited, up to `BATCH` of them; iterating over every bit of
+        -- the biggest bitsets would take far too long.
+        { 'iter', function(ctx)
+            local n = 0
+
+            for i in C.iter(ctx.a) do
+                n = n + 1
+
+                if n == BATCH then
+                    break
+                end
+            end
+        end, 'visited' },
+        { 'to_indices', function(ctx) return C.to_indices(ctx.a) end, 'counted' },
+        -- The count is cached, so this only counts on the first call. Set
+        -- and clear keep it up to date, but ranges throw it out.
+        { 'count', function(ctx) return C.count(ctx.a) end, 1 },
+        { 'count_after_set', function(ctx)
+            local work = ctx.work
+            C.set(work, 0)
+            C.clear(work, 0)
+            return C.count(work)
+        end, 1 },
+        { 'count_after_range', function(ctx)
+            local work = ctx.work
+            C.set_range(work, 0, 1)
+            return C.count(work)
+        end, 1, bytes },
+        -- Against an unchanging bitset, so after the first call the index
+        -- is already built.
+        { 'rank', function(ctx)
+            local idx, a = ctx.idx, ctx.a
+
+            for i=1,BATCH do
+                C.rank(a, idx[i])
+            end
+        end, BATCH },
+        { 'select', function(ctx)
+            local a, ranks = ctx.a, ctx.ranks
+
+            for i=1,BATCH do
+                C.select(a, ranks[i])
+            end
+        end, BATCH },
+        { 'intersection', function(ctx) return C.intersection(ctx.a, ctx.b) end, 1, 2 * bytes },
+        { 'intersection_mut', function(ctx) C.intersection_mut(ctx.work, ctx.b) end, 1, 2 * bytes },
+        { 'union', function(ctx) return C.union(ctx.a, ctx.b) end, 1, 2 * bytes },
+        { 'union_mut', function(ctx) C.union_mut(ctx.work, ctx.b) end, 1, 2 * bytes },
+        { 'difference', function(ctx) return C.difference(ctx.a, ctx.b) end, 1, 2 * bytes },
+        { 'difference_mut', function(ctx) C.difference_mut(ctx.work, ctx.b) end, 1, 2 * bytes },
+        { 'symmetric_diff', function(ctx) return C.symmetric_diff(ctx.a, ctx.b) end, 1, 2 * bytes },
+        { 'symmetric_diff_mut', function(ctx) C.symmetric_diff_mut(ctx.work, ctx.b) end, 1, 2 * bytes },
+        { 'intersection_into', function(ctx) C.intersection_into(ctx.work, ctx.a, ctx.b) end, 1, 2 * bytes },
+        { 'union_into', function(ctx) C.union_into(ctx.work, ctx.a, ctx.b) end, 1, 2 * bytes },
+        { 'difference_into', function(ctx) C.difference_into(ctx.work, ctx.a, ctx.b) end, 1, 2 * bytes },
+        { 'symmetric_diff_into', function(ctx) C.symmetric_diff_into(ctx.work, ctx.a, ctx.b) end, 1, 2 * bytes },
+        { 'intersection_count', function(ctx) return C.intersection_count(ctx.a, ctx.b) end, 1, 2 * bytes },
+        { 'union_count', function(ctx) return C.union_count(ctx.a, ctx.b) end, 1, 2 * bytes },
+        { 'difference_count', function(ctx) return C.difference_count(ctx.a, ctx.b) end, 1, 2 * bytes },
+        { 'symmetric_diff_count', function(ctx) return C.symmetric_diff_count(ctx.a, ctx.b) end, 1, 2 * bytes },
+        { 'jaccard', function(ctx) return C.jaccard(ctx.a, ctx.b) end, 1, 4 * bytes },
+        -- Stops at the first block in common, which comes early for all but the
+        -- sparsest bitsets.
+        { 'intersects', function(ctx) return C.intersects(ctx.a, ctx.b) end, 1 },
+        { 'is_disjoint', function(ctx) return C.is_disjoint(ctx.a, ctx.b) end, 1 },
+        -- Against an equal bitset, so these can't stop early.
+        { 'eq', function(ctx) return ctx.a == ctx.same end, 1, 2 * bytes },
+        { 'subset', function(ctx) return ctx.a <= ctx.same end, 1, 2 * bytes },
+        { 'strict_subset', function(ctx) return ctx.a < ctx.same end, 1, 2 * bytes },
+        { 'hash', function(ctx) return C.hash(ctx.a) end, 1, bytes },
+        -- Into an empty bitset, so that every call allocates.
+        { 'reserve', function(ctx) C.reserve(bitset.new(), nbits - 1) end, 1, bytes },
+        -- Has to reserve first to have anything to give back, so this includes
+        -- the time for `reserve` above.
+        { 'shrink_to_fit', function(ctx)
+            local bs = bitset.new()
+            C.reserve(bs, nbits - 1)
+            C.set(bs, 0)
+            C.shrink_to_fit(bs)
+        end, 1, bytes },
+        { 'capacity', function(ctx)
+            local a = ctx.a
+
+            for i=1,BATCH do
+                C.capacity(a)
+            end
+        end, BATCH },
+        { 'reallocations', function(ctx)
+            local a = ctx.a
+
+            for i=1,BATCH do
+                C.reallocations(a)
+            end
+        end, BATCH },
+        { 'dump_raw', function(ctx)
+            local a = ctx.a
+
+            for i=0,BATCH - 1 do
+                C.dump_raw(a, i % 2)
+            end
+        end, BATCH },
+        { 'to_bytes', function(ctx) return C.to_bytes(ctx.a) end, 1, bytes },
+        { 'to_bytes_rle', function(ctx) return C.to_bytes(ctx.a, 'rle') end, 1, bytes },
+        { 'from_bytes', function(ctx) return bitset.from_bytes(ctx.raw) end, 1, bytes },
+        { 'from_bytes_rle', function(ctx) return bitset.from_bytes(ctx.rle, 'rle') end, 1, bytes },
+        { 'dump_len', function(ctx)
+            local a = ctx.a
+
+            for i=1,BATCH do
+                C.dump_len(a)
+            end
+        end, BATCH },
+    }
+end
+
+describe('bitset methods', function()
+    local kernel = bitset.kernel()
+
+    for _,nbits in ipairs(SIZES) do
+        for _,density in ipairs(DENSITIES) do
+            local dname, p = density[1], density[2]
+
+            it('should be timed at ' .. nbits .. ' bits, ' .. dname, function()
+                local ctx = {
+                    a = random_bitset(nbits, p),
+                    b = random_bitset(nbits, p),
+                    idx = {},
+                }
+
+                ctx.same = bitset.new(ctx.a)
+                ctx.raw = C.to_bytes(ctx.a)
+                ctx.rle = C.to_bytes(ctx.a, 'rle')
+
+                ctx.ranks = {}
+
+                for i=1,BATCH do
+                    ctx.idx[i] = math.random(0, nbits - 1)
+                    ctx.ranks[i] = math.random(0, C.count(ctx.a) - 1)
+                end
+
+                for _,op in ipairs(ops(nbits)) do
+                    local name, fn, per_call, bytes = op[1], op[2], op[3], op[4]
+
+                    ctx.work = bitset.new(ctx.a)
+
+                    if per_call == 'visited' then
+                        per_call = math.min(BATCH, C.count(ctx.a))
+                    elseif per_call == 'counted' then
+                        per_call = math.max(1, C.count(ctx.a))
+                    end
+
+                    -- Don't make quick operations pay for collecting the
+                    -- results of the slow ones.
+                    collectgarbage()
+
+                    local seconds = bench.auto(function() return fn(ctx) end)
+
+                    bench.record {
+                        suite = 'bitset',
+                        op = name,
+                        bits = nbits,
+                        density = dname,
+                        kernel = kernel,
+                        ns_per_op = seconds / per_call * 1e9,
+                        gb_per_s = bytes and bytes / seconds / 1e9,
+                    }
+                end
+            end)
+        end
+    end
+end)
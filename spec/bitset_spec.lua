@@ -508,4 +508,1044 @@ describe('bitset', function()
         assert.is_true(a <= b)
         assert.is_true(a < b)
     end)
+
+    it('should copy without modifying the source', function()
+        local a = bitset.new()
+        a:set(3)
+        a:set(100)
+
+        local b = bitset.new(a)
+
+        assert.is_true(a:get(3))
+        assert.is_true(a:get(100))
+        assert.is_true(b:get(3))
+        assert.is_true(b:get(100))
+        assert.are_equal(2, b:count())
+    end)
+
+    it('should give the same results with every kernel', function()
+        local default = bitset.kernel()
+        local _, available = bitset.kernel()
+
+        -- Odd sizes, so that the vector kernels have leftover blocks to deal
+        -- with, and operands of different lengths.
+        for _,sizes in ipairs({ {1, 1}, {37, 5}, {300, 301}, {1000, 70}, {61, 999} }) do
+            local a = bitset.new(sizes[1] * 32)
+            local b = bitset.new(sizes[2] * 32)
+
+            for i=1,sizes[1] * 8 do
+                a:set(math.random(0, sizes[1] * 32 - 1))
+            end
+
+            for i=1,sizes[2] * 8 do
+                b:set(math.random(0, sizes[2] * 32 - 1))
+            end
+
+            local maxbit = math.max(sizes[1], sizes[2]) * 32
+
+            for _,name in ipairs(available) do
+                bitset.kernel(name)
+
+                local u, n, d, x = a + b, a * b, a - b, a:symmetric_diff(b)
+                local um, nm = bitset.new(a):union_mut(b), bitset.new(a):intersection_mut(b)
+                local dm, xm = bitset.new(a):difference_mut(b), bitset.new(a):symmetric_diff_mut(b)
+
+                local count = 0
+
+                for i=0,maxbit do
+                    local ai, bi = a:get(i), b:get(i)
+
+                    if ai then count = count + 1 end
+
+                    assert.are_equal(ai or bi, u:get(i))
+                    assert.are_equal(ai and bi, n:get(i))
+                    assert.are_equal(ai and not bi, d:get(i))
+                    assert.are_equal(ai ~= bi, x:get(i))
+                    assert.are_equal(ai or bi, um:get(i))
+                    assert.are_equal(ai and bi, nm:get(i))
+                    assert.are_equal(ai and not bi, dm:get(i))
+                    assert.are_equal(ai ~= bi, xm:get(i))
+                end
+
+                -- Into a fresh bitset, a recycled one, and each operand.
+                for _,into in ipairs({ 'union', 'intersection', 'difference', 'symmetric_diff' }) do
+                    local expected = a[into](a, b)
+                    local out = bitset.new(5000)
+                    out:set(4999)
+
+                    assert.is_true(expected == bitset[into .. '_into'](bitset.new(), a, b))
+                    assert.is_true(expected == out[into .. '_into'](out, a, b))
+                    assert.is_true(expected == bitset[into .. '_into'](bitset.new(a), bitset.new(a), b))
+                    assert.is_true(expected == bitset[into .. '_into'](bitset.new(b), a, bitset.new(b)))
+
+                    local a2, b2 = bitset.new(a), bitset.new(b)
+                    assert.is_true(expected == bitset[into .. '_into'](a2, a2, b))
+                    assert.is_true(expected == bitset[into .. '_into'](b2, a, b2))
+                end
+
+                local same = bitset.new(a)
+                assert.is_true(a == bitset.union_into(same, same, same))
+                assert.are_equal(0, bitset.difference_into(same, same, same):count())
+
+                assert.are_equal(count, a:count())
+                assert.are_equal(u:count(), a:union_count(b))
+                assert.are_equal(n:count(), a:intersection_count(b))
+                assert.are_equal(d:count(), a:difference_count(b))
+                assert.are_equal(x:count(), a:symmetric_diff_count(b))
+                assert.are_equal(n:count() > 0, a:intersects(b))
+                assert.are_equal(n:count() / u:count(), a:jaccard(b))
+                assert.is_true(a == bitset.new(a))
+                assert.is_false(a == b)
+                assert.is_true(n <= a)
+                assert.is_true(a <= u)
+                assert.is_false(u <= n)
+                assert.is_true(d <= a)
+                assert.is_false(a < a)
+            end
+        end
+
+        bitset.kernel(default)
+    end)
+
+    it('should give the same results split across threads', function()
+        local threads, min_bits = bitset.threads()
+
+        -- Big enough for plenty of chunks, with ragged ends.
+        local a, b = bitset.new(), bitset.new()
+
+        for i=1,3000 do
+            local lo = math.random(0, 3200000)
+            a:set_range(lo, lo + math.random(0, 2000))
+            b:set(math.random(0, 2400000))
+        end
+
+        local function results()
+            -- Decoded from bytes, so that nothing's count is cached.
+            local ca, cb = bitset.from_bytes(a:to_bytes()), bitset.from_bytes(b:to_bytes())
+
+            return {
+                (ca + cb):to_bytes(), (ca * cb):to_bytes(), (ca - cb):to_bytes(),
+                (cb - ca):to_bytes(), ca:symmetric_diff(cb):to_bytes(),
+                bitset.new(ca):union_mut(cb):to_bytes(),
+                bitset.new(ca):intersection_mut(cb):to_bytes(),
+                ca:count(), cb:count(), ca:union_count(cb), ca:intersection_count(cb),
+                ca:difference_count(cb), ca:symmetric_diff_count(cb),
+                ca == cb, ca == bitset.new(ca), ca * cb <= ca, ca <= ca * cb,
+                ca:intersects(cb), bitset.new(ca):clear_range(0, 2^22) == bitset.new(),
+            }
+        end
+
+        bitset.threads(1)
+        local serial = results()
+
+        assert.are_equal(4, bitset.threads(4, 0))
+        assert.are_same(serial, results())
+
+        -- Changing the number of threads restarts the workers.
+        bitset.threads(3)
+        assert.are_same(serial, results())
+
+        assert.has_error(function() bitset.threads(0) end)
+        assert.has_error(function() bitset.threads(2, -1) end)
+
+        bitset.threads(threads, min_bits)
+    end)
+
+    it('should count and test overlap without allocating', function()
+        local a, b = bitset.new(), bitset.new(1000)
+
+        assert.are_equal(0, a:union_count(b))
+        assert.are_equal(1, a:jaccard(b))
+        assert.is_false(a:intersects(b))
+        assert.is_true(a:is_disjoint(b))
+
+        a:set_range(0, 100)
+        b:set_range(50, 150)
+        b:set(999)
+
+        assert.are_equal(50, a:intersection_count(b))
+        assert.are_equal(50, b:intersection_count(a))
+        assert.are_equal(151, a:union_count(b))
+        assert.are_equal(50, a:difference_count(b))
+        assert.are_equal(51, b:difference_count(a))
+        assert.are_equal(101, a:symmetric_diff_count(b))
+        assert.are_equal(50 / 151, a:jaccard(b))
+        assert.are_equal(1, a:jaccard(bitset.new(a)))
+        assert.is_true(a:intersects(b))
+        assert.is_false(a:is_disjoint(b))
+
+        b:clear_range(0, 100)
+
+        assert.is_false(a:intersects(b))
+        assert.is_false(b:intersects(a))
+        assert.is_true(a:is_disjoint(b))
+        assert.are_equal(0, a:jaccard(b))
+    end)
+
+    it('should grow geometrically and keep its capacity', function()
+        local a = bitset.new()
+
+        for i=0,100000 do
+            a:set(i)
+        end
+
+        assert.are_equal(100001, a:count())
+        assert.is_true(a:capacity() >= 100001)
+        assert.is_true(a:reallocations() <= 20)
+
+        -- Shrinking and growing back doesn't need to reallocate, and the
+        -- blocks it grows back into are clear.
+        local cap, n = a:capacity(), a:reallocations()
+
+        a:intersection_mut(bitset.new(10, true))
+        a:set(cap - 1)
+
+        assert.are_equal(cap, a:capacity())
+        assert.are_equal(n, a:reallocations())
+        assert.are_equal(11, a:count())
+
+        a:union_mut(bitset.new(cap - 1, true))
+        a:symmetric_diff_mut(bitset.new(cap - 1, true))
+
+        assert.are_equal(1, a:count())
+        assert.are_equal(n, a:reallocations())
+    end)
+
+    it('should reserve and shrink to fit', function()
+        local a = bitset.new()
+
+        a:reserve(100000)
+
+        local n = a:reallocations()
+        assert.is_true(a:capacity() >= 100000)
+
+        for i=0,99999,7 do
+            a:set(i)
+        end
+
+        a:set_range(50000, 99999)
+
+        assert.are_equal(n, a:reallocations())
+
+        a:clear_range(1000, 100000)
+        a:shrink_to_fit()
+
+        assert.is_true(a:capacity() < 1100)
+        assert.are_equal(n + 1, a:reallocations())
+        assert.are_equal(994, a:next_set(990))
+        assert.is_nil(a:next_set(1000))
+        assert.are_equal(143, a:count())
+
+        a:set(5000)
+        assert.is_true(a:get(5000))
+        assert.is_false(a:get(4999))
+
+        assert.has_error(function() a:reserve(-1) end)
+    end)
+
+    it('should keep small bitsets inline until they grow', function()
+        local a = bitset.new(255)
+
+        assert.are_equal(256, a:capacity())
+
+        a:set(0)
+        a:set_range(200, 255)
+        a:set(255)
+
+        assert.are_equal(0, a:reallocations())
+
+        a:set(1000)
+
+        assert.are_equal(1, a:reallocations())
+        assert.are_equal(58, a:count())
+        assert.is_true(a:get(255))
+
+        -- Moving back inline keeps the bits.
+        a:clear(1000)
+        a:shrink_to_fit()
+
+        assert.are_equal(2, a:reallocations())
+        assert.are_equal(256, a:capacity())
+        assert.are_equal(57, a:count())
+        assert.is_true(a:get(0))
+        assert.is_true(a:get(255))
+        assert.is_false(a:get(1000))
+
+        local copy = bitset.new(a)
+
+        assert.is_true(copy == a)
+
+        copy:set(100000)
+
+        assert.is_false(a:get(100000))
+        assert.is_true(copy:get(100000))
+
+        -- Inline and heap bitsets work together.
+        assert.is_true(a <= copy)
+        assert.is_true(a < copy)
+        assert.is_false(a == copy)
+        assert.are_equal(58, #(a + copy))
+        assert.are_equal(57, #(copy * a))
+        assert.are_equal(1, #(copy - a))
+    end)
+
+    it('should make bitsets in an arena and empty them on reset', function()
+        local arena = bitset.arena()
+
+        local a = arena:new(10000)
+        local b = arena:new(10000, true)
+        local small = arena:new(63)
+        local heap = bitset.new(10000)
+
+        assert.is_true(arena:memory() >= 2 * 10000 / 8)
+        assert.are_equal(10000, b:count())
+
+        a:set(5)
+        a:set(20000)
+        small:set(1)
+        heap:set_range(0, 100)
+
+        assert.is_true(a:get(5))
+        assert.is_true(a:get(20000))
+        assert.are_equal(2, a:count())
+        assert.are_equal(1, (a * b):count())
+        assert.are_equal(100, #(heap * b))
+        assert.are_equal(1, a:reallocations())
+
+        local copy = arena:new(a)
+        assert.is_true(copy == a)
+
+        local memory = arena:memory()
+
+        arena:reset()
+
+        assert.are_equal(0, a:count())
+        assert.are_equal(0, b:count())
+        assert.are_equal(0, copy:count())
+        assert.is_false(a:get(5))
+        assert.are_equal(1, small:count())
+
+        -- Stale bitsets can go on being used.
+        a:set(123456)
+        assert.is_true(a:get(123456))
+        assert.are_equal(1, a:count())
+
+        -- The arena's memory gets reused.
+        for i=1,10 do
+            arena:new(10000):set_range(0, 10000)
+        end
+
+        assert.are_equal(memory, arena:memory())
+
+        assert.has_error(function() arena:new(-1) end)
+    end)
+
+    it('should find next and previous set bits correctly', function()
+        local a = bitset.new()
+
+        assert.is_nil(a:next_set(0))
+        assert.is_nil(a:prev_set(100))
+
+        a:set(5)
+        a:set(31)
+        a:set(32)
+        a:set(1000)
+
+        assert.are_equal(5, a:next_set(0))
+        assert.are_equal(5, a:next_set(5))
+        assert.are_equal(31, a:next_set(6))
+        assert.are_equal(32, a:next_set(32))
+        assert.are_equal(1000, a:next_set(33))
+        assert.is_nil(a:next_set(1001))
+        assert.is_nil(a:next_set(100000))
+
+        assert.is_nil(a:prev_set(4))
+        assert.are_equal(5, a:prev_set(5))
+        assert.are_equal(5, a:prev_set(30))
+        assert.are_equal(31, a:prev_set(31))
+        assert.are_equal(32, a:prev_set(999))
+        assert.are_equal(1000, a:prev_set(1000))
+        assert.are_equal(1000, a:prev_set(100000))
+    end)
+
+    it('should find next clear bits correctly', function()
+        local a = bitset.new()
+
+        assert.are_equal(0, a:next_clear(0))
+        assert.are_equal(77, a:next_clear(77))
+
+        a:set_range(0, 70)
+        a:clear(40)
+
+        assert.are_equal(40, a:next_clear(0))
+        assert.are_equal(70, a:next_clear(41))
+        assert.are_equal(90, a:next_clear(90))
+
+        a:set_range(0, 96)
+
+        assert.are_equal(96, a:next_clear(0))
+    end)
+
+    it('should find runs of clear bits correctly', function()
+        local a = bitset.new()
+
+        assert.are_equal(0, a:find_first_clear())
+        assert.are_equal(0, a:find_clear_run(100))
+        assert.are_equal(77, a:find_clear_run(5, 77))
+        assert.has_error(function() a:find_clear_run(0) end)
+        assert.has_error(function() a:find_clear_run(1, -1) end)
+
+        a:set_range(0, 100)
+        a:clear_range(10, 13)
+        a:clear_range(40, 80)
+
+        assert.are_equal(10, a:find_first_clear())
+        assert.are_equal(10, a:find_clear_run(3))
+        assert.are_equal(40, a:find_clear_run(4))
+        assert.are_equal(11, a:find_clear_run(2, 11))
+        assert.are_equal(40, a:find_clear_run(40))
+        assert.are_equal(100, a:find_clear_run(41))
+
+        -- Against a plain scan, on random maps with runs of every length.
+        for trial=1,20 do
+            local nbits = math.random(1, 600)
+            local b = bitset.new()
+
+            for i=0,nbits - 1 do
+                if math.random() < trial / 20 then
+                    b:set(i)
+                end
+            end
+
+            for n=1,70,3 do
+                local from = math.random(0, nbits)
+                local expected = from
+
+                for i=from,from + nbits + n do
+                    if b:get(i) then
+                        expected = i + 1
+                    elseif i - expected + 1 >= n then
+                        break
+                    end
+                end
+
+                assert.are_equal(expected, b:find_clear_run(n, from))
+            end
+        end
+    end)
+
+    it('should acquire runs of clear bits correctly', function()
+        local a = bitset.new(63)
+
+        for i=0,63 do
+            assert.are_equal(i, a:acquire_run(1))
+        end
+
+        assert.are_equal(64, a:count())
+
+        a:clear_range(20, 25)
+        a:clear(30)
+
+        assert.are_equal(20, a:acquire_run(3))
+        assert.are_equal(64, a:acquire_run(3))
+        assert.are_equal(23, a:acquire_run(2))
+        assert.are_equal(30, a:acquire_run(1))
+        assert.are_equal(67, a:acquire_run(100, 40))
+
+        assert.are_equal(167, a:count())
+        assert.are_equal(167, a:find_first_clear())
+        assert.is_true(a:get(166))
+    end)
+
+    it('should serialize to bytes correctly', function()
+        local a = bitset.new(1000)
+
+        assert.are_equal('', a:to_bytes())
+        assert.are_equal('', a:to_bytes('rle'))
+
+        a:set(0)
+        a:set(9)
+
+        -- Little-endian bytes, with the trailing zeroes left off.
+        assert.are_equal('\1\2', a:to_bytes())
+
+        a:set_range(300, 310)
+
+        -- Gap, then run length, for each run; the gap of 290 takes two bytes.
+        assert.are_equal('\0\1\8\1\162\2\10', a:to_bytes('rle'))
+
+        assert.is_true(bitset.from_bytes(a:to_bytes()) == a)
+        assert.is_true(bitset.from_bytes(a:to_bytes('rle'), 'rle') == a)
+        assert.are_equal(0, bitset.from_bytes(''):count())
+
+        assert.has_error(function() a:to_bytes('zip') end)
+        assert.has_error(function() bitset.from_bytes('\128', 'rle') end)
+        assert.has_error(function() bitset.from_bytes('\5', 'rle') end)
+
+        -- A gap of 2^64 - 6 bits, which leaves no room to round up to blocks.
+        local huge = '\250\255\255\255\255\255\255\255\255\1\1'
+        assert.has_error(function() bitset.from_bytes(huge, 'rle') end)
+
+        for trial=1,20 do
+            local b = bitset.new()
+            local p = trial / 20
+
+            for i=0,math.random(0, 3000) do
+                if math.random() < p then
+                    b:set(i)
+                end
+            end
+
+            local raw, rle = b:to_bytes(), b:to_bytes('rle')
+            local c, d = bitset.from_bytes(raw), bitset.from_bytes(rle, 'rle')
+
+            assert.is_true(c == b)
+            assert.is_true(d == b)
+            assert.are_equal(b:count(), c:count())
+            assert.are_equal(raw, d:to_bytes())
+            assert.are_equal(rle, c:to_bytes('rle'))
+        end
+    end)
+
+    it('should map files into memory correctly', function()
+        local path = os.tmpname()
+        os.remove(path)
+
+        local a = bitset.mmap(path, 1000)
+
+        assert.are_equal(32, a:dump_len())
+        assert.are_equal(0, a:count())
+
+        a:set(3)
+        a:set_range(100, 200)
+        a:sync()
+
+        local f = assert(io.open(path, 'rb'))
+        local contents = f:read('*a')
+        f:close()
+
+        assert.are_equal(128, #contents)
+        assert.are_equal(a:to_bytes(), contents:gsub('%z+$', ''))
+
+        -- Growing the bitset grows the file.
+        a:set(5000)
+        a:sync()
+
+        local b = bitset.mmap(path, nil, 'r')
+
+        assert.is_true(b == a)
+        assert.are_equal(102, b:count())
+
+        -- Read-only bitsets can be changed, but the file can't.
+        b:clear(3)
+        b:set(100000)
+
+        assert.is_false(b:get(3))
+        assert.is_true(b:get(100000))
+        assert.is_true(a:get(3))
+        assert.are_equal(102, bitset.mmap(path, nil, 'r'):count())
+        assert.has_error(function() b:sync() end)
+        assert.has_error(function() bitset.new():sync() end)
+
+        -- Existing files are opened as they are.
+        a = nil
+        b = nil
+        collectgarbage()
+
+        local c = bitset.mmap(path, 10)
+
+        assert.are_equal(102, c:count())
+        assert.is_true(c:get(5000))
+
+        c = nil
+        collectgarbage()
+        os.remove(path)
+
+        -- Files written by `to_bytes` can end partway through a block, and
+        -- get filled out to whole blocks so that no writes are lost.
+        f = assert(io.open(path, 'wb'))
+        f:write(bitset.new():set(3):set(33):to_bytes())
+        f:close()
+
+        local d = bitset.mmap(path)
+        d:set(50)
+        d:sync()
+        d = nil
+        collectgarbage()
+
+        d = bitset.mmap(path, nil, 'r')
+        assert.is_true(d:get(3) and d:get(33) and d:get(50))
+        assert.are_equal(3, d:count())
+        d = nil
+        collectgarbage()
+        os.remove(path)
+
+        -- Room for exactly as many bits as asked for, in whole blocks.
+        bitset.mmap(path, 32):sync()
+        collectgarbage()
+
+        f = assert(io.open(path, 'rb'))
+        assert.are_equal(4, #f:read('*a'))
+        f:close()
+        os.remove(path)
+
+        assert.has_error(function() bitset.mmap(path, nil, 'r') end)
+        assert.has_error(function() bitset.mmap(path, 10, 'x') end)
+    end)
+
+    it('should keep its count up to date', function()
+        local function recount(b)
+            local n = 0
+
+            for _ in b:iter() do
+                n = n + 1
+            end
+
+            return n
+        end
+
+        local a = bitset.new(100, true)
+
+        assert.are_equal(100, a:count())
+
+        for i=1,2000 do
+            local idx = math.random(0, 300)
+
+            if math.random() < 0.5 then
+                a:set(idx)
+            else
+                a:clear(idx)
+            end
+
+            if i % 100 == 0 then
+                assert.are_equal(recount(a), a:count())
+            end
+        end
+
+        a:set_range(50, 400)
+        assert.are_equal(recount(a), #a)
+
+        a:set(50)
+        a:clear(1000)
+        assert.are_equal(recount(a), #a)
+
+        a:symmetric_diff_mut(bitset.new(500, true))
+        assert.are_equal(recount(a), #a)
+
+        local b = bitset.new(a)
+        b:set(1000)
+
+        assert.are_equal(recount(a) + 1, #b)
+
+        local before = recount(a)
+        a:acquire_run(10)
+
+        assert.are_equal(before + 10, #a)
+        assert.is_true(a < bitset.new(a):set(5000))
+        assert.are_equal(recount(a * b), #(a * b))
+    end)
+
+    it('should rank and select correctly', function()
+        local a = bitset.new()
+
+        assert.are_equal(0, a:rank(0))
+        assert.are_equal(0, a:rank(1000))
+        assert.is_nil(a:select(0))
+        assert.has_error(function() a:rank(-1) end)
+        assert.has_error(function() a:select(-1) end)
+
+        -- Short bitsets go without the index, long ones with it, in the heap
+        -- and in an arena.
+        local arena = bitset.arena()
+
+        for _,nbits in ipairs({ 300, 20000 }) do
+            for _,b in ipairs({ bitset.new(nbits), arena:new(nbits) }) do
+                local set = {}
+
+                for i=1,nbits / 10 do
+                    b:set(math.random(0, nbits))
+                end
+
+                for i in b:iter() do
+                    table.insert(set, i)
+                end
+
+                for k,i in ipairs(set) do
+                    assert.are_equal(k - 1, b:rank(i))
+                    assert.are_equal(k, b:rank(i + 1))
+                    assert.are_equal(i, b:select(k - 1))
+                end
+
+                assert.are_equal(#set, b:rank(nbits * 2))
+                assert.is_nil(b:select(#set))
+
+                -- Changing the bitset throws the index out.
+                b:clear(set[1])
+                b:set_range(nbits + 1, nbits + 65)
+
+                assert.are_equal(0, b:rank(set[1]))
+                assert.are_equal(set[2], b:select(0))
+                assert.are_equal(#set - 1, b:rank(nbits + 1))
+                assert.are_equal(#set + 63, b:rank(nbits * 2))
+                assert.are_equal(nbits + 64, b:select(#set + 62))
+
+                b:union_mut(bitset.new(1, true))
+
+                assert.are_equal(0, b:select(0))
+            end
+        end
+    end)
+
+    it('should set, clear, and get arrays of indices correctly', function()
+        local a = bitset.new()
+        local indices = {}
+
+        for i=1,1000 do
+            indices[i] = math.random(0, 50000)
+        end
+
+        a:set_many(indices)
+
+        local b = bitset.new()
+
+        for _,i in ipairs(indices) do
+            b:set(i)
+        end
+
+        assert.is_true(a == b)
+        assert.are_equal(b:count(), #a)
+        assert.are_equal(1, a:reallocations())
+
+        local got = a:get_many({ indices[1], 50001, 10^9 })
+
+        assert.are_same({ true, false, false }, got)
+
+        local members = a:to_indices()
+        local expected = {}
+
+        for i in b:iter() do
+            table.insert(expected, i)
+        end
+
+        assert.are_same(expected, members)
+        assert.is_true(bitset.from_indices(members) == b)
+        assert.are_equal(#members, #bitset.from_indices(indices))
+
+        a:clear_many(indices, 500)
+
+        for i=1,500 do
+            b:clear(indices[i])
+        end
+
+        assert.is_true(a == b)
+        assert.are_equal(b:count(), a:count())
+        assert.are_same(a:to_indices(), b:to_indices())
+
+        assert.are_same({}, bitset.new(100):to_indices())
+        assert.are_equal(0, #bitset.from_indices({}))
+
+        -- Nothing is set if any of the indices is bad.
+        assert.has_error(function() a:set_many({ 1, 2, -3 }) end)
+        assert.has_error(function() a:set_many({ 1, 'nope' }) end)
+        assert.has_error(function() a:clear_many({ -1 }) end)
+        assert.has_error(function() bitset.from_indices(5) end)
+        assert.are_same(b:to_indices(), a:to_indices())
+    end)
+
+    it('should work with fixed-width bitsets', function()
+        assert.are_equal(64, bitset.fixed(1):width())
+        assert.are_equal(64, bitset.fixed(64):width())
+        assert.are_equal(128, bitset.fixed(65):width())
+        assert.are_equal(256, bitset.fixed(256):width())
+        assert.has_error(function() bitset.fixed(257) end)
+
+        for _,width in ipairs({ 64, 128, 256 }) do
+            local a, b = bitset.fixed(width), bitset.fixed(width)
+            local ga, gb = bitset.new(), bitset.new()
+
+            for i=1,width / 4 do
+                local x, y = math.random(0, width - 1), math.random(0, width - 1)
+                a:set(x); ga:set(x)
+                b:set(y); gb:set(y)
+            end
+
+            a:set(width - 1):clear(0)
+            ga:set(width - 1):clear(0)
+
+            assert.is_true(a:get(width - 1))
+            assert.is_false(a:get(0))
+            assert.are_equal(ga:count(), #a)
+            assert.has_error(function() a:set(width) end)
+            assert.has_error(function() a:get(-1) end)
+
+            assert.is_true((a + b):eq(ga + gb))
+            assert.is_true((a * b):eq(ga * gb))
+            assert.is_true((a - b):eq(ga - gb))
+            assert.is_true(a:symmetric_diff(b):eq(ga:symmetric_diff(gb)))
+            assert.is_true(bitset.fixed(width, a):union_mut(b) == a + b)
+            assert.is_true(bitset.fixed(width, a):intersection_mut(b) == a * b)
+            assert.is_true(bitset.fixed(width, a):difference_mut(b) == a - b)
+            assert.is_true(bitset.fixed(width, a):symmetric_diff_mut(b) ==
+                a:symmetric_diff(b))
+
+            -- Generic bitsets work as the second operand, and back again.
+            assert.is_true((a + gb) == a + b)
+            assert.is_true(a:eq(ga))
+            assert.is_true(a:to_bitset() == ga)
+            assert.is_true(bitset.new(a) == ga)
+            assert.is_true(bitset.fixed(width, ga) == a)
+
+            assert.is_true(a * b <= a)
+            assert.is_true(a <= a + b)
+            assert.are_equal(a:intersects(b), ga:intersects(gb))
+            assert.are_equal(a:is_disjoint(b), ga:is_disjoint(gb))
+            assert.are_equal(not (a + b == a), a < a + b)
+            assert.is_false(a < a)
+            assert.is_true(a:subset(ga))
+
+            local seen = {}
+
+            for i in a:iter() do
+                table.insert(seen, i)
+            end
+
+            assert.are_same(ga:to_indices(), seen)
+        end
+
+        -- Mixing widths works in the width of the bitset called on.
+        local small, big = bitset.fixed(64):set(3), bitset.fixed(256):set(3)
+
+        assert.is_true(small:eq(big))
+        assert.is_true(small:subset(big))
+        assert.is_true(big:subset(small))
+
+        big:set(200)
+
+        assert.is_false(small:eq(big))
+        assert.is_true(small:subset(big))
+        assert.is_true((small * big):eq(small))
+        assert.has_error(function() small:union(big) end)
+        assert.has_error(function() bitset.fixed(64, bitset.new():set(64)) end)
+        assert.has_error(function() small:union('nope') end)
+    end)
+
+    it('should take fixed-width bitsets as operands of bitsets', function()
+        for _,width in ipairs({ 64, 128, 256 }) do
+            local g = bitset.new():set(1):set(width - 1):set(1000)
+            local f = bitset.fixed(width):set(1):set(2)
+            local gf = f:to_bitset()
+
+            assert.is_true(g:union(f) == g + gf)
+            assert.is_true(g * f == g * gf)
+            assert.is_true(g - f == g - gf)
+            assert.is_true(g:symmetric_diff(f) == g:symmetric_diff(gf))
+            assert.is_true(g:intersects(f))
+            assert.is_false(g:is_disjoint(f))
+            assert.are_equal(4, g:union_count(f))
+            assert.are_equal(1, g:intersection_count(f))
+            assert.are_equal(0.25, g:jaccard(f))
+
+            assert.is_true(bitset.new(g):union_mut(f) == g + gf)
+            assert.is_true(bitset.union_into(bitset.new(), f, g) == g + gf)
+            assert.is_true(bitset.intersection_into(bitset.new(), f, f) == gf)
+            assert.is_true(bitset.difference_into(bitset.new(), g, f) == g - gf)
+
+            -- The comparisons work both ways round, and between widths.
+            assert.is_true(gf == f)
+            assert.is_true(f == gf)
+            assert.is_true(gf <= f)
+            assert.is_true(f <= gf + g)
+            assert.is_true(f < gf + g)
+            assert.is_false(gf + g <= f)
+            assert.is_false(g == f)
+            assert.is_true(bitset.fixed(256, f) == f)
+            assert.is_true(bitset.fixed(64, f) <= bitset.fixed(256, f):set(100))
+        end
+
+        assert.has_error(function() bitset.new():union('nope') end)
+    end)
+
+    it('should iterate over set bits in order', function()
+        local a = bitset.new()
+        local expected = {}
+
+        for i=1,200 do
+            a:set(math.random(0, 100000))
+        end
+
+        for i=0,100000 do
+            if a:get(i) then
+                table.insert(expected, i)
+            end
+        end
+
+        local seen = {}
+
+        for i in a:iter() do
+            table.insert(seen, i)
+        end
+
+        assert.are_same(expected, seen)
+
+        local from = expected[50]
+        local n = 0
+
+        for i in a:iter(from) do
+            n = n + 1
+            assert.are_equal(expected[49 + n], i)
+        end
+
+        assert.are_equal(#expected - 49, n)
+
+        for i in bitset.new():iter() do
+            assert.is_true(false)
+        end
+    end)
+
+    it('should hash and map bitsets by their contents', function()
+        local a = bitset.new(64):set(3):set(40)
+        local b = bitset.new(1024):set(3):set(40)
+        local f = bitset.fixed(256, a)
+
+        assert.are_equal(a:hash(), b:hash())
+        assert.are_equal(a:hash(), f:hash())
+        assert.are_equal(bitset.new():hash(), bitset.new(4096):hash())
+        assert.are_not_equal(a:hash(), bitset.new():set(3):hash())
+
+        local m = bitset.map()
+
+        assert.are_equal(m, m:set(a, 'a'))
+        assert.are_equal('a', m:get(b))
+        assert.are_equal('a', m:get(f))
+        assert.is_nil(m:get(bitset.new():set(3)))
+
+        -- Keys are copied, so changing one doesn't move its entry.
+        a:set(41)
+        assert.is_nil(m:get(a))
+        assert.are_equal('a', m:get(b))
+
+        m:set(bitset.fixed(64, b), 'b')
+        assert.are_equal(1, m:count())
+        assert.are_equal('b', m:get(b))
+
+        m:set(b, nil)
+        assert.are_equal(0, #m)
+        assert.is_nil(m:get(b))
+
+        local model = {}
+
+        for i=1,2000 do
+            local key = bitset.new():set(math.random(0, 40)):set(math.random(0, 300))
+            local bytes = key:to_bytes():gsub('%z+$', '')
+
+            if math.random() < 0.3 then
+                m:set(key, nil)
+                model[bytes] = nil
+            else
+                m:set(key, i)
+                model[bytes] = i
+            end
+        end
+
+        local n = 0
+
+        for key, value in m:iter() do
+            n = n + 1
+            assert.are_equal(model[key:to_bytes():gsub('%z+$', '')], value)
+        end
+
+        for _ in pairs(model) do
+            n = n - 1
+        end
+
+        assert.are_equal(0, n)
+
+        m:clear()
+        assert.are_equal(0, m:count())
+        assert.has_error(function() m:get('nope') end)
+    end)
+
+    it('should match signature tables against queries', function()
+        local default = bitset.kernel()
+        local _, available = bitset.kernel()
+
+        for _,width in ipairs({ 64, 128, 256 }) do
+            local t = bitset.signature_table(width)
+            local rows = {}
+
+            assert.are_equal(width, t:width())
+
+            -- Enough rows for the vector kernels to have a ragged end.
+            for i=1,1000 do
+                local row = bitset.fixed(width)
+
+                for j=1,6 do
+                    row:set(math.random(0, 15) * (width / 16))
+                end
+
+                rows[i] = row
+                assert.are_equal(i - 1, t:add(row))
+            end
+
+            assert.are_equal(1000, #t)
+            assert.is_true(t:get(10) == rows[11])
+
+            local all = bitset.new():set(0)
+            local none = bitset.fixed(width):set(width / 2)
+            local any = bitset.new():set(width / 16):set(width - width / 16)
+
+            for _,name in ipairs(available) do
+                bitset.kernel(name)
+
+                local matched = t:match(all, none, any)
+                local indices, n = t:match(all, none, any, { 'stale', 'stale', 'stale' })
+                local expected = {}
+
+                for i,row in ipairs(rows) do
+                    local wanted = bitset.new(row:to_bitset())
+                    local ok = all <= wanted and not wanted:get(width / 2) and
+                        (wanted:get(width / 16) or wanted:get(width - width / 16))
+
+                    assert.are_equal(ok, matched:get(i - 1))
+
+                    if ok then
+                        table.insert(expected, i - 1)
+                    end
+                end
+
+                assert.are_same(expected, indices)
+                assert.are_equal(#expected, n)
+                assert.are_equal(#expected, matched:count())
+
+                -- Without `any`, only `all` and `none` count.
+                local out = bitset.new(100000):set(99999)
+                assert.are_equal(out, t:match(all, nil, nil, out))
+                assert.is_false(out:get(99999))
+
+                for i,row in ipairs(rows) do
+                    assert.are_equal(row:get(0), out:get(i - 1))
+                end
+            end
+
+            bitset.kernel(default)
+
+            local last = t:get(999)
+            assert.are_equal(999, t:remove(5))
+            assert.is_true(t:get(5) == last)
+            assert.is_nil(t:remove(998))
+            assert.are_equal(998, t:count())
+
+            t:set(0, bitset.new())
+            assert.are_equal(998, select(2, t:match(nil, nil, nil, {})))
+            assert.is_false(t:match(all):get(0))
+
+            assert.has_error(function() t:add(bitset.new():set(width)) end)
+            assert.has_error(function() t:get(998) end)
+            assert.has_error(function() t:match('nope') end)
+
+            t:clear()
+            assert.are_equal(0, t:count())
+            assert.are_equal(0, t:match():count())
+        end
+    end)
 end)
@@ -0,0 +1,477 @@
+package.path  = './spec/?.lua;./lib/?.lua;;' .. package.path
+
+require 'bitset'
+
+-- Times every set-algebra operation with each of the available kernels, and
+-- the other bitset features against the ways they replace. Results are
+-- recorded through `bench.record`, so they can be compared across builds with
+-- spec/bench.lua.
+
+local SIZES = { 64 * 1024, 1024 * 1024 }
+
+local function random_bitset(nbits, density)
+    local bs = bitset.new(nbits)
+
+    for i=0,nbits - 1 do
+        if math.random() < density then
+            bs:set(i)
+        end
+    end
+
+    return bs
+end
+
+local bench = require 'bench'
+local time = bench.time
+
+local OPS = {
+    { 'union', function(a, b) return a:union(b) end },
+    { 'union_mut', function(a, b) return a:union_mut(b) end },
+    { 'intersection', function(a, b) return a:intersection(b) end },
+    { 'intersection_mut', function(a, b) return a:intersection_mut(b) end },
+    { 'difference', function(a, b) return a:difference(b) end },
+    { 'difference_mut', function(a, b) return a:difference_mut(b) end },
+    { 'symmetric_diff', function(a, b) return a:symmetric_diff(b) end },
+    { 'symmetric_diff_mut', function(a, b) return a:symmetric_diff_mut(b) end },
+    { 'eq', function(a, b) return a == b end },
+    { 'subset', function(a, b) return a <= b end },
+    { 'count', function(a, b) return a:count() end },
+}
+
+describe('bitset kernels', function()
+    local default, available = bitset.kernel()
+
+    for _,nbits in ipairs(SIZES) do
+        it('should be faster than scalar at ' .. nbits .. ' bits', function()
+            local a = random_bitset(nbits, 0.5)
+            -- Equal bitsets, so that `eq` and `subset` have to look at every
+            -- block instead of bailing out early.
+            local b = bitset.new(a)
+
+            local iterations = math.max(1, math.floor(64 * 1024 * 1024 / nbits))
+
+            for _,op in ipairs(OPS) do
+                local name, fn = op[1], op[2]
+
+                for _,kernel in ipairs(available) do
+                    bitset.kernel(kernel)
+
+                    -- The `_mut` operations are idempotent on these operands,
+                    -- so it's fine to run them over and over on `a`.
+                    local t = time(iterations, function() fn(a, b) end)
+
+                    bench.record {
+                        suite = 'bitset kernels',
+                        op = name,
+                        bits = nbits,
+                        density = 'half',
+                        kernel = kernel,
+                        ns_per_op = t * 1e9,
+                    }
+                end
+            end
+
+            bitset.kernel(default)
+        end)
+    end
+end)
+
+describe('bitset iteration', function()
+    it('should cost about as much as there are set bits', function()
+        local nbits = 100000
+        local a = bitset.new(nbits)
+
+        for i=1,50 do
+            a:set(math.random(0, nbits - 1))
+        end
+
+        local t_range = time(100, function()
+            local n = 0
+            for _,v in ipairs(a:get_range(0, nbits)) do
+                if v then n = n + 1 end
+            end
+        end)
+
+        local t_iter = time(100, function()
+            local n = 0
+            for i in a:iter() do
+                n = n + 1
+            end
+        end)
+
+        bench.record { suite = 'bitset iteration', op = 'scan', bits = nbits,
+            variant = 'get_range', ns_per_op = t_range * 1e9 }
+        bench.record { suite = 'bitset iteration', op = 'scan', bits = nbits,
+            variant = 'iter', ns_per_op = t_iter * 1e9 }
+    end)
+end)
+
+describe('bitset churn', function()
+    it('should make and collect small masks cheaply', function()
+        local mask = bitset.new(63)
+        mask:set_range(0, 48)
+
+        for _,nbits in ipairs({ 64, 256, 1024 }) do
+            local n = 100000
+
+            -- Includes collecting everything that was made, since that's where
+            -- most of the cost of a short-lived bitset goes.
+            local t = time(10, function()
+                for i=1,n do
+                    local m = bitset.new(nbits - 1)
+                    m:set(i % nbits)
+                    m:union_mut(mask)
+                end
+
+                collectgarbage()
+            end)
+
+            bench.record { suite = 'bitset churn', op = 'new', bits = nbits,
+                ns_per_op = t / n * 1e9 }
+        end
+    end)
+end)
+
+describe('bitset arena', function()
+    it('should make frame temporaries cheaper than the heap', function()
+        local nbits, per_frame = 64 * 1024, 100
+        local arena = bitset.arena()
+
+        local t_heap = time(100, function()
+            for i=1,per_frame do
+                bitset.new(nbits - 1):set(i)
+            end
+
+            collectgarbage('step')
+        end)
+
+        local t_arena = time(100, function()
+            for i=1,per_frame do
+                arena:new(nbits - 1):set(i)
+            end
+
+            arena:reset()
+        end)
+
+        bench.record { suite = 'bitset arena', op = 'new', bits = nbits,
+            variant = 'heap', ns_per_op = t_heap / per_frame * 1e9 }
+        bench.record { suite = 'bitset arena', op = 'new', bits = nbits,
+            variant = 'arena', ns_per_op = t_arena / per_frame * 1e9 }
+    end)
+end)
+
+describe('bitset mmap', function()
+    it('should open big bitsets without reading them', function()
+        local nbits = 256 * 1024 * 1024
+        local path = os.tmpname()
+
+        local bs = bitset.mmap(path, nbits)
+        bs:set_range(0, nbits)
+        bs:sync()
+        bs = nil
+        collectgarbage()
+
+        -- Looking one bit up, right after opening.
+        local t_read = time(5, function()
+            local f = assert(io.open(path, 'rb'))
+            local b = bitset.from_bytes(f:read('*a'))
+            f:close()
+
+            return b:get(12345)
+        end)
+
+        local t_mmap = time(5, function()
+            return bitset.mmap(path, nil, 'r'):get(12345)
+        end)
+
+        collectgarbage()
+        os.remove(path)
+
+        bench.record { suite = 'bitset mmap', op = 'open', bits = nbits,
+            variant = 'read', ns_per_op = t_read * 1e9 }
+        bench.record { suite = 'bitset mmap', op = 'open', bits = nbits,
+            variant = 'mmap', ns_per_op = t_mmap * 1e9 }
+    end)
+end)
+
+describe('bitset threads', function()
+    it('should scale with the number of threads', function()
+        local nbits = 512 * 1024 * 1024
+        local default, min_bits = bitset.threads()
+
+        local a = bitset.new(nbits):set_range(0, nbits / 3)
+        local b = bitset.new(a)
+        local bytes = a:to_bytes()
+
+        local ops = {
+            { 'union_mut', function() return a:union_mut(b) end },
+            { 'intersection_mut', function() return a:intersection_mut(b) end },
+            { 'union_count', function() return a:union_count(b) end },
+            { 'eq', function() return a == b end },
+            { 'from_bytes', function() return bitset.from_bytes(bytes) end },
+        }
+
+        local counts = { 1, 2, 4, 8 }
+
+        if default > 8 then
+            counts[#counts + 1] = default
+        end
+
+        for _,op in ipairs(ops) do
+            local name, fn = op[1], op[2]
+
+            for _,threads in ipairs(counts) do
+                bitset.threads(threads)
+
+                local t = time(5, fn)
+                collectgarbage()
+
+                bench.record {
+                    suite = 'bitset threads',
+                    op = name,
+                    bits = nbits,
+                    variant = threads .. ' threads',
+                    ns_per_op = t * 1e9,
+                    gb_per_s = nbits / 8 / t / 1e9,
+                }
+            end
+        end
+
+        bitset.threads(default, min_bits)
+    end)
+end)
+
+describe('bitset batches', function()
+    it('should be faster than one call per index', function()
+        local n = 10000
+        local indices = {}
+
+        for i=1,n do
+            indices[i] = math.random(0, 1000000)
+        end
+
+        local ops = {
+            { 'set', function()
+                local bs = bitset.new()
+                for i=1,n do bs:set(indices[i]) end
+                return bs
+            end, function() return bitset.new():set_many(indices) end },
+            { 'from_indices', function()
+                local bs = bitset.new()
+                for i=1,n do bs:set(indices[i]) end
+                return bs
+            end, function() return bitset.from_indices(indices) end },
+            { 'get', function()
+                local bs, got = bitset.from_indices(indices), {}
+                for i=1,n do got[i] = bs:get(indices[i]) end
+                return got
+            end, function()
+                return bitset.from_indices(indices):get_many(indices)
+            end },
+            { 'to_indices', function()
+                local bs, members = bitset.from_indices(indices), {}
+                for i in bs:iter() do members[#members + 1] = i end
+                return members
+            end, function() return bitset.from_indices(indices):to_indices() end },
+        }
+
+        for _,op in ipairs(ops) do
+            local name, one, many = op[1], op[2], op[3]
+
+            -- Per index.
+            bench.record { suite = 'bitset batches', op = name, variant = 'one',
+                ns_per_op = time(50, one) / n * 1e9 }
+            bench.record { suite = 'bitset batches', op = name, variant = 'many',
+                ns_per_op = time(50, many) / n * 1e9 }
+        end
+    end)
+end)
+
+describe('bitset map', function()
+    it('should look up bitsets by their contents', function()
+        local n = 1000
+
+        for _,nbits in ipairs({ 256, 4096 }) do
+            local keys, m, strings, buckets = {}, bitset.map(), {}, {}
+
+            for i=1,n do
+                local key = bitset.new(nbits)
+
+                for j=1,12 do
+                    key:set(math.random(0, nbits - 1))
+                end
+
+                keys[i] = key
+                m:set(key, i)
+                strings[key:to_bytes()] = i
+
+                local hash = key:hash()
+                buckets[hash] = buckets[hash] or {}
+                table.insert(buckets[hash], { key, i })
+            end
+
+            local ops = {
+                { 'to_bytes', function()
+                    local sum = 0
+                    for i=1,n do sum = sum + strings[keys[i]:to_bytes()] end
+                    return sum
+                end },
+                { 'hash', function()
+                    local sum = 0
+                    for i=1,n do
+                        local key = keys[i]
+                        for _,entry in ipairs(buckets[key:hash()]) do
+                            if entry[1] == key then sum = sum + entry[2] end
+                        end
+                    end
+                    return sum
+                end },
+                { 'map', function()
+                    local sum = 0
+                    for i=1,n do sum = sum + m:get(keys[i]) end
+                    return sum
+                end },
+            }
+
+            for _,op in ipairs(ops) do
+                bench.record { suite = 'bitset map', op = 'get', bits = nbits,
+                    variant = op[1], ns_per_op = time(200, op[2]) / n * 1e9 }
+            end
+        end
+    end)
+end)
+
+describe('bitset signature table', function()
+    it('should match queries faster than one subset test per row', function()
+        local n = 4096
+
+        for _,width in ipairs({ 64, 256 }) do
+            local t, masks = bitset.signature_table(width), {}
+
+            for i=1,n do
+                local mask = bitset.fixed(width)
+
+                for j=1,12 do
+                    mask:set(math.random(0, width - 1))
+                end
+
+                masks[i] = mask
+                t:add(mask)
+            end
+
+            local query = bitset.fixed(width):set(0):set(width - 1)
+            local rows, out = {}, bitset.new(n)
+
+            local t_each = time(100, function()
+                local k = 0
+                for i=1,n do
+                    if query <= masks[i] then k = k + 1; rows[k] = i - 1 end
+                end
+                return k
+            end)
+
+            local t_bitset = time(100, function() return t:match(query, nil, nil, out) end)
+            local t_indices = time(100, function() return t:match(query, nil, nil, rows) end)
+
+            -- Per row.
+            bench.record { suite = 'bitset signature table', op = 'match',
+                bits = width, variant = 'each', ns_per_op = t_each / n * 1e9 }
+            bench.record { suite = 'bitset signature table', op = 'match',
+                bits = width, variant = 'bitset', ns_per_op = t_bitset / n * 1e9 }
+            bench.record { suite = 'bitset signature table', op = 'match',
+                bits = width, variant = 'indices', ns_per_op = t_indices / n * 1e9 }
+        end
+    end)
+end)
+
+describe('bitset fixed', function()
+    it('should match archetypes faster than generic bitsets', function()
+        local cases = {}
+
+        for _,width in ipairs({ 64, 128, 256 }) do
+            local case = { width = width, archetypes = {}, fixed_archetypes = {} }
+
+            for i=1,1000 do
+                local a = bitset.new(width)
+
+                for j=1,12 do
+                    a:set(math.random(0, width - 1))
+                end
+
+                case.archetypes[i] = a
+                case.fixed_archetypes[i] = bitset.fixed(width, a)
+            end
+
+            case.query = bitset.new(width):set(0):set(width - 1)
+            case.fixed_query = bitset.fixed(width, case.query)
+
+            cases[#cases + 1] = case
+        end
+
+        -- LuaJIT keeps traces per function, so every measurement gets a copy
+        -- of its own, compiled for the one kind of bitset it sees.
+        local match_source = [[
+            local q, list = ...
+            local n = 0
+
+            for i=1,#list do
+                if q <= list[i] then
+                    n = n + 1
+                end
+            end
+
+            return n
+        ]]
+
+        local function match(q, list)
+            return (loadstring or load)(match_source)(q, list)
+        end
+
+        local function matcher(q, list)
+            local fn = (loadstring or load)(match_source)
+
+            return function() return fn(q, list) end
+        end
+
+        local function report(name, case, variant, t)
+            bench.record { suite = 'bitset fixed', op = name, bits = case.width,
+                variant = variant, ns_per_op = t / 1000 * 1e9 }
+        end
+
+        for _,case in ipairs(cases) do
+            local query, archetypes = case.query, case.archetypes
+            local fixed_query, fixed_archetypes = case.fixed_query, case.fixed_archetypes
+
+            assert.are_equal(match(query, archetypes),
+                match(fixed_query, fixed_archetypes))
+
+            report('subset', case, 'generic', time(200, matcher(query, archetypes)))
+            report('subset', case, 'fixed',
+                time(200, matcher(fixed_query, fixed_archetypes)))
+
+            report('union', case, 'generic', time(200, function()
+                for i=1,#archetypes do local _ = query + archetypes[i] end
+            end))
+            report('union', case, 'fixed', time(200, function()
+                for i=1,#fixed_archetypes do local _ = fixed_query + fixed_archetypes[i] end
+            end))
+        end
+
+        -- With the FFI front end, matching fixed-width bitsets doesn't call
+        -- into C at all. Loading it swaps the methods for good, so this has to
+        -- come last.
+        if pcall(require, 'ffi') then
+            require 'bitset_ffi'
+
+            for _,case in ipairs(cases) do
+                local fixed_query, fixed_archetypes = case.fixed_query, case.fixed_archetypes
+
+                assert.are_equal(match(case.query, case.archetypes),
+                    match(fixed_query, fixed_archetypes))
+
+                report('subset', case, 'fixed ffi',
+                    time(200, matcher(fixed_query, fixed_archetypes)))
+            end
+        end
+    end)
+end)
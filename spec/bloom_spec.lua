@@ -0,0 +1,161 @@
+package.path  = './spec/?.lua;./lib/?.lua;;' .. package.path
+
+require 'bloom'
+
+-- The fraction of `trials` keys never added that the filter claims to contain.
+local function false_positives(bl, trials)
+    local n = 0
+
+    for i=1,trials do
+        if bl:contains('absent:' .. i) then
+            n = n + 1
+        end
+    end
+
+    return n / trials
+end
+
+describe('bloom', function()
+    it('should exist', function()
+        assert.is_not_nil(bloom)
+        assert.is_not_nil(bloom.new)
+    end)
+
+    it('should contain everything added', function()
+        local bl = bloom.new(1000)
+
+        for i=1,1000 do
+            bl:add('key:' .. i)
+            bl:add(i * 7)
+        end
+
+        for i=1,1000 do
+            assert.is_true(bl:contains('key:' .. i))
+            assert.is_true(bl:contains(i * 7))
+        end
+
+        assert.are_equal(bl, bl:add(0.5))
+        assert.is_true(bl:contains(0.5))
+        assert.is_true(bloom.new(10):add(0):contains(-0))
+
+        assert.has_error(function() bl:add({}) end)
+        assert.has_error(function() bl:contains(nil) end)
+    end)
+
+    it('should keep close to its false positive rate', function()
+        for _,p in ipairs({ 0.1, 0.01, 0.001 }) do
+            local bl = bloom.new(10000, p)
+
+            for i=1,10000 do
+                bl:add('present:' .. i)
+            end
+
+            assert.is_true(false_positives(bl, 100000) < 1.5 * p)
+        end
+    end)
+
+    it('should tell strings and numbers apart', function()
+        local bl = bloom.new(100, 0.0001)
+
+        bl:add(1)
+
+        assert.is_true(bl:contains(1))
+        assert.is_false(bl:contains('1'))
+    end)
+
+    it('should add and look up arrays of keys', function()
+        local keys, others = {}, {}
+
+        for i=1,1000 do
+            keys[i] = (i % 2 == 0) and i or ('key:' .. i)
+            others[i] = 'other:' .. i
+        end
+
+        local a, b = bloom.new(1000), bloom.new(1000)
+
+        a:add_many(keys)
+
+        for _,key in ipairs(keys) do
+            b:add(key)
+        end
+
+        assert.is_true(a == b)
+
+        local found = a:contains_many(keys)
+
+        assert.are_equal(1000, #found)
+
+        for i=1,1000 do
+            assert.is_true(found[i])
+        end
+
+        local expected = {}
+
+        for i,key in ipairs(others) do
+            expected[i] = a:contains(key)
+        end
+
+        assert.are_same(expected, a:contains_many(others))
+        assert.are_same({ true, true }, a:contains_many(keys, 2))
+        assert.has_error(function() a:add_many({ 'a', true }) end)
+    end)
+
+    it('should union filters of the same shape', function()
+        local a, b = bloom.new(2000), bloom.new(2000)
+        local both = bloom.new(2000)
+
+        for i=1,1000 do
+            a:add(i)
+            b:add(-i)
+            both:add(i):add(-i)
+        end
+
+        local u = a + b
+
+        assert.is_true(u == both)
+        assert.is_true(u == a:union(b))
+        assert.is_false(u == a)
+        assert.is_true(bloom.new(a):union_mut(b) == both)
+
+        for i=1,1000 do
+            assert.is_true(u:contains(i))
+            assert.is_true(u:contains(-i))
+        end
+
+        assert.has_error(function() return a + bloom.new(10) end)
+        assert.has_error(function() return a + bloom.new(2000, 0.5) end)
+    end)
+
+    it('should estimate how many keys it holds', function()
+        local bl = bloom.new(10000)
+
+        assert.are_equal(0, bl:count())
+
+        for i=1,5000 do
+            bl:add(i)
+            bl:add(i)
+        end
+
+        assert.is_true(math.abs(#bl - 5000) < 250)
+
+        bl:clear()
+
+        assert.are_equal(0, #bl)
+        assert.is_false(bl:contains(1))
+    end)
+
+    it('should be much smaller than a table of the same keys', function()
+        local bl = bloom.new(100000)
+
+        assert.is_true(bl:memory() < 200000)
+        assert.is_true(bl:bits() >= 100000 * 9)
+        assert.is_true(bl:hashes() >= 6)
+    end)
+
+    it('should reject bad arguments', function()
+        assert.has_error(function() bloom.new(-1) end)
+        assert.has_error(function() bloom.new(10, 0) end)
+        assert.has_error(function() bloom.new(10, 1) end)
+        assert.has_error(function() bloom.new('x') end)
+    end)
+end)
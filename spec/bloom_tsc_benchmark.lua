@@ -0,0 +1,93 @@
+package.path  = './spec/?.lua;./lib/?.lua;;' .. package.path
+
+require 'bloom'
+
+-- Compares Bloom filters against the Lua tables they're meant to replace for
+-- deduplicating asset names, in time and in memory, and batch calls against
+-- one call per key.
+
+local bench = require 'bench'
+local time = bench.time
+
+local function asset_names(n, prefix)
+    local names = {}
+
+    for i=1,n do
+        names[i] = string.format('%s/textures/tile_%06d.png', prefix, i)
+    end
+
+    return names
+end
+
+local function table_bytes(build)
+    collectgarbage()
+    collectgarbage()
+    local before = collectgarbage('count')
+    local t = build()
+    collectgarbage()
+    local after = collectgarbage('count')
+    return (after - before) * 1024, t
+end
+
+describe('bloom', function()
+    for _,n in ipairs({ 10000, 1000000 }) do
+        it('should beat a table on ' .. n .. ' asset names', function()
+            local names = asset_names(n, 'assets')
+            local misses = asset_names(n, 'other')
+
+            local bytes = table_bytes(function()
+                local seen = {}
+                for i=1,n do seen[names[i]] = true end
+                return seen
+            end)
+
+            local bl = bloom.new(n):add_many(names)
+
+            local keys = n .. ' names'
+
+            bench.record { suite = 'bloom', op = 'memory', density = keys,
+                variant = 'bloom', bytes = bl:memory() }
+            bench.record { suite = 'bloom', op = 'memory', density = keys,
+                variant = 'table', bytes = bytes }
+
+            local seen = {}
+            for i=1,n do seen[names[i]] = true end
+
+            local iterations = math.max(1, math.floor(1000000 / n))
+
+            local ops = {
+                { 'table insert', function()
+                    local t = {}
+                    for i=1,n do t[names[i]] = true end
+                    return t
+                end },
+                { 'add', function()
+                    local b = bloom.new(n)
+                    for i=1,n do b:add(names[i]) end
+                    return b
+                end },
+                { 'add_many', function() return bloom.new(n):add_many(names) end },
+                { 'table lookup', function()
+                    local hits = 0
+                    for i=1,n do if seen[misses[i]] then hits = hits + 1 end end
+                    return hits
+                end },
+                { 'contains', function()
+                    local hits = 0
+                    for i=1,n do if bl:contains(misses[i]) then hits = hits + 1 end end
+                    return hits
+                end },
+                { 'contains_many', function() return bl:contains_many(misses) end },
+            }
+
+            for _,op in ipairs(ops) do
+                local name, fn = op[1], op[2]
+                local t = time(iterations, fn)
+
+                -- Per key.
+                bench.record { suite = 'bloom', op = name, density = keys,
+                    ns_per_op = t / n * 1e9 }
+            end
+        end)
+    end
+end)
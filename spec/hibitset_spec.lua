@@ -0,0 +1,313 @@
+package.path  = './spec/?.lua;./lib/?.lua;;' .. package.path
+
+require 'bitset'
+require 'hibitset'
+
+local model = require 'model'
+
+-- Random indices are clustered in regions this far apart, so that whole
+-- summary words are left empty in between.
+local REGION = 300000
+
+describe('hibitset', function()
+    it('should exist', function()
+        assert.is_not_nil(hibitset)
+        assert.is_not_nil(hibitset.new)
+    end)
+
+    it('should set, clear, and get correctly', function()
+        local h = hibitset.new()
+
+        assert.is_false(h:get(0))
+
+        h:set(0)
+        h:set(63)
+        h:set(64)
+        h:set(4096 * 64)
+        h:set(10000000)
+
+        assert.is_true(h:get(0))
+        assert.is_true(h:get(63))
+        assert.is_true(h:get(64))
+        assert.is_true(h:get(4096 * 64))
+        assert.is_true(h:get(10000000))
+        assert.is_false(h:get(1))
+        assert.is_false(h:get(10000001))
+        assert.is_false(h:get(2^40))
+        assert.are_equal(5, h:count())
+        assert.are_equal(5, #h)
+
+        h:clear(63)
+        h:clear(12345)
+        h:clear(2^40)
+
+        assert.is_false(h:get(63))
+        assert.are_equal(4, h:count())
+
+        assert.has_error(function() h:set(-1) end)
+    end)
+
+    it('should skip words which are cleared again', function()
+        local h = hibitset.new()
+
+        h:set(5)
+        h:set(1000000)
+        h:set(3000000)
+        h:clear(1000000)
+
+        assert.are_equal(3000000, h:next_set(6))
+        assert.are_equal(2, h:count())
+
+        h:clear(3000000)
+
+        assert.is_nil(h:next_set(6))
+        assert.are_equal(5, h:next_set(0))
+    end)
+
+    it('should set and clear ranges correctly', function()
+        local h = hibitset.new()
+        local m = {}
+
+        h:set_range(100, 300000)
+        for i=100,299999 do m[i] = true end
+
+        model.assert_matches(h, m)
+
+        h:clear_range(150, 262144)
+        for i=150,262143 do m[i] = nil end
+
+        model.assert_matches(h, m)
+
+        h:clear_range(299990, 5000000)
+        for i=299990,299999 do m[i] = nil end
+
+        model.assert_matches(h, m)
+    end)
+
+    it('should be much smaller than a dense bitset for sparse sets', function()
+        local h = hibitset.new()
+        local b = bitset.new()
+
+        h:set(10000000)
+        b:set(10000000)
+
+        -- The bits are dense, so only the summaries are smaller.
+        assert.is_true(h:memory() < b:dump_len() * 4 * 1.1)
+    end)
+
+    it('should do set algebra correctly', function()
+        for trial=1,10 do
+            local ma = model.random(trial * 1000, 20000, REGION)
+            local mb = model.random(trial * 1000, 20000, REGION)
+            local a = model.from(hibitset.new, ma)
+            local b = model.from(hibitset.new, mb)
+
+            local mu, mi, md, mx = {}, {}, {}, {}
+            local ni = 0
+
+            for i,_ in pairs(ma) do
+                mu[i] = true
+                if mb[i] then mi[i] = true; ni = ni + 1 else md[i] = true; mx[i] = true end
+            end
+
+            for i,_ in pairs(mb) do
+                mu[i] = true
+                if not ma[i] then mx[i] = true end
+            end
+
+            model.assert_matches(a + b, mu)
+            model.assert_matches(a * b, mi)
+            model.assert_matches(a - b, md)
+            model.assert_matches(a:symmetric_diff(b), mx)
+
+            model.assert_matches(hibitset.new(a):union_mut(b), mu)
+            model.assert_matches(hibitset.new(a):intersection_mut(b), mi)
+            model.assert_matches(hibitset.new(a):difference_mut(b), md)
+            model.assert_matches(hibitset.new(a):symmetric_diff_mut(b), mx)
+
+            assert.are_equal(ni, a:intersection_count(b))
+            assert.are_equal(ni > 0, a:intersects(b))
+            assert.are_equal(ni == 0, a:is_disjoint(b))
+
+            assert.is_true(a * b <= a)
+            assert.is_true(a <= a + b)
+            assert.is_false(a + b <= a * b)
+            assert.is_true(a == hibitset.new(a))
+            assert.is_false(a == b)
+        end
+    end)
+
+    it('should handle operands of different lengths', function()
+        local short = hibitset.new():set(3):set(70)
+        local long = hibitset.new():set(70):set(5000000)
+
+        model.assert_matches(short + long, { [3] = true, [70] = true, [5000000] = true })
+        model.assert_matches(short * long, { [70] = true })
+        model.assert_matches(long * short, { [70] = true })
+        model.assert_matches(long - short, { [5000000] = true })
+        model.assert_matches(hibitset.new(short):intersection_mut(long), { [70] = true })
+        model.assert_matches(hibitset.new(long):intersection_mut(short), { [70] = true })
+
+        -- Trailing empty words don't make bitsets unequal.
+        assert.is_true(hibitset.new(long):clear(5000000) == hibitset.new():set(70))
+        assert.is_true(hibitset.new(1000000) == hibitset.new())
+    end)
+
+    it('should work with dense bitsets', function()
+        local m = model.random(3000, 60000, REGION)
+        local h = hibitset.new()
+        local b = bitset.new()
+        local mb = {}
+
+        for i,_ in pairs(m) do
+            h:set(i)
+        end
+
+        for i=1,2000 do
+            local idx = math.random(0, 200000)
+            b:set(idx)
+            mb[idx] = true
+        end
+
+        local mu, mi = {}, {}
+
+        for i,_ in pairs(m) do
+            mu[i] = true
+            if mb[i] then mi[i] = true end
+        end
+
+        for i,_ in pairs(mb) do
+            mu[i] = true
+        end
+
+        model.assert_matches(h + b, mu)
+        model.assert_matches(h * b, mi)
+        model.assert_matches(hibitset.new(b), mb)
+
+        assert.is_true(hibitset.new(b):eq(b))
+        assert.is_true(hibitset.new(b):subset(b + bitset.new(1)))
+        assert.is_true((h * b):subset(b))
+        assert.is_false(h:eq(b))
+
+        local dense = h:to_bitset()
+
+        for i,_ in pairs(m) do
+            assert.is_true(dense:get(i))
+        end
+
+        assert.are_equal(h:count(), dense:count())
+    end)
+
+    it('should find next set bits correctly', function()
+        local h = hibitset.new()
+
+        assert.is_nil(h:next_set(0))
+
+        h:set(5)
+        h:set(70000)
+        h:set_range(2000000, 3000000)
+
+        assert.are_equal(5, h:next_set(0))
+        assert.are_equal(5, h:next_set(5))
+        assert.are_equal(70000, h:next_set(6))
+        assert.are_equal(2000000, h:next_set(70001))
+        assert.are_equal(2500000, h:next_set(2500000))
+        assert.is_nil(h:next_set(3000000))
+        assert.is_nil(h:next_set(2^40))
+    end)
+
+    it('should find previous set and next clear bits correctly', function()
+        local h = hibitset.new()
+
+        assert.is_nil(h:prev_set(100))
+        assert.are_equal(100, h:next_clear(100))
+
+        h:set(5)
+        h:set(70000)
+        h:set_range(2000000, 3000000)
+
+        assert.is_nil(h:prev_set(4))
+        assert.are_equal(5, h:prev_set(5))
+        assert.are_equal(5, h:prev_set(69999))
+        assert.are_equal(70000, h:prev_set(1999999))
+        assert.are_equal(2500000, h:prev_set(2500000))
+        assert.are_equal(2999999, h:prev_set(2^40))
+
+        assert.are_equal(0, h:next_clear(0))
+        assert.are_equal(6, h:next_clear(5))
+        assert.are_equal(3000000, h:next_clear(2000000))
+        assert.are_equal(2^40, h:next_clear(2^40))
+
+        local m = model.random(500, 5000, REGION)
+        local g = model.from(hibitset.new, m)
+
+        for _=1,200 do
+            local idx = math.random(0, 1000000)
+            local prev = nil
+
+            for i,_ in pairs(m) do
+                if i <= idx and (prev == nil or i > prev) then prev = i end
+            end
+
+            local clear = idx
+            while m[clear] do clear = clear + 1 end
+
+            assert.are_equal(prev, g:prev_set(idx))
+            assert.are_equal(clear, g:next_clear(idx))
+        end
+    end)
+
+    it('should count and write into bitsets like bitsets do', function()
+        for _=1,10 do
+            local a = model.from(hibitset.new, model.random(1500, 20000, REGION))
+            local b = model.from(hibitset.new, model.random(1500, 20000, REGION))
+            local db = b:to_bitset()
+
+            local nu, ni = (a + b):count(), (a * b):count()
+
+            for _,rhs in ipairs({ b, db }) do
+                assert.are_equal(nu, a:union_count(rhs))
+                assert.are_equal((a - b):count(), a:difference_count(rhs))
+                assert.are_equal(a:symmetric_diff(b):count(),
+                    a:symmetric_diff_count(rhs))
+                assert.are_equal(ni / nu, a:jaccard(rhs))
+
+                local out = hibitset.new():set(12345678)
+                assert.is_true(hibitset.union_into(out, a, rhs) == a + b)
+                assert.is_true(out:intersection_into(a, rhs) == a * b)
+                assert.is_true(out:difference_into(a, rhs) == a - b)
+                assert.is_true(out:symmetric_diff_into(a, rhs) ==
+                    a:symmetric_diff(b))
+            end
+
+            -- `out` may be either operand.
+            local c = hibitset.new(a)
+            assert.is_true(c:union_into(c, b) == a + b)
+            c = hibitset.new(b)
+            assert.is_true(c:difference_into(a, c) == a - b)
+        end
+
+        assert.are_equal(1, hibitset.new():jaccard(hibitset.new()))
+        assert.has_error(function()
+            hibitset.new():union_into(hibitset.new(), 5)
+        end)
+    end)
+
+    it('should convert to ranges, indices and bytes', function()
+        local h = hibitset.new():set(1):set(3):set(70000)
+
+        assert.are_same({ false, true, false, true, false }, h:get_range(0, 5))
+        assert.are_same({ true, false }, h:get_range(70000, 70002))
+        assert.are_same({ 1, 3, 70000 }, h:to_indices())
+        assert.are_same({}, hibitset.new():to_indices())
+
+        for _,encoding in ipairs({ 'raw', 'rle' }) do
+            local bytes = h:to_bytes(encoding)
+
+            assert.are_equal(h:to_bitset():to_bytes(encoding), bytes)
+            assert.is_true(hibitset.new(bitset.from_bytes(bytes, encoding)) == h)
+        end
+
+        assert.are_equal(h:to_bytes('raw'), h:to_bytes())
+    end)
+end)
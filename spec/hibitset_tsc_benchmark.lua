@@ -0,0 +1,71 @@
+package.path  = './spec/?.lua;./lib/?.lua;;' .. package.path
+
+require 'bitset'
+require 'hibitset'
+
+-- Compares hierarchical bitsets against dense bitsets on sparse entity-ID
+-- sets, where the dense layout scans every word up to the highest index and
+-- the summaries let the hierarchical one skip the empty ones.
+
+local bench = require 'bench'
+local time = bench.time
+
+local function sparse_ids(n, max)
+    local ids = {}
+
+    for i=1,n do
+        ids[i] = math.random(0, max)
+    end
+
+    return ids
+end
+
+local function iterate(a)
+    local n = 0
+
+    for _ in a:iter() do
+        n = n + 1
+    end
+
+    return n
+end
+
+local OPS = {
+    { 'intersection', function(a, b) return a * b end },
+    { 'inter_count', function(a, b) return a:intersection_count(b) end },
+    { 'union_mut', function(a, b) return a:union_mut(b) end },
+    { 'count', function(a, b) return a:count() end },
+    { 'iterate', function(a, b) return iterate(a) end },
+}
+
+describe('hibitset', function()
+    for _,n in ipairs({ 100, 10000 }) do
+        it('should beat dense bitsets on ' .. n .. ' ids below 2^26', function()
+            local max = 2^26
+            local ha, hb = hibitset.new(), hibitset.new()
+            local ba, bb = bitset.new(), bitset.new()
+
+            for _,id in ipairs(sparse_ids(n, max)) do ha:set(id); ba:set(id) end
+            for _,id in ipairs(sparse_ids(n, max)) do hb:set(id); bb:set(id) end
+
+            local ids = n .. ' ids'
+
+            bench.record { suite = 'hibitset', op = 'memory', bits = max, density = ids,
+                variant = 'hibitset', bytes = ha:memory() }
+            bench.record { suite = 'hibitset', op = 'memory', bits = max, density = ids,
+                variant = 'dense', bytes = ba:capacity() / 8 }
+
+            for _,op in ipairs(OPS) do
+                local name, fn = op[1], op[2]
+
+                local th = time(100, function() return fn(ha, hb) end)
+                local tb = time(10, function() return fn(ba, bb) end)
+
+                bench.record { suite = 'hibitset', op = name, bits = max, density = ids,
+                    variant = 'hibitset', ns_per_op = th * 1e9 }
+                bench.record { suite = 'hibitset', op = name, bits = max, density = ids,
+                    variant = 'dense', ns_per_op = tb * 1e9 }
+            end
+        end)
+    end
+end)
@@ -0,0 +1,98 @@
+--- Shared helpers for specs that check a structure against a plain Lua model.
+-- Sets of indices are modelled as tables mapping each set index to `true`, and
+-- grids as tables of rows of booleans, with their size in `w` and `h`.
+
+local model = {}
+
+--- Random indices clustered in a handful of regions `stride` apart, each
+-- `spread` wide, so that the space between them is left empty.
+function model.random(n, spread, stride)
+    local m = {}
+
+    for i=1,n do
+        local region = math.random(0, 3) * stride
+        m[region + math.random(0, spread)] = true
+    end
+
+    return m
+end
+
+--- A set made by `new()` with the indices of `m` set.
+function model.from(new, m)
+    local s = new()
+
+    for i,_ in pairs(m) do
+        s:set(i)
+    end
+
+    return s
+end
+
+--- Checks a set against the model of the indices which should be set.
+function model.assert_matches(s, m)
+    local n = 0
+
+    for i in s:iter() do
+        assert.is_true(m[i] == true)
+        n = n + 1
+    end
+
+    for i,_ in pairs(m) do
+        assert.is_true(s:get(i))
+    end
+
+    local expected = 0
+    for _ in pairs(m) do
+        expected = expected + 1
+    end
+
+    assert.are_equal(expected, n)
+    assert.are_equal(expected, s:count())
+end
+
+--- A `w` by `h` grid with each cell set with probability `density`.
+function model.random_grid(w, h, density)
+    local m = { w = w, h = h }
+
+    for y=0,h - 1 do
+        m[y] = {}
+
+        for x=0,w - 1 do
+            m[y][x] = math.random() < density
+        end
+    end
+
+    return m
+end
+
+--- A grid made by `new(w, h)` with the cells of `m` set.
+function model.from_grid(new, m)
+    local g = new(m.w, m.h)
+
+    for y=0,m.h - 1 do
+        for x=0,m.w - 1 do
+            if m[y][x] then g:set(x, y) end
+        end
+    end
+
+    return g
+end
+
+--- Checks a grid against the model of its cells.
+function model.assert_grid_matches(g, m)
+    local n = 0
+
+    assert.are_equal(m.w, g:width())
+    assert.are_equal(m.h, g:height())
+
+    for y=0,m.h - 1 do
+        for x=0,m.w - 1 do
+            assert.are_equal(m[y][x], g:get(x, y))
+            if m[y][x] then n = n + 1 end
+        end
+    end
+
+    assert.are_equal(n, g:count())
+end
+
+return model
@@ -0,0 +1,63 @@
+package.path  = './spec/?.lua;./lib/?.lua;;' .. package.path
+
+local morton = require 'morton_ffi'
+local has_ffi, ffi = pcall(require, 'ffi')
+
+describe('morton_ffi', function()
+    it('should exist', function()
+        assert.is_not_nil(morton)
+        assert.is_not_nil(morton.encode2_16_batch)
+    end)
+
+    it('should still take tables', function()
+        local codes = morton.encode2_16_batch({ 1, 0, 3 }, { 0, 1, 3 })
+
+        assert.are_same({ 1, 2, 15 }, codes)
+
+        local his, los = morton.encode2_32_batch({ 0 }, { 2^31 })
+        assert.are_same({ 2^31 }, his)
+        assert.are_same({ 0 }, los)
+    end)
+
+    if not has_ffi then
+        return
+    end
+
+    it('should encode and decode FFI arrays', function()
+        local n = 1000
+        local xs = ffi.new('uint32_t[?]', n)
+        local ys = ffi.new('uint32_t[?]', n)
+        local zs = ffi.new('uint32_t[?]', n)
+
+        for i=0,n - 1 do
+            xs[i], ys[i], zs[i] = math.random(0, 1023), math.random(0, 1023), math.random(0, 1023)
+        end
+
+        local codes = ffi.new('uint32_t[?]', n)
+        local wide = ffi.new('uint64_t[?]', n)
+        local dx = ffi.new('uint32_t[?]', n)
+        local dy = ffi.new('uint32_t[?]', n)
+        local dz = ffi.new('uint32_t[?]', n)
+
+        assert.are_equal(codes, morton.encode2_16_batch(xs, ys, codes, n))
+        morton.encode3_21_batch(xs, ys, zs, wide, n)
+
+        for i=0,n - 1 do
+            assert.are_equal(morton.encode2_16(xs[i], ys[i]), codes[i])
+
+            local hi, lo = morton.encode3_21(xs[i], ys[i], zs[i])
+            assert.are_equal(hi * 2^32 + lo, tonumber(wide[i]))
+        end
+
+        morton.decode2_16_batch(codes, dx, dy, n)
+        morton.decode3_21_batch(wide, dx, dy, dz, n)
+
+        for i=0,n - 1 do
+            assert.are_equal(xs[i], dx[i])
+            assert.are_equal(ys[i], dy[i])
+            assert.are_equal(zs[i], dz[i])
+        end
+
+        assert.has_error(function() morton.encode2_16_batch(xs, ys, codes) end)
+    end)
+end)
@@ -0,0 +1,325 @@
+package.path  = './spec/?.lua;./lib/?.lua;;' .. package.path
+
+require 'bitset'
+require 'morton'
+
+-- Interleaves bits one at a time, to check the real thing against.
+local function naive(coords, bits)
+    local code = 0
+    local place = 1
+
+    for b=0,bits - 1 do
+        for _,c in ipairs(coords) do
+            if math.floor(c / 2^b) % 2 == 1 then
+                code = code + place
+            end
+
+            place = place * 2
+        end
+    end
+
+    return code
+end
+
+local function split(code)
+    return math.floor(code / 2^32), code % 2^32
+end
+
+describe('morton', function()
+    it('should exist', function()
+        assert.is_not_nil(morton)
+        assert.is_not_nil(morton.encode2_16)
+    end)
+
+    it('should interleave bits with x lowest', function()
+        assert.are_equal(1, morton.encode2_16(1, 0))
+        assert.are_equal(2, morton.encode2_16(0, 1))
+        assert.are_equal(0xFFFFFFFF, morton.encode2_16(0xFFFF, 0xFFFF))
+        assert.are_equal(4, morton.encode3_10(0, 0, 1))
+        assert.are_equal(0x3FFFFFFF, morton.encode3_10(1023, 1023, 1023))
+
+        local hi, lo = morton.encode2_32(0, 2^31)
+        assert.are_equal(2^31, hi)
+        assert.are_equal(0, lo)
+
+        hi, lo = morton.encode3_21(0, 0, 2^20)
+        assert.are_equal(2^30, hi)
+        assert.are_equal(0, lo)
+    end)
+
+    it('should encode and decode correctly with every implementation', function()
+        local default, available = morton.kernel()
+
+        for _,name in ipairs(available) do
+            morton.kernel(name)
+
+            for i=1,200 do
+                local x, y, z = math.random(0, 0xFFFF), math.random(0, 0xFFFF)
+                local code = morton.encode2_16(x, y)
+                assert.are_equal(naive({ x, y }, 16), code)
+                assert.are_same({ x, y }, { morton.decode2_16(code) })
+
+                x, y = math.random(0, 2^26), math.random(0, 2^26)
+                local hi, lo = morton.encode2_32(x, y)
+                assert.are_same({ split(naive({ x, y }, 26)) }, { hi, lo })
+                assert.are_same({ x, y }, { morton.decode2_32(hi, lo) })
+
+                x, y, z = math.random(0, 1023), math.random(0, 1023), math.random(0, 1023)
+                code = morton.encode3_10(x, y, z)
+                assert.are_equal(naive({ x, y, z }, 10), code)
+                assert.are_same({ x, y, z }, { morton.decode3_10(code) })
+
+                x, y, z = math.random(0, 2^17), math.random(0, 2^17), math.random(0, 2^17)
+                hi, lo = morton.encode3_21(x, y, z)
+                assert.are_same({ split(naive({ x, y, z }, 17)) }, { hi, lo })
+                assert.are_same({ x, y, z }, { morton.decode3_21(hi, lo) })
+            end
+
+            -- Full-width coordinates, which the naive version can't check.
+            assert.are_same({ 2^32 - 1, 12345 },
+                { morton.decode2_32(morton.encode2_32(2^32 - 1, 12345)) })
+            assert.are_same({ 2^21 - 1, 0, 2^21 - 2 },
+                { morton.decode3_21(morton.encode3_21(2^21 - 1, 0, 2^21 - 2)) })
+        end
+
+        morton.kernel(default)
+    end)
+
+    it('should match the single-point functions in batches', function()
+        local n = 1000
+        local xs, ys, zs = {}, {}, {}
+
+        for i=1,n do
+            xs[i], ys[i], zs[i] = math.random(0, 1023), math.random(0, 1023), math.random(0, 1023)
+        end
+
+        local codes = morton.encode2_16_batch(xs, ys)
+        local codes3 = morton.encode3_10_batch(xs, ys, zs)
+        local his, los = morton.encode3_21_batch(xs, ys, zs)
+
+        assert.are_equal(n, #codes)
+
+        for i=1,n do
+            assert.are_equal(morton.encode2_16(xs[i], ys[i]), codes[i])
+            assert.are_equal(morton.encode3_10(xs[i], ys[i], zs[i]), codes3[i])
+            assert.are_same({ morton.encode3_21(xs[i], ys[i], zs[i]) }, { his[i], los[i] })
+        end
+
+        local dx, dy = morton.decode2_16_batch(codes)
+        assert.are_same(xs, dx)
+        assert.are_same(ys, dy)
+
+        dx, dy = morton.decode2_32_batch(morton.encode2_32_batch(xs, ys))
+        assert.are_same(xs, dx)
+        assert.are_same(ys, dy)
+
+        local dz
+        dx, dy, dz = morton.decode3_21_batch(his, los)
+        assert.are_same(zs, dz)
+
+        -- Writing into tables we already have.
+        local out = {}
+        assert.are_equal(out, morton.encode2_16_batch(xs, ys, out))
+        assert.are_same(codes, out)
+
+        local mx, my, mz = {}, nil, {}
+        dx, dy, dz = morton.decode3_10_batch(codes3, mx, my, mz)
+        assert.are_equal(mx, dx)
+        assert.are_equal(mz, dz)
+        assert.are_same(ys, dy)
+    end)
+
+    it('should reject bad coordinates and codes', function()
+        assert.has_error(function() morton.encode2_16(-1, 0) end)
+        assert.has_error(function() morton.encode2_16(0, 65536) end)
+        assert.has_error(function() morton.encode3_10(0, 0, 1024) end)
+        assert.has_error(function() morton.encode3_21(2^21, 0, 0) end)
+        assert.has_error(function() morton.decode3_10(2^30) end)
+        assert.has_error(function() morton.decode3_21(2^31, 0) end)
+        assert.has_error(function() morton.encode2_16_batch({ 1, 2 }, { 1 }) end)
+        assert.has_error(function() morton.encode2_16_batch({ 1, 70000 }, { 1, 2 }) end)
+        assert.has_error(function() morton.encode2_16_batch({ 1, 'x' }, { 1, 2 }) end)
+        assert.has_error(function() morton.kernel('no such kernel') end)
+    end)
+end)
+
+-- Brute-force versions of the index queries, to check against.
+local function overlapping(boxes, min_x, min_y, max_x, max_y)
+    local found = {}
+
+    for id,b in pairs(boxes) do
+        if b[3] >= min_x and b[1] <= max_x and b[4] >= min_y and b[2] <= max_y then
+            found[#found + 1] = id
+        end
+    end
+
+    table.sort(found)
+    return found
+end
+
+local function distance(b, x, y)
+    local dx = math.max(b[1] - x, 0, x - b[3])
+    local dy = math.max(b[2] - y, 0, y - b[4])
+    return dx * dx + dy * dy
+end
+
+local function random_box()
+    local x, y = math.random() * 1100 - 50, math.random() * 1100 - 50
+    local size = math.random() < 0.1 and 300 or 10
+    return { x, y, x + math.random() * size, y + math.random() * size }
+end
+
+local function sorted(t, n)
+    local copy = {}
+
+    for i=1,n do
+        copy[i] = t[i]
+    end
+
+    table.sort(copy)
+    return copy
+end
+
+describe('morton index', function()
+    it('should exist', function()
+        assert.is_not_nil(morton.quadtree)
+        assert.is_not_nil(morton.octree)
+    end)
+
+    it('should find overlapping boxes', function()
+        local index = morton.quadtree(4)
+        local boxes, ids, flat = {}, {}, {}
+
+        for id=1,500 do
+            local b = random_box()
+            boxes[id] = b
+            ids[#ids + 1] = id
+
+            for _,v in ipairs(b) do
+                flat[#flat + 1] = v
+            end
+        end
+
+        index:rebuild(ids, flat)
+        assert.are_equal(500, #index)
+
+        local out = {}
+
+        for trial=1,50 do
+            -- Move some entities around, add some and remove some.
+            for i=1,20 do
+                local id = math.random(1, 600)
+
+                if math.random() < 0.2 then
+                    index:remove(id)
+                    boxes[id] = nil
+                else
+                    local b = random_box()
+                    index:update(id, b[1], b[2], b[3], b[4])
+                    boxes[id] = b
+                end
+            end
+
+            local x, y = math.random() * 1000, math.random() * 1000
+            local w, h = math.random() * 200, math.random() * 200
+            local expected = overlapping(boxes, x, y, x + w, y + h)
+
+            local n = index:query(x, y, x + w, y + h, out)
+
+            assert.are_equal(#expected, n)
+            assert.are_equal(n, #out)
+            assert.are_same(expected, sorted(out, n))
+        end
+    end)
+
+    it('should put results into bitsets', function()
+        local index = morton.quadtree(1)
+
+        index:update(3, 0, 0, 1, 1)
+        index:update(1000, 5, 5)
+        index:update(7, 100, 100, 110, 110)
+
+        local bs = bitset.new()
+
+        assert.are_equal(2, index:query(0, 0, 10, 10, bs))
+        assert.is_true(bs:get(3))
+        assert.is_true(bs:get(1000))
+        assert.is_false(bs:get(7))
+        assert.are_equal(2, bs:count())
+
+        -- Reusing the bitset leaves only the new results in it.
+        assert.are_equal(1, index:query(100, 100, 120, 120, bs))
+        assert.is_true(bs:get(7))
+        assert.is_false(bs:get(3))
+        assert.are_equal(1, bs:count())
+    end)
+
+    it('should find the nearest boxes', function()
+        local index = morton.quadtree(2, -100, -100)
+        local boxes = {}
+
+        for id=0,399 do
+            local b = random_box()
+            boxes[id] = b
+            index:update(id, b[1], b[2], b[3], b[4])
+        end
+
+        local out = {}
+
+        for trial=1,50 do
+            local x, y = math.random() * 1400 - 200, math.random() * 1400 - 200
+            local k = math.random(1, 10)
+
+            assert.are_equal(k, index:nearest(x, y, k, out))
+
+            -- Nearest first, and nothing left out that is closer than the last.
+            for i=2,k do
+                assert.is_true(distance(boxes[out[i - 1]], x, y) <= distance(boxes[out[i]], x, y))
+            end
+
+            local worst = distance(boxes[out[k]], x, y)
+            local closer = 0
+
+            for id,b in pairs(boxes) do
+                if distance(b, x, y) < worst then
+                    closer = closer + 1
+                end
+            end
+
+            assert.is_true(closer < k)
+        end
+
+        assert.are_equal(400, index:nearest(0, 0, 1000, out))
+    end)
+
+    it('should work in 3D', function()
+        local index = morton.octree(1)
+
+        index:update(1, 0, 0, 0, 2, 2, 2)
+        index:update(2, 500, 500, 500)
+        index:update(3, 1000, 0, 1000, 1010, 10, 1010)
+
+        local out = {}
+
+        assert.are_equal(1, index:query(1, 1, 1, 1, 1, 1, out))
+        assert.are_equal(1, out[1])
+        assert.are_equal(2, index:query(0, 0, 0, 600, 600, 600, out))
+        assert.are_same({ 1, 2 }, sorted(out, 2))
+
+        assert.are_equal(1, index:nearest(1005, 5, 990, 1, out))
+        assert.are_equal(3, out[1])
+
+        assert.is_true(index:remove(3))
+        assert.is_false(index:remove(3))
+        assert.are_equal(2, #index)
+    end)
+
+    it('should reject bad arguments', function()
+        local index = morton.quadtree(1)
+
+        assert.has_error(function() morton.quadtree(0) end)
+        assert.has_error(function() index:update(-1, 0, 0) end)
+        assert.has_error(function() index:query(0, 0, 1, 1, 'out') end)
+        assert.has_error(function() index:rebuild({ 1, 2 }, { 0, 0, 1, 1 }) end)
+    end)
+end)
@@ -0,0 +1,147 @@
+package.path  = './spec/?.lua;./lib/?.lua;;' .. package.path
+
+require 'morton'
+
+local morton_ffi = require 'morton_ffi'
+local has_ffi, ffi = pcall(require, 'ffi')
+
+-- Compares encoding points one call at a time against the batch functions,
+-- on tables and (with LuaJIT) on FFI arrays, with each implementation.
+
+local N = 20000
+
+local bench = require 'bench'
+local time = bench.time
+
+describe('morton', function()
+    it('should encode batches faster than single points', function()
+        local default, available = morton.kernel()
+        local xs, ys, zs, out = {}, {}, {}, {}
+
+        for i=1,N do
+            xs[i], ys[i], zs[i] = math.random(0, 1023), math.random(0, 1023), math.random(0, 1023)
+        end
+
+        local encode2_16, encode3_10 = morton.encode2_16, morton.encode3_10
+
+        for _,name in ipairs(available) do
+            morton.kernel(name)
+
+            local single2 = time(20, function()
+                for i=1,N do out[i] = encode2_16(xs[i], ys[i]) end
+            end)
+
+            local batch2 = time(20, function()
+                morton.encode2_16_batch(xs, ys, out)
+            end)
+
+            local single3 = time(20, function()
+                for i=1,N do out[i] = encode3_10(xs[i], ys[i], zs[i]) end
+            end)
+
+            local batch3 = time(20, function()
+                morton.encode3_10_batch(xs, ys, zs, out)
+            end)
+
+            -- Per point.
+            local function report(op, variant, t)
+                bench.record { suite = 'morton', op = op, variant = variant,
+                    kernel = name, ns_per_op = t / N * 1e9 }
+            end
+
+            report('encode2_16', 'single', single2)
+            report('encode2_16', 'batch', batch2)
+            report('encode3_10', 'single', single3)
+            report('encode3_10', 'batch', batch3)
+
+            if has_ffi then
+                local fx = ffi.new('uint32_t[?]', N)
+                local fy = ffi.new('uint32_t[?]', N)
+                local fz = ffi.new('uint32_t[?]', N)
+                local codes = ffi.new('uint32_t[?]', N)
+
+                for i=1,N do
+                    fx[i - 1], fy[i - 1], fz[i - 1] = xs[i], ys[i], zs[i]
+                end
+
+                local ffi2 = time(200, function()
+                    morton_ffi.encode2_16_batch(fx, fy, codes, N)
+                end)
+
+                local ffi3 = time(200, function()
+                    morton_ffi.encode3_10_batch(fx, fy, fz, codes, N)
+                end)
+
+                report('encode2_16', 'ffi batch', ffi2)
+                report('encode3_10', 'ffi batch', ffi3)
+            end
+        end
+
+        morton.kernel(default)
+    end)
+end)
+
+describe('morton index', function()
+    it('should beat scanning every box', function()
+        local n = 20000
+        local index = morton.quadtree(8)
+        local ids, flat, boxes = {}, {}, {}
+
+        for id=1,n do
+            local x, y = math.random() * 8000, math.random() * 8000
+            local b = { x, y, x + 16, y + 16 }
+
+            ids[id], boxes[id] = id, b
+
+            for _,v in ipairs(b) do
+                flat[#flat + 1] = v
+            end
+        end
+
+        local rebuild = time(20, function() index:rebuild(ids, flat) end)
+
+        -- Nudge a tenth of the entities, as a frame of movement might.
+        local update = time(20, function()
+            for id=1,n,10 do
+                local b = boxes[id]
+                index:update(id, b[1] + 1, b[2] + 1, b[3] + 1, b[4] + 1)
+            end
+        end) / (n / 10)
+
+        local out = {}
+
+        local query = time(1000, function()
+            index:query(1000, 1000, 1400, 1300, out)
+        end)
+
+        local scan = time(20, function()
+            local found = 0
+
+            for id=1,n do
+                local b = boxes[id]
+
+                if b[3] >= 1000 and b[1] <= 1400 and b[4] >= 1000 and b[2] <= 1300 then
+                    found = found + 1
+                    out[found] = id
+                end
+            end
+        end)
+
+        local nearest = time(1000, function()
+            index:nearest(4000, 4000, 8, out)
+        end)
+
+        local entities = n .. ' entities'
+
+        local function report(op, variant, t)
+            bench.record { suite = 'morton index', op = op, density = entities,
+                variant = variant, ns_per_op = t * 1e9 }
+        end
+
+        report('rebuild', nil, rebuild)
+        report('update', nil, update)
+        report('query', 'index', query)
+        report('query', 'scan', scan)
+        report('nearest', nil, nearest)
+    end)
+end)
@@ -0,0 +1,243 @@
+package.path  = './spec/?.lua;./lib/?.lua;;' .. package.path
+
+require 'bitset'
+require 'roaring'
+
+local model = require 'model'
+
+-- Random indices are clustered in chunks this far apart, so that containers
+-- of every kind get exercised.
+local CHUNK = 65536
+
+describe('roaring', function()
+    it('should exist', function()
+        assert.is_not_nil(roaring)
+        assert.is_not_nil(roaring.new)
+    end)
+
+    it('should set, clear, and get correctly', function()
+        local r = roaring.new()
+
+        assert.is_false(r:get(0))
+
+        r:set(0)
+        r:set(65535)
+        r:set(65536)
+        r:set(10000000)
+        r:set(2^32 - 1)
+
+        assert.is_true(r:get(0))
+        assert.is_true(r:get(65535))
+        assert.is_true(r:get(65536))
+        assert.is_true(r:get(10000000))
+        assert.is_true(r:get(2^32 - 1))
+        assert.is_false(r:get(1))
+        assert.is_false(r:get(10000001))
+        assert.is_false(r:get(2^40))
+        assert.are_equal(5, r:count())
+        assert.are_equal(5, #r)
+
+        r:clear(65535)
+        r:clear(12345)
+
+        assert.is_false(r:get(65535))
+        assert.are_equal(4, r:count())
+
+        assert.has_error(function() r:set(-1) end)
+        assert.has_error(function() r:set(2^32) end)
+    end)
+
+    it('should switch between arrays and bitmaps correctly', function()
+        local r = roaring.new()
+        local m = {}
+
+        -- Enough bits in one chunk to go past the array limit and back.
+        for i=0,9999 do
+            r:set(i * 3)
+            m[i * 3] = true
+        end
+
+        model.assert_matches(r, m)
+
+        for i=0,9999,2 do
+            r:clear(i * 3)
+            m[i * 3] = nil
+        end
+
+        for i=0,9999,3 do
+            r:clear(i * 3)
+            m[i * 3] = nil
+        end
+
+        model.assert_matches(r, m)
+    end)
+
+    it('should set and clear ranges correctly', function()
+        local r = roaring.new()
+        local m = {}
+
+        r:set_range(100, 200000)
+        for i=100,199999 do m[i] = true end
+
+        model.assert_matches(r, m)
+
+        r:clear_range(150, 131072)
+        for i=150,131071 do m[i] = nil end
+
+        model.assert_matches(r, m)
+
+        r:set(131072 + 5)
+        r:clear(131072 + 6)
+        m[131072 + 6] = nil
+
+        model.assert_matches(r, m)
+    end)
+
+    it('should shrink when optimized', function()
+        local r = roaring.new()
+
+        r:set_range(0, 10000)
+        r:set_range(20000, 30000)
+
+        local before = r:memory()
+
+        r:optimize()
+
+        assert.is_true(r:memory() < before)
+        assert.are_equal(20000, r:count())
+
+        -- Modifying a run container expands it again.
+        r:clear(5000)
+        r:set(15000)
+
+        assert.is_false(r:get(5000))
+        assert.is_true(r:get(15000))
+        assert.is_true(r:get(29999))
+        assert.are_equal(20000, r:count())
+    end)
+
+    it('should be much smaller than a dense bitset for sparse sets', function()
+        local r = roaring.new()
+        local b = bitset.new()
+
+        r:set(10000000)
+        b:set(10000000)
+
+        assert.is_true(r:memory() * 1000 < b:dump_len() * 4)
+    end)
+
+    it('should do set algebra correctly', function()
+        for trial=1,10 do
+            local ma = model.random(trial * 1000, 20000, CHUNK)
+            local mb = model.random(trial * 1000, 20000, CHUNK)
+            local a = model.from(roaring.new, ma)
+            local b = model.from(roaring.new, mb)
+
+            local mu, mi, md, mx = {}, {}, {}, {}
+
+            for i,_ in pairs(ma) do
+                mu[i] = true
+                if mb[i] then mi[i] = true else md[i] = true; mx[i] = true end
+            end
+
+            for i,_ in pairs(mb) do
+                mu[i] = true
+                if not ma[i] then mx[i] = true end
+            end
+
+            model.assert_matches(a + b, mu)
+            model.assert_matches(a * b, mi)
+            model.assert_matches(a - b, md)
+            model.assert_matches(a:symmetric_diff(b), mx)
+
+            model.assert_matches(roaring.new(a):union_mut(b), mu)
+            model.assert_matches(roaring.new(a):intersection_mut(b), mi)
+            model.assert_matches(roaring.new(a):difference_mut(b), md)
+            model.assert_matches(roaring.new(a):symmetric_diff_mut(b), mx)
+
+            assert.is_true(a * b <= a)
+            assert.is_true(a <= a + b)
+            assert.is_false(a + b <= a * b)
+            assert.is_true(a == roaring.new(a))
+            assert.is_false(a == b)
+        end
+    end)
+
+    it('should work with dense bitsets', function()
+        local m = model.random(3000, 60000, CHUNK)
+        local r = roaring.new()
+        local b = bitset.new()
+        local mb = {}
+
+        for i,_ in pairs(m) do
+            r:set(i)
+        end
+
+        for i=1,2000 do
+            local idx = math.random(0, 200000)
+            b:set(idx)
+            mb[idx] = true
+        end
+
+        local mu, mi = {}, {}
+
+        for i,_ in pairs(m) do
+            mu[i] = true
+            if mb[i] then mi[i] = true end
+        end
+
+        for i,_ in pairs(mb) do
+            mu[i] = true
+        end
+
+        model.assert_matches(r + b, mu)
+        model.assert_matches(r * b, mi)
+        model.assert_matches(roaring.new(b), mb)
+
+        assert.is_true(roaring.new(b):eq(b))
+        assert.is_true(roaring.new(b):subset(b + bitset.new(1)))
+        assert.is_true((r * b):subset(b))
+        assert.is_false(r:eq(b))
+
+        -- Bits past the largest index can't be left out of the answer. The
+        -- file is sparse, so only the page with the high bit takes up room.
+        local path = os.tmpname()
+        os.remove(path)
+
+        local huge = bitset.mmap(path, 2^32 + 64):set(2^32)
+
+        assert.has_error(function() return r:eq(huge) end)
+        assert.has_error(function() return r:subset(huge) end)
+        assert.has_error(function() return r - huge end)
+        assert.has_error(function() roaring.new(huge) end)
+
+        huge = nil
+        collectgarbage()
+        os.remove(path)
+
+        local dense = r:to_bitset()
+
+        for i,_ in pairs(m) do
+            assert.is_true(dense:get(i))
+        end
+
+        assert.are_equal(r:count(), dense:count())
+    end)
+
+    it('should find next set bits correctly', function()
+        local r = roaring.new()
+
+        assert.is_nil(r:next_set(0))
+
+        r:set(5)
+        r:set(70000)
+        r:set_range(200000, 300000)
+        r:optimize()
+
+        assert.are_equal(5, r:next_set(0))
+        assert.are_equal(70000, r:next_set(6))
+        assert.are_equal(200000, r:next_set(70001))
+        assert.are_equal(250000, r:next_set(250000))
+        assert.is_nil(r:next_set(300000))
+    end)
+end)
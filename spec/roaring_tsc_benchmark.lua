@@ -0,0 +1,59 @@
+package.path  = './spec/?.lua;./lib/?.lua;;' .. package.path
+
+require 'bitset'
+require 'roaring'
+
+-- Compares roaring bitmaps against dense bitsets on sparse entity-ID sets,
+-- where the dense layout pays for every bit up to the highest index.
+
+local bench = require 'bench'
+local time = bench.time
+
+local function sparse_ids(n, max)
+    local ids = {}
+
+    for i=1,n do
+        ids[i] = math.random(0, max)
+    end
+
+    return ids
+end
+
+local OPS = {
+    { 'union', function(a, b) return a + b end },
+    { 'intersection', function(a, b) return a * b end },
+    { 'difference', function(a, b) return a - b end },
+    { 'count', function(a, b) return a:count() end },
+}
+
+describe('roaring', function()
+    for _,n in ipairs({ 100, 10000 }) do
+        it('should beat dense bitsets on ' .. n .. ' ids below 2^26', function()
+            local max = 2^26
+            local ra, rb = roaring.new(), roaring.new()
+            local ba, bb = bitset.new(), bitset.new()
+
+            for _,id in ipairs(sparse_ids(n, max)) do ra:set(id); ba:set(id) end
+            for _,id in ipairs(sparse_ids(n, max)) do rb:set(id); bb:set(id) end
+
+            local ids = n .. ' ids'
+
+            bench.record { suite = 'roaring', op = 'memory', bits = max, density = ids,
+                variant = 'roaring', bytes = ra:memory() }
+            bench.record { suite = 'roaring', op = 'memory', bits = max, density = ids,
+                variant = 'dense', bytes = ba:dump_len() * 4 }
+
+            for _,op in ipairs(OPS) do
+                local name, fn = op[1], op[2]
+
+                local tr = time(100, function() return fn(ra, rb) end)
+                local tb = time(10, function() return fn(ba, bb) end)
+
+                bench.record { suite = 'roaring', op = name, bits = max, density = ids,
+                    variant = 'roaring', ns_per_op = tr * 1e9 }
+                bench.record { suite = 'roaring', op = name, bits = max, density = ids,
+                    variant = 'dense', ns_per_op = tb * 1e9 }
+            end
+        end)
+    end
+end)